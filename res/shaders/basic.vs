@@ -1,13 +1,44 @@
 #version 330 core
 
+// permutations (see shader_permutations.h): SKINNED, INSTANCED, BAKED_ANIMATION, MULTI_DRAW
+
 in vec3 a_vertex;
 in vec3 a_normal;
 in vec4 a_color;
 in vec2 a_uv;
 
-uniform mat4 u_model;
-uniform mat4 u_viewprojection;
-uniform vec3 u_camera_position;
+#if defined(SKINNED) || defined(BAKED_ANIMATION)
+in ivec4 a_bones;
+in vec4 a_weights;
+#endif
+
+#ifdef SKINNED
+#define MAX_JOINTS 100
+uniform mat4 u_animated[MAX_JOINTS];
+#endif
+
+#ifdef BAKED_ANIMATION
+//skin matrices of every frame: one row per frame and 4 texels (columns) per joint
+uniform sampler2D u_animation_texture;
+uniform int u_animation_frame;
+#endif
+
+//std140 blocks shared by all the draws (see uniform_buffer.h)
+layout(std140) uniform FrameBlock {
+	mat4 u_viewprojection;
+	mat4 u_view;
+	mat4 u_projection;
+	vec3 u_camera_position;
+	float u_time;
+};
+
+#if defined(INSTANCED) || defined(MULTI_DRAW)
+in mat4 u_model; //per instance attribute
+#else
+layout(std140) uniform ObjectBlock {
+	mat4 u_model;
+};
+#endif
 
 //this will store the color for the pixel shader
 out vec3 v_position;
@@ -16,14 +47,47 @@ out vec3 v_normal;
 out vec4 v_color;
 out vec2 v_uv;
 
+#ifdef MULTI_DRAW
+in float a_draw_material; //per draw attribute, index in the material table
+flat out int v_material;
+#endif
+
+#if defined(SKINNED) || defined(BAKED_ANIMATION)
+mat4 get_joint_matrix(int joint)
+{
+#ifdef SKINNED
+	return u_animated[joint];
+#else
+	int x = joint * 4;
+	return mat4(
+		texelFetch(u_animation_texture, ivec2(x, u_animation_frame), 0),
+		texelFetch(u_animation_texture, ivec2(x + 1, u_animation_frame), 0),
+		texelFetch(u_animation_texture, ivec2(x + 2, u_animation_frame), 0),
+		texelFetch(u_animation_texture, ivec2(x + 3, u_animation_frame), 0));
+#endif
+}
+#endif
+
 void main()
-{	
+{
+	vec4 position = vec4(a_vertex, 1.0);
+	vec4 normal = vec4(a_normal, 0.0);
+
+#if defined(SKINNED) || defined(BAKED_ANIMATION)
+	mat4 skin = get_joint_matrix(a_bones.x) * a_weights.x +
+		get_joint_matrix(a_bones.y) * a_weights.y +
+		get_joint_matrix(a_bones.z) * a_weights.z +
+		get_joint_matrix(a_bones.w) * a_weights.w;
+	position = skin * position;
+	normal = skin * normal;
+#endif
+
 	//calcule the normal in camera space (the NormalMatrix is like ViewMatrix but without traslation)
-	v_normal = (u_model * vec4( a_normal, 0.0) ).xyz;
+	v_normal = (u_model * normal).xyz;
 	
 	//calcule the vertex in object space
-	v_position = a_vertex;
-	v_world_position = (u_model * vec4( v_position, 1.0) ).xyz;
+	v_position = position.xyz;
+	v_world_position = (u_model * position).xyz;
 	
 	//store the color in the varying var to use it from the pixel shader
 	v_color = a_color;
@@ -31,6 +95,10 @@ void main()
 	//store the texture coordinates
 	v_uv = a_uv;
 
+#ifdef MULTI_DRAW
+	v_material = int(a_draw_material);
+#endif
+
 	//calcule the position of the vertex using the matrices
 	gl_Position = u_viewprojection * vec4( v_world_position, 1.0 );
 }
\ No newline at end of file
@@ -1,10 +1,40 @@
 #version 330 core
 
-uniform vec4 u_color;
+// permutations: TEXTURED, MULTI_DRAW
+
+in vec2 v_uv;
+
+layout(std140) uniform MaterialBlock {
+	vec4 u_color;
+	float u_metallic;
+	float u_roughness;
+};
+
+#ifdef TEXTURED
+uniform sampler2D u_texture;
+#endif
+
+#ifdef MULTI_DRAW
+//Ka, Kd and Ks of every material of the mesh (see uniform_buffer.h)
+layout(std140) uniform MaterialTableBlock {
+	vec4 u_material_table[256 * 3];
+};
+flat in int v_material;
+#else
+uniform vec3 u_Kd = vec3(1.0); //diffuse of the submesh material (set by Mesh::render)
+#endif
 
 out vec4 FragColor;
 
 void main()
 {
 	FragColor = u_color;
+#ifdef MULTI_DRAW
+	FragColor.rgb *= u_material_table[v_material * 3 + 1].rgb;
+#else
+	FragColor.rgb *= u_Kd;
+#endif
+#ifdef TEXTURED
+	FragColor *= texture(u_texture, v_uv);
+#endif
 }
\ No newline at end of file
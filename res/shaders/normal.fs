@@ -1,13 +1,47 @@
 #version 330 core
 
+// permutations: NORMAL_MAPPED
+
 in vec3 v_normal;
 
+#ifdef NORMAL_MAPPED
+in vec3 v_world_position;
+in vec2 v_uv;
+
+uniform sampler2D u_normal_texture;
+
+//builds the tangent space from the screen derivatives, so the mesh does not need tangents
+vec3 perturb_normal(vec3 N, vec3 p, vec2 uv)
+{
+	vec3 dp1 = dFdx(p);
+	vec3 dp2 = dFdy(p);
+	vec2 duv1 = dFdx(uv);
+	vec2 duv2 = dFdy(uv);
+
+	vec3 dp2perp = cross(dp2, N);
+	vec3 dp1perp = cross(N, dp1);
+	vec3 T = dp2perp * duv1.x + dp1perp * duv2.x;
+	vec3 B = dp2perp * duv1.y + dp1perp * duv2.y;
+	float invmax = inversesqrt(max(dot(T, T), dot(B, B)));
+
+	vec3 map = texture(u_normal_texture, uv).xyz * 2.0 - 1.0;
+	//z is rebuilt from xy, so two channel (BC5) normal maps work too
+	map.z = sqrt(max(0.0, 1.0 - dot(map.xy, map.xy)));
+	return normalize(mat3(T * invmax, B * invmax, N) * map);
+}
+#endif
+
 out vec4 FragColor;
 
 void main()
 {
+	vec3 normal = v_normal;
+#ifdef NORMAL_MAPPED
+	normal = perturb_normal(normalize(normal), v_world_position, v_uv);
+#endif
+
 	// Convert from range [-1,1] to [0,1]
-	vec3 normal_color = (v_normal + 1.0) * 0.5;
+	vec3 normal_color = (normal + 1.0) * 0.5;
 	
 	FragColor = vec4(normal_color, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,16 @@
+#version 330 core
+
+in vec3 v_normal;
+in vec2 v_uv;
+
+uniform vec4 u_color;
+
+out vec4 FragColor;
+
+void main()
+{
+	//simple lambert with a fixed light so the relief can be seen
+	vec3 N = normalize(v_normal);
+	float light = max(dot(N, normalize(vec3(0.4, 1.0, 0.3))), 0.0) * 0.8 + 0.2;
+	FragColor = vec4(u_color.rgb * light, u_color.a);
+}
@@ -0,0 +1,66 @@
+#version 330 core
+
+// CDLOD terrain chunk: a grid in 0..1 placed over a quadtree node, the heights come from the height texture
+
+in vec3 a_vertex;
+
+//std140 blocks shared by all the draws (see uniform_buffer.h)
+layout(std140) uniform FrameBlock {
+	mat4 u_viewprojection;
+	mat4 u_view;
+	mat4 u_projection;
+	vec3 u_camera_position;
+	float u_time;
+};
+
+layout(std140) uniform ObjectBlock {
+	mat4 u_model;
+};
+
+uniform sampler2D u_height_texture;
+uniform vec4 u_chunk; //xy: origin of the node, z: size of the node, w: quads per side of the grid
+uniform vec2 u_morph; //distances where the morph to the next level starts and ends
+uniform vec4 u_terrain; //x: size, y: altitude, z: texel width and w: texel height of the height texture (in uv)
+uniform vec3 u_camera_local; //camera position in terrain space
+
+out vec3 v_position;
+out vec3 v_world_position;
+out vec3 v_normal;
+out vec2 v_uv;
+
+float get_height(vec2 uv)
+{
+	return textureLod(u_height_texture, uv, 0.0).r * u_terrain.y;
+}
+
+void main()
+{
+	vec2 grid = a_vertex.xz;
+	vec2 position = u_chunk.xy + grid * u_chunk.z;
+
+	//odd vertices slide onto the even ones, so at the end of the range the chunk matches the coarser level
+	float distance = length(u_camera_local - vec3(position.x, get_height(position / u_terrain.x), position.y));
+	float morph = clamp((distance - u_morph.x) / max(u_morph.y - u_morph.x, 0.0001), 0.0, 1.0);
+	vec2 odd = fract(grid * u_chunk.w * 0.5) * 2.0 / u_chunk.w;
+	grid -= odd * morph;
+	position = u_chunk.xy + grid * u_chunk.z;
+
+	vec2 uv = position / u_terrain.x;
+	float height = get_height(uv);
+
+	//normal from the central differences of the heights
+	vec2 texel = u_terrain.zw;
+	float left = get_height(uv - vec2(texel.x, 0.0));
+	float right = get_height(uv + vec2(texel.x, 0.0));
+	float down = get_height(uv - vec2(0.0, texel.y));
+	float up = get_height(uv + vec2(0.0, texel.y));
+	//slopes over 2 texels of each axis, scaled by texel.x * texel.y to keep the divisions out
+	vec3 normal = normalize(vec3((left - right) * texel.y, 2.0 * texel.x * texel.y * u_terrain.x, (down - up) * texel.x));
+
+	v_position = vec3(position.x, height, position.y);
+	v_world_position = (u_model * vec4(v_position, 1.0)).xyz;
+	v_normal = (u_model * vec4(normal, 0.0)).xyz;
+	v_uv = uv;
+
+	gl_Position = u_viewprojection * vec4(v_world_position, 1.0);
+}
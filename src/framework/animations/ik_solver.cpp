@@ -0,0 +1,166 @@
+#include "ik_solver.h"
+
+bool IKSolver::set_chain(Pose& pose, unsigned int root_id, unsigned int end_effector_id)
+{
+	chain.clear();
+
+	// walk up from the end effector until the root of the chain is found
+	int id = end_effector_id;
+	while (id >= 0) {
+		chain.push_back(id);
+		if (id == (int)root_id) break;
+		id = pose.get_parent(id);
+	}
+
+	if (id != (int)root_id) {
+		chain.clear();
+		return false;
+	}
+
+	// the chain is stored from the root to the end effector
+	unsigned int num_joints = chain.size();
+	for (unsigned int i = 0; i < num_joints / 2; i++) {
+		unsigned int tmp = chain[i];
+		chain[i] = chain[num_joints - 1 - i];
+		chain[num_joints - 1 - i] = tmp;
+	}
+
+	// allocate once here, so solving does not allocate
+	local.resize(num_joints);
+	world.resize(num_joints);
+
+	return true;
+}
+
+void IKSolver::load_chain(Pose& pose)
+{
+	// the global transform of the parent of the chain is the only one that needs the pose hierarchy
+	int parent_id = pose.get_parent(chain[0]);
+	base = parent_id >= 0 ? pose.get_global_transform(parent_id) : Transform();
+
+	for (unsigned int i = 0; i < chain.size(); i++) {
+		local[i] = pose.get_local_transform(chain[i]);
+	}
+	update_world(0);
+}
+
+void IKSolver::store_chain(Pose& pose)
+{
+	for (unsigned int i = 0; i < chain.size(); i++) {
+		pose.set_local_transform(chain[i], local[i]);
+	}
+}
+
+void IKSolver::update_world(unsigned int from)
+{
+	for (unsigned int i = from; i < chain.size(); i++) {
+		world[i] = combine(i == 0 ? base : world[i - 1], local[i]);
+	}
+}
+
+void IKSolver::rotate_joint(unsigned int index, const quat& world_delta)
+{
+	const quat& parent_rotation = index == 0 ? base.rotation : world[index - 1].rotation;
+
+	// new world rotation: first the current one, then the delta
+	quat world_rotation = world[index].rotation * world_delta;
+
+	// remove the parent rotation to get back to local space
+	local[index].rotation = normalized(world_rotation * inverse(parent_rotation));
+
+	update_world(index);
+}
+
+bool CCDSolver::solve(Pose& pose, const vec3& target)
+{
+	unsigned int num_joints = size();
+	if (num_joints == 0) return false;
+
+	load_chain(pose);
+
+	unsigned int last = num_joints - 1;
+	float threshold_sq = threshold * threshold;
+	bool solved = len_sq(target - world[last].position) < threshold_sq;
+
+	for (unsigned int step = 0; step < num_steps && !solved; step++) {
+		// from the joint before the end effector towards the root
+		for (int i = (int)last - 1; i >= 0; i--) {
+			vec3 position = world[i].position;
+			vec3 to_effector = world[last].position - position;
+			vec3 to_target = target - position;
+
+			if (len_sq(to_effector) < VEC3_EPSILON || len_sq(to_target) < VEC3_EPSILON) continue;
+
+			// rotate the joint so the end effector points to the target
+			rotate_joint(i, from_to(to_effector, to_target));
+
+			solved = len_sq(target - world[last].position) < threshold_sq;
+			if (solved) break;
+		}
+	}
+
+	store_chain(pose);
+	return solved;
+}
+
+void FABRIKSolver::iterate_backward(const vec3& target)
+{
+	// place the end effector at the target and pull the rest of the chain keeping the bone lengths
+	int last = (int)positions.size() - 1;
+	positions[last] = target;
+	for (int i = last - 1; i >= 0; i--) {
+		vec3 direction = normalized(positions[i] - positions[i + 1]);
+		positions[i] = positions[i + 1] + direction * lengths[i + 1];
+	}
+}
+
+void FABRIKSolver::iterate_forward(const vec3& root_position)
+{
+	// put the root back in its place and push the rest of the chain keeping the bone lengths
+	positions[0] = root_position;
+	for (unsigned int i = 1; i < positions.size(); i++) {
+		vec3 direction = normalized(positions[i] - positions[i - 1]);
+		positions[i] = positions[i - 1] + direction * lengths[i];
+	}
+}
+
+bool FABRIKSolver::solve(Pose& pose, const vec3& target)
+{
+	unsigned int num_joints = size();
+	if (num_joints == 0) return false;
+
+	load_chain(pose);
+
+	// world positions and bone lengths of the chain
+	positions.resize(num_joints);
+	lengths.resize(num_joints);
+	for (unsigned int i = 0; i < num_joints; i++) {
+		positions[i] = world[i].position;
+		lengths[i] = i == 0 ? 0.f : len(positions[i] - positions[i - 1]);
+	}
+
+	unsigned int last = num_joints - 1;
+	float threshold_sq = threshold * threshold;
+	vec3 root_position = positions[0];
+
+	for (unsigned int step = 0; step < num_steps; step++) {
+		if (len_sq(target - positions[last]) < threshold_sq) break;
+
+		iterate_backward(target);
+		iterate_forward(root_position);
+	}
+
+	// convert the solved positions into rotations, from the root to the end effector
+	for (unsigned int i = 0; i < last; i++) {
+		vec3 position = world[i].position;
+		vec3 to_next = world[i + 1].position - position;
+		vec3 to_desired = positions[i + 1] - position;
+
+		if (len_sq(to_next) < VEC3_EPSILON || len_sq(to_desired) < VEC3_EPSILON) continue;
+
+		rotate_joint(i, from_to(to_next, to_desired));
+	}
+
+	store_chain(pose);
+	return len_sq(target - world[last].position) < threshold_sq;
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+#include "pose.h"
+
+// Base class of the inverse kinematics solvers. A solver works on a chain of joints of a Pose,
+// from the chain root to the end effector. The world (model space) transforms of the chain are
+// cached while solving, so each iteration only updates the joints of the chain below the one that
+// was rotated instead of evaluating the whole hierarchy from the root of the pose.
+class IKSolver
+{
+protected:
+	std::vector<unsigned int> chain; // joint ids of the chain, chain[0] is the root and the last one is the end effector
+	std::vector<Transform> local; // local transforms of the chain joints
+	std::vector<Transform> world; // global transforms of the chain joints
+	Transform base; // global transform of the parent of the chain root
+
+	// Reads the local transforms of the chain from the pose and computes their global transforms
+	void load_chain(Pose& pose);
+	// Writes the solved local transforms back into the pose
+	void store_chain(Pose& pose);
+	// Recomputes the global transforms of the chain starting from the given index
+	void update_world(unsigned int from);
+	// Applies a rotation (given in world space) to a joint of the chain, keeping the rest of the chain attached
+	void rotate_joint(unsigned int index, const quat& world_delta);
+
+public:
+	unsigned int num_steps = 15; // maximum number of iterations per solve
+	float threshold = 0.001f; // distance to the target at which the chain is considered solved
+
+	// Builds the chain walking the parents from the end effector up to the root joint. Returns false if the root is not an ancestor of the end effector
+	bool set_chain(Pose& pose, unsigned int root_id, unsigned int end_effector_id);
+	unsigned int size() { return (unsigned int)chain.size(); }
+	unsigned int get_joint(unsigned int index) { return chain[index]; }
+
+	// Moves the end effector towards the target (in the same space as the global transforms of the pose)
+	// Returns true if the target has been reached within the iteration budget
+	virtual bool solve(Pose& pose, const vec3& target) = 0;
+};
+
+// Cyclic Coordinate Descent: rotates each joint, from the end effector towards the root, so the end effector points to the target
+class CCDSolver : public IKSolver
+{
+public:
+	bool solve(Pose& pose, const vec3& target);
+};
+
+// Forward And Backward Reaching Inverse Kinematics: solves the joint positions keeping the bone lengths,
+// then converts the new positions back into rotations of the chain
+class FABRIKSolver : public IKSolver
+{
+protected:
+	std::vector<vec3> positions; // world positions of the joints while solving
+	std::vector<float> lengths; // length of the bone that goes from the previous joint to each joint
+
+	void iterate_backward(const vec3& target);
+	void iterate_forward(const vec3& root_position);
+
+public:
+	bool solve(Pose& pose, const vec3& target);
+};
\ No newline at end of file
@@ -1,5 +1,11 @@
 #include "pose.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "../frame_allocator.h"
+
 Pose::Pose() { }
 
 Pose::Pose(unsigned int num_joints)
@@ -17,6 +23,14 @@ void Pose::resize(unsigned int size)
 {
 	parents.resize(size);
 	joints.resize(size);
+
+	globals.resize(size);
+	global_matrices.resize(size);
+	dirty.resize(size);
+	skin_dirty.resize(size);
+
+	flag_hierarchy_changed = true;
+	mark_all_dirty();
 }
 
 // get the number of joints
@@ -29,6 +43,10 @@ unsigned int Pose::size()
 void Pose::set_parent(unsigned int id, unsigned int parent_id)
 {
 	parents[id] = parent_id;
+
+	// the children lists have to be rebuilt and every cached transform could be wrong
+	flag_hierarchy_changed = true;
+	mark_all_dirty();
 }
 
 // get parent id
@@ -41,6 +59,7 @@ int Pose::get_parent(unsigned int id)
 void Pose::set_local_transform(unsigned int id, const Transform& transform)
 {
 	joints[id] = transform;
+	mark_dirty(id);
 }
 
 // get local transform of the joint
@@ -52,18 +71,13 @@ Transform Pose::get_local_transform(unsigned int id)
 // get global (world) transform of the joint
 Transform Pose::get_global_transform(unsigned int id)
 {
-	// use "combine()" function to combine two transforms
-	Transform transform = joints[id];
-	for (int i = parents[id]; i >= 0; i = parents[i]) {
-		transform = combine(joints[i], transform);
-	}
-	return transform;
+	return update_global(id);
 }
 
 mat4 Pose::get_global_matrix(unsigned int id)
 {
-	Transform t = get_global_transform(id);
-	return transform_to_mat4(t);
+	update_global(id);
+	return global_matrices[id];
 }
 
 Transform Pose::operator[](unsigned int index)
@@ -75,16 +89,126 @@ Transform Pose::operator[](unsigned int index)
 std::vector<mat4> Pose::get_global_matrices()
 {
 	unsigned int num_joints = size();
-	std::vector<mat4> out(num_joints);
-	if (out.size() != num_joints) {
-		out.resize(num_joints);
+
+	// Only the joints that changed since the last call are recomputed, the rest come from the cache
+	for (unsigned int i = 0; i < num_joints; i++) {
+		update_global(i);
+	}
+
+	return global_matrices;
+}
+
+mat4* Pose::get_global_matrices(LinearArena& arena)
+{
+	unsigned int num_joints = size();
+	mat4* matrices = arena.alloc_array<mat4>(num_joints);
+
+	for (unsigned int i = 0; i < num_joints; i++) {
+		update_global(i);
+	}
+	if (num_joints) {
+		memcpy(matrices, global_matrices.data(), sizeof(mat4) * num_joints);
+	}
+
+	return matrices;
+}
+
+const std::vector<mat4>& Pose::get_skin_matrices(const std::vector<mat4>& inv_bind_pose, uint32_t generation)
+{
+	unsigned int num_joints = size();
+	assert(inv_bind_pose.size() >= num_joints);
+
+	// a different skeleton (or the same one with a new bind pose) invalidates the whole palette
+	if (skin_matrices.size() != num_joints || skin_generation != generation) {
+		skin_matrices.resize(num_joints);
+		skin_generation = generation;
+		std::fill(skin_dirty.begin(), skin_dirty.end(), 1);
+	}
+
+	for (unsigned int i = 0; i < num_joints; i++) {
+		update_global(i);
+		if (skin_dirty[i]) {
+			skin_matrices[i] = global_matrices[i] * inv_bind_pose[i];
+			skin_dirty[i] = 0;
+		}
+	}
+
+	return skin_matrices;
+}
+
+bool Pose::is_dirty(unsigned int id)
+{
+	return dirty[id] != 0;
+}
+
+void Pose::mark_all_dirty()
+{
+	std::fill(dirty.begin(), dirty.end(), 1);
+	std::fill(skin_dirty.begin(), skin_dirty.end(), 1);
+}
+
+void Pose::update_children()
+{
+	unsigned int num_joints = size();
+
+	// count the children of every joint
+	child_offsets.assign(num_joints + 1, 0);
+	for (unsigned int i = 0; i < num_joints; i++) {
+		if (parents[i] >= 0) {
+			child_offsets[parents[i] + 1]++;
+		}
+	}
+	for (unsigned int i = 0; i < num_joints; i++) {
+		child_offsets[i + 1] += child_offsets[i];
 	}
 
-	// For every joint, find the global transform (using get_global_transform), convert it into a matrix, and store the result in a vector of matrices
+	// fill the children ids
+	child_ids.resize(child_offsets[num_joints]);
+	std::vector<unsigned int> next(child_offsets.begin(), child_offsets.end() - 1);
 	for (unsigned int i = 0; i < num_joints; i++) {
-		Transform t = get_global_transform(i);
-		out[i] = transform_to_mat4(t);
+		if (parents[i] >= 0) {
+			child_ids[next[parents[i]]++] = i;
+		}
+	}
+
+	flag_hierarchy_changed = false;
+}
+
+void Pose::mark_dirty(unsigned int id)
+{
+	// if the joint is already dirty, its whole subtree is dirty too
+	if (dirty[id]) {
+		return;
+	}
+
+	if (flag_hierarchy_changed) {
+		update_children();
+	}
+
+	dirty[id] = 1;
+	for (unsigned int i = child_offsets[id]; i < child_offsets[id + 1]; i++) {
+		mark_dirty(child_ids[i]);
 	}
+}
+
+const Transform& Pose::update_global(unsigned int id)
+{
+	if (!dirty[id]) {
+		return globals[id];
+	}
+
+	// use "combine()" function to combine the (already updated) parent transform with the local one
+	int parent_id = parents[id];
+	if (parent_id >= 0) {
+		globals[id] = combine(update_global(parent_id), joints[id]);
+	}
+	else {
+		globals[id] = joints[id];
+	}
+	global_matrices[id] = transform_to_mat4(globals[id]);
+
+	dirty[id] = 0;
+	skin_dirty[id] = 1;
 
-	return out;
+	return globals[id];
 }
\ No newline at end of file
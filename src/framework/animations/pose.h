@@ -1,8 +1,11 @@
 #pragma once
 
 #include <vector>
+#include <cstdint>
 #include "../math/transform.h"
 
+class LinearArena;
+
 // Used to hold the transformation of every bone in an animated hierarchy
 class Pose
 {
@@ -10,6 +13,25 @@ protected:
 	std::vector<Transform> joints; // local transforms
 	std::vector<int> parents; // parent joints Id (index in the joints array)
 
+	// Cached evaluation of the hierarchy: only the joints flagged as dirty are recomputed
+	std::vector<Transform> globals; // global transforms of the joints
+	std::vector<mat4> global_matrices; // global transforms as matrices
+	std::vector<mat4> skin_matrices; // global matrix * inverse bind pose matrix of each joint
+	std::vector<unsigned char> dirty; // the global transform of the joint is outdated
+	std::vector<unsigned char> skin_dirty; // the skin matrix of the joint is outdated
+	uint32_t skin_generation = 0; // of the inverse bind pose used to compute the cached skin matrices (0 for none)
+
+	// Children of every joint (stored contiguously, children of joint i are in [child_offsets[i], child_offsets[i + 1]))
+	std::vector<unsigned int> child_offsets;
+	std::vector<unsigned int> child_ids;
+	bool flag_hierarchy_changed = true;
+
+	void update_children();
+	// Marks the joint and all its descendants as dirty
+	void mark_dirty(unsigned int id);
+	// Recomputes the global transform of the joint (and of its dirty ancestors) if needed
+	const Transform& update_global(unsigned int id);
+
 public:
 	Pose(); // Empty constructor
 	// Initialize the pose given another pose
@@ -24,15 +46,26 @@ public:
 	void set_parent(unsigned int id, unsigned int parent_id);
 	int get_parent(unsigned int id);
 
-	// Set the transformation for the joint given its id
+	// Set the transformation for the joint given its id (its subtree is marked as dirty)
 	void set_local_transform(unsigned int id, const Transform& transform);
 	// Get the transformation of the joint given its id
 	Transform get_local_transform(unsigned int id);
-	// Get the global transformation (world space) of the joint 
+	// Get the global transformation (world space) of the joint
 	Transform get_global_transform(unsigned int id);
 	// Get the global transformation matrix (world space) of all the joints
 	std::vector<mat4> get_global_matrices();
-	// Get the global transformation matrix (world space) of a specific joint 
+	// Same without heap allocations, the matrices are copied to the arena (valid until it is released)
+	mat4* get_global_matrices(LinearArena& arena);
+	// Get the global transformation matrix (world space) of a specific joint
 	mat4 get_global_matrix(unsigned int id);
 	Transform operator[](unsigned int index);
+
+	// Get the skinning matrices (global matrix * inverse bind pose) of all the joints, only the dirty ones are recomputed.
+	// The generation identifies the inverse bind pose (Skeleton::get_generation), a different one recomputes all of them
+	const std::vector<mat4>& get_skin_matrices(const std::vector<mat4>& inv_bind_pose, uint32_t generation);
+
+	// Check if the global transform of the joint has to be recomputed (it changed since the last evaluation)
+	bool is_dirty(unsigned int id);
+	// Force the recomputation of the whole pose
+	void mark_all_dirty();
 };
\ No newline at end of file
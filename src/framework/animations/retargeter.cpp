@@ -0,0 +1,215 @@
+#include "retargeter.h"
+
+#include <cassert>
+#include <cctype>
+#include <math.h>
+#include <unordered_map>
+
+std::map<std::pair<Skeleton*, Skeleton*>, Retargeter*> Retargeter::s_retargeters_built;
+
+// Names from different rigs usually differ in prefixes and separators (e.g. "mixamorig:LeftArm" and "Left_Arm")
+static std::string normalize_joint_name(const std::string& name)
+{
+	size_t start = name.find_last_of(":|");
+	start = start == std::string::npos ? 0 : start + 1;
+
+	std::string out;
+	for (size_t i = start; i < name.size(); i++) {
+		unsigned char c = name[i];
+		if (isalnum(c)) {
+			out += (char)tolower(c);
+		}
+	}
+	return out;
+}
+
+Retargeter::Retargeter()
+{
+	translation_scale = 1.f;
+}
+
+Retargeter::Retargeter(Skeleton& source, Skeleton& target)
+{
+	build(source, target);
+}
+
+void Retargeter::build(Skeleton& source, Skeleton& target)
+{
+	unsigned int num_joints = target.get_rest_pose().size();
+
+	joint_map.assign(num_joints, -1);
+	pre_rotations.assign(num_joints, quat());
+	post_rotations.assign(num_joints, quat());
+	source_rest_positions.assign(num_joints, vec3());
+	apply_translation.assign(num_joints, 0);
+	target_rest.resize(num_joints);
+	translation_scale = 1.f;
+
+	map_by_name(source, target);
+	map_by_hierarchy(source, target);
+	compute_corrections(source, target);
+}
+
+void Retargeter::map_by_name(Skeleton& source, Skeleton& target)
+{
+	std::vector<std::string>& source_names = source.get_joint_names();
+	std::vector<std::string>& target_names = target.get_joint_names();
+
+	std::unordered_map<std::string, int> exact;
+	std::unordered_map<std::string, int> normalized;
+	for (unsigned int i = 0; i < source_names.size(); i++) {
+		exact.emplace(source_names[i], i);
+		normalized.emplace(normalize_joint_name(source_names[i]), i);
+	}
+
+	for (unsigned int i = 0; i < joint_map.size() && i < target_names.size(); i++) {
+		auto it = exact.find(target_names[i]);
+		if (it == exact.end()) {
+			it = normalized.find(normalize_joint_name(target_names[i]));
+			if (it == normalized.end()) continue;
+		}
+		joint_map[i] = it->second;
+	}
+}
+
+// Joints that could not be matched by name are matched when they are the only unmapped child of two mapped parents
+void Retargeter::map_by_hierarchy(Skeleton& source, Skeleton& target)
+{
+	Pose& source_rest = source.get_rest_pose();
+	Pose& target_rest_pose = target.get_rest_pose();
+	unsigned int num_source = source_rest.size();
+	unsigned int num_target = target_rest_pose.size();
+
+	std::vector<unsigned char> used(num_source, 0);
+	for (unsigned int i = 0; i < num_target; i++) {
+		if (joint_map[i] >= 0) used[joint_map[i]] = 1;
+	}
+
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (unsigned int i = 0; i < num_target; i++) {
+			if (joint_map[i] >= 0) continue;
+
+			int target_parent = target_rest_pose.get_parent(i);
+			if (target_parent >= 0 && joint_map[target_parent] < 0) continue;
+			int source_parent = target_parent >= 0 ? joint_map[target_parent] : -1;
+
+			// the joint has to be the only unmapped child of its parent on both rigs
+			int num_target_candidates = 0;
+			for (unsigned int j = 0; j < num_target; j++) {
+				if (joint_map[j] < 0 && target_rest_pose.get_parent(j) == target_parent) num_target_candidates++;
+			}
+
+			int candidate = -1;
+			int num_source_candidates = 0;
+			for (unsigned int j = 0; j < num_source; j++) {
+				if (!used[j] && source_rest.get_parent(j) == source_parent) {
+					candidate = j;
+					num_source_candidates++;
+				}
+			}
+
+			if (num_target_candidates == 1 && num_source_candidates == 1) {
+				joint_map[i] = candidate;
+				used[candidate] = 1;
+				changed = true;
+			}
+		}
+	}
+}
+
+void Retargeter::compute_corrections(Skeleton& source, Skeleton& target)
+{
+	Pose& source_rest = source.get_rest_pose();
+	Pose& target_rest_pose = target.get_rest_pose();
+	bool scale_found = false;
+
+	for (unsigned int i = 0; i < joint_map.size(); i++) {
+		target_rest[i] = target_rest_pose.get_local_transform(i);
+
+		int s = joint_map[i];
+		if (s < 0) continue;
+
+		int target_parent = target_rest_pose.get_parent(i);
+		int source_parent = source_rest.get_parent(s);
+
+		Transform target_global = target_rest_pose.get_global_transform(i);
+		Transform source_global = source_rest.get_global_transform(s);
+		quat target_parent_rotation = target_parent >= 0 ? target_rest_pose.get_global_transform(target_parent).rotation : quat();
+		quat source_parent_rotation = source_parent >= 0 ? source_rest.get_global_transform(source_parent).rotation : quat();
+
+		// Moves the source local rotation into the frame of the target joint so that, in world space,
+		// the target joint rotates away from its rest pose in the same way the source joint does
+		pre_rotations[i] = source_parent_rotation * inverse(target_parent_rotation);
+		post_rotations[i] = target_global.rotation * inverse(source_global.rotation);
+
+		source_rest_positions[i] = source_rest.get_local_transform(s).position;
+		apply_translation[i] = target_parent < 0 || joint_map[target_parent] < 0;
+
+		// the first root of the mapping gives the size relation between both rigs
+		if (apply_translation[i] && !scale_found && fabsf(source_global.position.y) > VEC3_EPSILON) {
+			translation_scale = target_global.position.y / source_global.position.y;
+			scale_found = true;
+		}
+	}
+}
+
+void Retargeter::apply(Pose& source_pose, Pose& target_pose)
+{
+	unsigned int num_joints = joint_map.size();
+	assert(target_pose.size() == num_joints && "target pose does not belong to the target skeleton");
+
+	for (unsigned int i = 0; i < num_joints; i++) {
+		int s = joint_map[i];
+		if (s < 0) {
+			target_pose.set_local_transform(i, target_rest[i]);
+			continue;
+		}
+
+		Transform source = source_pose.get_local_transform(s);
+		Transform out = target_rest[i];
+		out.rotation = normalized(post_rotations[i] * source.rotation * pre_rotations[i]);
+
+		if (apply_translation[i]) {
+			vec3 delta = (source.position - source_rest_positions[i]) * translation_scale;
+			out.position = out.position + pre_rotations[i] * delta;
+		}
+
+		target_pose.set_local_transform(i, out);
+	}
+}
+
+unsigned int Retargeter::get_num_mapped_joints()
+{
+	unsigned int count = 0;
+	for (unsigned int i = 0; i < joint_map.size(); i++) {
+		if (joint_map[i] >= 0) count++;
+	}
+	return count;
+}
+
+Retargeter* Retargeter::get(Skeleton* source, Skeleton* target)
+{
+	assert(source && target);
+
+	auto it = s_retargeters_built.find(std::make_pair(source, target));
+	if (it != s_retargeters_built.end())
+		return it->second;
+
+	Retargeter* retargeter = new Retargeter(*source, *target);
+	s_retargeters_built[std::make_pair(source, target)] = retargeter;
+	return retargeter;
+}
+
+void Retargeter::forget(Skeleton* skeleton)
+{
+	for (auto it = s_retargeters_built.begin(); it != s_retargeters_built.end();) {
+		if (it->first.first == skeleton || it->first.second == skeleton) {
+			delete it->second;
+			it = s_retargeters_built.erase(it);
+		}
+		else
+			it++;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include "skeleton.h"
+
+// Transfers poses from one skeleton (source) to another one (target) with a different rig.
+// The joint mapping and the rest pose corrections are computed once when the retargeter is built,
+// so applying a pose is only an index remap and two quaternion products per joint (no string work).
+class Retargeter
+{
+protected:
+	std::vector<int> joint_map; // for every target joint, the id of the source joint that drives it (-1 if not mapped)
+	std::vector<quat> pre_rotations; // rest pose correction applied on the parent side of every target joint
+	std::vector<quat> post_rotations; // rest pose correction applied on the joint side of every target joint
+	std::vector<vec3> source_rest_positions; // rest local position of the source joint of every target joint
+	std::vector<unsigned char> apply_translation; // the joint is a root of the mapping and follows the source translation
+	std::vector<Transform> target_rest; // rest local transforms of the target skeleton
+
+	float translation_scale; // height ratio between the target and the source rigs
+
+	void map_by_name(Skeleton& source, Skeleton& target);
+	void map_by_hierarchy(Skeleton& source, Skeleton& target);
+	void compute_corrections(Skeleton& source, Skeleton& target);
+
+public:
+	// cache of the retargeters already built for a pair of skeletons (the skeletons remove theirs when they change or are deleted)
+	static std::map<std::pair<Skeleton*, Skeleton*>, Retargeter*> s_retargeters_built;
+
+	Retargeter();
+	Retargeter(Skeleton& source, Skeleton& target);
+
+	// Builds the joint mapping (first by name, then by hierarchy) and caches the rest pose corrections
+	void build(Skeleton& source, Skeleton& target);
+
+	// Writes in target_pose the source_pose retargeted to the target skeleton
+	void apply(Pose& source_pose, Pose& target_pose);
+
+	int get_source_joint(unsigned int target_id) { return joint_map[target_id]; }
+	unsigned int get_num_mapped_joints();
+
+	// get using the cache (builds the retargeter the first time the pair of skeletons is used)
+	static Retargeter* get(Skeleton* source, Skeleton* target);
+	// deletes the cached retargeters of the skeleton, as source or as target
+	static void forget(Skeleton* skeleton);
+};
\ No newline at end of file
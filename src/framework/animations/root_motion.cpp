@@ -0,0 +1,150 @@
+#include "root_motion.h"
+
+#include <math.h>
+
+static float get_yaw(const quat& rotation)
+{
+	// angle of the forward vector projected on the ground
+	vec3 forward = rotation * vec3(0.f, 0.f, 1.f);
+	if (fabsf(forward.x) < VEC3_EPSILON && fabsf(forward.z) < VEC3_EPSILON) {
+		return 0.f;
+	}
+	return atan2f(forward.x, forward.z);
+}
+
+RootMotion::RootMotion() { }
+
+void RootMotion::extract(const std::vector<float>& sample_times, std::vector<Transform>& root_samples)
+{
+	unsigned int num_samples = (unsigned int)root_samples.size();
+
+	times = sample_times;
+	times.resize(num_samples);
+	positions.resize(num_samples);
+	yaws.resize(num_samples);
+
+	if (num_samples == 0) return;
+
+	vec3 start = root_samples[0].position;
+	float previous_yaw = 0.f;
+
+	for (unsigned int i = 0; i < num_samples; i++) {
+		Transform& root = root_samples[i];
+
+		// unwrap the yaw so the track does not jump when crossing +-PI
+		float yaw = get_yaw(root.rotation);
+		if (i > 0) {
+			while (yaw - previous_yaw > PI) yaw -= 2.f * PI;
+			while (yaw - previous_yaw < -PI) yaw += 2.f * PI;
+		}
+		previous_yaw = yaw;
+
+		positions[i] = vec3(root.position.x - start.x, 0.f, root.position.z - start.z);
+		yaws[i] = yaw;
+
+		// remove the yaw applied on top of the rest of the root rotation, and keep the root over its start position
+		quat yaw_rotation = angle_axis(yaw, vec3(0.f, 1.f, 0.f));
+		root.rotation = normalized(root.rotation * inverse(yaw_rotation));
+		root.position = vec3(start.x, root.position.y, start.z);
+	}
+}
+
+void RootMotion::sample(float t, vec3& position, float& yaw)
+{
+	unsigned int num_samples = size();
+	if (num_samples == 0) {
+		position = vec3();
+		yaw = 0.f;
+		return;
+	}
+
+	if (num_samples == 1 || t <= times[0]) {
+		position = positions[0];
+		yaw = yaws[0];
+		return;
+	}
+	if (t >= times[num_samples - 1]) {
+		position = positions[num_samples - 1];
+		yaw = yaws[num_samples - 1];
+		return;
+	}
+
+	// binary search of the samples around t
+	unsigned int lo = 0, hi = num_samples - 1;
+	while (hi - lo > 1) {
+		unsigned int mid = (lo + hi) / 2;
+		if (times[mid] <= t) lo = mid;
+		else hi = mid;
+	}
+
+	float span = times[hi] - times[lo];
+	float f = span > 0.f ? (t - times[lo]) / span : 0.f;
+	position = lerp(positions[lo], positions[hi], f);
+	yaw = yaws[lo] + (yaws[hi] - yaws[lo]) * f;
+}
+
+float RootMotion::get_duration()
+{
+	if (times.size() < 2) return 0.f;
+	return times.back() - times.front();
+}
+
+Transform RootMotion::get_total()
+{
+	if (times.empty()) return Transform();
+	return get_delta(times.front(), times.back(), false);
+}
+
+Transform RootMotion::get_delta(float from, float to, bool looping)
+{
+	Transform delta;
+	float duration = get_duration();
+	if (duration <= 0.f) return delta;
+
+	float start = times.front();
+	vec3 position_from, position_to;
+	float yaw_from, yaw_to;
+
+	if (!looping) {
+		sample(from, position_from, yaw_from);
+		sample(to, position_to, yaw_to);
+
+		// displacement in the space of the character at "from"
+		quat inverse_yaw = angle_axis(-yaw_from, vec3(0.f, 1.f, 0.f));
+		delta.position = inverse_yaw * (position_to - position_from);
+		delta.rotation = angle_axis(yaw_to - yaw_from, vec3(0.f, 1.f, 0.f));
+		return delta;
+	}
+
+	// number of loops between both times, only the local times inside the clip are sampled
+	float loops_from = floorf((from - start) / duration);
+	float loops_to = floorf((to - start) / duration);
+	int num_loops = (int)(loops_to - loops_from);
+
+	sample(from - loops_from * duration, position_from, yaw_from);
+	sample(to - loops_to * duration, position_to, yaw_to);
+
+	// walk the loops in the space of the track: every loop starts where the previous one ended
+	float loop_yaw = yaws.back() - yaws.front();
+	vec3 loop_position = positions.back();
+	vec3 position = vec3();
+	float yaw = 0.f;
+	int step = num_loops >= 0 ? 1 : -1;
+	for (int i = 0; i != num_loops; i += step) {
+		if (step > 0) {
+			position = position + angle_axis(yaw, vec3(0.f, 1.f, 0.f)) * loop_position;
+			yaw += loop_yaw;
+		}
+		else {
+			yaw -= loop_yaw;
+			position = position - angle_axis(yaw, vec3(0.f, 1.f, 0.f)) * loop_position;
+		}
+	}
+	position = position + angle_axis(yaw, vec3(0.f, 1.f, 0.f)) * position_to;
+	yaw += yaw_to;
+
+	quat inverse_yaw = angle_axis(-yaw_from, vec3(0.f, 1.f, 0.f));
+	delta.position = inverse_yaw * (position - position_from);
+	delta.rotation = angle_axis(yaw - yaw_from, vec3(0.f, 1.f, 0.f));
+	return delta;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+#include "../math/transform.h"
+
+// Root motion track of a clip: the horizontal translation and the yaw of the root joint are taken out of the
+// clip when it is imported and stored here as accumulated values. At runtime the delta between two times is
+// applied to the Entity transform, so the root joint does not have to be sampled again and the character
+// position is built from small per-frame deltas instead of large absolute clip positions.
+class RootMotion
+{
+protected:
+	std::vector<float> times; // time of each sample
+	std::vector<vec3> positions; // horizontal displacement of the root from the first sample (y is always 0)
+	std::vector<float> yaws; // rotation of the root around the up axis (unwrapped, in radians)
+
+	// accumulated displacement and yaw at time t (clamped to the track)
+	void sample(float t, vec3& position, float& yaw);
+
+public:
+	RootMotion();
+
+	// Extracts the root motion from the samples of the root joint of a clip (local transforms, one per time).
+	// The samples are modified: the horizontal translation and the yaw are removed from them, keeping the height
+	// and the rest of the rotation, so the clip plays in place
+	void extract(const std::vector<float>& sample_times, std::vector<Transform>& root_samples);
+
+	// Motion between two times of the clip, expressed in the character space at time "from".
+	// If the clip loops, "to" can be smaller than "from" or several loops away and the motion of each loop is added
+	Transform get_delta(float from, float to, bool looping);
+
+	float get_duration();
+	unsigned int size() { return (unsigned int)times.size(); }
+	// displacement and rotation of a whole loop of the clip
+	Transform get_total();
+};
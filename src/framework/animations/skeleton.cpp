@@ -1,4 +1,9 @@
 #include "skeleton.h"
+#include "retargeter.h"
+
+#include <atomic>
+
+static std::atomic<uint32_t> s_last_generation{ 0 };
 
 Skeleton::Skeleton() {}
 
@@ -7,8 +12,15 @@ Skeleton::Skeleton(const Pose& rest, const Pose& bind, const std::vector<std::st
 	set(rest, bind, names);
 }
 
+Skeleton::~Skeleton()
+{
+	Retargeter::forget(this);
+}
+
 void Skeleton::set(const Pose& rest, const Pose& bind, const std::vector<std::string>& names)
 {
+	// the joint mapping of the cached retargeters was built for the old rig
+	Retargeter::forget(this);
 	rest_pose = rest;
 	bind_pose = bind;
 	joint_names = names;
@@ -40,12 +52,24 @@ std::string& Skeleton::get_joint_name(unsigned int id)
 	return joint_names[id];
 }
 
+int Skeleton::get_joint_id(const std::string& name)
+{
+	for (unsigned int i = 0; i < joint_names.size(); ++i) {
+		if (joint_names[i] == name) {
+			return i;
+		}
+	}
+	return -1;
+}
+
 void Skeleton::update_inv_bind_pose()
 {
 	unsigned int size = bind_pose.size();
 	inv_bind_pose.resize(size);
+	// the bind pose caches its global matrices, so each joint is only evaluated once
 	for (unsigned int i = 0; i < size; ++i) {
-		Transform world = bind_pose.get_global_transform(i);
-		inv_bind_pose[i] = inverse(transform_to_mat4(world));
+		inv_bind_pose[i] = inverse(bind_pose.get_global_matrix(i));
 	}
+	// a skeleton created where a deleted one was does not reuse its cached skin matrices
+	generation = ++s_last_generation;
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <cstdint>
 #include "pose.h"
 
 class Skeleton
@@ -11,6 +12,7 @@ protected:
 	
 	std::vector<mat4> inv_bind_pose; // vector of inverse bind pose matrix of each joint
 	std::vector<std::string> joint_names; // vector of the name of each joint
+	uint32_t generation = 0; // unique for every inverse bind pose computed by any skeleton, the poses cache their skin matrices with it
 
 	// updates the inverse bind pose matrices: any time the bind pose of the skeleton is updated, the inverse bind pose should be re-calculated as well
 	void update_inv_bind_pose();
@@ -19,6 +21,7 @@ public:
 	Skeleton(); // Empty constructor
 	// Initialize the skeleton given the rest and bind poses, and the names of the joints
 	Skeleton(const Pose& rest, const Pose& bind, const std::vector<std::string>& names);
+	~Skeleton(); // the retargeters cached for it are deleted
 
 	void set(const Pose& rest, const Pose& bind, const std::vector<std::string>& names);
 
@@ -26,6 +29,9 @@ public:
 	Pose& get_rest_pose();
 
 	std::vector<mat4>& get_inv_bind_pose();
+	uint32_t get_generation() { return generation; }
 	std::vector<std::string>& get_joint_names();
 	std::string& get_joint_name(unsigned int id);
+	// Linear search of a joint by its name, returns -1 if not found (do not use it per frame)
+	int get_joint_id(const std::string& name);
 };
\ No newline at end of file
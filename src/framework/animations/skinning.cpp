@@ -0,0 +1,59 @@
+#include "skinning.h"
+
+#include <cmath>
+#include <cstdint>
+
+template<typename T>
+static inline const T& element(const T* base, size_t stride, size_t i)
+{
+	return *(const T*)((const uint8_t*)base + i * stride);
+}
+
+void skin_vertices(const vec3* positions, size_t position_stride, const vec3* normals, size_t normal_stride,
+	const ivec4* joints, const vec4* weights, size_t num_vertices, const mat4* skin_matrices,
+	vec3* out_positions, vec3* out_normals)
+{
+	if (!position_stride) position_stride = sizeof(vec3);
+	if (!normal_stride) normal_stride = sizeof(vec3);
+
+	for (size_t i = 0; i < num_vertices; i++)
+	{
+		const ivec4& joint = joints[i];
+		const vec4& weight = weights[i];
+
+		// blended matrix (only the 3x4 part is needed, the last row of the skin matrices is 0 0 0 1)
+		float m[12] = { 0 };
+		for (int k = 0; k < 4; k++)
+		{
+			float w = weight.v[k];
+			if (w == 0.f)
+				continue;
+			const float* s = skin_matrices[joint.v[k]].data;
+			m[0] += s[0] * w; m[1] += s[1] * w; m[2] += s[2] * w;
+			m[3] += s[4] * w; m[4] += s[5] * w; m[5] += s[6] * w;
+			m[6] += s[8] * w; m[7] += s[9] * w; m[8] += s[10] * w;
+			m[9] += s[12] * w; m[10] += s[13] * w; m[11] += s[14] * w;
+		}
+
+		const vec3& p = element(positions, position_stride, i);
+		out_positions[i] = vec3(
+			m[0] * p.x + m[3] * p.y + m[6] * p.z + m[9],
+			m[1] * p.x + m[4] * p.y + m[7] * p.z + m[10],
+			m[2] * p.x + m[5] * p.y + m[8] * p.z + m[11]);
+
+		if (normals && out_normals)
+		{
+			const vec3& n = element(normals, normal_stride, i);
+			vec3 r(
+				m[0] * n.x + m[3] * n.y + m[6] * n.z,
+				m[1] * n.x + m[4] * n.y + m[7] * n.z,
+				m[2] * n.x + m[5] * n.y + m[8] * n.z);
+			float length_sq = r.x * r.x + r.y * r.y + r.z * r.z;
+			if (length_sq > 0.f) {
+				float inv_length = 1.f / sqrtf(length_sq);
+				r = vec3(r.x * inv_length, r.y * inv_length, r.z * inv_length);
+			}
+			out_normals[i] = r;
+		}
+	}
+}
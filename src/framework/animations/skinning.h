@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+#include "../math/vec3.h"
+#include "../math/vec4.h"
+#include "../math/mat4.h"
+
+// Linear blend skinning on the CPU: every vertex is transformed by the weighted sum of the skin matrices
+// (global matrix * inverse bind pose) of its four joints. The input arrays can be interleaved, the strides are in bytes
+// (0 means tightly packed). Normals are optional (NULL), and are renormalized after the transform
+void skin_vertices(const vec3* positions, size_t position_stride, const vec3* normals, size_t normal_stride,
+	const ivec4* joints, const vec4* weights, size_t num_vertices, const mat4* skin_matrices,
+	vec3* out_positions, vec3* out_normals);
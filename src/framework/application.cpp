@@ -4,6 +4,18 @@
 
 #include "animations/pose.h"
 #include "animations/skeleton.h"
+#include "graphics/uniform_buffer.h"
+#include "graphics/texture_streamer.h"
+#include "graphics/draw_batch.h"
+#include "profiler.h"
+#include "job_system.h"
+#include "frame_allocator.h"
+#include "resource_manager.h"
+#include "scene.h"
+
+#include <typeinfo>
+#include <cstring>
+#include <algorithm>
 
 Camera* Application::camera = nullptr;
 Application* Application::instance;
@@ -21,77 +33,188 @@ void Application::init(GLFWwindow* window)
     camera->look_at(vec3(0.f, 1.5f, 7.f), vec3(0.f, 0.0f, 0.f), vec3(0.f, 1.f, 0.f));
     camera->set_perspective(45.f, window_width / (float)window_height, 0.1f, 500.f);
 
-    /* ADD ENTITIES TO THE SCENE */
-    /*Entity* example = new Entity("Example");
-    example->mesh = Mesh::get("res/meshes/sphere.obj");
-    example->material = new FlatMaterial();
-    example->set_transform(Transform());
-    entity_list.push_back(example);*/
-
-    /* ADD ENTITIES TO THE SCENE */
-
-    // Add spheres
-    Entity* dot_ent = new Entity("Dot Sphere");
-    dot_ent->mesh = Mesh::get("res/meshes/sphere.obj");
-    dot_ent->material = new FlatMaterial();
-    dot_ent->set_transform(Transform(vec3(-3.f, 0.f, 0.f), quat(), vec3(1.f)));
-    entity_list.push_back(dot_ent);
-
-    Entity* cross_ent = new Entity("Cross Sphere");
-    cross_ent->mesh = Mesh::get("res/meshes/sphere.obj");
-    cross_ent->material = new NormalMaterial();
-    cross_ent->set_transform(Transform(vec3(-1.f, 0.f, 0.f), quat(), vec3(1.f)));
-    entity_list.push_back(cross_ent);
-
-    Entity* quat_ent = new Entity("Quat Sphere");
-    quat_ent->mesh = Mesh::get("res/meshes/sphere.obj");
-    quat_ent->material = new NormalMaterial();
-    quat_ent->set_transform(Transform(vec3(1.f, 0.f, 0.f), quat(), vec3(1.f)));
-    entity_list.push_back(quat_ent);
-
-    Entity* lerp_ent = new Entity("Lerp Sphere");
-    lerp_ent->mesh = Mesh::get("res/meshes/sphere.obj");
-    lerp_ent->material = new FlatMaterial();
-    lerp_ent->set_transform(Transform(vec3(3.f, 0.f, 0.f), quat(), vec3(1.f)));
-    entity_list.push_back(lerp_ent);
-
-    // Then, add debug lines (so they are rendered on top of the previous entities)
-    LineHelper* dot_l1 = new LineHelper(vec3(-3.f, 0.f, 0.f), vec3(0.f, 1.f, 0.f));
-    dot_l1->color = vec4(1.f, 0.f, 0.f, 1.f);
-    dot_l1->unlocked = false;
-    entity_list.push_back(dot_l1);
-
-    LineHelper* dot_l2 = new LineHelper(vec3(-3.f, 0.f, 0.f), vec3(0.f, 0.f, 1.f));
-    entity_list.push_back(dot_l2);
-
-    LineHelper* cross_l3 = new LineHelper(vec3(-1.f, 0.f, 0.f), vec3(0.f, 1.f, 0.f));
-    cross_l3->color = vec4(1.f, 0.f, 0.f, 1.f);
-    cross_l3->unlocked = false;
-    entity_list.push_back(cross_l3);
-
-    LineHelper* cross_l4 = new LineHelper(vec3(-1.f, 0.f, 0.f), vec3(0.f, 0.f, 1.f));
-    entity_list.push_back(cross_l4);
-
-    LineHelper* cross_l5 = new LineHelper(vec3(-1.f, 0.f, 0.f), vec3(1.f, 0.f, 0.f));
-    cross_l5->color = vec4(0.f, 1.f, 0.f, 1.f);
-    cross_l5->unlocked = false;
-    entity_list.push_back(cross_l5);
-
-    LineHelper* quat_l6 = new LineHelper(vec3(1.f, 0.f, 0.f), vec3(0.f, 0.f, 1.f));
-    quat_l6->color = vec4(1.f, 0.f, 0.f, 1.f);
-    quat_l6->unlocked = false;
-    entity_list.push_back(quat_l6);
-
-    LineHelper* quat_l7 = new LineHelper(vec3(1.f, 0.f, 0.f), vec3(0.f, 0.f, 1.f));
-    entity_list.push_back(quat_l7);
+    // Compile the shader variants used by the materials
+    ShaderPermutations::precompile("res/shaders/permutations.txt");
+
+    // The entities come from the scene file (cooked to a .scnbin the first time it is loaded)
+    scene = Scene::load("res/scenes/default.json", entity_list);
+    if (scene) {
+        camera->look_at(scene->camera_eye, scene->camera_center, vec3(0.f, 1.f, 0.f));
+        camera->set_perspective(scene->camera_fov, window_width / (float)window_height, 0.1f, 500.f);
+        flag_grid = scene->grid;
+    }
 }
 
 void Application::update(float dt)
 {
-    float curr_time = glfwGetTime();
+    PROFILE_SCOPE("Application::update");
+
+    // steps of the simulation due in this frame
+    int num_steps = 1;
+    float step_dt = dt;
+    render_alpha = 1.f;
+    if (fixed_steps_per_frame > 0) {
+        num_steps = fixed_steps_per_frame;
+        step_dt = fixed_timestep;
+    }
+    else if (flag_fixed_timestep) {
+        // a long frame (a breakpoint, a load) does not make the simulation run lots of steps to catch up
+        step_accumulator += std::min(dt, fixed_timestep * max_substeps);
+        num_steps = (int)(step_accumulator / fixed_timestep);
+        step_accumulator -= num_steps * fixed_timestep;
+        step_dt = fixed_timestep;
+        render_alpha = step_accumulator / fixed_timestep;
+    }
+
+    // the scene can only change once the last pipelined update is done
+    wait_update();
+
+    if (num_steps == 0) {
+        // faster display than simulation: the same frame is drawn with a higher interpolation
+        if (!render_frame) {
+            capture(render_frames[0]);
+            upload_step();
+            render_frame = &render_frames[0];
+        }
+        return;
+    }
+
+    if (!flag_pipelined) {
+        for (int i = 0; i < num_steps; i++)
+            step(step_dt, render_frames[0]);
+        upload_step();
+        render_frame = &render_frames[0];
+        return;
+    }
+
+    sRenderFrame* next_frame = render_frame == &render_frames[0] ? &render_frames[1] : &render_frames[0];
+    for (int i = 0; i < num_steps - 1; i++)
+        step(step_dt, *next_frame);
 
-    // Update entities of the scene
+    if (!render_frame) {
+        // nothing captured yet to draw meanwhile
+        step(step_dt, *next_frame);
+        upload_step();
+        render_frame = next_frame;
+        return;
+    }
+
+    // the scene logic of the last step stays in the main thread (it uploads meshes and edits materials the render reads),
+    // the poses and the capture run while this frame is rendered from the last capture. Same order as step(), the
+    // uploads that need the poses are done by wait_update()
+    update_scene(step_dt);
+    num_steps_simulated++;
+    // the job only captures this (the rest is in members), so std::function does not allocate it
+    pending_frame = next_frame;
+    pending_dt = step_dt;
+    JobSystem::run([this]() {
+        update_entities_async(pending_dt);
+        capture(*pending_frame);
+    }, &update_counter);
+}
+
+void Application::step(float dt, sRenderFrame& frame)
+{
+    // scene logic, then the poses (with the camera of this step), then the capture: the order of the pipelined update
+    update_scene(dt);
+    update_entities_async(dt);
+    capture(frame);
+    num_steps_simulated++;
+}
+
+void Application::wait_update()
+{
+    if (!pending_frame)
+        return;
+
+    PROFILE_SCOPE("Wait update");
+    JobSystem::wait(&update_counter);
+    render_frame = pending_frame;
+    pending_frame = nullptr;
+    upload_step();
+}
+
+void Application::upload_step()
+{
+    PROFILE_SCOPE("Upload step");
+    for (Entity* entity : entity_list)
+        entity->upload_step();
+}
+
+void Application::capture(sRenderFrame& frame)
+{
+    frame.clear();
+    if (!frame.camera)
+        frame.camera = new Camera(*camera); // copy, so Camera::current is not changed
+    else
+        *frame.camera = *camera;
+    frame.grid = flag_grid;
+
+    for (Entity* entity : entity_list) {
+        entity->capture(frame);
+    }
+
+    // the models of the previous step, matched by position in the capture (the scene does not change often)
+    for (size_t i = 0; i < frame.items.size(); i++) {
+        sDrawItem& item = frame.items[i];
+        item.has_prev_model = i < last_step_models.size() && last_step_models[i].first == item.entity;
+        if (item.has_prev_model)
+            item.prev_model = last_step_models[i].second;
+    }
+    last_step_models.resize(frame.items.size());
+    for (size_t i = 0; i < frame.items.size(); i++)
+        last_step_models[i] = { frame.items[i].entity, frame.items[i].model };
+}
+
+void Application::update_entities_async(float dt)
+{
+    PROFILE_SCOPE("Entities async");
+
+    // grouped so the entities sharing a skeleton (and its pose cache) are in the same job, in the frame arena so the
+    // steps do not allocate (this runs in a worker in the pipelined mode, it uses the arena of that thread)
+    LinearArena& arena = FrameAllocator::get();
+    sArenaScope scope(arena);
+
+    struct sGroupEntry
+    {
+        const void* key; // the skeleton, or the entity itself when it does not share anything
+        size_t index;
+    };
+    size_t count = entity_list.size();
+    sGroupEntry* entries = arena.alloc_array<sGroupEntry>(count);
+    for (size_t i = 0; i < count; i++) {
+        SkinnedEntity* skinned = entity_list[i]->as<SkinnedEntity>();
+        entries[i].key = skinned && skinned->skeleton ? (const void*)skinned->skeleton : (const void*)entity_list[i];
+        entries[i].index = i;
+    }
+    std::sort(entries, entries + count, [](const sGroupEntry& a, const sGroupEntry& b) {
+        return a.key != b.key ? a.key < b.key : a.index < b.index;
+    });
+
+    size_t* group_starts = arena.alloc_array<size_t>(count + 1);
+    size_t num_groups = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i == 0 || entries[i].key != entries[i - 1].key)
+            group_starts[num_groups++] = i;
+    }
+    group_starts[num_groups] = count;
+
+    JobSystem::parallel_for(num_groups, 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            for (size_t j = group_starts[i]; j < group_starts[i + 1]; j++)
+                entity_list[entries[j].index]->update_async(dt);
+    });
+}
+
+void Application::update_scene(float dt)
+{
+    // sections of the scene around the camera, before the entities of this step are updated
+    if (scene)
+        scene->update(camera->eye);
+
+    // the rest of the update may upload to the GPU, in the main thread
     for (unsigned int i = 0; i < entity_list.size(); i++) {
+        PROFILE_SCOPE(entity_list[i]->name.c_str());
         entity_list[i]->update(dt);
     }
 
@@ -111,7 +234,9 @@ void Application::update(float dt)
     // the last two are related to quat
 
     // iterate entity_list and save directions
-    std::vector<vec3> directions;
+    sArenaScope scope(FrameAllocator::get());
+    tArenaVector<vec3> directions(ArenaAllocator<vec3>(FrameAllocator::get()));
+    directions.reserve(entity_list.size());
     for (Entity* entity : entity_list) {
         LineHelper* line_helper = entity->as<LineHelper>();
 
@@ -120,6 +245,10 @@ void Application::update(float dt)
         directions.push_back(line_helper->end); // line direction relative to its origin
     }
 
+    // the tasks below need the spheres and line helpers of the default scene
+    if (entity_list.size() < 2 || directions.size() < 4)
+        return;
+
     { // DOT PRODUCT TASK 
         vec3 color_xyz(1.f); // we cannot get it from the material since it can be 0, will be always black
 
@@ -149,8 +278,18 @@ void Application::update(float dt)
     }
 }
 
+// between the last two simulation steps, position and scale are lerped and the rotation nlerped
+static mat4 get_interpolated_model(const sDrawItem& item, float alpha)
+{
+    if (!item.has_prev_model || alpha >= 1.f || memcmp(&item.model, &item.prev_model, sizeof(mat4)) == 0)
+        return item.model;
+    return transform_to_mat4(mix(mat4_to_transform(item.prev_model), mat4_to_transform(item.model), alpha));
+}
+
 void Application::render()
 {
+    PROFILE_GPU_SCOPE("Application::render");
+
     // set the clear color (the background color)
     glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 
@@ -161,13 +300,123 @@ void Application::render()
     glEnable(GL_CULL_FACE); // render both sides of every triangle
     glEnable(GL_DEPTH_TEST); // check the occlusions using the Z buffer
 
-    for (unsigned int i = 0; i < entity_list.size(); i++)
-    {         
-        entity_list[i]->render(camera);        
+    // everything is drawn from the captured frame, in the pipelined mode the scene is being updated meanwhile
+    if (!render_frame) {
+        return;
+    }
+    sRenderFrame& frame = *render_frame;
+    Camera* frame_camera = frame.camera;
+
+    // camera matrices are uploaded once for all the draws of the frame
+    // with a fixed number of steps per frame the shader time follows the simulation, so the images are repeatable
+    float time = fixed_steps_per_frame > 0 ? (float)(num_steps_simulated * fixed_timestep) : (float)glfwGetTime();
+    UniformBlocks::begin_frame(frame_camera, time);
+    TextureStreamer::begin_frame(frame_camera, window_height);
+
+    // plain entities that share mesh and material are drawn together, the rest draw themselves
+    LinearArena& arena = FrameAllocator::get();
+    sArenaScope scope(arena);
+
+    struct sBatchedDraw
+    {
+        unsigned int permutation_id;
+        Mesh* mesh;
+        Material* material;
+        size_t order;
+        mat4 model;
+    };
+    sBatchedDraw* batched = arena.alloc_array<sBatchedDraw>(frame.items.size());
+    size_t num_batched = 0;
+
+    struct sSingleDraw
+    {
+        const sDrawItem* item;
+        unsigned int permutation_id;
+        size_t order;
+    };
+    sSingleDraw* singles = arena.alloc_array<sSingleDraw>(frame.items.size());
+    int num_singles = 0;
+
+    for (const sDrawItem& item : frame.items)
+    {
+        if (item.batchable) {
+            batched[num_batched] = { item.material->permutation_id, item.mesh, item.material, num_batched, get_interpolated_model(item, render_alpha) };
+            num_batched++;
+        }
+        else {
+            singles[num_singles] = { &item, item.custom ? 0u : item.material->permutation_id, (size_t)num_singles };
+            num_singles++;
+        }
+    }
+
+    // single draws sorted by shader permutation and mesh so the program changes as few times as possible, the custom
+    // draws keep the capture order after them
+    std::sort(singles, singles + num_singles, [](const sSingleDraw& a, const sSingleDraw& b) {
+        if (a.item->custom != b.item->custom) return b.item->custom;
+        if (!a.item->custom) {
+            if (a.permutation_id != b.permutation_id) return a.permutation_id < b.permutation_id;
+            if (a.item->mesh != b.item->mesh) return a.item->mesh < b.item->mesh;
+        }
+        return a.order < b.order;
+    });
+
+    // the object blocks of the single draws are uploaded together, every draw binds its slot
+    mat4* object_models = arena.alloc_array<mat4>(frame.items.size());
+    for (int i = 0; i < num_singles; i++)
+        object_models[i] = get_interpolated_model(*singles[i].item, render_alpha);
+    UniformBlocks::upload_frame_objects(object_models, num_singles);
+
+    for (int object_slot = 0; object_slot < num_singles; object_slot++)
+    {
+        const sDrawItem& item = *singles[object_slot].item;
+        PROFILE_GPU_SCOPE(item.entity->name.c_str());
+        if (item.custom) {
+            UniformBlocks::frame_object = object_slot;
+            item.entity->render(frame_camera);
+            UniformBlocks::frame_object = -1;
+            continue;
+        }
+        Uniforms uniforms;
+        uniforms.camera = frame_camera;
+        uniforms.model = object_models[object_slot];
+        uniforms.object_slot = object_slot;
+        if (item.palette_start >= 0) {
+            uniforms.animated_matrices = &frame.palettes[item.palette_start];
+            uniforms.num_animated_matrices = item.palette_size;
+        }
+        item.material->render(item.mesh, uniforms);
+    }
+
+    // sorted by shader permutation, mesh and material, every run is one batch (the models keep the capture order)
+    std::sort(batched, batched + num_batched, [](const sBatchedDraw& a, const sBatchedDraw& b) {
+        if (a.permutation_id != b.permutation_id) return a.permutation_id < b.permutation_id;
+        if (a.mesh != b.mesh) return a.mesh < b.mesh;
+        return a.material != b.material ? a.material < b.material : a.order < b.order;
+    });
+    mat4* models = arena.alloc_array<mat4>(num_batched);
+    for (size_t i = 0; i < num_batched; i++)
+        models[i] = batched[i].model;
+
+    for (size_t begin = 0, end = 0; begin < num_batched; begin = end)
+    {
+        end = begin + 1;
+        while (end < num_batched && batched[end].mesh == batched[begin].mesh && batched[end].material == batched[begin].material)
+            end++;
+
+        PROFILE_GPU_SCOPE("Multi draw batch");
+        Uniforms uniforms;
+        uniforms.camera = frame_camera;
+        batched[begin].material->render_multi_draw(batched[begin].mesh, models + begin, end - begin, uniforms);
     }
 
     // Draw the floor grid
-    if (flag_grid) draw_grid();
+    if (frame.grid) {
+        PROFILE_GPU_SCOPE("Grid");
+        draw_grid(frame_camera);
+    }
+
+    // mip levels for the next frame, from the requests of the draws
+    TextureStreamer::update();
 }
 
 void Application::render_gui()
@@ -179,6 +428,48 @@ void Application::render_gui()
             ImGui::TreePop();
         }
 
+        ImGui::Checkbox("Multi draw", &Material::use_multi_draw);
+        ImGui::SameLine();
+        ImGui::Checkbox("Indirect", &DrawBatch::use_indirect);
+        ImGui::Checkbox("Job system", &JobSystem::enabled);
+        ImGui::SameLine();
+        ImGui::Checkbox("Pipelined update", &flag_pipelined);
+        ImGui::SameLine();
+        ImGui::Text("(%d workers)", JobSystem::get_num_workers());
+        ImGui::Text("Frame arenas: %d, peak %.1f KB of %.1f KB", (int)FrameAllocator::get_num_arenas(),
+            FrameAllocator::get_peak_used() / 1024.0, FrameAllocator::get_capacity() / 1024.0);
+
+        if (ImGui::TreeNode("Simulation")) {
+            ImGui::Checkbox("Fixed timestep", &flag_fixed_timestep);
+            float rate = 1.f / fixed_timestep;
+            if (ImGui::DragFloat("Steps per second", &rate, 1.f, 10.f, 1000.f, "%.0f"))
+                fixed_timestep = 1.f / std::max(rate, 1.f);
+            ImGui::SliderInt("Max substeps", &max_substeps, 1, 32);
+            ImGui::SliderInt("Steps per frame", &fixed_steps_per_frame, 0, 64);
+            ImGui::Text("Steps: %llu  interpolation %.2f", num_steps_simulated, render_alpha);
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("Profiler")) {
+            Profiler::render_gui();
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("Texture streaming")) {
+            TextureStreamer::render_gui();
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("Resources")) {
+            ResourceManager::render_gui();
+            ImGui::TreePop();
+        }
+
+        if (scene && ImGui::TreeNode("Scene streaming")) {
+            scene->render_gui();
+            ImGui::TreePop();
+        }
+
         unsigned int count = 0;
         std::stringstream ss;
         for (auto& node : entity_list) {
@@ -193,7 +484,18 @@ void Application::render_gui()
     }
 }
 
-void Application::shut_down() { }
+void Application::shut_down()
+{
+    wait_update();
+    for (sRenderFrame& frame : render_frames) {
+        delete frame.camera;
+        frame.camera = nullptr;
+    }
+    render_frame = nullptr;
+
+    delete scene;
+    scene = nullptr;
+}
 
 // keycodes: https://www.glfw.org/docs/3.3/group__keys.html
 void Application::on_key_down(int key, int scancode)
@@ -6,6 +6,10 @@
 
 #include "camera.h"
 #include "framework/entity.h"
+#include "framework/render_frame.h"
+#include "framework/job_system.h"
+
+class Scene;
 
 class Application
 {
@@ -14,12 +18,31 @@ public:
 	
 	static Camera* camera;
 	std::vector<Entity*> entity_list;
+	Scene* scene = nullptr; // streams its sections into entity_list
 
 	int window_width;
 	int window_height;
 
 	bool flag_grid;
 	bool flag_wireframe;
+	bool flag_pipelined = false; // the update of the next frame runs in a worker while this one is rendered
+
+	// the simulation advances in fixed steps, the render interpolates the transforms between the last two
+	bool flag_fixed_timestep = true;
+	float fixed_timestep = 1.f / 60.f;
+	int max_substeps = 8; // per frame, the rest of a long frame is dropped instead of catching up
+	int fixed_steps_per_frame = 0; // >0 ignores the clock: this many steps every frame (deterministic, faster than real time)
+	float step_accumulator = 0.f; // time not simulated yet
+	float render_alpha = 1.f; // fraction of a step between the last two steps, for the interpolation
+	unsigned long long num_steps_simulated = 0;
+	std::vector<std::pair<Entity*, mat4>> last_step_models; // models of the last captured step, in capture order
+
+	// double buffered snapshot of the scene: render() draws render_frame while the pipelined update writes the other one
+	sRenderFrame render_frames[2];
+	sRenderFrame* render_frame = nullptr;
+	sRenderFrame* pending_frame = nullptr; // being written by the update job
+	float pending_dt = 0.f; // step of the update job
+	sJobCounter update_counter;
 
 	bool close = false;
 	bool orbiting;
@@ -28,7 +51,13 @@ public:
 	vec2 last_mouse_position;
 
 	void init(GLFWwindow* window);
-	void update(float dt);
+	void update(float dt); // frame time, runs the simulation steps due
+	void step(float dt, sRenderFrame& frame); // one simulation step in the calling thread
+	void update_entities_async(float dt); // CPU part of the entities, with the job system
+	void update_scene(float dt); // GL part of the entities, camera and scene logic (main thread)
+	void capture(sRenderFrame& frame);
+	void upload_step(); // GL uploads of the entities for the captured step (main thread, before it is drawn)
+	void wait_update(); // the scene can only be changed after this (events, GUI)
 	void render();
 	void render_gui();
 	void shut_down();
@@ -8,6 +8,8 @@
 #include <istream>
 #include <fstream>
 #include <algorithm>
+#include <typeinfo>
+#include <math.h>
 
 unsigned int Entity::name_id_counter = 0;
 
@@ -49,6 +51,42 @@ void Entity::render(Camera* camera)
 	}
 }
 
+void Entity::capture(sRenderFrame& frame)
+{
+	if (!flag_visible)
+		return;
+
+	if (material) {
+		sDrawItem item;
+		item.entity = this;
+		item.mesh = mesh;
+		item.material = material;
+		item.model = parent ? model * parent->model : model;
+		item.batchable = typeid(*this) == typeid(Entity) && !parent && children.empty() && material->can_multi_draw(mesh);
+		frame.items.push_back(item);
+	}
+
+	for (unsigned int i = 0; i < children.size(); i++) {
+		children[i]->capture(frame);
+	}
+}
+
+void Entity::capture_custom(sRenderFrame& frame, const mat4& model)
+{
+	sDrawItem item;
+	item.entity = this;
+	item.model = model;
+	item.custom = true;
+	frame.items.push_back(item);
+}
+
+void Entity::update_async(float dt)
+{
+	for (unsigned int i = 0; i < children.size(); i++) {
+		children[i]->update_async(dt);
+	}
+}
+
 void Entity::update(float dt)
 {
 	if (children.size() > 0) {
@@ -58,6 +96,13 @@ void Entity::update(float dt)
 	}
 }
 
+void Entity::upload_step()
+{
+	for (unsigned int i = 0; i < children.size(); i++) {
+		children[i]->upload_step();
+	}
+}
+
 void Entity::render_gui()
 {
 	ImGui::Checkbox("Visible", &flag_visible);
@@ -130,6 +175,12 @@ void Entity::set_transform(const Transform& t)
 	gui_rotation = quat_to_euler(transform.rotation);
 }
 
+void Entity::apply_root_motion(const Transform& delta)
+{
+	// the delta is applied as a child of the current transform, so it follows the facing of the entity
+	set_transform(combine(transform, delta));
+}
+
 void Entity::set_children(std::vector<Entity*> entities)
 {
 	for(unsigned int i = 0; i < entities.size(); i++) {
@@ -163,12 +214,22 @@ LineHelper::LineHelper(vec3 origin, vec3 end, const char* _name) : origin(origin
 	mesh->upload_to_vram();
 }
 
+LineHelper::~LineHelper()
+{
+	Mesh* lines = mesh;
+	mesh = nullptr;
+	delete lines;
+	delete helper_material;
+}
+
 void LineHelper::render(Camera* camera)
 {
-	WireframeMaterial mat = WireframeMaterial();
+	if (!helper_material)
+		helper_material = new WireframeMaterial();
+	WireframeMaterial& mat = *helper_material;
 	mat.color = vec4(color.x, color.y, color.z, color.w);
 	
-	if (flag_visible && mat.shader && mesh) {
+	if (flag_visible && mat.shader && mat.shader->compiled && mesh) {
 		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 		glDisable(GL_CULL_FACE);
 		glDisable(GL_DEPTH_TEST);
@@ -179,6 +240,7 @@ void LineHelper::render(Camera* camera)
 		Uniforms uniforms;
 		uniforms.camera = camera;
 		uniforms.model = model;
+		uniforms.object_slot = UniformBlocks::frame_object;
 
 		//upload material specific uniforms
 		mat.set_uniforms(uniforms);
@@ -192,6 +254,12 @@ void LineHelper::render(Camera* camera)
 	}
 }
 
+void LineHelper::capture(sRenderFrame& frame)
+{
+	// the line mesh is uploaded by update() in the main thread, it draws itself
+	capture_custom(frame, model);
+}
+
 void LineHelper::update(float dt)
 {
 	if (flag_update) {
@@ -225,7 +293,8 @@ SkeletonHelper::SkeletonHelper(Pose& current_pose, const char* _name) : Entity(_
 {
 	if (!(_name && *_name)) { name = "SkeletonHelper_" + std::to_string(name_id_counter); }
 	
-	pose = new Pose(current_pose);
+	owned_pose = new Pose(current_pose);
+	pose = owned_pose;
 	color = vec4(1.f);
 	flag_editable = true;
 	flag_apply_parent_transform = true;
@@ -286,23 +355,29 @@ SkeletonHelper::SkeletonHelper(Skeleton& skeleton, const char* _name) : Entity(_
 
 SkeletonHelper::~SkeletonHelper()
 {
-	if (pose) {
-		delete pose;
-		pose = nullptr;
-	}
+	// the lines mesh belongs to the helper, the pose only when it was copied
+	Mesh* lines = mesh;
+	mesh = nullptr;
+	delete lines;
+	delete owned_pose;
+	delete helper_material;
+}
+
+mat4 SkeletonHelper::get_render_model()
+{
+	return parent && flag_apply_parent_transform ? model * parent->get_model() : model;
 }
 
 void SkeletonHelper::render(Camera* camera)
 {
-	WireframeMaterial mat = WireframeMaterial();
+	if (!helper_material)
+		helper_material = new WireframeMaterial();
+	WireframeMaterial& mat = *helper_material;
 	mat.color = vec4(color.x, color.y, color.z, color.w);
 
-	mat4 model_mat = model;
-	if (parent && flag_apply_parent_transform) {
-		model_mat = model_mat * parent->get_model();
-	}
+	mat4 model_mat = get_render_model();
 
-	if (flag_visible && mat.shader && mesh)	{
+	if (flag_visible && mat.shader && mat.shader->compiled && mesh)	{
 		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 		glDisable(GL_CULL_FACE);
 		glDisable(GL_DEPTH_TEST);
@@ -313,6 +388,7 @@ void SkeletonHelper::render(Camera* camera)
 		Uniforms uniforms;
 		uniforms.camera = camera;
 		uniforms.model = model_mat;
+		uniforms.object_slot = UniformBlocks::frame_object;
 
 		//upload material specific uniforms
 		mat.set_uniforms(uniforms);
@@ -326,6 +402,11 @@ void SkeletonHelper::render(Camera* camera)
 	}
 }
 
+void SkeletonHelper::capture(sRenderFrame& frame)
+{
+	capture_custom(frame, get_render_model());
+}
+
 void SkeletonHelper::update(float dt) 
 {
 	if (pose) {
@@ -342,7 +423,8 @@ void SkeletonHelper::set_pose(Pose* current_pose, bool editable)
 	// create mesh from the skeleton
 	pose = current_pose;
 	flag_editable = editable;
-	mesh = new Mesh();
+	if (!mesh)
+		mesh = new Mesh(); // rebuilt by update(), it is not in the mesh cache
 	
 	update(0.f);
 }
@@ -399,11 +481,22 @@ void SkeletonHelper::render_gui_bone(unsigned int id, Pose& pose, Bone bone)
 	}
 }
 
+float SkinnedEntity::lod_screen_sizes[SkinnedEntity::LOD_CULLED] = { 0.25f, 0.1f, 0.f };
+float SkinnedEntity::lod_update_periods[SkinnedEntity::LOD_CULLED] = { 0.f, 1.f / 30.f, 1.f / 15.f };
+int SkinnedEntity::lod_skip_heights[SkinnedEntity::LOD_CULLED] = { -1, -1, 0 };
+int SkinnedEntity::lod_skipped_interval = 4;
+
 SkinnedEntity::SkinnedEntity(const char* _name) : Entity(_name)
 {
 	if (!(_name && *_name)) { name = "SkinnedEntity_" + std::to_string(name_id_counter); }
 	
 	flag_apply_bind_pose = false;
+
+	flag_animation_lod = true;
+	lod = LOD_FULL;
+	lod_screen_size = 1.f;
+	lod_time = -1.f;
+	lod_evaluations = 0;
 }
 
 void SkinnedEntity::render(Camera* camera)
@@ -433,18 +526,55 @@ void SkinnedEntity::render(Camera* camera)
 	}
 }
 
-void SkinnedEntity::update(float dt)
+void SkinnedEntity::capture(sRenderFrame& frame)
 {
-	if (children.size() > 0) {
+	if (flag_visible) {
+		if (material) {
+			sDrawItem item;
+			item.entity = this;
+			item.mesh = mesh;
+			item.material = material;
+			item.model = parent && flag_apply_parent_transform ? model * parent->get_model() : model;
+
+			// the skin matrices of this update, the next one may be writing pose_mat_joint_space while this frame is drawn
+			if (pose_mat_joint_space.size()) {
+				item.palette_start = (int)frame.palettes.size();
+				item.palette_size = (int)pose_mat_joint_space.size();
+				frame.palettes.insert(frame.palettes.end(), pose_mat_joint_space.begin(), pose_mat_joint_space.end());
+			}
+			frame.items.push_back(item);
+		}
+
 		for (unsigned int i = 0; i < children.size(); i++) {
-			children[i]->update(dt);
+			children[i]->capture(frame);
 		}
 	}
 
+	if (skeleton_helper) {
+		skeleton_helper->capture(frame);
+	}
+}
+
+void SkinnedEntity::update_async(float dt)
+{
+	Entity::update_async(dt);
+
+	// the pose evaluation only touches the skeleton of the entity, it runs in a worker thread
 	if (mesh && skeleton) {
-		Pose current_pose = skeleton->get_rest_pose();
+		// keep a reference so the pose cache is reused between frames (only edited joints are recomputed)
+		Pose* current_pose = &skeleton->get_rest_pose();
 		if (parent && parent->as<SkinnedEntity>()->flag_apply_bind_pose) {
-			current_pose = skeleton->get_bind_pose();
+			current_pose = &skeleton->get_bind_pose();
+		}
+
+		update_lod(Camera::current);
+
+		// Off-screen characters are not skinned at all
+		if (lod != LOD_CULLED) {
+			update_skinning(current_pose, dt);
+		}
+		else {
+			lod_time = -1.f;
 		}
 
 		// CPU Skinning
@@ -453,8 +583,24 @@ void SkinnedEntity::update(float dt)
 		// GPU Skinning
 		// ..
 	}
+}
+
+void SkinnedEntity::update(float dt)
+{
+	if (children.size() > 0) {
+		for (unsigned int i = 0; i < children.size(); i++) {
+			children[i]->update(dt);
+		}
+	}
+}
+
+void SkinnedEntity::upload_step()
+{
+	Entity::upload_step();
+
+	// the helper mesh is built from the pose of the step that was captured, so it matches the skin palette
 	if (skeleton_helper) {
-		skeleton_helper->update(dt);
+		skeleton_helper->update(0.f);
 	}
 }
 
@@ -462,6 +608,9 @@ void SkinnedEntity::render_gui()
 {
 	Entity::render_gui();
 
+	ImGui::Checkbox("Animation LOD", &flag_animation_lod);
+	ImGui::Text("LOD %d (screen size %.3f)", lod, lod_screen_size);
+
 	if (skeleton_helper) {
 		if (ImGui::Checkbox("Show bind pose", &flag_apply_bind_pose)) {
 			if (flag_apply_bind_pose) {
@@ -495,4 +644,167 @@ void SkinnedEntity::set_skeleton(const Pose& rest, const Pose& bind, const std::
 	for (unsigned int i = 0; i < children.size(); i++) {
 		children[i]->as<SkinnedEntity>()->skeleton = skeleton;
 	}
+}
+
+void SkinnedEntity::update_lod(Camera* camera)
+{
+	if (!flag_animation_lod || !camera || !mesh) {
+		lod = LOD_FULL;
+		lod_screen_size = 1.f;
+		return;
+	}
+
+	mat4 model_mat = model;
+	if (parent && flag_apply_parent_transform) {
+		model_mat = model * parent->get_model();
+	}
+
+	// bounding sphere in world space (the radius is scaled by the biggest axis of the model)
+	vec3 center = transform_point(model_mat, mesh->box.center);
+	float scale = std::max(len(vec3(model_mat.right.x, model_mat.right.y, model_mat.right.z)),
+		std::max(len(vec3(model_mat.up.x, model_mat.up.y, model_mat.up.z)), len(vec3(model_mat.forward.x, model_mat.forward.y, model_mat.forward.z))));
+	float radius = mesh->radius * scale;
+
+	// the camera up vector in world space is the second row of the view matrix
+	vec3 camera_up = vec3(camera->view_matrix.r1c0, camera->view_matrix.r1c1, camera->view_matrix.r1c2);
+
+	bool center_behind, top_behind;
+	vec3 projected_center = camera->project_vector(center, center_behind);
+	vec3 projected_top = camera->project_vector(center + camera_up * radius, top_behind);
+
+	// radius in NDC is the fraction of the screen height covered by the diameter
+	float dx = projected_top.x - projected_center.x;
+	float dy = projected_top.y - projected_center.y;
+	lod_screen_size = sqrtf(dx * dx + dy * dy);
+
+	bool outside = (center_behind && top_behind) ||
+		projected_center.x + lod_screen_size < -1.f || projected_center.x - lod_screen_size > 1.f ||
+		projected_center.y + lod_screen_size < -1.f || projected_center.y - lod_screen_size > 1.f;
+
+	if (outside) {
+		lod = LOD_CULLED;
+		return;
+	}
+
+	lod = LOD_LOW;
+	for (int i = 0; i < LOD_CULLED; i++) {
+		if (lod_screen_size >= lod_screen_sizes[i]) {
+			lod = i;
+			break;
+		}
+	}
+}
+
+void SkinnedEntity::update_skinning(Pose* current_pose, float dt)
+{
+	std::vector<mat4>& inv_bind_pose = skeleton->get_inv_bind_pose();
+	uint32_t generation = skeleton->get_generation();
+	unsigned int num_joints = current_pose->size();
+
+	// Full LOD: the pose is evaluated every frame (only the dirty joints are recomputed)
+	if (lod == LOD_FULL || num_joints == 0) {
+		pose_mat_joint_space = current_pose->get_skin_matrices(inv_bind_pose, generation);
+		lod_time = -1.f;
+		return;
+	}
+
+	if (lod_next_pose.size() != num_joints) {
+		lod_prev_pose = *current_pose;
+		lod_next_pose = *current_pose;
+		lod_pose = *current_pose;
+
+		// distance of every joint to its farthest leaf
+		joint_heights.assign(num_joints, 0);
+		for (unsigned int i = 0; i < num_joints; i++) {
+			int height = 0;
+			for (int p = current_pose->get_parent(i); p >= 0; p = current_pose->get_parent(p)) {
+				height++;
+				if (joint_heights[p] >= height) break;
+				joint_heights[p] = height;
+			}
+		}
+
+		lod_time = -1.f;
+	}
+
+	float period = lod_update_periods[lod];
+	int skip_height = lod_skip_heights[lod];
+
+	// the cached poses are stale after a full rate or culled period, start again from the current pose (the skipped
+	// joints too, lod_pose keeps them as they are until their next refresh)
+	if (lod_time < 0.f) {
+		for (unsigned int i = 0; i < num_joints; i++) {
+			lod_prev_pose.set_local_transform(i, current_pose->get_local_transform(i));
+			lod_next_pose.set_local_transform(i, current_pose->get_local_transform(i));
+			lod_pose.set_local_transform(i, current_pose->get_local_transform(i));
+		}
+		lod_time = 0.f;
+		lod_evaluations = 0;
+	}
+
+	// evaluate the pose at a reduced rate, leaf joints are only refreshed every few evaluations when far away
+	lod_time += dt;
+	if (lod_time >= period) {
+		bool refresh_skipped = ++lod_evaluations >= lod_skipped_interval;
+		if (refresh_skipped)
+			lod_evaluations = 0;
+		for (unsigned int i = 0; i < num_joints; i++) {
+			if (joint_heights[i] <= skip_height) {
+				if (refresh_skipped)
+					lod_pose.set_local_transform(i, current_pose->get_local_transform(i));
+				continue;
+			}
+			lod_prev_pose.set_local_transform(i, lod_next_pose.get_local_transform(i));
+			lod_next_pose.set_local_transform(i, current_pose->get_local_transform(i));
+		}
+		lod_time = 0.f;
+	}
+
+	// interpolate between the last two evaluations
+	float t = period > 0.f ? std::min(lod_time / period, 1.f) : 1.f;
+	for (unsigned int i = 0; i < num_joints; i++) {
+		if (joint_heights[i] <= skip_height) continue;
+		lod_pose.set_local_transform(i, mix(lod_prev_pose.get_local_transform(i), lod_next_pose.get_local_transform(i), t));
+	}
+
+	pose_mat_joint_space = lod_pose.get_skin_matrices(inv_bind_pose, generation);
+}
+
+TerrainEntity::TerrainEntity(Terrain* terrain, const char* name) : Entity(name)
+{
+	this->terrain = terrain;
+	color = vec4(0.6f, 0.55f, 0.45f, 1.f);
+}
+
+TerrainEntity::~TerrainEntity()
+{
+	delete terrain;
+}
+
+void TerrainEntity::render(Camera* camera)
+{
+	if (flag_visible && terrain) {
+		mat4 model_mat = parent ? model * parent->get_model() : model;
+		terrain->render(camera, model_mat, color);
+	}
+
+	// the object slot of the frame is the one of the terrain, the rest upload their own model
+	UniformBlocks::frame_object = -1;
+	Entity::render(camera);
+}
+
+void TerrainEntity::capture(sRenderFrame& frame)
+{
+	// the terrain selects its chunks with the camera of the frame when it is drawn
+	capture_custom(frame, parent ? model * parent->get_model() : model);
+}
+
+void TerrainEntity::render_gui()
+{
+	Entity::render_gui();
+
+	ImGui::ColorEdit3("Color", (float*)&color);
+	if (terrain) {
+		terrain->render_gui();
+	}
 }
\ No newline at end of file
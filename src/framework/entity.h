@@ -1,10 +1,12 @@
 #pragma once
 
 #include "camera.h"
+#include "render_frame.h"
 #include "framework/utils.h"
 #include "graphics/shader.h"
 #include "graphics/mesh.h"
 #include "graphics/material.h"
+#include "graphics/terrain.h"
 
 #include "math/vec3.h"
 #include "math/vec4.h"
@@ -34,7 +36,7 @@ public:
 		return dynamic_cast<ChildEntity*>(this);
 	}
 
-	Mesh* mesh = nullptr;
+	ResourceHandle<Mesh> mesh; // holds a reference, the mesh is not unloaded while an entity uses it
 	Material* material = nullptr;
 
 	Entity* parent = nullptr;
@@ -43,7 +45,14 @@ public:
 	Entity(const char* _name = nullptr);
 
 	virtual void render(Camera* camera);
+	// copies what render() would draw into the frame, the frame is rendered later (maybe while the next update runs)
+	virtual void capture(sRenderFrame& frame);
+	// CPU work of the update run by the job system after update(), in parallel with the other entities:
+	// no GL calls and no access to other entities than the children
+	virtual void update_async(float dt);
 	virtual void update(float dt);
+	// GL uploads of what update_async computed (main thread, after the capture and before that frame is drawn)
+	virtual void upload_step();
 	virtual void render_gui();
 
 	mat4 get_model();
@@ -51,9 +60,15 @@ public:
 
 	void set_model(const mat4& m);
 	void set_transform(const Transform& t);
+	// Moves the entity with a root motion delta (given in the space of the entity)
+	void apply_root_motion(const Transform& delta);
 	void set_children(std::vector<Entity*> children);
 
 	void set_color(const vec3& color);
+
+protected:
+	// the frame calls render() of the entity, the model is uploaded with the object blocks of the frame
+	void capture_custom(sRenderFrame& frame, const mat4& model);
 };
 
 class LineHelper : public Entity
@@ -66,10 +81,14 @@ public:
 
 	bool unlocked = true;
 
+	WireframeMaterial* helper_material = nullptr; // created with the first draw, not every frame
+
 	// (world position, relative position to the origin position, Entity name in the GUI)
 	LineHelper(vec3 origin, vec3 end, const char* name = nullptr);
+	~LineHelper(); // the lines mesh is its own
 
 	void render(Camera* camera);
+	void capture(sRenderFrame& frame);
 	void update(float dt);
 	void render_gui();
 };
@@ -88,16 +107,20 @@ public:
 	std::map<unsigned int, Bone> bones;
 
 	Pose* pose = nullptr;
+	Pose* owned_pose = nullptr; // the copy made by the Pose constructor, set_pose does not take ownership
+	WireframeMaterial* helper_material = nullptr; // created with the first draw, not every frame
 
 	SkeletonHelper(Pose& pose, const char* _name = nullptr);
 	SkeletonHelper(Skeleton& skeleton, const char* _name = nullptr);
 	~SkeletonHelper();
 
 	void render(Camera* camera);
+	void capture(sRenderFrame& frame);
 	void update(float dt);
 	void render_gui();
 
 	void set_pose(Pose* pose, bool editable = true);
+	mat4 get_render_model(); // with the parent transform when it is applied
 	void render_gui_bone(unsigned int id, Pose& pose, Bone bone);
 };
 
@@ -111,11 +134,49 @@ public:
 
 	std::vector<mat4> pose_mat_joint_space;
 
+	// Animation LOD: the level is chosen from the projected size of the mesh on the screen
+	enum { LOD_FULL, LOD_HALF_RATE, LOD_LOW, LOD_CULLED, NUM_LODS };
+	static float lod_screen_sizes[LOD_CULLED]; // minimum fraction of the screen height covered by the mesh to use each LOD
+	static float lod_update_periods[LOD_CULLED]; // seconds between pose evaluations (interpolated in between)
+	static int lod_skip_heights[LOD_CULLED]; // joints at this distance (or less) from a leaf are not animated, -1 animates all
+	static int lod_skipped_interval; // pose evaluations between the refreshes of the skipped joints (they jump, no blend)
+
+	bool flag_animation_lod;
+	int lod;
+	float lod_screen_size;
+	float lod_time; // time since the last pose evaluation (negative when the cached poses have to be reset)
+	int lod_evaluations; // since the last refresh of the skipped joints
+
+	Pose lod_prev_pose; // last two evaluated poses, blended while the next evaluation is due
+	Pose lod_next_pose;
+	Pose lod_pose;
+	std::vector<int> joint_heights; // distance of every joint to its farthest leaf (0 for leaves like fingers or face joints)
+
 	SkinnedEntity(const char* _name = nullptr);
 
 	void render(Camera* camera);
+	void capture(sRenderFrame& frame);
+	void update_async(float dt);
 	void update(float dt);
+	void upload_step();
 	void render_gui();
 
 	void set_skeleton(const Pose& rest, const Pose& bind, const std::vector<std::string>& names);
+
+	void update_lod(Camera* camera);
+	void update_skinning(Pose* current_pose, float dt);
+};
+
+class TerrainEntity : public Entity
+{
+public:
+	Terrain* terrain = nullptr; // owned, deleted with the entity
+	vec4 color;
+
+	TerrainEntity(Terrain* terrain, const char* name = nullptr);
+	~TerrainEntity();
+
+	void render(Camera* camera);
+	void capture(sRenderFrame& frame);
+	void render_gui();
 };
\ No newline at end of file
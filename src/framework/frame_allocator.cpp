@@ -0,0 +1,133 @@
+#include "frame_allocator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <mutex>
+
+LinearArena::LinearArena(size_t block_size)
+{
+	this->block_size = block_size;
+}
+
+LinearArena::~LinearArena()
+{
+	for (sBlock& block : blocks)
+		delete[] block.data;
+}
+
+void* LinearArena::alloc(size_t size, size_t alignment)
+{
+	assert(alignment && (alignment & (alignment - 1)) == 0 && "the alignment must be a power of two");
+
+	while (true)
+	{
+		if (current < blocks.size()) {
+			sBlock& block = blocks[current];
+			uintptr_t address = (uintptr_t)block.data + offset;
+			size_t padding = (alignment - (address & (alignment - 1))) & (alignment - 1);
+			if (offset + padding + size <= block.size) {
+				offset += padding + size;
+				return (void*)(address + padding);
+			}
+
+			// the next block if it was already allocated in another frame
+			if (current + 1 < blocks.size()) {
+				current++;
+				offset = 0;
+				continue;
+			}
+		}
+
+		// new block, the allocations bigger than a block get one of their exact size
+		size_t new_size = std::max(block_size, size + alignment);
+		blocks.push_back({ new uint8_t[new_size], new_size });
+		current = blocks.size() - 1;
+		offset = 0;
+	}
+}
+
+void LinearArena::free_to_marker(const sMarker& marker)
+{
+	assert((marker.block < current || (marker.block == current && marker.offset <= offset)) && "the marker is newer than the arena state");
+	// the peak is kept here instead of in every alloc, get_used() walks the blocks
+	peak_used = std::max(peak_used, get_used());
+	current = marker.block;
+	offset = marker.offset;
+}
+
+size_t LinearArena::get_used()
+{
+	size_t used = offset;
+	for (size_t i = 0; i < current && i < blocks.size(); i++)
+		used += blocks[i].size;
+	return used;
+}
+
+size_t LinearArena::get_capacity()
+{
+	size_t capacity = 0;
+	for (sBlock& block : blocks)
+		capacity += block.size;
+	return capacity;
+}
+
+static std::mutex s_arenas_mutex;
+static std::vector<LinearArena*> s_arenas;
+static size_t s_last_peak_used = 0;
+
+// registered while the thread lives, so the stats can be read from the main thread
+struct sThreadArena
+{
+	LinearArena arena;
+
+	sThreadArena()
+	{
+		std::lock_guard<std::mutex> lock(s_arenas_mutex);
+		s_arenas.push_back(&arena);
+	}
+
+	~sThreadArena()
+	{
+		std::lock_guard<std::mutex> lock(s_arenas_mutex);
+		s_arenas.erase(std::find(s_arenas.begin(), s_arenas.end(), &arena));
+	}
+};
+
+LinearArena& FrameAllocator::get()
+{
+	static thread_local sThreadArena thread_arena;
+	return thread_arena.arena;
+}
+
+void FrameAllocator::begin_frame()
+{
+	get().reset();
+
+	// no jobs are running at this point, the arenas of the workers can be read
+	std::lock_guard<std::mutex> lock(s_arenas_mutex);
+	s_last_peak_used = 0;
+	for (LinearArena* arena : s_arenas) {
+		s_last_peak_used = std::max(s_last_peak_used, arena->get_peak_used());
+		arena->peak_used = arena->get_used();
+	}
+}
+
+size_t FrameAllocator::get_num_arenas()
+{
+	std::lock_guard<std::mutex> lock(s_arenas_mutex);
+	return s_arenas.size();
+}
+
+size_t FrameAllocator::get_capacity()
+{
+	std::lock_guard<std::mutex> lock(s_arenas_mutex);
+	size_t capacity = 0;
+	for (LinearArena* arena : s_arenas)
+		capacity += arena->get_capacity();
+	return capacity;
+}
+
+size_t FrameAllocator::get_peak_used()
+{
+	return s_last_peak_used;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <type_traits>
+
+#define FRAME_ARENA_BLOCK_SIZE (1 << 20) // bytes, bigger allocations get a block of their own
+
+// Linear allocator: allocating is moving an offset and nothing is freed individually, the whole arena (or everything
+// allocated after a marker) is released at once. The blocks are kept, so once they have grown to the size of a frame
+// there are no more mallocs. Not thread safe, every thread uses its own (see FrameAllocator)
+class LinearArena
+{
+public:
+	struct sMarker
+	{
+		size_t block = 0;
+		size_t offset = 0;
+	};
+
+	LinearArena(size_t block_size = FRAME_ARENA_BLOCK_SIZE);
+	~LinearArena();
+	LinearArena(const LinearArena&) = delete;
+	LinearArena& operator=(const LinearArena&) = delete;
+
+	void* alloc(size_t size, size_t alignment = 16);
+	// uninitialized, only for types without destructor (they are never called)
+	template<typename T> T* alloc_array(size_t count)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "the arena does not call destructors");
+		return (T*)alloc(sizeof(T) * count, alignof(T) < 16 ? 16 : alignof(T));
+	}
+
+	sMarker get_marker() { return { current, offset }; }
+	void free_to_marker(const sMarker& marker); // releases everything allocated after the marker
+	void reset() { free_to_marker({}); }
+
+	size_t get_used(); // bytes, including the alignment padding
+	size_t get_capacity();
+	size_t get_peak_used() { size_t used = get_used(); return used > peak_used ? used : peak_used; }
+	size_t peak_used = 0; // updated when memory is released, get_peak_used() includes what is in use now
+
+protected:
+	struct sBlock
+	{
+		uint8_t* data;
+		size_t size;
+	};
+
+	std::vector<sBlock> blocks;
+	size_t block_size;
+	size_t current = 0; // block being filled
+	size_t offset = 0; // in the current block
+};
+
+// Releases what was allocated in the arena inside the scope
+struct sArenaScope
+{
+	LinearArena& arena;
+	LinearArena::sMarker marker;
+
+	sArenaScope(LinearArena& arena) : arena(arena), marker(arena.get_marker()) {}
+	~sArenaScope() { arena.free_to_marker(marker); }
+};
+
+// STL adaptor, the memory is only reclaimed when the arena is released (vectors should be reserved once)
+template<typename T>
+struct ArenaAllocator
+{
+	typedef T value_type;
+	LinearArena* arena;
+
+	ArenaAllocator(LinearArena& arena) : arena(&arena) {}
+	template<typename U> ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+	T* allocate(size_t count) { return (T*)arena->alloc(sizeof(T) * count, alignof(T) < 16 ? 16 : alignof(T)); }
+	void deallocate(T*, size_t) {}
+
+	template<typename U> bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+	template<typename U> bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+template<typename T> using tArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Arenas for the transient data of a frame: one per thread, so the workers of the job system do not contend on the
+// heap. The data must not outlive the frame: the main thread arena is reset at the start of every frame, in the jobs
+// the allocations go inside a sArenaScope (a job does not know when the next one of the same thread starts)
+class FrameAllocator
+{
+public:
+	static LinearArena& get(); // arena of the calling thread
+	static void begin_frame(); // main thread, resets its arena and updates the stats of all of them
+
+	static size_t get_num_arenas();
+	static size_t get_capacity(); // of all the arenas
+	static size_t get_peak_used(); // highest use of any arena in the last frame
+};
@@ -0,0 +1,251 @@
+#include "draw_batch.h"
+
+#include "mesh.h"
+#include "shader.h"
+#include "../utils.h"
+#include "../profiler.h"
+
+#include <cassert>
+#include <cstddef>
+
+bool DrawBatch::use_indirect = true;
+std::map<Mesh*, sMaterialTable*> DrawBatch::s_material_tables;
+
+bool DrawBatch::is_indirect_supported()
+{
+	// base instance is what lets every command read its own draw data
+	static int supported = -1;
+	if (supported == -1)
+		supported = glfwExtensionSupported("GL_ARB_multi_draw_indirect") && glfwExtensionSupported("GL_ARB_draw_indirect") &&
+			glfwExtensionSupported("GL_ARB_base_instance");
+	return supported == 1;
+}
+
+sMaterialTable* DrawBatch::get_material_table(Mesh* mesh)
+{
+	auto it = s_material_tables.find(mesh);
+	if (it != s_material_tables.end())
+		return it->second;
+
+	sMaterialTable* table = new sMaterialTable();
+
+	// entry 0 is for the draws without material (white, same as the uniforms of flat.fs)
+	sMaterialTableEntry white = { vec4(1.f), vec4(1.f), vec4(1.f) };
+	table->entries.push_back(white);
+
+	std::map<std::string, int> indices;
+	for (auto& material : mesh->materials)
+	{
+		if (table->entries.size() >= MAX_TABLE_MATERIALS) {
+			std::cerr << "Mesh " << mesh->name << " has more than " << MAX_TABLE_MATERIALS << " materials, the rest are drawn white" << std::endl;
+			break;
+		}
+		indices[material.first] = (int)table->entries.size();
+		table->entries.push_back({ vec4(material.second.Ka, 1.f), vec4(material.second.Kd, 1.f), vec4(material.second.Ks, 1.f) });
+	}
+
+	if (mesh->submeshes.empty())
+	{
+		table->draw_materials.push_back(0);
+		table->draw_starts.push_back(0);
+		table->draw_lengths.push_back(mesh->indices.size() ? mesh->indices.size() : mesh->get_num_vertices());
+	}
+
+	for (sSubmeshInfo& submesh : mesh->submeshes)
+	{
+		for (unsigned int j = 0; j < submesh.num_draw_calls; j++)
+		{
+			auto material = indices.find(submesh.draw_calls[j].material);
+			table->draw_materials.push_back(material != indices.end() ? material->second : 0);
+			table->draw_starts.push_back(submesh.draw_calls[j].start);
+			table->draw_lengths.push_back(submesh.draw_calls[j].length);
+		}
+	}
+
+	// the block is declared with all the entries, the buffer must cover it
+	table->buffer = new UniformBuffer();
+	table->buffer->create(MAX_TABLE_MATERIALS * sizeof(sMaterialTableEntry));
+	table->buffer->update(table->entries.data(), (unsigned int)(table->entries.size() * sizeof(sMaterialTableEntry)));
+
+	s_material_tables[mesh] = table;
+	return table;
+}
+
+void DrawBatch::forget(Mesh* mesh)
+{
+	auto it = s_material_tables.find(mesh);
+	if (it == s_material_tables.end())
+		return;
+
+	delete it->second->buffer;
+	delete it->second;
+	s_material_tables.erase(it);
+}
+
+DrawBatch::~DrawBatch()
+{
+	if (draw_buffer) glDeleteBuffers(1, &draw_buffer);
+	if (indirect_buffer) glDeleteBuffers(1, &indirect_buffer);
+}
+
+void DrawBatch::begin(Mesh* mesh)
+{
+	this->mesh = mesh;
+	models.clear();
+	if (mesh)
+		mesh->touch(); // drawn this frame, it is not unloaded
+}
+
+void DrawBatch::add(const mat4& model)
+{
+	models.push_back(model);
+}
+
+void DrawBatch::set_draw_attributes(Shader* shader, size_t first_draw)
+{
+	int model_location = shader->get_attribute_location("u_model");
+	int material_location = shader->get_attribute_location("a_draw_material");
+	size_t offset = first_draw * sizeof(sDrawData);
+
+	glBindVertexArray(mesh->interleaved_vao_id);
+	glBindBuffer(GL_ARRAY_BUFFER, draw_buffer);
+
+	//mat4 count as 4 different attributes of vec4
+	if (model_location != -1)
+	{
+		for (int k = 0; k < 4; ++k)
+		{
+			glEnableVertexAttribArray(model_location + k);
+			glVertexAttribPointer(model_location + k, 4, GL_FLOAT, false, sizeof(sDrawData), (void*)(offset + sizeof(vec4) * k));
+			glVertexAttribDivisor(model_location + k, 1);
+		}
+	}
+
+	if (material_location != -1)
+	{
+		glEnableVertexAttribArray(material_location);
+		glVertexAttribPointer(material_location, 1, GL_FLOAT, false, sizeof(sDrawData), (void*)(offset + offsetof(sDrawData, material)));
+		glVertexAttribDivisor(material_location, 1);
+	}
+}
+
+void DrawBatch::disable_draw_attributes(Shader* shader)
+{
+	int model_location = shader->get_attribute_location("u_model");
+	int material_location = shader->get_attribute_location("a_draw_material");
+
+	glBindVertexArray(mesh->interleaved_vao_id);
+	if (model_location != -1)
+	{
+		for (int k = 0; k < 4; ++k)
+		{
+			glDisableVertexAttribArray(model_location + k);
+			glVertexAttribDivisor(model_location + k, 0);
+		}
+	}
+	if (material_location != -1)
+	{
+		glDisableVertexAttribArray(material_location);
+		glVertexAttribDivisor(material_location, 0);
+	}
+	glBindVertexArray(0);
+}
+
+void DrawBatch::flush()
+{
+	num_gl_draw_calls = 0;
+	if (!mesh || models.empty())
+		return;
+
+	Shader* shader = Shader::current;
+	assert(shader && "shader must be enabled");
+	assert((mesh->indices.empty() || mesh->indices_vbo_id) && "indices must be uploaded to the GPU");
+
+	sMaterialTable* table = get_material_table(mesh);
+	size_t num_models = models.size();
+	size_t num_draws = table->draw_materials.size();
+
+	// draw data grouped by draw call, so the instances of a command are contiguous
+	draws.resize(num_draws * num_models);
+	for (size_t d = 0; d < num_draws; d++)
+	{
+		for (size_t m = 0; m < num_models; m++)
+		{
+			sDrawData& draw = draws[d * num_models + m];
+			draw.model = models[m];
+			draw.material = (float)table->draw_materials[d];
+		}
+	}
+
+	if (!draw_buffer)
+		glGenBuffers(1, &draw_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, draw_buffer);
+	glBufferData(GL_ARRAY_BUFFER, draws.size() * sizeof(sDrawData), draws.data(), GL_STREAM_DRAW);
+	Profiler::count_upload(draws.size() * sizeof(sDrawData));
+
+	table->buffer->bind(MATERIAL_TABLE_BINDING);
+
+	mesh->enable_buffers(shader);
+	bool indexed = !mesh->indices.empty();
+
+	if (use_indirect && is_indirect_supported())
+	{
+		// one command per submesh draw call, all of them in one call
+		if (!indirect_buffer)
+			glGenBuffers(1, &indirect_buffer);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+
+		element_commands.clear();
+		array_commands.clear();
+		for (size_t d = 0; d < num_draws; d++)
+		{
+			GLuint base_instance = (GLuint)(d * num_models);
+			if (indexed)
+				element_commands.push_back({ (GLuint)table->draw_lengths[d], (GLuint)num_models, (GLuint)table->draw_starts[d], 0, base_instance });
+			else
+				array_commands.push_back({ (GLuint)table->draw_lengths[d], (GLuint)num_models, (GLuint)table->draw_starts[d], base_instance });
+		}
+
+		set_draw_attributes(shader, 0);
+		if (indexed)
+		{
+			glBufferData(GL_DRAW_INDIRECT_BUFFER, element_commands.size() * sizeof(sDrawElementsIndirectCommand), element_commands.data(), GL_STREAM_DRAW);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->indices_vbo_id);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, (GLsizei)element_commands.size(), 0);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		}
+		else
+		{
+			glBufferData(GL_DRAW_INDIRECT_BUFFER, array_commands.size() * sizeof(sDrawArraysIndirectCommand), array_commands.data(), GL_STREAM_DRAW);
+			glMultiDrawArraysIndirect(GL_TRIANGLES, 0, (GLsizei)array_commands.size(), 0);
+		}
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		num_gl_draw_calls = 1;
+	}
+	else
+	{
+		// no base instance: the attributes are moved to the data of every draw call, still one draw for all the models
+		for (size_t d = 0; d < num_draws; d++)
+		{
+			set_draw_attributes(shader, d * num_models);
+			if (indexed)
+			{
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->indices_vbo_id);
+				glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)table->draw_lengths[d], GL_UNSIGNED_INT,
+					(void*)(table->draw_starts[d] * sizeof(unsigned int)), (GLsizei)num_models);
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+			}
+			else
+				glDrawArraysInstanced(GL_TRIANGLES, (GLint)table->draw_starts[d], (GLsizei)table->draw_lengths[d], (GLsizei)num_models);
+		}
+		num_gl_draw_calls = (unsigned int)num_draws;
+	}
+
+	disable_draw_attributes(shader);
+	mesh->disable_buffers(shader);
+
+	Mesh::num_meshes_rendered += num_gl_draw_calls;
+	Mesh::num_triangles_rendered += (long)(num_models * (indexed ? mesh->indices.size() : mesh->get_num_vertices()) / 3);
+
+	assert(check_gl_errors());
+}
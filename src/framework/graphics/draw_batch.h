@@ -0,0 +1,84 @@
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include "framework/includes.h"
+#include "uniform_buffer.h"
+#include "../math/mat4.h"
+
+class Mesh;
+class Shader;
+
+// Data of every draw, read by the MULTI_DRAW shaders as instanced attributes (u_model and a_draw_material)
+struct sDrawData
+{
+	mat4 model;
+	float material;
+};
+
+// Layouts of the commands of glMultiDrawElementsIndirect and glMultiDrawArraysIndirect
+struct sDrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instance_count;
+	GLuint first_index;
+	GLuint base_vertex;
+	GLuint base_instance;
+};
+
+struct sDrawArraysIndirectCommand
+{
+	GLuint count;
+	GLuint instance_count;
+	GLuint first;
+	GLuint base_instance;
+};
+
+// Materials of the submeshes of a mesh in a uniform buffer, and the index of the material of every submesh draw call
+struct sMaterialTable
+{
+	UniformBuffer* buffer = NULL;
+	std::vector<sMaterialTableEntry> entries;
+	std::vector<int> draw_materials; // one per draw call of the mesh (submesh after submesh)
+	std::vector<size_t> draw_starts;
+	std::vector<size_t> draw_lengths;
+};
+
+// Draws all the submeshes of one mesh for many models at once. The draw data is stored grouped by submesh draw call
+// (all the models of the first draw call, then the second one...), so every draw call is a single instanced command whose
+// base instance points to its data. With GL_ARB_multi_draw_indirect the whole batch is one glMultiDraw*Indirect;
+// without it (GL 3.3 has no base instance) every command is an instanced draw with the per draw attributes moved to its data
+class DrawBatch
+{
+public:
+	static bool use_indirect;
+	static std::map<Mesh*, sMaterialTable*> s_material_tables;
+
+	static bool is_indirect_supported();
+	// built the first time a mesh is batched (the materials of a mesh do not change after loading)
+	static sMaterialTable* get_material_table(Mesh* mesh);
+	// deletes the table of a mesh being deleted, so a mesh allocated later at the same address does not get it
+	static void forget(Mesh* mesh);
+
+	Mesh* mesh = NULL;
+	std::vector<mat4> models;
+	std::vector<sDrawData> draws;
+	std::vector<sDrawElementsIndirectCommand> element_commands;
+	std::vector<sDrawArraysIndirectCommand> array_commands;
+
+	GLuint draw_buffer = 0;
+	GLuint indirect_buffer = 0;
+	unsigned int num_gl_draw_calls = 0; // issued by the last flush
+
+	~DrawBatch();
+
+	void begin(Mesh* mesh);
+	void add(const mat4& model);
+	// draws everything with the shader enabled (a MULTI_DRAW permutation)
+	void flush();
+
+protected:
+	void set_draw_attributes(Shader* shader, size_t first_draw);
+	void disable_draw_attributes(Shader* shader);
+};
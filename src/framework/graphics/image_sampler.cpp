@@ -0,0 +1,262 @@
+#include "image_sampler.h"
+
+#include "../job_system.h"
+
+#include <cmath>
+#include <climits>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGE_SAMPLER_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef IMAGE_SAMPLER_SSE2
+// low 32 bits of the products (SSE2 only multiplies the even lanes, to 64 bits)
+static inline __m128i mullo_epi32(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+// v clamped to [0, max] (there is no min/max of ints before SSE4.1)
+static inline __m128i clamp_epi32(__m128i v, __m128i max)
+{
+	v = _mm_and_si128(v, _mm_cmpgt_epi32(v, _mm_setzero_si128()));
+	__m128i over = _mm_cmpgt_epi32(v, max);
+	return _mm_or_si128(_mm_and_si128(over, max), _mm_andnot_si128(over, v));
+}
+
+// v modulo size (positive), exact while v fits in the mantissa of a float
+static inline __m128i repeat_epi32(__m128i v, int size)
+{
+	__m128i vsize = _mm_set1_epi32(size);
+	__m128i q = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(1.f / size)));
+	__m128i r = _mm_sub_epi32(v, mullo_epi32(q, vsize));
+	// the quotient can be one off after the rounding of the division and the truncation of the negatives
+	r = _mm_add_epi32(r, _mm_and_si128(_mm_cmplt_epi32(r, _mm_setzero_si128()), vsize));
+	r = _mm_sub_epi32(r, _mm_andnot_si128(_mm_cmplt_epi32(r, vsize), vsize));
+	return r;
+}
+#endif
+
+int ImageSampler::min_samples_per_job = 16384;
+
+static_assert(sizeof(vec2) == 2 * sizeof(float), "uvs are read as pairs of floats");
+
+template<typename T>
+struct sSampleSource
+{
+	const T* data;
+	int width;
+	int height;
+	int channels;
+	int channel;
+	bool repeat;
+	float scale;
+
+	inline int wrap_x(int x) const {
+		if (repeat) { x %= width; return x < 0 ? x + width : x; }
+		return std::clamp(x, 0, width - 1);
+	}
+	inline int wrap_y(int y) const {
+		if (repeat) { y %= height; return y < 0 ? y + height : y; }
+		return std::clamp(y, 0, height - 1);
+	}
+	inline float fetch(int x, int y) const {
+		return data[((size_t)wrap_y(y) * width + wrap_x(x)) * channels + channel] * scale;
+	}
+
+#ifdef IMAGE_SAMPLER_SSE2
+	// the addresses of four texels are computed at once, only the loads are one by one (there is no gather in SSE2).
+	// The offsets are 32 bits, bigger images use fetch()
+	bool can_gather() const { return (size_t)width * height * channels <= INT_MAX; }
+	inline __m128i row_offsets(__m128i y) const {
+		y = repeat ? repeat_epi32(y, height) : clamp_epi32(y, _mm_set1_epi32(height - 1));
+		return mullo_epi32(y, _mm_set1_epi32(width * channels));
+	}
+	inline __m128i column_offsets(__m128i x) const {
+		x = repeat ? repeat_epi32(x, width) : clamp_epi32(x, _mm_set1_epi32(width - 1));
+		return _mm_add_epi32(mullo_epi32(x, _mm_set1_epi32(channels)), _mm_set1_epi32(channel));
+	}
+	inline __m128 gather(__m128i rows, __m128i columns) const {
+		alignas(16) int index[4];
+		_mm_store_si128((__m128i*)index, _mm_add_epi32(rows, columns));
+		__m128 texels = _mm_setr_ps((float)data[index[0]], (float)data[index[1]], (float)data[index[2]], (float)data[index[3]]);
+		return _mm_mul_ps(texels, _mm_set1_ps(scale));
+	}
+#endif
+};
+
+// Catmull-Rom weights of the four taps around t (0..1)
+static inline void cubic_weights(float t, float* w)
+{
+	w[0] = t * (-0.5f + t * (1.f - 0.5f * t));
+	w[1] = 1.f + t * t * (-2.5f + 1.5f * t);
+	w[2] = t * (0.5f + t * (2.f - 1.5f * t));
+	w[3] = t * t * (-0.5f + 0.5f * t);
+}
+
+#ifdef IMAGE_SAMPLER_SSE2
+// same weights for four fractions
+static inline void cubic_weights(__m128 t, __m128* w)
+{
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128 one = _mm_set1_ps(1.f);
+	__m128 t2 = _mm_mul_ps(t, t);
+	w[0] = _mm_mul_ps(t, _mm_add_ps(_mm_set1_ps(-0.5f), _mm_mul_ps(t, _mm_sub_ps(one, _mm_mul_ps(half, t)))));
+	w[1] = _mm_add_ps(one, _mm_mul_ps(t2, _mm_add_ps(_mm_set1_ps(-2.5f), _mm_mul_ps(_mm_set1_ps(1.5f), t))));
+	w[2] = _mm_mul_ps(t, _mm_add_ps(half, _mm_mul_ps(t, _mm_sub_ps(_mm_set1_ps(2.f), _mm_mul_ps(_mm_set1_ps(1.5f), t)))));
+	w[3] = _mm_mul_ps(t2, _mm_add_ps(_mm_set1_ps(-0.5f), _mm_mul_ps(half, t)));
+}
+#endif
+
+#ifdef IMAGE_SAMPLER_SSE2
+// texel coordinates of four uvs, split in integer part (floor) and fraction
+static inline void texel_coords(const vec2* uvs, __m128 width, __m128 height, __m128i& ix, __m128i& iy, __m128& fx, __m128& fy)
+{
+	__m128 a = _mm_loadu_ps(&uvs[0].x);
+	__m128 b = _mm_loadu_ps(&uvs[2].x);
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128 x = _mm_sub_ps(_mm_mul_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), width), half);
+	__m128 y = _mm_sub_ps(_mm_mul_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)), height), half);
+
+	// truncation rounds towards zero, the negative values are moved one down
+	ix = _mm_cvttps_epi32(x);
+	iy = _mm_cvttps_epi32(y);
+	ix = _mm_add_epi32(ix, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(ix), x)));
+	iy = _mm_add_epi32(iy, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(iy), y)));
+	fx = _mm_sub_ps(x, _mm_cvtepi32_ps(ix));
+	fy = _mm_sub_ps(y, _mm_cvtepi32_ps(iy));
+}
+#endif
+
+template<typename T>
+static void sample_bilinear(const sSampleSource<T>& src, const vec2* uvs, int begin, int end, float* out)
+{
+	int i = begin;
+
+#ifdef IMAGE_SAMPLER_SSE2
+	__m128 width = _mm_set1_ps((float)src.width);
+	__m128 height = _mm_set1_ps((float)src.height);
+	__m128i one = _mm_set1_epi32(1);
+
+	for (; i + 4 <= end && src.can_gather(); i += 4)
+	{
+		__m128i ix, iy;
+		__m128 fx, fy;
+		texel_coords(uvs + i, width, height, ix, iy, fx, fy);
+
+		__m128i x0 = src.column_offsets(ix), x1 = src.column_offsets(_mm_add_epi32(ix, one));
+		__m128i y0 = src.row_offsets(iy), y1 = src.row_offsets(_mm_add_epi32(iy, one));
+		__m128 top = src.gather(y0, x0);
+		__m128 bottom = src.gather(y1, x0);
+		top = _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(src.gather(y0, x1), top), fx));
+		bottom = _mm_add_ps(bottom, _mm_mul_ps(_mm_sub_ps(src.gather(y1, x1), bottom), fx));
+		_mm_storeu_ps(out + i, _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), fy)));
+	}
+#endif
+
+	for (; i < end; i++)
+	{
+		float x = uvs[i].x * src.width - 0.5f;
+		float y = uvs[i].y * src.height - 0.5f;
+		int x0 = (int)floorf(x);
+		int y0 = (int)floorf(y);
+		float fx = x - x0;
+		float fy = y - y0;
+
+		float top = src.fetch(x0, y0) + (src.fetch(x0 + 1, y0) - src.fetch(x0, y0)) * fx;
+		float bottom = src.fetch(x0, y0 + 1) + (src.fetch(x0 + 1, y0 + 1) - src.fetch(x0, y0 + 1)) * fx;
+		out[i] = top + (bottom - top) * fy;
+	}
+}
+
+template<typename T>
+static void sample_bicubic(const sSampleSource<T>& src, const vec2* uvs, int begin, int end, float* out)
+{
+	int i = begin;
+
+#ifdef IMAGE_SAMPLER_SSE2
+	__m128 width = _mm_set1_ps((float)src.width);
+	__m128 height = _mm_set1_ps((float)src.height);
+
+	for (; i + 4 <= end && src.can_gather(); i += 4)
+	{
+		__m128i ix, iy;
+		__m128 fx, fy;
+		texel_coords(uvs + i, width, height, ix, iy, fx, fy);
+
+		__m128 wx[4], wy[4];
+		cubic_weights(fx, wx);
+		cubic_weights(fy, wy);
+
+		__m128i columns[4];
+		for (int column = 0; column < 4; column++)
+			columns[column] = src.column_offsets(_mm_add_epi32(ix, _mm_set1_epi32(column - 1)));
+
+		__m128 result = _mm_setzero_ps();
+		for (int row = 0; row < 4; row++)
+		{
+			__m128i rows = src.row_offsets(_mm_add_epi32(iy, _mm_set1_epi32(row - 1)));
+			__m128 line = _mm_setzero_ps();
+			for (int column = 0; column < 4; column++)
+				line = _mm_add_ps(line, _mm_mul_ps(src.gather(rows, columns[column]), wx[column]));
+			result = _mm_add_ps(result, _mm_mul_ps(line, wy[row]));
+		}
+		_mm_storeu_ps(out + i, result);
+	}
+#endif
+
+	for (; i < end; i++)
+	{
+		float x = uvs[i].x * src.width - 0.5f;
+		float y = uvs[i].y * src.height - 0.5f;
+		int x0 = (int)floorf(x);
+		int y0 = (int)floorf(y);
+
+		float wx[4], wy[4];
+		cubic_weights(x - x0, wx);
+		cubic_weights(y - y0, wy);
+
+		float result = 0.f;
+		for (int row = 0; row < 4; row++)
+		{
+			float line = 0.f;
+			for (int column = 0; column < 4; column++)
+				line += src.fetch(x0 + column - 1, y0 + row - 1) * wx[column];
+			result += line * wy[row];
+		}
+		out[i] = result;
+	}
+}
+
+// big batches are split in ranges (multiple of four samples) run by the job system workers
+template<typename T>
+static void sample_batch(const sSampleSource<T>& src, const vec2* uvs, int num, float* out, int filter)
+{
+	auto run = [&](size_t begin, size_t end) {
+		if (filter == ImageSampler::FILTER_BICUBIC)
+			sample_bicubic(src, uvs, (int)begin, (int)end, out);
+		else
+			sample_bilinear(src, uvs, (int)begin, (int)end, out);
+	};
+
+	size_t batch_size = (size_t)(std::max(ImageSampler::min_samples_per_job, 4) + 3) & ~(size_t)3;
+	JobSystem::parallel_for((size_t)std::max(num, 0), batch_size, run);
+}
+
+void ImageSampler::sample(const uint8_t* data, int width, int height, int channels, int channel,
+	const vec2* uvs, int num, float* out, int filter, bool repeat)
+{
+	sSampleSource<uint8_t> src = { data, width, height, channels, channel, repeat, 1.f / 255.f };
+	sample_batch(src, uvs, num, out, filter);
+}
+
+void ImageSampler::sample(const float* data, int width, int height, int channels, int channel,
+	const vec2* uvs, int num, float* out, int filter, bool repeat)
+{
+	sSampleSource<float> src = { data, width, height, channels, channel, repeat, 1.f };
+	sample_batch(src, uvs, num, out, filter);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include "../math/vec2.h"
+
+// Batched sampling of one channel of an image at an array of UVs (0..1, texel centers at (i + 0.5) / size).
+// The coordinates, texel addresses and weights of four samples are computed at once (SSE2, scalar fallback) and big
+// batches are split in jobs (JobSystem), so displacing a mesh of a million vertices is not a loop of get_pixel_interpolated.
+// Byte images return values normalized to 0..1, float images return the stored values
+class ImageSampler
+{
+public:
+	enum { FILTER_BILINEAR, FILTER_BICUBIC };
+
+	static int min_samples_per_job; // smaller batches are sampled in the calling thread, bigger ones in jobs of this size
+
+	static void sample(const uint8_t* data, int width, int height, int channels, int channel,
+		const vec2* uvs, int num, float* out, int filter = FILTER_BILINEAR, bool repeat = false);
+	static void sample(const float* data, int width, int height, int channels, int channel,
+		const vec2* uvs, int num, float* out, int filter = FILTER_BILINEAR, bool repeat = false);
+};
@@ -1,17 +1,99 @@
 #include "material.h"
 
 #include "framework/application.h"
+#include "texture_streamer.h"
+#include "draw_batch.h"
 
 #include <istream>
 #include <fstream>
 #include <algorithm>
+#include <cassert>
 
 #include "../math/vec3.h"
 
+bool Material::use_multi_draw = true;
+
+Material::~Material()
+{
+	delete block_buffer;
+}
+
+void Material::set_program(const char* name, unsigned int features)
+{
+	ShaderPermutations::init();
+	program = ShaderPermutations::get_program(name);
+	assert(program != -1 && "shader program not registered");
+	set_features(features);
+}
+
+void Material::set_features(unsigned int features)
+{
+	this->features = features;
+	permutation_id = ShaderPermutations::get_permutation_id(program, features);
+	shader = ShaderPermutations::get(permutation_id);
+}
+
+void Material::set_scene_uniforms(Uniforms& uniforms)
+{
+	// the frame block is uploaded once per frame, only the objects change per draw
+	if (shader->has_uniform_block(FRAME_BLOCK_BINDING)) {
+		UniformBlocks::use_camera(uniforms.camera);
+	}
+	else {
+		shader->set_uniform(Shader::UNIFORM_VIEWPROJECTION, uniforms.camera->viewprojection_matrix);
+		shader->set_uniform(Shader::UNIFORM_CAMERA_POSITION, uniforms.camera->eye);
+	}
+
+	if (shader->has_uniform_block(OBJECT_BLOCK_BINDING)) {
+		if (uniforms.object_slot >= 0)
+			UniformBlocks::bind_frame_object(uniforms.object_slot);
+		else
+			UniformBlocks::set_object(uniforms.model);
+	}
+	else {
+		shader->set_uniform(Shader::UNIFORM_MODEL, uniforms.model);
+	}
+
+	if (uniforms.num_animated_matrices) {
+		shader->set_uniform(Shader::UNIFORM_ANIMATED, uniforms.animated_matrices, uniforms.num_animated_matrices);
+	}
+
+	if ((features & SHADER_BAKED_ANIMATION) && uniforms.animation_texture) {
+		shader->set_uniform(Shader::UNIFORM_ANIMATION_TEXTURE, uniforms.animation_texture, 2);
+		shader->set_uniform(Shader::UNIFORM_ANIMATION_FRAME, uniforms.animation_frame);
+	}
+}
+
+void Material::bind_material_block(float metallic, float roughness)
+{
+	bool changed = !block_buffer || block.color.x != color.x || block.color.y != color.y || block.color.z != color.z || block.color.w != color.w ||
+		block.metallic != metallic || block.roughness != roughness;
+
+	if (!block_buffer) {
+		block_buffer = new UniformBuffer();
+		block_buffer->create(sizeof(sMaterialBlock));
+	}
+
+	if (changed) {
+		block.color = color;
+		block.metallic = metallic;
+		block.roughness = roughness;
+		block_buffer->update(&block, sizeof(sMaterialBlock));
+	}
+
+	block_buffer->bind(MATERIAL_BLOCK_BINDING);
+}
+
+void Material::request_textures(Mesh* mesh, Uniforms& uniforms)
+{
+	if (texture) TextureStreamer::request(texture, mesh, uniforms.model);
+	if (normal_texture) TextureStreamer::request(normal_texture, mesh, uniforms.model);
+}
+
 FlatMaterial::FlatMaterial(vec4 color)
 {
 	this->color = color;
-	shader = Shader::get("res/shaders/basic.vs", "res/shaders/flat.fs");
+	set_program("flat");
 }
 
 FlatMaterial::~FlatMaterial() { }
@@ -19,22 +101,38 @@ FlatMaterial::~FlatMaterial() { }
 void FlatMaterial::set_uniforms(Uniforms& uniforms)
 {
 	//upload node uniforms
-	shader->set_uniform("u_viewprojection", uniforms.camera->viewprojection_matrix);
-	shader->set_uniform("u_camera_position", uniforms.camera->eye);
-	shader->set_uniform("u_model", uniforms.model);
-	if (uniforms.animated_matrices.size()) {
-		shader->set_uniform("u_animated", uniforms.animated_matrices);
+	set_scene_uniforms(uniforms);
+
+	if (shader->has_uniform_block(MATERIAL_BLOCK_BINDING)) {
+		bind_material_block();
+	}
+	else {
+		shader->set_uniform(Shader::UNIFORM_COLOR, color);
 	}
-	shader->set_uniform("u_color", color);
+
+	if ((features & SHADER_TEXTURED) && texture) shader->set_uniform(Shader::UNIFORM_TEXTURE, texture, 0);
+	if ((features & SHADER_NORMAL_MAPPED) && normal_texture) shader->set_uniform(Shader::UNIFORM_NORMAL_TEXTURE, normal_texture, 1);
+
+	// Mesh::render sets the diffuse of every submesh, meshes without materials are not tinted by the previous one
+	shader->set_uniform(Shader::UNIFORM_KD, vec3(1.f));
 }
 
 void FlatMaterial::render(Mesh* mesh, Uniforms& uniforms)
 {
-	if (mesh && shader) {
+	// one draw for all the submesh materials
+	if (mesh && mesh->materials.size() > 1 && can_multi_draw(mesh)) {
+		mat4 model = uniforms.model;
+		render_multi_draw(mesh, &model, 1, uniforms);
+		return;
+	}
+
+	// the shader can still be compiling in background
+	if (mesh && shader && shader->compiled) {
 		// enable shader
 		shader->enable();
 		
 		// upload uniforms
+		request_textures(mesh, uniforms);
 		set_uniforms(uniforms);
 
 		// do the draw call
@@ -44,6 +142,44 @@ void FlatMaterial::render(Mesh* mesh, Uniforms& uniforms)
 	}
 }
 
+bool FlatMaterial::can_multi_draw(Mesh* mesh)
+{
+	// only the flat program reads the material table, and the skinned and instanced models come from elsewhere
+	static int flat_program = ShaderPermutations::get_program("flat");
+	return use_multi_draw && mesh && mesh->interleaved_vao_id && (mesh->indices.empty() || mesh->indices_vbo_id) && program == flat_program &&
+		!(features & (SHADER_SKINNED | SHADER_INSTANCED | SHADER_BAKED_ANIMATION));
+}
+
+void FlatMaterial::render_multi_draw(Mesh* mesh, const mat4* models, size_t num_models, Uniforms& uniforms)
+{
+	// never deleted, its buffers belong to the GL context
+	static DrawBatch* batch = new DrawBatch();
+
+	// the shader can still be compiling in background
+	Shader* multi_draw_shader = ShaderPermutations::get(program, features | SHADER_MULTI_DRAW);
+	if (!mesh || !num_models || !multi_draw_shader || !multi_draw_shader->compiled)
+		return;
+
+	// the uniforms go to the multi draw permutation, the model of every draw goes to the batch
+	Shader* material_shader = shader;
+	shader = multi_draw_shader;
+	shader->enable();
+
+	for (size_t i = 0; i < num_models; i++) {
+		uniforms.model = models[i];
+		request_textures(mesh, uniforms);
+	}
+	set_uniforms(uniforms);
+
+	batch->begin(mesh);
+	for (size_t i = 0; i < num_models; i++)
+		batch->add(models[i]);
+	batch->flush();
+
+	shader->disable();
+	shader = material_shader;
+}
+
 void FlatMaterial::render_gui()
 {
 	ImGui::ColorEdit3("Color", (float*)&color);
@@ -51,7 +187,7 @@ void FlatMaterial::render_gui()
 
 NormalMaterial::NormalMaterial()
 {
-	shader = Shader::get("res/shaders/basic.vs", "res/shaders/normal.fs");
+	set_program("normal");
 }
 
 void NormalMaterial::render_gui() { }
@@ -61,39 +197,44 @@ PBRMaterial::PBRMaterial()
 	metallic = 1.f;
 	roughness = 1.f;
 
-	shader = Shader::get("res/shaders/basic.vs", "res/shaders/texture.fs");
+	set_program("texture", SHADER_TEXTURED);
 }
 
 void PBRMaterial::set_uniforms(Uniforms& uniforms)
 {
 	//upload node uniforms
-	shader->set_uniform("u_viewprojection", uniforms.camera->viewprojection_matrix);
-	shader->set_uniform("u_camera_position", uniforms.camera->eye);
-	shader->set_uniform("u_model", uniforms.model);
+	set_scene_uniforms(uniforms);
 
-	if (uniforms.animated_matrices.size()) {
-		shader->set_uniform("u_animated", uniforms.animated_matrices);
+	if (shader->has_uniform_block(MATERIAL_BLOCK_BINDING)) {
+		bind_material_block(metallic, roughness);
 	}
 
-	if (albedo_tex) shader->set_uniform("u_texture", albedo_tex, 0);
+	if (albedo_tex) shader->set_uniform(Shader::UNIFORM_TEXTURE, albedo_tex, 0);
 	//if (normal_tex) shader->set_uniform("u_normal_tex", normal_tex, 1);
 	//if (met_rou_tex) shader->set_uniform("u_met_rou_tex", met_rou_tex, 2);
 }
 
+void PBRMaterial::request_textures(Mesh* mesh, Uniforms& uniforms)
+{
+	if (albedo_tex) TextureStreamer::request(albedo_tex, mesh, uniforms.model);
+	if (normal_tex) TextureStreamer::request(normal_tex, mesh, uniforms.model);
+	if (met_rou_tex) TextureStreamer::request(met_rou_tex, mesh, uniforms.model);
+}
+
 void PBRMaterial::render_gui() { }
 
 WireframeMaterial::WireframeMaterial()
 {
 	color = vec4(1.f);
 
-	shader = Shader::get("res/shaders/basic.vs", "res/shaders/flat.fs");
+	set_program("flat");
 }
 
 WireframeMaterial::~WireframeMaterial() { }
 
 void WireframeMaterial::render(Mesh* mesh, Uniforms& uniforms)
 {
-	if (shader && mesh)
+	if (shader && shader->compiled && mesh)
 	{
 		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 		glDisable(GL_CULL_FACE);
@@ -4,6 +4,8 @@
 #include "mesh.h"
 #include "texture.h"
 #include "shader.h"
+#include "uniform_buffer.h"
+#include "shader_permutations.h"
 
 #include "../math/vec4.h"
 #include "../math/mat4.h"
@@ -11,16 +13,46 @@
 struct Uniforms {
 	mat4 model;
 	Camera* camera = nullptr;
-	std::vector<mat4> animated_matrices;
+	const mat4* animated_matrices = nullptr; // skin matrices, not owned (they live in the render frame)
+	int num_animated_matrices = 0;
+	Texture* animation_texture = nullptr; // baked skin matrices (SHADER_BAKED_ANIMATION)
+	int animation_frame = 0;
+	int object_slot = -1; // object block already uploaded with the frame (UniformBlocks::upload_frame_objects), -1 uploads model
 };
 
 class Material {
 public:
-	
+	static bool use_multi_draw; // meshes with many materials (and entities sharing mesh and material) are drawn with DrawBatch
+
 	Shader* shader = NULL;
-	Texture* texture = NULL;
+	ResourceHandle<Texture> texture;
+	ResourceHandle<Texture> normal_texture;
 	vec4 color;
 
+	// the shader is the permutation of the program with the feature bits of the material
+	int program = -1;
+	unsigned int features = 0;
+	unsigned int permutation_id = 0; // the render sorts the draws by it, so the program changes as few times as possible
+
+	UniformBuffer* block_buffer = NULL; // material uniform block, created the first time it is used
+	sMaterialBlock block;
+
+	virtual ~Material();
+
+	void set_program(const char* name, unsigned int features = 0);
+	void set_features(unsigned int features);
+
+	// camera and model uniforms, through the frame and object blocks when the shader has them
+	void set_scene_uniforms(Uniforms& uniforms);
+	// uploads the material block only if it changed and binds it
+	void bind_material_block(float metallic = 0.f, float roughness = 0.f);
+	// tells the texture streamer the mip levels needed to draw the mesh
+	virtual void request_textures(Mesh* mesh, Uniforms& uniforms);
+
+	// true when the mesh can be drawn for many models at once with render_multi_draw
+	virtual bool can_multi_draw(Mesh* mesh) { return false; }
+	virtual void render_multi_draw(Mesh* mesh, const mat4* models, size_t num_models, Uniforms& uniforms) { }
+
 	virtual void set_uniforms(Uniforms& uniforms) = 0;
 	virtual void render(Mesh* mesh, Uniforms& uniforms) = 0;
 	virtual void render_gui() = 0;
@@ -34,6 +66,9 @@ public:
 
 	void set_uniforms(Uniforms& uniforms);
 	void render(Mesh* mesh, Uniforms& uniforms);
+	bool can_multi_draw(Mesh* mesh);
+	// all the submeshes of the mesh for all the models, with the material of every submesh read from a table
+	void render_multi_draw(Mesh* mesh, const mat4* models, size_t num_models, Uniforms& uniforms);
 	void render_gui();
 };
 
@@ -46,15 +81,16 @@ public:
 
 class PBRMaterial : public FlatMaterial {
 public:
-	Texture* albedo_tex = NULL;
-	Texture* normal_tex = NULL;
-	Texture* met_rou_tex = NULL;
+	ResourceHandle<Texture> albedo_tex;
+	ResourceHandle<Texture> normal_tex;
+	ResourceHandle<Texture> met_rou_tex;
 
 	float metallic;
 	float roughness;
 
 	PBRMaterial();
 	void set_uniforms(Uniforms& uniforms);
+	void request_textures(Mesh* mesh, Uniforms& uniforms);
 	void render_gui();
 };
 
@@ -65,4 +101,5 @@ public:
 	~WireframeMaterial();
 
 	void render(Mesh* mesh, Uniforms& uniforms);
+	bool can_multi_draw(Mesh* mesh) { return false; }
 };
\ No newline at end of file
@@ -1,17 +1,23 @@
 #include "mesh.h"
 
 #include <cassert>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
 #include <limits>
 #include <sys/stat.h>
 
 #include "shader.h"
 #include "texture.h"
+#include "draw_batch.h"
 #include "../includes.h"
 #include "../utils.h"
+#include "../profiler.h"
+#include "../job_system.h"
 #include "../camera.h"
 #include "../animations/pose.h"
 #include "../animations/skeleton.h"
+#include "../animations/skinning.h"
 
 bool Mesh::use_binary = true;			//checks if there is .wbin, it there is one tries to read it instead of the other file
 bool Mesh::auto_upload_to_vram = true;	//uploads the mesh to the GPU VRAM to speed up rendering
@@ -59,6 +65,7 @@ BoundingBox transform_bounding_box(const mat4 m, const BoundingBox& box)
 Mesh::Mesh()
 {
 	radius = 0;
+	interleaved_vao_id = 0;
 	vertices_vbo_id = uvs_vbo_id = uvs1_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = bones_vbo_id = weights_vbo_id = 0;
 	collision_model = NULL;
 	clear();
@@ -67,6 +74,12 @@ Mesh::Mesh()
 Mesh::~Mesh()
 {
 	clear();
+	DrawBatch::forget(this);
+
+	// an unloaded mesh leaves the cache, Mesh::get loads it again if it is needed later
+	auto it = s_meshes_loaded.find(name);
+	if (it != s_meshes_loaded.end() && it->second == this)
+		s_meshes_loaded.erase(it);
 }
 
 void Mesh::clear()
@@ -90,9 +103,13 @@ void Mesh::clear()
 		glDeleteBuffers(1, &weights_vbo_id);
 	if (uvs1_vbo_id)
 		glDeleteBuffers(1, &uvs1_vbo_id);
+	if (interleaved_vao_id)
+		glDeleteVertexArrays(1, &interleaved_vao_id);
 
 	//VBOs ids
 	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = weights_vbo_id = bones_vbo_id = uvs1_vbo_id = 0;
+	interleaved_vao_id = 0;
+	vram_bytes = 0;
 
 	//buffers
 	vertices.clear();
@@ -100,15 +117,54 @@ void Mesh::clear()
 	uvs.clear();
 	colors.clear();
 	interleaved.clear();
+	compact.clear();
 	indices.clear();
 	bones.clear();
 	weights.clear();
 	uvs1.clear();
+	draw_call_materials.clear();
+	skinned_vertices.clear();
+	skinned_normals.clear();
+}
+
+#define CPU_SKINNING_BATCH 4096 // vertices per job
+
+void Mesh::cpu_skinning(Skeleton* skeleton, Pose& pose)
+{
+	size_t num_vertices = get_num_vertices();
+	assert(bones.size() == num_vertices && weights.size() == num_vertices && "the mesh has no skin");
+	if (bones.size() != num_vertices || weights.size() != num_vertices)
+		return;
+	// the skinned meshes are not quantized by the cooker, the compact layout has no float normals to skin
+	assert((interleaved.size() || vertices.size()) && "cpu skinning of a quantized mesh");
+	if (interleaved.empty() && vertices.size() != num_vertices)
+		return;
+
+	const std::vector<mat4>& skin_matrices = pose.get_skin_matrices(skeleton->get_inv_bind_pose(), skeleton->get_generation());
+
+	// the bind pose vertices are kept, the result goes to the skinned arrays
+	skinned_vertices.resize(num_vertices);
+	bool has_normals = interleaved.size() || normals.size() == num_vertices;
+	skinned_normals.resize(has_normals ? num_vertices : 0);
+
+	// every vertex is independent, big meshes are split in ranges for the job system
+	JobSystem::parallel_for(num_vertices, CPU_SKINNING_BATCH, [&](size_t begin, size_t end) {
+		size_t num = end - begin;
+		if (interleaved.size())
+			skin_vertices(&interleaved[begin].vertex, sizeof(tInterleaved), &interleaved[begin].normal, sizeof(tInterleaved), &bones[begin], &weights[begin],
+				num, skin_matrices.data(), &skinned_vertices[begin], &skinned_normals[begin]);
+		else
+			skin_vertices(&vertices[begin], 0, has_normals ? &normals[begin] : NULL, 0, &bones[begin], &weights[begin],
+				num, skin_matrices.data(), &skinned_vertices[begin], has_normals ? &skinned_normals[begin] : NULL);
+	});
 }
 
-void Mesh::cpu_skinning(Skeleton* skeleton, Pose pose)
+size_t Mesh::get_cpu_bytes()
 {
-	// ..
+	return vertices.capacity() * sizeof(vec3) + normals.capacity() * sizeof(vec3) + uvs.capacity() * sizeof(vec2) + uvs1.capacity() * sizeof(vec2) +
+		colors.capacity() * sizeof(vec4) + interleaved.capacity() * sizeof(tInterleaved) + compact.capacity() * sizeof(tCompactVertex) +
+		indices.capacity() * sizeof(unsigned int) + bones.capacity() * sizeof(ivec4) + weights.capacity() * sizeof(vec4) +
+		skinned_vertices.capacity() * sizeof(vec3) + skinned_normals.capacity() * sizeof(vec3) + submeshes.capacity() * sizeof(sSubmeshInfo);
 }
 
 int vertex_location = -1;
@@ -131,12 +187,23 @@ void Mesh::enable_buffers(Shader* sh)
 	int offset_normal = 0;
 	int offset_uv = 0;
 
+	//the compact vertices are interleaved too, with packed normals and half float uvs
+	bool is_compact = compact.size() > 0;
+	GLenum normal_type = is_compact ? GL_INT_2_10_10_10_REV : GL_FLOAT;
+	GLenum uv_type = is_compact ? GL_HALF_FLOAT : GL_FLOAT;
+
 	if (interleaved.size())
 	{
 		spacing = sizeof(tInterleaved);
 		offset_normal = sizeof(vec3);
 		offset_uv = sizeof(vec3) + sizeof(vec3);
 	}
+	else if (is_compact)
+	{
+		spacing = sizeof(tCompactVertex);
+		offset_normal = sizeof(vec3);
+		offset_uv = sizeof(vec3) + sizeof(uint32_t);
+	}
 
 	glBindVertexArray(interleaved_vao_id);
 
@@ -146,7 +213,7 @@ void Mesh::enable_buffers(Shader* sh)
 		glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, 0);
 	}
 	else
-		glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].vertex : &vertices[0]);
+		glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].vertex : is_compact ? &compact[0].vertex : &vertices[0]);
 
 	glEnableVertexAttribArray(vertex_location);
 
@@ -160,10 +227,10 @@ void Mesh::enable_buffers(Shader* sh)
 			if (normals_vbo_id || interleaved_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : normals_vbo_id);
-				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, (void*)offset_normal);
+				glVertexAttribPointer(normal_location, is_compact ? 4 : 3, normal_type, is_compact, spacing, (void*)offset_normal);
 			}
 			else
-				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].normal : &normals[0]);
+				glVertexAttribPointer(normal_location, is_compact ? 4 : 3, normal_type, is_compact, spacing, interleaved.size() ? (void*)&interleaved[0].normal : is_compact ? (void*)&compact[0].normal : (void*)&normals[0]);
 		}
 	}
 
@@ -177,10 +244,10 @@ void Mesh::enable_buffers(Shader* sh)
 			if (uvs_vbo_id || interleaved_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : uvs_vbo_id);
-				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, (void*)offset_uv);
+				glVertexAttribPointer(uv_location, 2, uv_type, GL_FALSE, spacing, (void*)offset_uv);
 			}
 			else
-				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].uv : &uvs[0]);
+				glVertexAttribPointer(uv_location, 2, uv_type, GL_FALSE, spacing, interleaved.size() ? (void*)&interleaved[0].uv : is_compact ? (void*)compact[0].uv : (void*)&uvs[0]);
 		}
 	}
 
@@ -263,6 +330,7 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 		return;
 	}
 	assert((interleaved.size() || vertices.size()) && "No vertices in this mesh");
+	touch();
 
 	//bind buffers to attribute locations
 	enable_buffers(shader);
@@ -270,14 +338,17 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 	//draw call
 	if (submesh_id == -1 && materials.size() > 0) // if there's mesh mtl
 	{
+		if (draw_call_materials.size() != submeshes.size() * MAX_SUBMESH_DRAW_CALLS)
+			update_draw_call_materials();
+
 		for (int i = 0; i < submeshes.size(); ++i) {
 			sSubmeshInfo& submesh = submeshes[i];
 			for (uint32_t j = 0; j < submesh.num_draw_calls; ++j) {
-				const sSubmeshDrawCallInfo& dc = submesh.draw_calls[j];
-				if (materials.count(dc.material) > 0) {
-					shader->set_uniform("u_Ka", materials[dc.material].Ka);
-					shader->set_uniform("u_Kd", materials[dc.material].Kd);
-					shader->set_uniform("u_Ks", materials[dc.material].Ks);
+				const sMaterialInfo* material = draw_call_materials[i * MAX_SUBMESH_DRAW_CALLS + j];
+				if (material) {
+					shader->set_uniform(Shader::UNIFORM_KA, material->Ka);
+					shader->set_uniform(Shader::UNIFORM_KD, material->Kd);
+					shader->set_uniform(Shader::UNIFORM_KS, material->Ks);
 				}
 				draw_call(primitive, i, j, num_instances);
 			}
@@ -291,6 +362,20 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 	disable_buffers(shader);
 }
 
+void Mesh::update_draw_call_materials()
+{
+	draw_call_materials.assign(submeshes.size() * MAX_SUBMESH_DRAW_CALLS, nullptr);
+
+	for (int i = 0; i < submeshes.size(); ++i) {
+		sSubmeshInfo& submesh = submeshes[i];
+		for (uint32_t j = 0; j < submesh.num_draw_calls; ++j) {
+			auto it = materials.find(submesh.draw_calls[j].material);
+			if (it != materials.end())
+				draw_call_materials[i * MAX_SUBMESH_DRAW_CALLS + j] = &it->second;
+		}
+	}
+}
+
 void Mesh::draw_call(unsigned int primitive, int submesh_id, int draw_call_id, int num_instances)
 {
 	size_t start = 0; //in primitives
@@ -380,6 +465,7 @@ void Mesh::render_instanced(unsigned int primitive, const mat4* instanced_models
 		glGenBuffers(1, &instances_buffer_id);
 	glBindBuffer(GL_ARRAY_BUFFER, instances_buffer_id);
 	glBufferData(GL_ARRAY_BUFFER, num_instances * sizeof(mat4), instanced_models, GL_STREAM_DRAW);
+	Profiler::count_upload(num_instances * sizeof(mat4));
 
 	int attribLocation = shader->get_attribute_location("u_model");
 	assert(attribLocation != -1 && "shader must have attribute mat4 u_model (not a uniform)");
@@ -407,7 +493,7 @@ void Mesh::render_instanced(unsigned int primitive, const mat4* instanced_models
 	}
 }
 
-void Mesh::render_instanced(unsigned int primitive, const std::vector<vec3> positions, const char* uniform_name)
+void Mesh::render_instanced(unsigned int primitive, const std::vector<vec3>& positions, const char* uniform_name)
 {
 	if (!positions.size())
 		return;
@@ -420,6 +506,7 @@ void Mesh::render_instanced(unsigned int primitive, const std::vector<vec3> posi
 		glGenBuffers(1, &instances_buffer_id);
 	glBindBuffer(GL_ARRAY_BUFFER, instances_buffer_id);
 	glBufferData(GL_ARRAY_BUFFER, num_instances * sizeof(vec3), &positions[0], GL_STREAM_DRAW);
+	Profiler::count_upload(num_instances * sizeof(vec3));
 
 	int attribLocation = shader->get_attribute_location(uniform_name);
 	assert(attribLocation != -1 && "shader uniform not found");
@@ -530,7 +617,7 @@ void Mesh::render_fixed_pipeline(int primitive)
 
 void Mesh::upload_to_vram()
 {
-	assert(vertices.size() || interleaved.size());
+	assert(vertices.size() || interleaved.size() || compact.size());
 
 	if (glGenBuffers == 0)
 	{
@@ -538,12 +625,20 @@ void Mesh::upload_to_vram()
 		exit(0);
 	}
 
-	glGenVertexArrays(1, &interleaved_vao_id);
+	// uploading again (helpers rebuilt every frame) reuses the VAO and the buffers
+	if (!interleaved_vao_id)
+		glGenVertexArrays(1, &interleaved_vao_id);
+	vram_bytes = 0;
 	if (interleaved.size())
 	{
 		// Vertex,Normal,UV
 		upload_attributes_to_vram(interleaved, interleaved_vbo_id);
 	}
+	else if (compact.size())
+	{
+		// Vertex,Normal,UV quantized
+		upload_attributes_to_vram(compact, interleaved_vbo_id);
+	}
 	else
 	{
 		// Vertices
@@ -598,12 +693,14 @@ void Mesh::upload_to_vram()
 }
 
 template<typename T>
-void Mesh::upload_attributes_to_vram(const std::vector<T> values, unsigned int& id)
+void Mesh::upload_attributes_to_vram(const std::vector<T>& values, unsigned int& id)
 {
 	if (id == 0)
 		glGenBuffers(1, &id);
 	glBindBuffer(GL_ARRAY_BUFFER, id);
 	glBufferData(GL_ARRAY_BUFFER, values.size() * sizeof(T), &values[0], GL_STATIC_DRAW);
+	Profiler::count_upload(values.size() * sizeof(T));
+	vram_bytes += values.size() * sizeof(T);
 }
 
 bool Mesh::interleave_buffers()
@@ -642,11 +739,19 @@ struct sMeshInfo
 	float radius = 0.0;
 	size_t num_bones = 0;
 	size_t num_submeshes = 0;
+	size_t num_materials = 0;
 	mat4 bind_matrix;
-	char streams[8]; //Vertex/Interlaved|Normal|Uvs|Color|Indices|Bones|Weights|Extra|Uvs1
+	char streams[8]; //Vertex/Interlaved/Quantized|Normal|Uvs|Color|Indices|Bones|Weights|Uvs1
 	char extra[32]; //unused
 };
 
+//materials are stored in the bin so loading it does not parse the mtl
+struct sMeshBinMaterial
+{
+	char name[32];
+	sMaterialInfo info;
+};
+
 bool Mesh::read_bin(const char* filename)
 {
 	FILE* f;
@@ -654,18 +759,20 @@ bool Mesh::read_bin(const char* filename)
 
 	struct stat stbuffer;
 
-	stat(filename, &stbuffer);
+	if (stat(filename, &stbuffer) != 0)
+		return false;
 	f = fopen(filename, "rb");
 	if (f == NULL)
 		return false;
 
-	unsigned int size = (unsigned int)stbuffer.st_size;
-	char* data = new char[size];
-	fread(data, size, 1, f);
+	size_t size = (size_t)stbuffer.st_size;
+	std::vector<char> content(size);
+	fread(content.data(), size, 1, f);
 	fclose(f);
+	char* data = content.data();
 
 	//watermark
-	if (memcmp(data, "MBIN", 4) != 0)
+	if (size < 4 + sizeof(sMeshInfo) || memcmp(data, "MBIN", 4) != 0)
 	{
 		std::cout << "[ERROR] loading BIN: invalid content: " << filename << std::endl;
 		return false;
@@ -688,6 +795,12 @@ bool Mesh::read_bin(const char* filename)
 		memcpy((void*)&interleaved[0], pos, sizeof(tInterleaved) * info.size);
 		pos += sizeof(tInterleaved) * info.size;
 	}
+	else if (info.streams[0] == 'Q')
+	{
+		compact.resize(info.size);
+		memcpy((void*)&compact[0], pos, sizeof(tCompactVertex) * info.size);
+		pos += sizeof(tCompactVertex) * info.size;
+	}
 	else if (info.streams[0] == 'V')
 	{
 		vertices.resize(info.size);
@@ -720,14 +833,14 @@ bool Mesh::read_bin(const char* filename)
 	{
 		indices.resize(info.num_indices);
 		memcpy((void*)&indices[0], pos, sizeof(unsigned int) * info.num_indices);
-		pos += sizeof(uivec3) * info.num_indices;
+		pos += sizeof(unsigned int) * info.num_indices;
 	}
 
 	if (info.streams[5] == 'B')
 	{
 		bones.resize(info.size);
-		memcpy((void*)&bones[0], pos, sizeof(vec4) * info.size);
-		pos += sizeof(vec4) * info.size;
+		memcpy((void*)&bones[0], pos, sizeof(ivec4) * info.size);
+		pos += sizeof(ivec4) * info.size;
 	}
 
 	if (info.streams[6] == 'W')
@@ -765,29 +878,33 @@ bool Mesh::read_bin(const char* filename)
 		pos += sizeof(sSubmeshInfo) * info.num_submeshes;
 	}
 
-	// if the mtl is not specified in the obj but it's needed
-	if (!materials.size()) {
-		std::string mesh_name = filename;
-		mesh_name = mesh_name.substr(0, mesh_name.size() - 5);
-
-		std::string ext = mesh_name.substr(mesh_name.find_last_of(".") + 1);
-		if (ext == "obj" || ext == "OBJ") {
-			replace(mesh_name, ".obj", ".mtl");
-			if (!parse_mtl(mesh_name.c_str()))
-				std::cerr << "MTL file not found: " << mesh_name.c_str() << std::endl;
-		}
+	for (size_t i = 0; i < info.num_materials; ++i)
+	{
+		sMeshBinMaterial material;
+		memcpy(&material, pos, sizeof(sMeshBinMaterial));
+		pos += sizeof(sMeshBinMaterial);
+		material.name[31] = 0;
+		materials[material.name] = material.info;
 	}
 
+	assert(pos <= data + size && "mesh BIN shorter than its header says");
+
 	//createCollisionModel();
 	return true;
 }
 
 bool Mesh::write_bin(const char* filename)
 {
-	assert(vertices.size() || interleaved.size());
+	assert(vertices.size() || interleaved.size() || compact.size());
 	std::string s_filename = filename;
 	s_filename += ".mbin";
 
+	//the cooked bins are written in their own folder tree
+	std::filesystem::path folder = std::filesystem::path(s_filename).parent_path();
+	std::error_code error;
+	if (!folder.empty())
+		std::filesystem::create_directories(folder, error);
+
 	FILE* f = fopen(s_filename.c_str(), "wb");
 	if (f == NULL)
 	{
@@ -802,7 +919,7 @@ bool Mesh::write_bin(const char* filename)
 	memset(&info, 0, sizeof(info));
 	info.version = MESH_BIN_VERSION;
 	info.header_bytes = sizeof(sMeshInfo);
-	info.size = interleaved.size() ? interleaved.size() : vertices.size();
+	info.size = get_num_vertices();
 	info.num_indices = indices.size();
 	info.aabb_max = aabb_max;
 	info.aabb_min = aabb_min;
@@ -812,8 +929,9 @@ bool Mesh::write_bin(const char* filename)
 	info.num_bones = bones_info.size();
 	info.bind_matrix = bind_matrix;
 	info.num_submeshes = submeshes.size();
+	info.num_materials = materials.size();
 
-	info.streams[0] = interleaved.size() ? 'I' : 'V';
+	info.streams[0] = interleaved.size() ? 'I' : compact.size() ? 'Q' : 'V';
 	info.streams[1] = normals.size() ? 'N' : ' ';
 	info.streams[2] = uvs.size() ? 'U' : ' ';
 	info.streams[3] = colors.size() ? 'C' : ' ';
@@ -825,17 +943,18 @@ bool Mesh::write_bin(const char* filename)
 	//write info
 	fwrite((void*)&info, sizeof(sMeshInfo), 1, f);
 
-	//write streams
+	//write streams (same order read_bin reads them)
 	if (interleaved.size())
 		fwrite((void*)&interleaved[0], interleaved.size() * sizeof(tInterleaved), 1, f);
+	else if (compact.size())
+		fwrite((void*)&compact[0], compact.size() * sizeof(tCompactVertex), 1, f);
 	else
-	{
 		fwrite((void*)&vertices[0], vertices.size() * sizeof(vec3), 1, f);
-		if (normals.size())
-			fwrite((void*)&normals[0], normals.size() * sizeof(vec3), 1, f);
-		if (uvs.size())
-			fwrite((void*)&uvs[0], uvs.size() * sizeof(vec2), 1, f);
-	}
+
+	if (normals.size())
+		fwrite((void*)&normals[0], normals.size() * sizeof(vec3), 1, f);
+	if (uvs.size())
+		fwrite((void*)&uvs[0], uvs.size() * sizeof(vec2), 1, f);
 
 	if (colors.size())
 		fwrite((void*)&colors[0], colors.size() * sizeof(vec4), 1, f);
@@ -844,17 +963,26 @@ bool Mesh::write_bin(const char* filename)
 		fwrite((void*)&indices[0], indices.size() * sizeof(unsigned int), 1, f);
 
 	if (bones.size())
-		fwrite((void*)&bones[0], bones.size() * sizeof(vec4), 1, f);
+		fwrite((void*)&bones[0], bones.size() * sizeof(ivec4), 1, f);
 	if (weights.size())
 		fwrite((void*)&weights[0], weights.size() * sizeof(vec4), 1, f);
-	if (bones_info.size())
-		fwrite((void*)&bones_info[0], bones_info.size() * sizeof(BoneInfo), 1, f);
 	if (uvs1.size())
 		fwrite((void*)&uvs1[0], uvs1.size() * sizeof(vec2), 1, f);
+	if (bones_info.size())
+		fwrite((void*)&bones_info[0], bones_info.size() * sizeof(BoneInfo), 1, f);
 
 	if (submeshes.size())
 		fwrite((void*)&submeshes[0], submeshes.size() * sizeof(sSubmeshInfo), 1, f);
 
+	for (auto& it : materials)
+	{
+		sMeshBinMaterial material;
+		memset(&material, 0, sizeof(material));
+		strncpy(material.name, it.first.c_str(), sizeof(material.name) - 1);
+		material.info = it.second;
+		fwrite((void*)&material, sizeof(sMeshBinMaterial), 1, f);
+	}
+
 	fclose(f);
 	return true;
 }
@@ -966,6 +1094,20 @@ void parse_from_text(vec3& v, const char* text, const char separator)
 	}
 };
 
+bool Mesh::load_source(const char* filename)
+{
+	std::string name = filename;
+	std::string ext = name.substr(name.find_last_of(".") + 1);
+	if (ext == "obj" || ext == "OBJ")
+		return load_obj(filename);
+	if (ext == "mesh" || ext == "MESH")
+		return load_mesh(filename);
+	/*if (ext == "ase" || ext == "ASE")
+		return loadASE(filename);*/
+	std::cerr << "Unknown mesh source format: " << filename << std::endl;
+	return false;
+}
+
 bool Mesh::load_obj(const char* filename)
 {
 	struct stat stbuffer;
@@ -1359,6 +1501,8 @@ void Mesh::create_subdivided_plane(float size, int subdivisions, bool centered)
 	float iuv = static_cast<float>(1 / (double)(subdivisions * size));
 	float sub_size = 1.0f / subdivisions;
 	vertices.clear();
+	vertices.reserve((size_t)subdivisions * subdivisions * 6);
+	uvs.reserve(uvs.size() + (size_t)subdivisions * subdivisions * 6);
 
 	for (int x = 0; x < subdivisions; ++x)
 	{
@@ -1404,15 +1548,16 @@ void Mesh::displace(Image* heightmap, float altitude)
 	int num = is_interleaved ? interleaved.size() : vertices.size();
 	assert(num && "no vertices found");
 
-	for (int i = 0; i < num; ++i)
-	{
-		vec2& uv = uvs[i];
-		vec4 c = heightmap->get_pixel_interpolated(uv.x * heightmap->width, uv.y * heightmap->height);
-		if (is_interleaved)
-			interleaved[i].vertex.y = (c.x / 255.0f) * altitude;
-		else
-			vertices[i].y = (c.x / 255.0f) * altitude;
-	}
+	//all the heights are sampled in a single batch (vectorized and split between threads)
+	std::vector<float> heights(num);
+	heightmap->sample(&uvs[0], num, &heights[0]);
+
+	if (is_interleaved)
+		for (int i = 0; i < num; ++i)
+			interleaved[i].vertex.y = heights[i] * altitude;
+	else
+		for (int i = 0; i < num; ++i)
+			vertices[i].y = heights[i] * altitude;
 	box.center.y += altitude * 0.5f;
 	box.halfsize.y += altitude * 0.5f;
 	//radius = static_cast<float>(box.halfsize.length());
@@ -1491,14 +1636,14 @@ void Mesh::render_bounding(const mat4& model, bool world_bounding)
 
 	Shader* sh = Shader::get_default_shader("flat");
 	sh->enable();
-	sh->set_uniform("u_viewprojection", Camera::current->viewprojection_matrix);
+	sh->set_uniform(Shader::UNIFORM_VIEWPROJECTION, Camera::current->viewprojection_matrix);
 
 	mat4 matrix;
 	matrix = translate(matrix, box.center);
 	matrix = scale(matrix, box.halfsize);
 
-	sh->set_uniform("u_color", vec4(1, 1, 0, 1));
-	sh->set_uniform("u_model", matrix * model);
+	sh->set_uniform(Shader::UNIFORM_COLOR, vec4(1, 1, 0, 1));
+	sh->set_uniform(Shader::UNIFORM_MODEL, matrix * model);
 	wire_box->render(GL_LINES);
 
 	if (world_bounding)
@@ -1507,8 +1652,8 @@ void Mesh::render_bounding(const mat4& model, bool world_bounding)
 		matrix = mat4();
 		matrix = translate(matrix, AABB.center);
 		matrix = scale(matrix, AABB.halfsize);
-		sh->set_uniform("u_model", matrix);
-		sh->set_uniform("u_color", vec4(0, 1, 1, 1));
+		sh->set_uniform(Shader::UNIFORM_MODEL, matrix);
+		sh->set_uniform(Shader::UNIFORM_COLOR, vec4(0, 1, 1, 1));
 		wire_box->render(GL_LINES);
 	}
 
@@ -1534,6 +1679,8 @@ Mesh* Mesh::get(const char* filename)
 	if (it != s_meshes_loaded.end())
 		return it->second;
 
+	PROFILE_SCOPE("Mesh::get");
+
 	Mesh* m = new Mesh();
 	std::string name = filename;
 
@@ -1559,13 +1706,21 @@ Mesh* Mesh::get(const char* filename)
 	std::cout << " + Mesh loading: " << filename << " ... ";
 	std::string binfilename = filename;
 
+	//the cooked version goes first, then the one written next to the source by older builds.
+	//A binary older than its source is skipped, the source is loaded and cooked again
+	bool binary_valid = true;
 	if (file_format != FORMAT_MBIN)
-		binfilename = binfilename + ".mbin";
+	{
+		binfilename = get_cooked_filename(filename, ".mbin");
+		if (!is_cooked_file_valid(name, binfilename))
+			binfilename = name + ".mbin";
+		binary_valid = is_cooked_file_valid(name, binfilename);
+	}
 
 	//try loading the binary version
-	if (use_binary && m->read_bin(binfilename.c_str()))
+	if (use_binary && binary_valid && m->read_bin(binfilename.c_str()))
 	{
-		if (interleave_meshes && m->interleaved.size() == 0)
+		if (interleave_meshes && m->interleaved.size() == 0 && m->compact.size() == 0)
 		{
 			std::cout << "[INTERL] ";
 			m->interleave_buffers();
@@ -1577,21 +1732,13 @@ Mesh* Mesh::get(const char* filename)
 			m->upload_to_vram();
 		}
 
-		std::cout << "[OK BIN]  Faces: " << (m->interleaved.size() ? m->interleaved.size() : m->vertices.size()) / 3 << " Time: " << (get_time() - time) * 0.001 << "sec" << std::endl;
+		std::cout << "[OK BIN]  Faces: " << (m->indices.size() ? m->indices.size() : m->get_num_vertices()) / 3 << " Time: " << (get_time() - time) * 0.001 << "sec" << std::endl;
 		m->register_mesh(filename);
 		return m;
 	}
 
 	//load the ascii version
-	bool loaded = false;
-	if (file_format == FORMAT_OBJ)
-		loaded = m->load_obj(filename);
-	/*else if (file_format == FORMAT_ASE)
-		loaded = m->loadASE(filename);*/
-	else if (file_format == FORMAT_MESH)
-		loaded = m->load_mesh(filename);
-
-	if (!loaded)
+	if (!m->load_source(filename))
 	{
 		delete m;
 		std::cout << "[ERROR]: Mesh not found" << std::endl;
@@ -1616,7 +1763,7 @@ Mesh* Mesh::get(const char* filename)
 	if (use_binary)
 	{
 		std::cout << "\t\t Writing .BIN ... ";
-		m->write_bin(filename);
+		m->write_bin(get_cooked_filename(filename, "").c_str());
 		std::cout << "[OK]" << std::endl;
 	}
 
@@ -1628,4 +1775,5 @@ void Mesh::register_mesh(std::string name)
 {
 	this->name = name;
 	s_meshes_loaded[name] = this;
+	ResourceManager::add(this);
 }
\ No newline at end of file
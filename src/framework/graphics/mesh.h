@@ -3,19 +3,21 @@
 #include <vector>
 #include <map>
 #include <string>
+#include <cstdint>
 
 #include "../math/vec2.h"
 #include "../math/vec3.h"
 #include "../math/vec4.h"
 #include "../math/mat4.h"
+#include "../resource_manager.h"
 
 class Shader; //for binding
 class Image; //for displace
 class Skeleton; //for skinned meshes
 class Pose;
 
-//version from 21/01/2024
-#define MESH_BIN_VERSION 12 //this is used to regenerate bins if the format changes
+//version from 19/10/2026: compact vertices, materials, fixed stream order
+#define MESH_BIN_VERSION 13 //this is used to regenerate bins if the format changes
 
 #define MAX_SUBMESH_DRAW_CALLS 16
 
@@ -58,7 +60,7 @@ struct sMaterialInfo
 	vec3 Ks;
 };
 
-class Mesh
+class Mesh : public Resource
 {
 public:
 	static std::map<std::string, Mesh*> s_meshes_loaded;
@@ -72,6 +74,7 @@ public:
 
 	std::vector<sSubmeshInfo> submeshes; //contains info about every submesh
 	std::map<std::string, sMaterialInfo> materials; //contains info about every material
+	std::vector<const sMaterialInfo*> draw_call_materials; //material of every submesh draw call, resolved once so rendering does no name lookups
 
 	std::vector<vec3> vertices;	//here we store the vertices
 	std::vector<vec3> normals;	//here we store the normals
@@ -88,6 +91,15 @@ public:
 
 	std::vector<tInterleaved> interleaved; //to render interleaved
 
+	struct tCompactVertex
+	{
+		vec3 vertex;
+		uint32_t normal; //GL_INT_2_10_10_10_REV
+		uint16_t uv[2]; //half floats
+	};
+
+	std::vector<tCompactVertex> compact; //quantized interleaved vertices, only written by the asset cooker (see MeshCooking)
+
 	std::vector<unsigned int> indices; //for indexed meshes
 
 	//for animated meshes
@@ -95,6 +107,8 @@ public:
 	std::vector<vec4> weights; //tells how much affect every bone
 	std::vector<BoneInfo> bones_info; //tells 
 	mat4 bind_matrix;
+	std::vector<vec3> skinned_vertices; //result of cpu_skinning
+	std::vector<vec3> skinned_normals;
 
 	vec3 aabb_min;
 	vec3 aabb_max;
@@ -113,29 +127,37 @@ public:
 	unsigned int bones_vbo_id;
 	unsigned int weights_vbo_id;
 	unsigned int uvs1_vbo_id;
+	size_t vram_bytes = 0; // of all the buffers uploaded
 
 	Mesh();
 	~Mesh();
 
 	void clear();
 
-	void cpu_skinning(Skeleton* skeleton, Pose pose);
+	// Resource
+	eResourceType get_resource_type() { return RESOURCE_MESH; }
+	const char* get_resource_name() { return name.c_str(); }
+	size_t get_cpu_bytes();
+	size_t get_gpu_bytes() { return vram_bytes; }
+
+	void cpu_skinning(Skeleton* skeleton, Pose& pose); // the pose is not copied, its skin matrix cache is updated
 
 	void render(unsigned int primitive, int submesh_id = -1, int num_instances = 0);
 	void render_instanced(unsigned int primitive, const mat4* instanced_models, int number);
-	void render_instanced(unsigned int primitive, const std::vector<vec3> positions, const char* uniform_name);
+	void render_instanced(unsigned int primitive, const std::vector<vec3>& positions, const char* uniform_name);
 	void render_bounding(const mat4& model, bool world_bounding = true);
 	void render_fixed_pipeline(int primitive); //sloooooooow
 
 	void enable_buffers(Shader* shader);
 	void draw_call(unsigned int primitive, int submesh_id, int draw_call_id, int num_instances);
+	void update_draw_call_materials();
 	void disable_buffers(Shader* shader);
 
 	bool read_bin(const char* filename);
 	bool write_bin(const char* filename);
 
 	unsigned int get_num_submeshes() { return (unsigned int)submeshes.size(); }
-	unsigned int get_num_vertices() { return (unsigned int)interleaved.size() ? (unsigned int)interleaved.size() : (unsigned int)vertices.size(); }
+	unsigned int get_num_vertices() { return interleaved.size() ? (unsigned int)interleaved.size() : compact.size() ? (unsigned int)compact.size() : (unsigned int)vertices.size(); }
 
 	//collision testing
 	void* collision_model;
@@ -146,6 +168,7 @@ public:
 
 	//loader
 	static Mesh* get(const char* filename);
+	bool load_source(const char* filename); //obj or mesh, without the binary version (used by the asset cooker)
 	void register_mesh(std::string name);
 
 	//create help meshes
@@ -163,7 +186,7 @@ public:
 	//optimize meshes
 	void upload_to_vram();
 	template <typename T>
-	void upload_attributes_to_vram(const std::vector<T> values, unsigned int& id);
+	void upload_attributes_to_vram(const std::vector<T>& values, unsigned int& id);
 
 	bool interleave_buffers();
 
@@ -0,0 +1,359 @@
+#include "mesh_cooking.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <algorithm>
+#include <unordered_map>
+
+#include "mesh.h"
+
+#define UNUSED_VERTEX 0xFFFFFFFF
+
+//moves every vertex of a stream to its new position, old vertices mapped to the same new one must be equal
+template<typename T> static void remap_stream(std::vector<T>& stream, const std::vector<unsigned int>& remap, size_t new_size)
+{
+	if (stream.empty())
+		return;
+	assert(stream.size() == remap.size());
+	std::vector<T> result(new_size);
+	for (size_t i = 0; i < stream.size(); ++i)
+		if (remap[i] != UNUSED_VERTEX)
+			result[remap[i]] = stream[i];
+	stream.swap(result);
+}
+
+template<typename T> static void append_key(std::string& key, const std::vector<T>& stream, size_t index)
+{
+	if (stream.size())
+		key.append((const char*)&stream[index], sizeof(T));
+}
+
+static void remap_streams(Mesh* mesh, const std::vector<unsigned int>& remap, size_t new_size)
+{
+	remap_stream(mesh->interleaved, remap, new_size);
+	remap_stream(mesh->compact, remap, new_size);
+	remap_stream(mesh->vertices, remap, new_size);
+	remap_stream(mesh->normals, remap, new_size);
+	remap_stream(mesh->uvs, remap, new_size);
+	remap_stream(mesh->uvs1, remap, new_size);
+	remap_stream(mesh->colors, remap, new_size);
+	remap_stream(mesh->bones, remap, new_size);
+	remap_stream(mesh->weights, remap, new_size);
+}
+
+bool MeshCooking::weld(Mesh* mesh)
+{
+	if (mesh->indices.size())
+		return false; //already indexed
+
+	size_t num_vertices = mesh->get_num_vertices();
+	if (!num_vertices)
+		return false;
+
+	//the bytes of the vertex in every stream are the key, so only exact copies are merged
+	std::unordered_map<std::string, unsigned int> unique;
+	unique.reserve(num_vertices);
+	std::vector<unsigned int> remap(num_vertices);
+	std::string key;
+
+	mesh->indices.resize(num_vertices);
+	for (size_t i = 0; i < num_vertices; ++i)
+	{
+		key.clear();
+		append_key(key, mesh->interleaved, i);
+		append_key(key, mesh->compact, i);
+		append_key(key, mesh->vertices, i);
+		append_key(key, mesh->normals, i);
+		append_key(key, mesh->uvs, i);
+		append_key(key, mesh->uvs1, i);
+		append_key(key, mesh->colors, i);
+		append_key(key, mesh->bones, i);
+		append_key(key, mesh->weights, i);
+
+		auto it = unique.emplace(key, (unsigned int)unique.size()).first;
+		remap[i] = it->second;
+		mesh->indices[i] = it->second;
+	}
+
+	remap_streams(mesh, remap, unique.size());
+	return true;
+}
+
+//Forsyth's "Linear-speed vertex cache optimisation" scores
+#define FORSYTH_CACHE_DECAY_POWER 1.5f
+#define FORSYTH_LAST_TRI_SCORE 0.75f
+#define FORSYTH_VALENCE_BOOST_SCALE 2.0f
+#define FORSYTH_VALENCE_BOOST_POWER 0.5f
+
+struct sForsythVertex
+{
+	int cache_position = -1;
+	float score = 0.0f;
+	unsigned int first_triangle = 0; //in the adjacency list
+	unsigned int num_triangles = 0; //not emitted yet
+	unsigned int total_triangles = 0;
+};
+
+static float get_forsyth_score(const sForsythVertex& v, int cache_size)
+{
+	if (v.num_triangles == 0)
+		return -1.0f;
+
+	float score = 0.0f;
+	if (v.cache_position >= 0)
+	{
+		if (v.cache_position < 3)
+			score = FORSYTH_LAST_TRI_SCORE; //the triangle just emitted, so it does not get all the bonus
+		else
+			score = powf(1.0f - (v.cache_position - 3) / (float)(cache_size - 3), FORSYTH_CACHE_DECAY_POWER);
+	}
+	//vertices with few triangles left are finished first, to not leave lonely triangles behind
+	score += FORSYTH_VALENCE_BOOST_SCALE * powf((float)v.num_triangles, -FORSYTH_VALENCE_BOOST_POWER);
+	return score;
+}
+
+//reorders the triangles of indices[start, start + length)
+static void optimize_range(unsigned int* indices, size_t length, std::vector<sForsythVertex>& vertices, int cache_size)
+{
+	size_t num_triangles = length / 3;
+	if (num_triangles < 2)
+		return;
+
+	//vertices used by the range, the rest of the array is not touched
+	std::vector<unsigned int> used;
+	for (size_t i = 0; i < num_triangles * 3; ++i)
+	{
+		sForsythVertex& v = vertices[indices[i]];
+		if (v.total_triangles == 0)
+			used.push_back(indices[i]);
+		v.total_triangles++;
+	}
+
+	//adjacency: triangles of every vertex
+	unsigned int offset = 0;
+	for (unsigned int index : used)
+	{
+		sForsythVertex& v = vertices[index];
+		v.first_triangle = offset;
+		offset += v.total_triangles;
+	}
+	std::vector<unsigned int> adjacency(offset);
+	for (size_t i = 0; i < num_triangles * 3; ++i)
+	{
+		sForsythVertex& v = vertices[indices[i]];
+		adjacency[v.first_triangle + v.num_triangles++] = (unsigned int)(i / 3);
+	}
+
+	for (unsigned int index : used)
+		vertices[index].score = get_forsyth_score(vertices[index], cache_size);
+
+	std::vector<float> triangle_scores(num_triangles);
+	std::vector<bool> emitted(num_triangles, false);
+	for (size_t i = 0; i < num_triangles; ++i)
+		triangle_scores[i] = vertices[indices[i * 3]].score + vertices[indices[i * 3 + 1]].score + vertices[indices[i * 3 + 2]].score;
+
+	std::vector<unsigned int> result;
+	result.reserve(num_triangles * 3);
+	std::vector<unsigned int> cache;
+	std::vector<unsigned int> new_cache;
+	size_t next_unemitted = 0;
+
+	int best = 0;
+	for (size_t i = 1; i < num_triangles; ++i)
+		if (triangle_scores[i] > triangle_scores[best])
+			best = (int)i;
+
+	while (best >= 0)
+	{
+		emitted[best] = true;
+		const unsigned int* tri = &indices[best * 3];
+
+		for (int k = 0; k < 3; ++k)
+		{
+			result.push_back(tri[k]);
+
+			//remove the triangle from the ones left of the vertex
+			sForsythVertex& v = vertices[tri[k]];
+			unsigned int* triangles = &adjacency[v.first_triangle];
+			for (unsigned int j = 0; j < v.num_triangles; ++j)
+				if (triangles[j] == (unsigned int)best)
+				{
+					std::swap(triangles[j], triangles[v.num_triangles - 1]);
+					v.num_triangles--;
+					break;
+				}
+		}
+
+		//the vertices of the triangle go to the front of the LRU cache
+		new_cache.assign(tri, tri + 3);
+		for (unsigned int index : cache)
+			if (index != tri[0] && index != tri[1] && index != tri[2])
+				new_cache.push_back(index);
+		cache.swap(new_cache);
+
+		for (size_t j = 0; j < cache.size(); ++j)
+			vertices[cache[j]].cache_position = j < (size_t)cache_size ? (int)j : -1;
+		for (size_t j = 0; j < cache.size(); ++j)
+			vertices[cache[j]].score = get_forsyth_score(vertices[cache[j]], cache_size);
+
+		//only the triangles of the vertices in the cache change their score
+		best = -1;
+		float best_score = -1.0f;
+		for (unsigned int index : cache)
+		{
+			const sForsythVertex& v = vertices[index];
+			for (unsigned int j = 0; j < v.num_triangles; ++j)
+			{
+				unsigned int t = adjacency[v.first_triangle + j];
+				const unsigned int* other = &indices[t * 3];
+				float score = vertices[other[0]].score + vertices[other[1]].score + vertices[other[2]].score;
+				triangle_scores[t] = score;
+				if (score > best_score)
+				{
+					best_score = score;
+					best = (int)t;
+				}
+			}
+		}
+
+		if (cache.size() > (size_t)cache_size)
+			cache.resize(cache_size);
+
+		//nothing left around the cache, continue with any triangle
+		if (best < 0)
+		{
+			while (next_unemitted < num_triangles && emitted[next_unemitted])
+				next_unemitted++;
+			if (next_unemitted < num_triangles)
+				best = (int)next_unemitted;
+		}
+	}
+
+	assert(result.size() == num_triangles * 3);
+	memcpy(indices, &result[0], result.size() * sizeof(unsigned int));
+
+	for (unsigned int index : used)
+		vertices[index] = sForsythVertex();
+}
+
+void MeshCooking::optimize_vertex_cache(Mesh* mesh, int cache_size)
+{
+	if (mesh->indices.empty())
+		return;
+	assert(cache_size > 3);
+
+	size_t num_vertices = mesh->get_num_vertices();
+	std::vector<sForsythVertex> vertices(num_vertices);
+
+	//every draw call on its own, so the submesh ranges stay valid
+	if (mesh->submeshes.empty())
+		optimize_range(&mesh->indices[0], mesh->indices.size(), vertices, cache_size);
+	for (sSubmeshInfo& submesh : mesh->submeshes)
+		for (unsigned int i = 0; i < submesh.num_draw_calls; ++i)
+		{
+			sSubmeshDrawCallInfo& dc = submesh.draw_calls[i];
+			assert(dc.start + dc.length <= mesh->indices.size());
+			if (dc.length)
+				optimize_range(&mesh->indices[dc.start], dc.length, vertices, cache_size);
+		}
+
+	//vertices in the order they are fetched (unused ones are removed)
+	std::vector<unsigned int> remap(num_vertices, UNUSED_VERTEX);
+	unsigned int num_used = 0;
+	for (unsigned int& index : mesh->indices)
+	{
+		if (remap[index] == UNUSED_VERTEX)
+			remap[index] = num_used++;
+		index = remap[index];
+	}
+	remap_streams(mesh, remap, num_used);
+}
+
+//beyond this the half float step is over 1/512, visible in tiled textures
+#define QUANTIZE_MAX_UV 4.0f
+
+bool MeshCooking::quantize(Mesh* mesh)
+{
+	// skinned meshes keep the float layout, the CPU skinning reads the positions and normals from it
+	if (mesh->interleaved.empty() || mesh->bones.size() || mesh->weights.size())
+		return false;
+
+	for (const Mesh::tInterleaved& v : mesh->interleaved)
+		if (fabsf(v.uv.x) > QUANTIZE_MAX_UV || fabsf(v.uv.y) > QUANTIZE_MAX_UV)
+			return false;
+
+	mesh->compact.resize(mesh->interleaved.size());
+	for (size_t i = 0; i < mesh->interleaved.size(); ++i)
+	{
+		const Mesh::tInterleaved& v = mesh->interleaved[i];
+		Mesh::tCompactVertex& c = mesh->compact[i];
+		c.vertex = v.vertex;
+		c.normal = pack_normal(v.normal.x, v.normal.y, v.normal.z);
+		c.uv[0] = float_to_half(v.uv.x);
+		c.uv[1] = float_to_half(v.uv.y);
+	}
+	mesh->interleaved.clear();
+	return true;
+}
+
+float MeshCooking::get_acmr(const std::vector<unsigned int>& indices, int cache_size)
+{
+	if (indices.size() < 3)
+		return 0.0f;
+
+	std::deque<unsigned int> cache; //FIFO
+	size_t misses = 0;
+	for (unsigned int index : indices)
+	{
+		if (std::find(cache.begin(), cache.end(), index) != cache.end())
+			continue;
+		misses++;
+		cache.push_back(index);
+		if (cache.size() > (size_t)cache_size)
+			cache.pop_front();
+	}
+	return misses / (float)(indices.size() / 3);
+}
+
+uint16_t MeshCooking::float_to_half(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	uint32_t sign = (bits >> 16) & 0x8000;
+	int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFF;
+
+	if (((bits >> 23) & 0xFF) == 0xFF) //inf or nan
+		return (uint16_t)(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+	if (exponent >= 31) //too big
+		return (uint16_t)(sign | 0x7C00);
+	if (exponent <= 0) //denormal
+	{
+		if (exponent < -10)
+			return (uint16_t)sign;
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		uint32_t half = mantissa >> shift;
+		if ((mantissa >> (shift - 1)) & 1)
+			half++;
+		return (uint16_t)(sign | half);
+	}
+
+	uint32_t half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000) //rounding, a carry into the exponent is still right
+		half++;
+	return (uint16_t)half;
+}
+
+uint32_t MeshCooking::pack_normal(float x, float y, float z)
+{
+	//signed normalized 10 bits per component, w unused
+	auto pack = [](float v) -> uint32_t {
+		v = std::max(-1.0f, std::min(1.0f, v));
+		return (uint32_t)((int)roundf(v * 511.0f) & 0x3FF);
+	};
+	return pack(x) | (pack(y) << 10) | (pack(z) << 20);
+}
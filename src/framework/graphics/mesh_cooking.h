@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class Mesh;
+
+// Offline optimizations of the geometry of a mesh, used by the asset cooker (src/tools/asset_cooker.cpp) before
+// writing the .mbin. They only touch the CPU arrays, and keep the triangles of every submesh draw call inside its range
+class MeshCooking
+{
+public:
+	// builds the index buffer of a non indexed mesh merging the vertices that are equal in every stream
+	// (the triangles keep their order, so the submesh ranges are now ranges of the index buffer)
+	static bool weld(Mesh* mesh);
+
+	// reorders the triangles of every draw call for the post-transform vertex cache (Forsyth's algorithm)
+	// and then the vertices in the order they are first used, for the pre-transform cache
+	static void optimize_vertex_cache(Mesh* mesh, int cache_size = 32);
+
+	// interleaved vertices to the compact layout: normals as 10:10:10:2 and uvs as half floats (32 to 20 bytes per vertex),
+	// false for skinned meshes (the CPU skinning needs the float layout)
+	static bool quantize(Mesh* mesh);
+
+	// average number of vertices transformed per triangle with a FIFO cache (1 would be perfect, 3 no reuse at all)
+	static float get_acmr(const std::vector<unsigned int>& indices, int cache_size = 16);
+
+	static uint16_t float_to_half(float value);
+	static uint32_t pack_normal(float x, float y, float z);
+};
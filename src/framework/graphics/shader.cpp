@@ -3,12 +3,21 @@
 #include <cassert>
 #include <iostream>
 #include "../utils.h"
+#include "../profiler.h"
 #include <algorithm> 
 #include <functional> 
 #include <cctype>
 #include <locale>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 
 #include "texture.h"
+#include "uniform_buffer.h"
 
 std::string Shader::s_shader_atlas_filename;
 std::map<std::string, std::string> Shader::s_shaders_atlas;
@@ -57,6 +66,40 @@ REGISTER_GLEXT(void, glUniformMatrix4fv, GLint location, GLsizei count, GLboolea
 std::map<std::string, Shader*> Shader::s_Shaders;
 bool Shader::s_ready = false;
 Shader* Shader::current = NULL;
+bool Shader::use_program_cache = true;
+std::string Shader::s_program_cache_path = "res/shaders/cache/";
+
+//background compiler, the jobs are compiled in a hidden window that shares objects with the main one
+struct sShaderJob
+{
+	Shader* shader;
+	std::string vsm;
+	std::string psm;
+	uint64_t cache_key;
+	GLuint program;
+	std::string log;
+};
+
+static GLFWwindow* s_compile_window = NULL;
+static std::thread s_compile_thread;
+static std::mutex s_jobs_mutex;
+static std::condition_variable s_jobs_condition;
+static std::deque<sShaderJob*> s_pending_jobs;
+static std::deque<sShaderJob*> s_done_jobs;
+static bool s_compile_thread_exit = false;
+
+//same order as the UNIFORM_* handles
+std::vector<std::string> Shader::s_uniform_names = {
+	"u_viewprojection", "u_camera_position", "u_model", "u_animated",
+	"u_color", "u_texture", "u_Ka", "u_Kd", "u_Ks",
+	"u_normal_texture", "u_animation_texture", "u_animation_frame"
+};
+std::map<std::string, int, std::less<>> Shader::s_uniform_handles = {
+	{ "u_viewprojection", UNIFORM_VIEWPROJECTION }, { "u_camera_position", UNIFORM_CAMERA_POSITION },
+	{ "u_model", UNIFORM_MODEL }, { "u_animated", UNIFORM_ANIMATED }, { "u_color", UNIFORM_COLOR },
+	{ "u_texture", UNIFORM_TEXTURE }, { "u_Ka", UNIFORM_KA }, { "u_Kd", UNIFORM_KD }, { "u_Ks", UNIFORM_KS },
+	{ "u_normal_texture", UNIFORM_NORMAL_TEXTURE }, { "u_animation_texture", UNIFORM_ANIMATION_TEXTURE }, { "u_animation_frame", UNIFORM_ANIMATION_FRAME }
+};
 
 Shader::Shader()
 {
@@ -64,6 +107,9 @@ Shader::Shader()
 		Shader::init();
 	compiled = false;
 	from_atlas = false;
+	pending = false;
+	vs = fs = program = 0;
+	uniform_blocks = 0;
 }
 
 Shader::~Shader()
@@ -90,6 +136,33 @@ bool Shader::load(const std::string& vsf, const std::string& psf, const char* ma
 
 	std::cout << " + Shader: Vertex: " << vsf << "  Pixel: " << psf << "  " << (macros && printMacros ? macros : "") << std::endl;
 	std::string vsm, psm;
+	if (!read_sources(vsf, psf, macros, vsm, psm))
+		return false;
+
+	if (!compile_from_memory(vsm, psm))
+		return false;
+
+	assert(glGetError() == GL_NO_ERROR);
+
+	return true;
+}
+
+//the macros have to go after the #version line, which must be the first one of the shader
+static std::string insert_macros(const std::string& code, const char* macros)
+{
+	size_t pos = code.find("#version");
+	if (pos == std::string::npos)
+		return macros + code;
+
+	pos = code.find('\n', pos);
+	if (pos == std::string::npos)
+		return code + "\n" + macros;
+
+	return code.substr(0, pos + 1) + macros + code.substr(pos + 1);
+}
+
+bool Shader::read_sources(const std::string& vsf, const std::string& psf, const char* macros, std::string& vsm, std::string& psm)
+{
 	if (!read_file(vsf, vsm) || !read_file(psf, psm))
 		return false;
 
@@ -97,16 +170,10 @@ bool Shader::load(const std::string& vsf, const std::string& psf, const char* ma
 	//printf("Fragment shader from memory:\n%s\n", psm.c_str());
 	if (macros)
 	{
-		vsm = macros + vsm;
-		psm = macros + psm;
+		vsm = insert_macros(vsm, macros);
+		psm = insert_macros(psm, macros);
 		this->macros = macros;
 	}
-
-	if (!compile_from_memory(vsm, psm))
-		return false;
-
-	assert(glGetError() == GL_NO_ERROR);
-
 	return true;
 }
 
@@ -125,8 +192,9 @@ Shader* Shader::get(const char* vsf, const char* psf, const char* macros)
 	if (!psf)
 		return NULL;
 
+	//with the background compiler the shader is returned before it is compiled
 	Shader* sh = new Shader();
-	if (!sh->load(vsf, psf, macros))
+	if (!(s_compile_window ? sh->load_async(vsf, psf, macros) : sh->load(vsf, psf, macros)))
 		return NULL;
 	s_Shaders[name] = sh;
 	return sh;
@@ -134,8 +202,9 @@ Shader* Shader::get(const char* vsf, const char* psf, const char* macros)
 
 void Shader::reload_all()
 {
+	//in background the old programs are used until the new ones are ready
 	for (std::map<std::string, Shader*>::iterator it = s_Shaders.begin(); it != s_Shaders.end(); it++)
-		it->second->recompile();
+		s_compile_window ? it->second->recompile_async() : it->second->recompile();
 	if (!s_shader_atlas_filename.empty())
 		load_atlas(s_shader_atlas_filename.c_str());
 	std::cout << "Shaders recompiled" << std::endl;
@@ -303,9 +372,24 @@ bool Shader::compile_from_memory(const std::string& vsm, const std::string& psm)
 		exit(0);
 	}
 
+	//try the program binary cache first
+	uint64_t cache_key = 0;
+	if (use_program_cache && is_program_binary_supported())
+	{
+		cache_key = get_program_key(vsm, psm);
+		if (load_program_binary(cache_key))
+		{
+			on_program_linked();
+			return true;
+		}
+	}
+
 	program = glCreateProgram();
 	assert(glGetError() == GL_NO_ERROR);
 
+	if (cache_key)
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
 	if (!create_vertex_shader_object(vsm))
 	{
 		printf("Vertex shader compilation failed\n");
@@ -337,11 +421,24 @@ bool Shader::compile_from_memory(const std::string& vsm, const std::string& psm)
 	validate();
 #endif
 
-	compiled = true;
+	on_program_linked();
+
+	if (cache_key)
+		save_program_binary(cache_key);
 
 	return true;
 }
 
+void Shader::on_program_linked()
+{
+	compiled = true;
+
+	//resolve every known uniform once, the draw path only indexes this table
+	uniform_shadows.clear();
+	resolve_uniforms();
+	bind_uniform_blocks();
+}
+
 bool Shader::validate()
 {
 	glValidateProgram(program);
@@ -433,6 +530,8 @@ void Shader::release()
 	}
 
 	locations.clear();
+	uniform_shadows.clear();
+	uniform_blocks = 0;
 
 	compiled = false;
 }
@@ -445,6 +544,8 @@ void Shader::enable()
 
 	current = this;
 
+	PROFILE_SCOPE("Shader bind");
+	Profiler::counters.shader_binds++;
 	glUseProgram(program);
 	GLuint err = glGetError();
 	assert(err == GL_NO_ERROR);
@@ -564,9 +665,7 @@ int Shader::get_uniform_location(const char* varname)
 
 void Shader::set_texture(const char* varname, Texture* tex, int slot)
 {
-	glBindTexture(tex->texture_type, tex->texture_id);
-	glActiveTexture(GL_TEXTURE0 + slot);
-	set_uniform1(varname, slot);
+	set_uniform(get_uniform_handle(varname), tex, slot);
 }
 
 /*
@@ -580,166 +679,655 @@ void Shader::set_texture(const char* varname, unsigned int tex)
 }
 */
 
+//the setters by name go through the same shadow as the handles, so both paths agree on what GL holds
+
 void Shader::set_uniform1(const char* varname, bool input1)
 {
-	GLint loc = get_location(varname, &locations);
-	CHECK_SHADER_VAR(loc, varname);
-	glUniform1i(loc, input1);
-	assert(glGetError() == GL_NO_ERROR);
+	set_uniform(get_uniform_handle(varname), (int)input1);
 }
 
 void Shader::set_uniform1(const char* varname, int input1)
 {
-	GLint loc = get_location(varname, &locations);
-	CHECK_SHADER_VAR(loc, varname);
-	glUniform1i(loc, input1);
-	assert(glGetError() == GL_NO_ERROR);
+	set_uniform(get_uniform_handle(varname), input1);
 }
 
 void Shader::set_uniform2(const char* varname, int input1, int input2)
 {
-	GLint loc = get_location(varname, &locations);
+	int handle = get_uniform_handle(varname);
+	GLint loc = get_handle_location(handle);
 	CHECK_SHADER_VAR(loc, varname);
+	int data[2] = { input1, input2 };
+	if (!update_shadow(handle, data, sizeof(data))) return;
 	glUniform2i(loc, input1, input2);
 	assert(glGetError() == GL_NO_ERROR);
 }
 
 void Shader::set_uniform3(const char* varname, int input1, int input2, int input3)
 {
-	GLint loc = get_location(varname, &locations);
+	int handle = get_uniform_handle(varname);
+	GLint loc = get_handle_location(handle);
 	CHECK_SHADER_VAR(loc, varname);
+	int data[3] = { input1, input2, input3 };
+	if (!update_shadow(handle, data, sizeof(data))) return;
 	glUniform3i(loc, input1, input2, input3);
 	assert(glGetError() == GL_NO_ERROR);
 }
 
-void Shader::set_uniform4(const char* varname, const int input1, const int input2, const int input3, const int input4)
+void Shader::set_uniform4(const char* varname, int input1, int input2, int input3, int input4)
 {
-	GLint loc = get_location(varname, &locations);
+	int handle = get_uniform_handle(varname);
+	GLint loc = get_handle_location(handle);
 	CHECK_SHADER_VAR(loc, varname);
+	int data[4] = { input1, input2, input3, input4 };
+	if (!update_shadow(handle, data, sizeof(data))) return;
 	glUniform4i(loc, input1, input2, input3, input4);
 	assert(glGetError() == GL_NO_ERROR);
 }
 
 void Shader::set_uniform1_array(const char* varname, const int* input, const int count)
 {
-	GLint loc = get_location(varname, &locations);
+	int handle = get_uniform_handle(varname);
+	GLint loc = get_handle_location(handle);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform1iv(loc, count, input);
+	invalidate_shadow(handle);
 	assert(glGetError() == GL_NO_ERROR);
 }
 
 void Shader::set_uniform2_array(const char* varname, const int* input, const int count)
 {
-	GLint loc = get_location(varname, &locations);
+	int handle = get_uniform_handle(varname);
+	GLint loc = get_handle_location(handle);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform2iv(loc, count, input);
+	invalidate_shadow(handle);
 	assert(glGetError() == GL_NO_ERROR);
 }
 
 void Shader::set_uniform3_array(const char* varname, const int* input, const int count)
 {
-	GLint loc = get_location(varname, &locations);
+	int handle = get_uniform_handle(varname);
+	GLint loc = get_handle_location(handle);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform3iv(loc, count, input);
+	invalidate_shadow(handle);
 	assert(glGetError() == GL_NO_ERROR);
 }
 
 void Shader::set_uniform4_array(const char* varname, const int* input, const int count)
 {
-	GLint loc = get_location(varname, &locations);
+	int handle = get_uniform_handle(varname);
+	GLint loc = get_handle_location(handle);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform4iv(loc, count, input);
+	invalidate_shadow(handle);
 	assert(glGetError() == GL_NO_ERROR);
 }
 
 void Shader::set_uniform1(const char* varname, const float input1)
 {
-	GLint loc = get_location(varname, &locations);
-	CHECK_SHADER_VAR(loc, varname);
-	glUniform1f(loc, input1);
-	assert(glGetError() == GL_NO_ERROR);
+	set_uniform(get_uniform_handle(varname), input1);
 }
 
 void Shader::set_uniform2(const char* varname, const float input1, const float input2)
 {
-	GLint loc = get_location(varname, &locations);
-	CHECK_SHADER_VAR(loc, varname);
-	glUniform2f(loc, input1, input2);
-	assert(glGetError() == GL_NO_ERROR);
+	set_uniform(get_uniform_handle(varname), vec2(input1, input2));
 }
 
 void Shader::set_uniform3(const char* varname, const float input1, const float input2, const float input3)
 {
-	GLint loc = get_location(varname, &locations);
-	CHECK_SHADER_VAR(loc, varname);
-	glUniform3f(loc, input1, input2, input3);
-	assert(glGetError() == GL_NO_ERROR);
+	set_uniform(get_uniform_handle(varname), vec3(input1, input2, input3));
 }
 
 void Shader::set_uniform4(const char* varname, const float input1, const float input2, const float input3, const float input4)
 {
-	GLint loc = get_location(varname, &locations);
-	CHECK_SHADER_VAR(loc, varname);
-	glUniform4f(loc, input1, input2, input3, input4);
-	check_gl_errors();
+	set_uniform(get_uniform_handle(varname), vec4(input1, input2, input3, input4));
 }
 
 void Shader::set_uniform1_array(const char* varname, const float* input, const int count)
 {
-	GLint loc = get_location(varname, &locations);
+	int handle = get_uniform_handle(varname);
+	GLint loc = get_handle_location(handle);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform1fv(loc, count, input);
+	invalidate_shadow(handle);
 	assert(glGetError() == GL_NO_ERROR);
 }
 
 void Shader::set_uniform2_array(const char* varname, const float* input, const int count)
 {
-	GLint loc = get_location(varname, &locations);
+	int handle = get_uniform_handle(varname);
+	GLint loc = get_handle_location(handle);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform2fv(loc, count, input);
+	invalidate_shadow(handle);
 	assert(glGetError() == GL_NO_ERROR);
 }
 
 void Shader::set_uniform3_array(const char* varname, const float* input, const int count)
 {
-	GLint loc = get_location(varname, &locations);
+	int handle = get_uniform_handle(varname);
+	GLint loc = get_handle_location(handle);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform3fv(loc, count, input);
+	invalidate_shadow(handle);
 	assert(glGetError() == GL_NO_ERROR);
 }
 
 void Shader::set_uniform4_array(const char* varname, const float* input, const int count)
 {
-	GLint loc = get_location(varname, &locations);
+	int handle = get_uniform_handle(varname);
+	GLint loc = get_handle_location(handle);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform4fv(loc, count, input);
+	invalidate_shadow(handle);
 	assert(glGetError() == GL_NO_ERROR);
 }
 
 void Shader::set_matrix4(const char* varname, const float* m)
 {
-	GLint loc = get_location(varname, &locations);
+	int handle = get_uniform_handle(varname);
+	GLint loc = get_handle_location(handle);
 	CHECK_SHADER_VAR(loc, varname);
+	if (!update_shadow(handle, m, sizeof(float) * 16)) return;
 	glUniformMatrix4fv(loc, 1, GL_FALSE, m);
 	assert(glGetError() == GL_NO_ERROR);
 }
 
 void Shader::set_matrix4(const char* varname, const mat4& m)
 {
-	GLint loc = get_location(varname, &locations);
-	CHECK_SHADER_VAR(loc, varname);
-	glUniformMatrix4fv(loc, 1, GL_FALSE, m.data);
-	assert(glGetError() == GL_NO_ERROR);
+	set_uniform(get_uniform_handle(varname), m);
 }
 
 void Shader::set_matrix4_array(const char* varname, mat4* m_array, int num)
 {
-	GLint loc = get_location(varname, &locations);
-	CHECK_SHADER_VAR(loc, varname);
-	glUniformMatrix4fv(loc, num, GL_FALSE, (GLfloat*)m_array);
+	set_uniform(get_uniform_handle(varname), m_array, num);
+}
+
+int Shader::get_uniform_handle(const char* varname)
+{
+	auto it = s_uniform_handles.find(varname);
+	if (it != s_uniform_handles.end())
+		return it->second;
+
+	int handle = (int)s_uniform_names.size();
+	s_uniform_names.push_back(varname);
+	s_uniform_handles[varname] = handle;
+	return handle;
+}
+
+void Shader::resolve_uniforms()
+{
+	size_t first = uniform_shadows.size();
+	uniform_shadows.resize(s_uniform_names.size());
+
+	for (size_t i = first; i < uniform_shadows.size(); i++)
+	{
+		sUniformShadow& uniform = uniform_shadows[i];
+		uniform.location = program ? glGetUniformLocation(program, s_uniform_names[i].c_str()) : -1;
+		uniform.valid = false;
+	}
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void Shader::bind_uniform_blocks()
+{
+	//same order as the block bindings
+	static const char* block_names[NUM_BLOCK_BINDINGS] = { "FrameBlock", "MaterialBlock", "ObjectBlock", "MaterialTableBlock" };
+
+	uniform_blocks = 0;
+	for (unsigned int i = 0; i < NUM_BLOCK_BINDINGS; i++)
+	{
+		GLuint index = glGetUniformBlockIndex(program, block_names[i]);
+		if (index == GL_INVALID_INDEX)
+			continue;
+
+		glUniformBlockBinding(program, index, i);
+		uniform_blocks |= 1 << i;
+	}
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+GLint Shader::get_handle_location(int handle)
+{
+	assert(current == this);
+	assert(handle >= 0 && handle < (int)s_uniform_names.size());
+
+	//handles registered after linking
+	if (handle >= (int)uniform_shadows.size())
+		resolve_uniforms();
+	return uniform_shadows[handle].location;
+}
+
+bool Shader::update_shadow(int handle, const void* data, size_t size)
+{
+	sUniformShadow& uniform = uniform_shadows[handle];
+	if (uniform.valid && memcmp(uniform.data, data, size) == 0)
+		return false;
+
+	memcpy(uniform.data, data, size);
+	uniform.valid = true;
+	return true;
+}
+
+void Shader::set_uniform(int handle, int input)
+{
+	GLint loc = get_handle_location(handle);
+	CHECK_SHADER_VAR(loc, s_uniform_names[handle].c_str());
+	if (!update_shadow(handle, &input, sizeof(int))) return;
+	glUniform1i(loc, input);
 	assert(glGetError() == GL_NO_ERROR);
 }
 
+void Shader::set_uniform(int handle, float input)
+{
+	GLint loc = get_handle_location(handle);
+	CHECK_SHADER_VAR(loc, s_uniform_names[handle].c_str());
+	if (!update_shadow(handle, &input, sizeof(float))) return;
+	glUniform1f(loc, input);
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void Shader::set_uniform(int handle, const vec2& input)
+{
+	GLint loc = get_handle_location(handle);
+	CHECK_SHADER_VAR(loc, s_uniform_names[handle].c_str());
+	if (!update_shadow(handle, input.v, sizeof(float) * 2)) return;
+	glUniform2f(loc, input.x, input.y);
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void Shader::set_uniform(int handle, const vec3& input)
+{
+	GLint loc = get_handle_location(handle);
+	CHECK_SHADER_VAR(loc, s_uniform_names[handle].c_str());
+	if (!update_shadow(handle, input.v, sizeof(float) * 3)) return;
+	glUniform3f(loc, input.x, input.y, input.z);
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void Shader::set_uniform(int handle, const vec4& input)
+{
+	GLint loc = get_handle_location(handle);
+	CHECK_SHADER_VAR(loc, s_uniform_names[handle].c_str());
+	if (!update_shadow(handle, input.v, sizeof(float) * 4)) return;
+	glUniform4f(loc, input.x, input.y, input.z, input.w);
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void Shader::set_uniform(int handle, const mat4& input)
+{
+	GLint loc = get_handle_location(handle);
+	CHECK_SHADER_VAR(loc, s_uniform_names[handle].c_str());
+	if (!update_shadow(handle, input.data, sizeof(float) * 16)) return;
+	glUniformMatrix4fv(loc, 1, GL_FALSE, input.data);
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void Shader::set_uniform(int handle, const mat4* matrices, int count)
+{
+	assert(count);
+	GLint loc = get_handle_location(handle);
+	CHECK_SHADER_VAR(loc, s_uniform_names[handle].c_str());
+	glUniformMatrix4fv(loc, count, GL_FALSE, (GLfloat*)matrices);
+	invalidate_shadow(handle); //the first element may not match the shadow anymore
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void Shader::set_uniform(int handle, Texture* texture, int slot)
+{
+	//the binding is global state so it is always done, only the sampler slot is shadowed
+	Profiler::counters.texture_binds++;
+	glActiveTexture(GL_TEXTURE0 + slot);
+	glBindTexture(texture->texture_type, texture->texture_id);
+	set_uniform(handle, slot);
+}
+
+bool Shader::is_program_binary_supported()
+{
+	static int supported = -1;
+	if (supported == -1)
+	{
+		//GL 4.1 core or the ARB extension in older contexts, and the driver must expose at least one format
+		GLint num_formats = 0;
+		if (glfwExtensionSupported("GL_ARB_get_program_binary"))
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+		supported = num_formats > 0;
+	}
+	return supported == 1;
+}
+
+uint64_t Shader::get_program_key(const std::string& vsm, const std::string& psm)
+{
+	//the driver string is part of the key: a binary from another driver version would be rejected anyway
+	static std::string driver;
+	if (driver.empty())
+	{
+		const char* strings[] = { (const char*)glGetString(GL_VENDOR), (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION) };
+		for (int i = 0; i < 3; i++)
+			driver += std::string(strings[i] ? strings[i] : "") + "|";
+	}
+
+	//FNV-1a
+	uint64_t hash = 14695981039346656037ULL;
+	const std::string* parts[] = { &vsm, &psm, &driver };
+	for (int i = 0; i < 3; i++)
+	{
+		for (size_t j = 0; j < parts[i]->size(); j++)
+		{
+			hash ^= (unsigned char)(*parts[i])[j];
+			hash *= 1099511628211ULL;
+		}
+		hash ^= 0xff; //separator
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+struct sProgramBinaryHeader
+{
+	char watermark[4]; //"PBIN"
+	uint64_t key;
+	GLenum format;
+	GLint size;
+};
+
+static std::string get_program_cache_filename(uint64_t key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.pbin", (unsigned long long)key);
+	return Shader::s_program_cache_path + name;
+}
+
+bool Shader::load_program_binary(uint64_t key)
+{
+	std::ifstream file(get_program_cache_filename(key), std::ios::binary);
+	if (!file.good())
+		return false;
+
+	sProgramBinaryHeader header;
+	file.read((char*)&header, sizeof(header));
+	if (!file.good() || memcmp(header.watermark, "PBIN", 4) != 0 || header.key != key || header.size <= 0)
+		return false;
+
+	std::vector<char> data(header.size);
+	file.read(data.data(), header.size);
+	if (!file.good())
+		return false;
+
+	program = glCreateProgram();
+	glProgramBinary(program, header.format, data.data(), header.size);
+
+	//the driver can reject the binary (update, different GPU), then it is compiled from source again
+	GLint linked = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	glGetError();
+	if (!linked)
+	{
+		glDeleteProgram(program);
+		program = 0;
+		return false;
+	}
+	return true;
+}
+
+void Shader::save_program_binary(uint64_t key)
+{
+	GLint size = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+	if (size <= 0)
+		return;
+
+	sProgramBinaryHeader header;
+	memcpy(header.watermark, "PBIN", 4);
+	header.key = key;
+	header.size = 0;
+
+	std::vector<char> data(size);
+	glGetProgramBinary(program, size, &header.size, &header.format, data.data());
+	if (glGetError() != GL_NO_ERROR || header.size <= 0)
+		return;
+
+	std::error_code error;
+	std::filesystem::create_directories(s_program_cache_path, error);
+
+	std::ofstream file(get_program_cache_filename(key), std::ios::binary);
+	if (!file.good())
+	{
+		std::cout << "[ERROR] cannot write program binary in " << s_program_cache_path << std::endl;
+		return;
+	}
+	file.write((const char*)&header, sizeof(header));
+	file.write(data.data(), header.size);
+}
+
+//runs in the compile thread, only touches GL objects and the job
+static void compile_job(sShaderJob* job)
+{
+	const std::string* sources[] = { &job->vsm, &job->psm };
+	GLenum types[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+	GLuint handles[2] = { 0, 0 };
+	bool ok = true;
+
+	job->program = glCreateProgram();
+	if (job->cache_key)
+		glProgramParameteri(job->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+	for (int i = 0; i < 2 && ok; i++)
+	{
+		handles[i] = glCreateShader(types[i]);
+		const char* ptr = sources[i]->c_str();
+		glShaderSource(handles[i], 1, &ptr, NULL);
+		glCompileShader(handles[i]);
+
+		GLint compile = 0;
+		glGetShaderiv(handles[i], GL_COMPILE_STATUS, &compile);
+		if (!compile)
+		{
+			char log[4096];
+			glGetShaderInfoLog(handles[i], sizeof(log), NULL, log);
+			job->log += log;
+			ok = false;
+		}
+		glAttachShader(job->program, handles[i]);
+	}
+
+	if (ok)
+	{
+		glLinkProgram(job->program);
+
+		GLint linked = 0;
+		glGetProgramiv(job->program, GL_LINK_STATUS, &linked);
+		if (!linked)
+		{
+			char log[4096];
+			glGetProgramInfoLog(job->program, sizeof(log), NULL, log);
+			job->log += log;
+			ok = false;
+		}
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		if (!handles[i]) continue;
+		glDetachShader(job->program, handles[i]);
+		glDeleteShader(handles[i]);
+	}
+
+	if (!ok)
+	{
+		glDeleteProgram(job->program);
+		job->program = 0;
+	}
+
+	//the program has to be complete before the main context uses it
+	glFinish();
+}
+
+static void compile_thread_main()
+{
+	glfwMakeContextCurrent(s_compile_window);
+
+	while (true)
+	{
+		sShaderJob* job = NULL;
+		{
+			std::unique_lock<std::mutex> lock(s_jobs_mutex);
+			s_jobs_condition.wait(lock, [] { return s_compile_thread_exit || !s_pending_jobs.empty(); });
+			if (s_compile_thread_exit)
+				break;
+			job = s_pending_jobs.front();
+			s_pending_jobs.pop_front();
+		}
+
+		compile_job(job);
+
+		std::lock_guard<std::mutex> lock(s_jobs_mutex);
+		s_done_jobs.push_back(job);
+	}
+
+	glfwMakeContextCurrent(NULL);
+}
+
+static void enqueue_job(Shader* shader, const std::string& vsm, const std::string& psm, uint64_t cache_key)
+{
+	sShaderJob* job = new sShaderJob();
+	job->shader = shader;
+	job->vsm = vsm;
+	job->psm = psm;
+	job->cache_key = cache_key;
+	job->program = 0;
+	shader->pending = true;
+
+	{
+		std::lock_guard<std::mutex> lock(s_jobs_mutex);
+		s_pending_jobs.push_back(job);
+	}
+	s_jobs_condition.notify_one();
+}
+
+void Shader::init_async(GLFWwindow* main_window)
+{
+	if (s_compile_window)
+		return;
+
+	//hidden window with the same context version, sharing the objects with the main context
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	s_compile_window = glfwCreateWindow(1, 1, "Shader compiler", NULL, main_window);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+
+	if (!s_compile_window)
+	{
+		std::cout << "[WARN] Shared context not available, shaders will compile in the main thread" << std::endl;
+		return;
+	}
+
+	s_compile_thread_exit = false;
+	s_compile_thread = std::thread(compile_thread_main);
+}
+
+void Shader::shutdown_async()
+{
+	if (!s_compile_window)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(s_jobs_mutex);
+		s_compile_thread_exit = true;
+	}
+	s_jobs_condition.notify_all();
+	s_compile_thread.join();
+
+	glfwDestroyWindow(s_compile_window);
+	s_compile_window = NULL;
+
+	for (sShaderJob* job : s_pending_jobs) delete job;
+	for (sShaderJob* job : s_done_jobs) delete job;
+	s_pending_jobs.clear();
+	s_done_jobs.clear();
+}
+
+bool Shader::load_async(const std::string& vsf, const std::string& psf, const char* macros)
+{
+	assert(compiled == false);
+
+	vs_filename = vsf;
+	ps_filename = psf;
+	from_atlas = false;
+
+	std::cout << " + Shader (async): Vertex: " << vsf << "  Pixel: " << psf << std::endl;
+	std::string vsm, psm;
+	if (!read_sources(vsf, psf, macros, vsm, psm))
+		return false;
+
+	if (!s_compile_window)
+		return compile_from_memory(vsm, psm);
+
+	//a cached binary is as fast as it gets, no need to go to the other thread
+	uint64_t cache_key = 0;
+	if (use_program_cache && is_program_binary_supported())
+	{
+		cache_key = get_program_key(vsm, psm);
+		if (load_program_binary(cache_key))
+		{
+			on_program_linked();
+			return true;
+		}
+	}
+
+	enqueue_job(this, vsm, psm, cache_key);
+	return true;
+}
+
+bool Shader::recompile_async()
+{
+	if (from_atlas || pending || !vs_filename.size() || !ps_filename.size())
+		return false;
+
+	//the current program keeps working until the new one replaces it
+	std::string vsm, psm;
+	if (!read_sources(vs_filename, ps_filename, macros.size() ? macros.c_str() : NULL, vsm, psm))
+		return false;
+
+	uint64_t cache_key = use_program_cache && is_program_binary_supported() ? get_program_key(vsm, psm) : 0;
+	enqueue_job(this, vsm, psm, cache_key);
+	return true;
+}
+
+void Shader::update_async()
+{
+	std::deque<sShaderJob*> done;
+	{
+		std::lock_guard<std::mutex> lock(s_jobs_mutex);
+		done.swap(s_done_jobs);
+	}
+
+	for (sShaderJob* job : done)
+	{
+		Shader* shader = job->shader;
+		shader->pending = false;
+
+		if (!job->program)
+		{
+			std::cout << " * Shader compilation failed: " << shader->vs_filename << ", " << shader->ps_filename << "\n" << job->log << std::endl;
+			delete job;
+			continue;
+		}
+
+		//replace the old program
+		if (current == shader)
+			shader->disable();
+		shader->release();
+		shader->program = job->program;
+		shader->on_program_linked();
+
+		if (job->cache_key)
+			shader->save_program_binary(job->cache_key);
+
+		delete job;
+	}
+}
+
 void Shader::init()
 {
 	static bool firsttime = true;
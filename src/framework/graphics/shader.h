@@ -14,7 +14,9 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <functional>
 #include <cassert>
+#include <cstdint>
 
 #ifdef _DEBUG
 #define CHECK_SHADER_VAR(a,b) if (a == -1) return
@@ -56,18 +58,43 @@ public:
 	virtual bool is_uniform(const char* varname) { return (get_uniform_location(varname) != -1); } //uniform exist
 	virtual bool is_attribute(const char* varname) { return (get_attribute_location(varname) != -1); } //attribute exist
 
-	//upload
-	void set_uniform(const char* varname, bool input) { assert(current == this); set_uniform1(varname, input); }
-	void set_uniform(const char* varname, int input) { assert(current == this); set_uniform1(varname, input); }
-	void set_uniform(const char* varname, float input) { assert(current == this); set_uniform1(varname, input); }
-	void set_uniform(const char* varname, const vec2& input) { assert(current == this); set_uniform2(varname, input.x, input.y); }
-	void set_uniform(const char* varname, const vec3& input) { assert(current == this); set_uniform3(varname, input.x, input.y, input.z); }
-	void set_uniform(const char* varname, const vec4& input) { assert(current == this); set_uniform4(varname, input.x, input.y, input.z, input.w); }
-	void set_uniform(const char* varname, const mat4& input) { assert(current == this); set_matrix4(varname, input); }
-	void set_uniform(const char* varname, std::vector<mat4>& m_vector) { assert(current == this && m_vector.size()); set_matrix4_array(varname, &m_vector[0], static_cast<int>(m_vector.size())); }
+	//uniform handles: a name is registered once and gets an integer handle that is valid for every shader,
+	//the location of each handle is resolved after linking so uploading by handle does no string work
+	enum {
+		UNIFORM_VIEWPROJECTION, UNIFORM_CAMERA_POSITION, UNIFORM_MODEL, UNIFORM_ANIMATED,
+		UNIFORM_COLOR, UNIFORM_TEXTURE, UNIFORM_KA, UNIFORM_KD, UNIFORM_KS,
+		UNIFORM_NORMAL_TEXTURE, UNIFORM_ANIMATION_TEXTURE, UNIFORM_ANIMATION_FRAME, NUM_BUILTIN_UNIFORMS
+	};
+	static int get_uniform_handle(const char* varname); //registers the name the first time (do it at load time, not per draw)
+	static const char* get_uniform_name(int handle) { return s_uniform_names[handle].c_str(); }
+
+	//upload by handle: the last value uploaded to each uniform is kept, so unchanged values do not reach GL
+	void set_uniform(int handle, bool input) { set_uniform(handle, (int)input); }
+	void set_uniform(int handle, int input);
+	void set_uniform(int handle, float input);
+	void set_uniform(int handle, const vec2& input);
+	void set_uniform(int handle, const vec3& input);
+	void set_uniform(int handle, const vec4& input);
+	void set_uniform(int handle, const mat4& input);
+	void set_uniform(int handle, std::vector<mat4>& m_vector) { set_uniform(handle, m_vector.data(), (int)m_vector.size()); }
+	void set_uniform(int handle, const mat4* matrices, int count); //arrays are not shadowed, they are uploaded always
+	void set_uniform(int handle, Texture* texture, int slot);
+
+	//std140 uniform blocks (see uniform_buffer.h), the blocks found in the program are bound to their fixed binding after linking
+	bool has_uniform_block(unsigned int binding) { return (uniform_blocks >> binding) & 1; }
+
+	//upload by name (goes through the handle table, prefer the handles in the draw path)
+	void set_uniform(const char* varname, bool input) { set_uniform(get_uniform_handle(varname), input); }
+	void set_uniform(const char* varname, int input) { set_uniform(get_uniform_handle(varname), input); }
+	void set_uniform(const char* varname, float input) { set_uniform(get_uniform_handle(varname), input); }
+	void set_uniform(const char* varname, const vec2& input) { set_uniform(get_uniform_handle(varname), input); }
+	void set_uniform(const char* varname, const vec3& input) { set_uniform(get_uniform_handle(varname), input); }
+	void set_uniform(const char* varname, const vec4& input) { set_uniform(get_uniform_handle(varname), input); }
+	void set_uniform(const char* varname, const mat4& input) { set_uniform(get_uniform_handle(varname), input); }
+	void set_uniform(const char* varname, std::vector<mat4>& m_vector) { set_uniform(get_uniform_handle(varname), m_vector); }
 
 	//for textures you must specify an slot (a number from 0 to 16) where this texture is stored in the shader
-	void set_uniform(const char* varname, Texture* texture, int slot) { assert(current == this); set_texture(varname, texture, slot); }
+	void set_uniform(const char* varname, Texture* texture, int slot) { set_uniform(get_uniform_handle(varname), texture, slot); }
 
 
 	virtual void setInt(const char* varname, const int& input) { set_uniform1(varname, input); }
@@ -125,6 +152,22 @@ public:
 
 	static Shader* get_default_shader(std::string name);
 
+	//program binary cache: linked programs are stored in s_program_cache_path keyed by a hash of the sources (macros included)
+	//and the driver, so the next run skips compiling. Needs GL 4.1 or ARB_get_program_binary, otherwise it compiles always
+	static bool use_program_cache;
+	static std::string s_program_cache_path;
+	static bool is_program_binary_supported();
+
+	//background compilation in a shared context: Shader::get and reload_all return immediately and the programs are
+	//swapped in by update_async when they are ready (until then the shader is not compiled or keeps the old program)
+	static void init_async(GLFWwindow* main_window);
+	static void shutdown_async();
+	static void update_async(); //call it once per frame from the main thread
+	bool pending; //there is a compilation of this shader in the background
+
+	virtual bool load_async(const std::string& vsf, const std::string& psf, const char* macros);
+	virtual bool recompile_async();
+
 protected:
 
 	std::string info_log;
@@ -141,11 +184,43 @@ protected:
 
 	bool validate();
 
+	//things to do every time a new program is ready (from source, from the cache or from the background thread)
+	void on_program_linked();
+	uint64_t get_program_key(const std::string& vsm, const std::string& psm);
+	bool load_program_binary(uint64_t key);
+	void save_program_binary(uint64_t key);
+	//reads the sources of the files with the macros in front
+	bool read_sources(const std::string& vsf, const std::string& psf, const char* macros, std::string& vsm, std::string& psm);
+
 	GLuint vs;
 	GLuint fs;
 	GLuint program;
 	std::string log;
 
+	//location and last uploaded value of every uniform handle in this program
+	struct sUniformShadow
+	{
+		GLint location;
+		bool valid;
+		float data[16]; //enough for a mat4, ints are stored bitwise
+	};
+	std::vector<sUniformShadow> uniform_shadows;
+
+	static std::vector<std::string> s_uniform_names;
+	static std::map<std::string, int, std::less<>> s_uniform_handles;
+
+	unsigned int uniform_blocks; //bit mask of the block bindings used by the program
+
+	//resolves the locations of the handles registered since the last call (all of them after linking)
+	void resolve_uniforms();
+	void bind_uniform_blocks();
+	//location of the handle in this program (-1 if the uniform does not exist)
+	GLint get_handle_location(int handle);
+	//stores the value in the shadow of the handle, returns false if it did not change and the upload can be skipped
+	bool update_shadow(int handle, const void* data, size_t size);
+	//arrays are not shadowed, an upload makes the stored value unknown
+	void invalidate_shadow(int handle) { uniform_shadows[handle].valid = false; }
+
 	//this is a hack to speed up shader usage (save info locally)
 private:
 
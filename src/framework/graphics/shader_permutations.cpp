@@ -0,0 +1,124 @@
+#include "shader_permutations.h"
+
+#include "shader.h"
+#include "../utils.h"
+
+#include <cassert>
+#include <sstream>
+
+std::vector<ShaderPermutations::sProgram> ShaderPermutations::s_programs;
+std::map<unsigned int, Shader*> ShaderPermutations::s_permutations;
+
+// same order as the feature bits
+static const char* s_feature_names[NUM_SHADER_FEATURES] = { "SKINNED", "INSTANCED", "TEXTURED", "NORMAL_MAPPED", "BAKED_ANIMATION", "MULTI_DRAW" };
+
+void ShaderPermutations::init()
+{
+	if (s_programs.size())
+		return;
+
+	register_program("flat", "res/shaders/basic.vs", "res/shaders/flat.fs");
+	register_program("normal", "res/shaders/basic.vs", "res/shaders/normal.fs");
+	register_program("texture", "res/shaders/basic.vs", "res/shaders/texture.fs");
+	register_program("terrain", "res/shaders/terrain.vs", "res/shaders/terrain.fs");
+}
+
+int ShaderPermutations::register_program(const char* name, const char* vs_filename, const char* ps_filename)
+{
+	int program = get_program(name);
+	if (program != -1)
+		return program;
+
+	// the program index has to fit in the permutation id next to the feature bits
+	assert(s_programs.size() < (1u << (32 - NUM_SHADER_FEATURES)));
+
+	s_programs.push_back({ name, vs_filename, ps_filename });
+	return (int)s_programs.size() - 1;
+}
+
+int ShaderPermutations::get_program(const char* name)
+{
+	for (unsigned int i = 0; i < s_programs.size(); i++) {
+		if (s_programs[i].name == name)
+			return i;
+	}
+	return -1;
+}
+
+std::string ShaderPermutations::get_macros(unsigned int features)
+{
+	std::string macros;
+	for (int i = 0; i < NUM_SHADER_FEATURES; i++) {
+		if (features & (1 << i))
+			macros += std::string("#define ") + s_feature_names[i] + "\n";
+	}
+	return macros;
+}
+
+Shader* ShaderPermutations::get(int program, unsigned int features)
+{
+	return get(get_permutation_id(program, features));
+}
+
+Shader* ShaderPermutations::get(unsigned int permutation_id)
+{
+	auto it = s_permutations.find(permutation_id);
+	if (it != s_permutations.end())
+		return it->second;
+
+	int program = permutation_id >> NUM_SHADER_FEATURES;
+	unsigned int features = permutation_id & ((1 << NUM_SHADER_FEATURES) - 1);
+	if (program < 0 || program >= (int)s_programs.size())
+		return NULL;
+
+	sProgram& info = s_programs[program];
+	std::string macros = get_macros(features);
+
+	// Shader::get keeps the compiled shaders, here we only avoid building its string key every time
+	Shader* shader = Shader::get(info.vs_filename.c_str(), info.ps_filename.c_str(), macros.size() ? macros.c_str() : NULL);
+	s_permutations[permutation_id] = shader;
+	return shader;
+}
+
+bool ShaderPermutations::precompile(const char* manifest_filename)
+{
+	std::string content;
+	if (!read_file(manifest_filename, content)) {
+		std::cout << "[ERROR] Shader permutations manifest not found: " << manifest_filename << std::endl;
+		return false;
+	}
+
+	init();
+
+	std::vector<std::string> lines = tokenize(content, "\n");
+	for (unsigned int i = 0; i < lines.size(); i++) {
+		std::stringstream line(lines[i]);
+		std::string name;
+		if (!(line >> name) || name[0] == '#')
+			continue;
+
+		int program = get_program(name.c_str());
+		if (program == -1) {
+			std::cout << "[ERROR] Unknown shader program in manifest: " << name << std::endl;
+			continue;
+		}
+
+		unsigned int features = 0;
+		std::string feature;
+		while (line >> feature) {
+			int bit = -1;
+			for (int j = 0; j < NUM_SHADER_FEATURES; j++) {
+				if (feature == s_feature_names[j]) bit = j;
+			}
+			if (bit == -1) {
+				std::cout << "[ERROR] Unknown shader feature in manifest: " << feature << std::endl;
+				continue;
+			}
+			features |= 1 << bit;
+		}
+
+		get(program, features);
+	}
+
+	return true;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+class Shader;
+
+// Features a material can ask for, each one is a #define in the shader code
+enum {
+	SHADER_SKINNED = 1 << 0,			// joint matrices in u_animated
+	SHADER_INSTANCED = 1 << 1,			// model matrix as a per instance attribute
+	SHADER_TEXTURED = 1 << 2,			// albedo texture
+	SHADER_NORMAL_MAPPED = 1 << 3,		// normal texture
+	SHADER_BAKED_ANIMATION = 1 << 4,	// joint matrices read from an animation texture
+	SHADER_MULTI_DRAW = 1 << 5,			// model and material index per draw (see DrawBatch)
+	NUM_SHADER_FEATURES = 6
+};
+
+// Compiles and caches the macro variants of a few programs (vs + fs pairs). A permutation is identified by an int
+// made of the program index and the feature bits, so materials can be sorted and compared without any string
+class ShaderPermutations
+{
+public:
+	struct sProgram {
+		std::string name;
+		std::string vs_filename;
+		std::string ps_filename;
+	};
+
+	static std::vector<sProgram> s_programs;
+	static std::map<unsigned int, Shader*> s_permutations;
+
+	// registers the programs used by the materials
+	static void init();
+
+	// returns the index of the program (the existing one if the name is already registered)
+	static int register_program(const char* name, const char* vs_filename, const char* ps_filename);
+	static int get_program(const char* name);
+
+	static unsigned int get_permutation_id(int program, unsigned int features) { return ((unsigned int)program << NUM_SHADER_FEATURES) | features; }
+	static std::string get_macros(unsigned int features);
+
+	// compiles the permutation the first time it is requested
+	static Shader* get(int program, unsigned int features);
+	static Shader* get(unsigned int permutation_id);
+
+	// compiles the permutations listed in a manifest, one per line: program name followed by the feature names
+	// (e.g. "flat SKINNED INSTANCED"), lines starting with # are ignored
+	static bool precompile(const char* manifest_filename);
+};
@@ -0,0 +1,290 @@
+#include "terrain.h"
+
+#include "shader.h"
+#include "shader_permutations.h"
+#include "uniform_buffer.h"
+#include "image_sampler.h"
+#include "../utils.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+Terrain::Terrain() { }
+
+Terrain::~Terrain()
+{
+	delete grid;
+	delete height_texture;
+}
+
+bool Terrain::create(Image* heightmap, float size, float altitude, int num_lods, int grid_resolution)
+{
+	assert(heightmap && heightmap->data && "image without data");
+	assert(grid_resolution >= 2 && grid_resolution % 2 == 0 && "the grid needs an even number of quads");
+
+	this->size = size;
+	this->altitude = altitude;
+	this->grid_resolution = grid_resolution;
+
+	// first channel of the image, at the texel centers
+	heights_width = heightmap->width;
+	heights_height = heightmap->height;
+	heights.resize((size_t)heights_width * heights_height);
+	for (int y = 0; y < heights_height; y++)
+		for (int x = 0; x < heights_width; x++)
+			heights[(size_t)y * heights_width + x] = heightmap->data[((size_t)y * heights_width + x) * heightmap->bytes_per_pixel] / 255.f;
+
+	// finer nodes than the heightmap would only add vertices
+	this->num_lods = std::max(1, num_lods);
+	while (this->num_lods > 1 && (std::max(heights_width, heights_height) >> (this->num_lods - 1)) < grid_resolution)
+		this->num_lods--;
+
+	delete height_texture;
+	height_texture = new Texture(heights_width, heights_height, GL_RED, GL_FLOAT, false, (uint8_t*)heights.data(), GL_R32F);
+
+	build_grid();
+
+	nodes.clear();
+	build_node(vec2(0.f, 0.f), size, this->num_lods - 1);
+
+	set_lod_distance(size / (1 << (this->num_lods - 1)) * 2.f);
+	return true;
+}
+
+void Terrain::set_lod_distance(float distance)
+{
+	lod_distance = distance;
+	lod_ranges.resize(num_lods);
+	for (int i = 0; i < num_lods; i++)
+		lod_ranges[i] = lod_distance * (float)(1 << i);
+}
+
+// (N+1)^2 vertices in 0..1, with the triangles of every quadrant in a contiguous range of the indices
+void Terrain::build_grid()
+{
+	delete grid;
+	grid = new Mesh();
+
+	int n = grid_resolution;
+	grid->vertices.reserve((size_t)(n + 1) * (n + 1));
+	for (int z = 0; z <= n; z++)
+		for (int x = 0; x <= n; x++)
+			grid->vertices.push_back(vec3(x / (float)n, 0.f, z / (float)n));
+
+	grid->indices.reserve((size_t)n * n * 6);
+	grid->submeshes.resize(4);
+	for (int quadrant = 0; quadrant < 4; quadrant++)
+	{
+		sSubmeshInfo& submesh = grid->submeshes[quadrant];
+		memset(&submesh, 0, sizeof(sSubmeshInfo));
+		submesh.num_draw_calls = 1;
+		submesh.draw_calls[0].start = grid->indices.size();
+
+		int x0 = (quadrant % 2) * n / 2;
+		int z0 = (quadrant / 2) * n / 2;
+		for (int z = z0; z < z0 + n / 2; z++)
+		{
+			for (int x = x0; x < x0 + n / 2; x++)
+			{
+				unsigned int i00 = z * (n + 1) + x;
+				unsigned int i10 = i00 + 1;
+				unsigned int i01 = i00 + n + 1;
+				unsigned int i11 = i01 + 1;
+				grid->indices.insert(grid->indices.end(), { i00, i01, i10, i10, i01, i11 });
+			}
+		}
+
+		submesh.draw_calls[0].length = grid->indices.size() - submesh.draw_calls[0].start;
+	}
+
+	grid->box.center = vec3(0.5f, 0.f, 0.5f);
+	grid->box.halfsize = vec3(0.5f, 0.f, 0.5f);
+	grid->radius = len(grid->box.halfsize);
+	grid->upload_to_vram();
+}
+
+int Terrain::build_node(vec2 origin, float size, int level)
+{
+	int id = (int)nodes.size();
+	nodes.push_back(sTerrainNode());
+	nodes[id].origin = origin;
+	nodes[id].size = size;
+	nodes[id].level = level;
+
+	float min_height = 1.f, max_height = 0.f;
+	if (level == 0)
+	{
+		// texels under the node, one more on every side for the bilinear filtering
+		int x0 = std::max(0, (int)floorf(origin.x / this->size * heights_width) - 1);
+		int z0 = std::max(0, (int)floorf(origin.y / this->size * heights_height) - 1);
+		int x1 = std::min(heights_width - 1, (int)ceilf((origin.x + size) / this->size * heights_width) + 1);
+		int z1 = std::min(heights_height - 1, (int)ceilf((origin.y + size) / this->size * heights_height) + 1);
+		for (int z = z0; z <= z1; z++)
+		{
+			for (int x = x0; x <= x1; x++)
+			{
+				float h = heights[(size_t)z * heights_width + x];
+				min_height = std::min(min_height, h);
+				max_height = std::max(max_height, h);
+			}
+		}
+	}
+	else
+	{
+		float half = size * 0.5f;
+		for (int quadrant = 0; quadrant < 4; quadrant++)
+		{
+			vec2 child_origin(origin.x + (quadrant % 2) * half, origin.y + (quadrant / 2) * half);
+			int child = build_node(child_origin, half, level - 1);
+			nodes[id].children[quadrant] = child;
+			min_height = std::min(min_height, nodes[child].min_height);
+			max_height = std::max(max_height, nodes[child].max_height);
+		}
+	}
+
+	nodes[id].min_height = min_height;
+	nodes[id].max_height = max_height;
+	return id;
+}
+
+static bool box_in_frustum(const mat4& mvp, const vec3& box_min, const vec3& box_max)
+{
+	vec4 corners[8];
+	for (int i = 0; i < 8; i++)
+		corners[i] = mvp * vec4(i & 1 ? box_max.x : box_min.x, i & 2 ? box_max.y : box_min.y, i & 4 ? box_max.z : box_min.z, 1.f);
+
+	// outside if all the corners are on the outer side of one of the clip planes
+	for (int plane = 0; plane < 6; plane++)
+	{
+		int axis = plane / 2;
+		float sign = plane % 2 ? -1.f : 1.f;
+		bool all_outside = true;
+		for (int i = 0; i < 8 && all_outside; i++)
+			all_outside = sign * corners[i].v[axis] < -corners[i].w;
+		if (all_outside)
+			return false;
+	}
+	return true;
+}
+
+static bool sphere_intersects_box(const vec3& center, float radius, const vec3& box_min, const vec3& box_max)
+{
+	float dx = std::max(std::max(box_min.x - center.x, 0.f), center.x - box_max.x);
+	float dy = std::max(std::max(box_min.y - center.y, 0.f), center.y - box_max.y);
+	float dz = std::max(std::max(box_min.z - center.z, 0.f), center.z - box_max.z);
+	return dx * dx + dy * dy + dz * dz <= radius * radius;
+}
+
+// Returns false when the node is too far for its level, so the parent draws that area with its own level
+bool Terrain::select_node(int id, const vec3& camera_position, const mat4& mvp)
+{
+	const sTerrainNode& node = nodes[id];
+	vec3 box_min(node.origin.x, node.min_height * altitude, node.origin.y);
+	vec3 box_max(node.origin.x + node.size, node.max_height * altitude, node.origin.y + node.size);
+
+	if (!box_in_frustum(mvp, box_min, box_max)) {
+		num_nodes_culled++;
+		return true;
+	}
+
+	if (!sphere_intersects_box(camera_position, lod_ranges[node.level], box_min, box_max))
+		return false;
+
+	if (node.level == 0 || !sphere_intersects_box(camera_position, lod_ranges[node.level - 1], box_min, box_max)) {
+		selection.push_back({ id, -1 });
+		return true;
+	}
+
+	for (int quadrant = 0; quadrant < 4; quadrant++) {
+		if (!select_node(node.children[quadrant], camera_position, mvp))
+			selection.push_back({ id, quadrant });
+	}
+	return true;
+}
+
+void Terrain::select(Camera* camera, const mat4& model)
+{
+	selection.clear();
+	num_nodes_culled = 0;
+	if (nodes.empty())
+		return;
+
+	vec3 camera_position = transform_point(inverse(model), camera->eye);
+	mat4 mvp = camera->viewprojection_matrix * model;
+
+	// the root is drawn with the coarsest level even beyond its range
+	if (!select_node(0, camera_position, mvp))
+		selection.push_back({ 0, -1 });
+}
+
+void Terrain::render(Camera* camera, const mat4& model, const vec4& color)
+{
+	static int program = -1;
+	static int u_height_texture = Shader::get_uniform_handle("u_height_texture");
+	static int u_chunk = Shader::get_uniform_handle("u_chunk");
+	static int u_morph = Shader::get_uniform_handle("u_morph");
+	static int u_terrain = Shader::get_uniform_handle("u_terrain");
+	static int u_camera_local = Shader::get_uniform_handle("u_camera_local");
+
+	if (!grid)
+		return;
+
+	if (program == -1) {
+		ShaderPermutations::init();
+		program = ShaderPermutations::get_program("terrain");
+	}
+
+	// the shader can still be compiling in background
+	Shader* shader = ShaderPermutations::get(program, 0);
+	if (!shader || !shader->compiled)
+		return;
+
+	select(camera, model);
+
+	shader->enable();
+	UniformBlocks::use_camera(camera);
+	// drawn in the frame loop its object block is already uploaded
+	if (UniformBlocks::frame_object >= 0)
+		UniformBlocks::bind_frame_object(UniformBlocks::frame_object);
+	else
+		UniformBlocks::set_object(model);
+	shader->set_uniform(Shader::UNIFORM_COLOR, color);
+	shader->set_uniform(u_height_texture, height_texture, 0);
+	shader->set_uniform(u_terrain, vec4(size, altitude, 1.f / heights_width, 1.f / heights_height));
+	shader->set_uniform(u_camera_local, transform_point(inverse(model), camera->eye));
+
+	grid->enable_buffers(shader);
+	for (const sTerrainChunk& chunk : selection)
+	{
+		const sTerrainNode& node = nodes[chunk.node];
+		float range_start = node.level > 0 ? lod_ranges[node.level - 1] : 0.f;
+		float range_end = lod_ranges[node.level];
+
+		shader->set_uniform(u_chunk, vec4(node.origin.x, node.origin.y, node.size, (float)grid_resolution));
+		shader->set_uniform(u_morph, vec2(range_start + (range_end - range_start) * morph_ratio, range_end));
+		grid->draw_call(GL_TRIANGLES, chunk.quadrant, 0, 0);
+	}
+	grid->disable_buffers(shader);
+	shader->disable();
+
+	assert(check_gl_errors());
+}
+
+void Terrain::render_gui()
+{
+	float distance = lod_distance;
+	if (ImGui::DragFloat("LOD distance", &distance, 0.5f, 1.f, size))
+		set_lod_distance(distance);
+	ImGui::SliderFloat("Morph ratio", &morph_ratio, 0.f, 0.95f);
+	ImGui::Text("Levels: %d Chunks: %d Culled nodes: %d", num_lods, (int)selection.size(), num_nodes_culled);
+}
+
+float Terrain::get_height(float x, float z)
+{
+	vec2 uv(x / size, z / size);
+	float h = 0.f;
+	ImageSampler::sample(heights.data(), heights_width, heights_height, 1, 0, &uv, 1, &h);
+	return h * altitude;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vector>
+
+#include "mesh.h"
+#include "texture.h"
+#include "../camera.h"
+#include "../math/vec2.h"
+#include "../math/vec4.h"
+#include "../math/mat4.h"
+
+// Node of the terrain quadtree (level 0 are the smallest nodes, the root has the biggest level)
+struct sTerrainNode
+{
+	vec2 origin; // corner with the smallest x and z, in terrain space
+	float size;
+	float min_height; // 0..1 heights of the heightmap inside the node, for the bounding box
+	float max_height;
+	int level;
+	int children[4] = { -1, -1, -1, -1 }; // ordered by quadrant (z * 2 + x)
+};
+
+// Part of a node selected to be drawn this frame
+struct sTerrainChunk
+{
+	int node;
+	int quadrant; // -1 for the whole node, or the only quadrant of the node that has to be drawn
+};
+
+// Chunked terrain with continuous distance-based LOD (CDLOD). All the chunks are drawn with the same grid mesh
+// (a single index buffer, ordered by quadrants so a quarter of a node is a range of it) scaled to the size of
+// their quadtree node. The heights are read from a texture in the vertex shader, and the vertices of every chunk
+// morph into the grid of the next level as they approach the end of their LOD range, so there are no cracks
+// between chunks of different levels. Nodes are culled against the frustum with their bounding boxes
+class Terrain
+{
+public:
+	float size = 0.f; // width and depth in terrain space
+	float altitude = 0.f; // height of a white heightmap texel
+	int num_lods = 0;
+	int grid_resolution = 0; // quads per side of the grid of a chunk (even)
+	float lod_distance = 0.f; // range of the finest level, every coarser level doubles it
+	float morph_ratio = 0.7f; // part of every range where the vertices do not morph yet
+
+	std::vector<float> heights; // heightmap (0..1)
+	int heights_width = 0;
+	int heights_height = 0;
+	Texture* height_texture = NULL;
+	Mesh* grid = NULL;
+
+	std::vector<sTerrainNode> nodes; // nodes[0] is the root
+	std::vector<float> lod_ranges;
+	std::vector<sTerrainChunk> selection; // chunks selected by the last select()
+
+	unsigned int num_nodes_culled = 0;
+
+	Terrain();
+	~Terrain();
+
+	// builds the quadtree (the number of levels is clamped so the finest node has at least one texel per grid quad)
+	bool create(Image* heightmap, float size, float altitude, int num_lods = 6, int grid_resolution = 32);
+	void set_lod_distance(float distance);
+
+	// chooses the chunks to draw from the camera (the model places the terrain in the world)
+	void select(Camera* camera, const mat4& model);
+	void render(Camera* camera, const mat4& model, const vec4& color);
+	void render_gui();
+
+	// height in terrain space at a point of the terrain (bilinear, same as the vertex shader)
+	float get_height(float x, float z);
+
+protected:
+	void build_grid();
+	int build_node(vec2 origin, float size, int level);
+	bool select_node(int id, const vec3& camera_position, const mat4& mvp);
+};
@@ -1,6 +1,7 @@
 #include "texture.h"
 
 #include "../utils.h"
+#include "../profiler.h"
 
 #include <iostream> //to output
 #include <cmath>
@@ -8,6 +9,10 @@
 
 #include "mesh.h"
 #include "shader.h"
+#include "texture_loader.h"
+#include "texture_streamer.h"
+#include "image_sampler.h"
+#include "stb_image.h"
 #include <cassert>
 
 //bilinear interpolation
@@ -39,10 +44,17 @@ vec4 Image::get_pixel_interpolated_high(float x, float y, bool repeat) {
 	return lerp(top, bottom, fy);
 };
 
+void Image::sample(const vec2* uvs, int num, float* out, int channel, bool bicubic, bool repeat)
+{
+	assert(data && channel < bytes_per_pixel);
+	ImageSampler::sample(data, width, height, bytes_per_pixel, channel, uvs, num, out, bicubic ? ImageSampler::FILTER_BICUBIC : ImageSampler::FILTER_BILINEAR, repeat);
+}
+
 std::map<std::string, Texture*> Texture::s_textures_loaded;
 int Texture::default_mag_filter = GL_LINEAR;
 int Texture::default_min_filter = GL_LINEAR_MIPMAP_LINEAR;
 FBO* Texture::global_fbo = NULL;
+bool Texture::use_compressed = true;
 
 Texture::Texture()
 {
@@ -74,6 +86,47 @@ Texture::Texture(Image* img)
 Texture::~Texture()
 {
 	clear();
+
+	// an unloaded texture leaves the cache (under all its names) and the streamer
+	TextureStreamer::remove(this);
+	for (auto it = s_textures_loaded.begin(); it != s_textures_loaded.end();) {
+		if (it->second == this)
+			it = s_textures_loaded.erase(it);
+		else
+			it++;
+	}
+}
+
+size_t Texture::get_cpu_bytes()
+{
+	//streamed textures only keep the levels read from the file until they are uploaded
+	return image.data ? (size_t)image.width * image.height * image.bytes_per_pixel : 0;
+}
+
+size_t Texture::get_gpu_bytes()
+{
+	if (!texture_id)
+		return 0;
+	if (sStreamedTexture* streamed = TextureStreamer::find(this))
+		return streamed->get_bytes(streamed->resident_level);
+
+	int w = (int)width, h = (int)height;
+	size_t layers = texture_type == GL_TEXTURE_CUBE_MAP ? 6 : std::max((int)depth, 1);
+	if (compressed_format != COMPRESSED_NONE) {
+		size_t bytes = 0;
+		do {
+			bytes += TextureCompression::get_level_size(compressed_format, w, h);
+			w = std::max(w / 2, 1);
+			h = std::max(h / 2, 1);
+		} while (mipmaps && (w > 1 || h > 1));
+		return bytes * layers;
+	}
+
+	// estimated from the format, the driver may pad RGB to RGBA
+	size_t channels = format == GL_RED ? 1 : format == GL_RG ? 2 : format == GL_RGB ? 3 : 4;
+	size_t channel_bytes = type == GL_FLOAT ? 4 : type == GL_HALF_FLOAT ? 2 : 1;
+	size_t bytes = (size_t)w * h * channels * channel_bytes * layers;
+	return mipmaps ? bytes * 4 / 3 : bytes;
 }
 
 void Texture::clear()
@@ -221,55 +274,163 @@ Texture* Texture::get(const char* filename, bool mipmaps, bool wrap)
 		return NULL;
 	}
 
+	ResourceManager::add(texture);
 	return texture;
 }
 
 bool Texture::load(const char* filename, bool mipmaps, bool wrap, unsigned int type)
 {
 	std::string str = filename;
-	std::string ext = str.substr(str.size() - 4, 4);
-	Image* image = NULL;
+	std::string ext = str.substr(str.find_last_of('.') + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
 	long time = get_time();
 
 	std::cout << " + Texture loading: " << filename << " ... ";
 
-	image = new Image();
-	bool found = false;
+	//block compressed textures go straight to VRAM
+	sCompressedImage compressed;
+	bool is_container = ext == "dds" || ext == "ktx2";
+	if (is_container || (use_compressed && type != GL_FLOAT && TextureCompression::load(get_compressed_filename(filename).c_str(), compressed)))
+	{
+		if (is_container && !TextureCompression::load(filename, compressed))
+		{
+			std::cout << " [ERROR]: Texture not found or unsupported format" << std::endl;
+			return false;
+		}
 
-	if (ext == ".tga" || ext == ".TGA")
-		found = image->loadTGA(filename);
-	else if (ext == ".png" || ext == ".PNG")
-		found = image->loadPNG(filename);
-	else
+		if (upload_compressed(compressed, wrap))
+		{
+			this->filename = filename;
+			std::cout << "[OK " << TextureCompression::get_format_name(compressed.format) << "] Size: " << width << "x" << height << " Time: " << (get_time() - time) * 0.001 << "sec" << std::endl;
+			set_name(filename);
+			return true;
+		}
+
+		if (is_container)
+		{
+			std::cout << " [ERROR]: " << TextureCompression::get_format_name(compressed.format) << " not supported by the GPU" << std::endl;
+			return false;
+		}
+	}
+
+	if (ext != "tga" && ext != "png" && ext != "jpg" && ext != "jpeg" && ext != "bmp" && ext != "hdr")
 	{
 		std::cout << "[ERROR]: unsupported format" << std::endl;
 		return false; //unsupported file type
 	}
 
-	if (!found) //file not found
+	//decodes, builds the mipmaps and uploads (float textures are decoded as HDR)
+	if (!TextureLoader::load(this, filename, mipmaps, wrap, type == GL_FLOAT))
 	{
 		std::cout << " [ERROR]: Texture not found " << std::endl;
 		return false;
 	}
 
-	this->filename = filename;
+	this->image.clear();
+	std::cout << "[OK] Size: " << width << "x" << height << " Time: " << (get_time() - time) * 0.001 << "sec" << std::endl;
+	set_name(filename);
+	return true;
+}
 
-	unsigned int internal_format = 0;
+Texture* Texture::get_async(const char* filename, bool mipmaps, bool wrap)
+{
+	assert(filename);
 
-	if (type == GL_FLOAT)
-		internal_format = (image->bytes_per_pixel == 3 ? GL_RGB32F : GL_RGBA32F);
+	auto it = s_textures_loaded.find(filename);
+	if (it != s_textures_loaded.end())
+		return it->second;
 
-	//upload to VRAM
-	create(image->width, image->height, (image->bytes_per_pixel == 3 ? GL_RGB : GL_RGBA), type, mipmaps, image->data, 0);
+	//white until the loader uploads the pixels
+	const uint8_t data[3] = { 255,255,255 };
+	Texture* texture = new Texture(1, 1, GL_RGB, GL_UNSIGNED_BYTE, false, (uint8_t*)data);
+	texture->filename = filename;
+	texture->set_name(filename);
+	TextureLoader::load_async(texture, filename, mipmaps, wrap);
+	ResourceManager::add(texture);
+	return texture;
+}
 
-	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, this->mipmaps && wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
-	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, this->mipmaps && wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
-	if (mipmaps)
-		generate_mipmaps();
+std::string Texture::get_compressed_filename(const char* filename)
+{
+	std::string cooked = get_cooked_filename(filename, ".dds");
+	if (file_exists(cooked))
+		return cooked;
+	return TextureCompression::get_sidecar_filename(filename);
+}
 
-	this->image.clear();
-	std::cout << "[OK] Size: " << width << "x" << height << " Time: " << (get_time() - time) * 0.001 << "sec" << std::endl;
-	set_name(filename);
+bool Texture::is_compressed_format_supported(int format)
+{
+	static int s3tc = -1, bptc = -1;
+	if (s3tc == -1) {
+		s3tc = glfwExtensionSupported("GL_EXT_texture_compression_s3tc");
+		bptc = glfwExtensionSupported("GL_ARB_texture_compression_bptc");
+	}
+
+	switch (format) {
+	case COMPRESSED_BC1:
+	case COMPRESSED_BC3: return s3tc;
+	case COMPRESSED_BC4:
+	case COMPRESSED_BC5: return true; //RGTC is core since GL 3.0
+	case COMPRESSED_BC7: return bptc;
+	}
+	return false;
+}
+
+unsigned int Texture::get_compressed_gl_format(int format, bool srgb)
+{
+	if (srgb) {
+		switch (format) {
+		case COMPRESSED_BC1: return GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+		case COMPRESSED_BC3: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+		case COMPRESSED_BC7: return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+		}
+	}
+
+	switch (format) {
+	case COMPRESSED_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case COMPRESSED_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case COMPRESSED_BC4: return GL_COMPRESSED_RED_RGTC1;
+	case COMPRESSED_BC5: return GL_COMPRESSED_RG_RGTC2;
+	case COMPRESSED_BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	}
+	return 0;
+}
+
+bool Texture::upload_compressed(sCompressedImage& image, bool wrap)
+{
+	if (!is_compressed_format_supported(image.format) || image.get_num_levels() == 0)
+		return false;
+
+	unsigned int gl_format = get_compressed_gl_format(image.format, image.srgb);
+
+	if (texture_id == 0)
+		glGenTextures(1, &texture_id);
+
+	unsigned int num_levels = image.get_num_levels();
+	this->width = (float)image.width;
+	this->height = (float)image.height;
+	this->depth = 0;
+	this->format = gl_format;
+	this->internal_format = gl_format;
+	this->type = 0;
+	this->texture_type = GL_TEXTURE_2D;
+	this->mipmaps = num_levels > 1;
+	this->compressed_format = image.format;
+
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+	for (unsigned int i = 0; i < num_levels; i++)
+		glCompressedTexImage2D(GL_TEXTURE_2D, i, gl_format, image.get_level_width(i), image.get_level_height(i), 0, (GLsizei)image.level_sizes[i], &image.data[image.level_offsets[i]]);
+	Profiler::count_upload(image.data.size());
+
+	wrap_s = wrap_t = wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE;
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, default_mag_filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmaps ? default_min_filter : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap_s);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap_t);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	assert(check_gl_errors() && "Error uploading compressed texture");
 	return true;
 }
 
@@ -419,6 +580,7 @@ void Texture::bind()
 {
 	//glEnable(this->texture_type); //enable the textures 
 	glBindTexture(this->texture_type, texture_id);	//enable the id of the texture we are going to use
+	touch();
 }
 
 void Texture::unbind()
@@ -454,7 +616,7 @@ void Texture::to_viewport(Shader* shader)
 	if (!shader)
 		shader = Shader::get_default_shader("screen");
 	shader->enable();
-	shader->set_uniform("u_texture", this, 0);
+	shader->set_uniform(Shader::UNIFORM_TEXTURE, this, 0);
 	quad->render(GL_TRIANGLES);
 	shader->disable();
 }
@@ -490,6 +652,7 @@ void Image::from_screen(int width, int height)
 		this->height = height;
 		data = new uint8_t[width * height * 4];
 	}
+	bytes_per_pixel = 4;
 
 	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, data);
 }
@@ -591,35 +754,19 @@ bool Image::loadTGA(const char* filename)
 
 bool Image::loadPNG(const char* filename, bool flip_y)
 {
-	std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
-
-	//get filesize
-	std::streamsize size = 0;
-	if (file.seekg(0, std::ios::end).good()) size = file.tellg();
-	if (file.seekg(0, std::ios::beg).good()) size -= file.tellg();
-
-	if (!size)
+	int w, h, channels;
+	stbi_set_flip_vertically_on_load_thread(0);
+	uint8_t* pixels = stbi_load(filename, &w, &h, &channels, 4);
+	if (!pixels)
 		return false;
 
-	std::vector<unsigned char> buffer;
-
-	//read contents of the file into the vector
-	if (size > 0)
-	{
-		buffer.resize((size_t)size);
-		file.read((char*)(&buffer[0]), size);
-	}
-	else
-		buffer.clear();
-
-	std::vector<unsigned char> out_image;
-
-	//if (decodePNG(out_image, width, height, buffer.empty() ? 0 : &buffer[0], (unsigned long)buffer.size(), true) != 0)
-	//	return false;
-
-	data = new uint8_t[out_image.size()];
-	memcpy(data, &out_image[0], out_image.size());
+	clear();
+	width = w;
+	height = h;
 	bytes_per_pixel = 4;
+	data = new uint8_t[w * h * 4];
+	memcpy(data, pixels, w * h * 4);
+	stbi_image_free(pixels);
 
 	//flip pixels in Y
 	if (flip_y)
@@ -5,7 +5,10 @@
 #pragma once
 
 #include "framework/includes.h"
+#include "../math/vec2.h"
 #include "../math/vec4.h"
+#include "texture_compression.h"
+#include "../resource_manager.h"
 
 #include <map>
 #include <string>
@@ -46,6 +49,8 @@ public:
 
 	vec4 get_pixel_interpolated(float x, float y, bool repeat = false);
 	vec4 get_pixel_interpolated_high(float x, float y, bool repeat = false); //returns a Vector4 (floats)
+	//samples one channel at many uvs at once (0..1 values), see ImageSampler
+	void sample(const vec2* uvs, int num, float* out, int channel = 0, bool bicubic = false, bool repeat = false);
 
 	void from_texture(Texture* texture);
 	void from_screen(int width, int height);
@@ -57,12 +62,13 @@ public:
 
 
 // TEXTURE CLASS
-class Texture
+class Texture : public Resource
 {
 public:
 	static int default_mag_filter;
 	static int default_min_filter;
 	static FBO* global_fbo;
+	static bool use_compressed; //loads the compressed copy (file.png.dds) of a texture when there is one
 
 	//a general struct to store all the information about a TGA file
 
@@ -80,6 +86,8 @@ public:
 	unsigned int internal_format;
 	unsigned int texture_type; //GL_TEXTURE_2D, GL_TEXTURE_CUBE, GL_TEXTURE_2D_ARRAY
 	bool mipmaps;
+	bool pending = false; //still decoding in the TextureLoader threads
+	int compressed_format = COMPRESSED_NONE; //BCn format of the pixels in VRAM
 
 	unsigned int wrap_s = GL_CLAMP_TO_EDGE;
 	unsigned int wrap_t = GL_CLAMP_TO_EDGE;
@@ -94,6 +102,13 @@ public:
 
 	void clear();
 
+	// Resource
+	eResourceType get_resource_type() { return RESOURCE_TEXTURE; }
+	const char* get_resource_name() { return filename.c_str(); }
+	size_t get_cpu_bytes();
+	size_t get_gpu_bytes();
+	bool can_evict() { return !pending; }
+
 	void create(unsigned int width, unsigned int height, unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, uint8_t* data = NULL, unsigned int internal_format = 0);
 	void create3D(unsigned int width, unsigned int height, unsigned int depth, unsigned int format = GL_RED, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, uint8_t* data = NULL, unsigned int internal_format = 0);
 	void create3D(unsigned int width, unsigned int height, unsigned int depth, unsigned int format = GL_RED, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, float* data = NULL, unsigned int internal_format = 0);
@@ -105,6 +120,7 @@ public:
 	void upload3D(float* data = NULL, unsigned int mag_filter = GL_LINEAR, unsigned int min_filter = GL_LINEAR, unsigned int wrap = GL_CLAMP_TO_EDGE);
 	void upload_cubemap(unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, uint8_t** data = NULL, unsigned int internal_format = 0);
 	void upload_as_array(unsigned int texture_size, bool mipmaps = true);
+	bool upload_compressed(sCompressedImage& image, bool wrap = true);
 
 	void bind();
 	void unbind();
@@ -118,6 +134,8 @@ public:
 
 	//load using the manager (caching loaded ones to avoid reloading them)
 	static Texture* get(const char* filename, bool mipmaps = true, bool wrap = true);
+	//same as get, but returns a white placeholder and reads the file (or its compressed copy) in the background
+	static Texture* get_async(const char* filename, bool mipmaps = true, bool wrap = true);
 	void set_name(const char* name) { s_textures_loaded[name] = this; }
 
 	void generate_mipmaps();
@@ -125,6 +143,10 @@ public:
 	//show the texture on the current viewport
 	void to_viewport(Shader* shader = NULL);
 
+	static bool is_compressed_format_supported(int format);
+	static unsigned int get_compressed_gl_format(int format, bool srgb = false);
+	static std::string get_compressed_filename(const char* filename); //the cooked copy if there is one, otherwise file.png.dds
+
 	static Texture* get_black_texture();
 	static Texture* get_white_texture();
 };
@@ -0,0 +1,537 @@
+#include "texture_compression.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#define MAKE_FOURCC(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+// DDS container (only the fields used here are named)
+struct sDDSPixelFormat
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t fourcc;
+	uint32_t bit_count;
+	uint32_t masks[4];
+};
+
+struct sDDSHeader
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t height;
+	uint32_t width;
+	uint32_t pitch_or_linear_size;
+	uint32_t depth;
+	uint32_t mipmap_count;
+	uint32_t reserved1[11];
+	sDDSPixelFormat pixel_format;
+	uint32_t caps[4];
+	uint32_t reserved2;
+};
+
+struct sDDSHeaderDX10
+{
+	uint32_t dxgi_format;
+	uint32_t resource_dimension;
+	uint32_t misc_flag;
+	uint32_t array_size;
+	uint32_t misc_flags2;
+};
+
+static_assert(sizeof(sDDSHeader) == 124, "DDS header must be 124 bytes");
+
+#define DDSD_CAPS 0x1
+#define DDSD_HEIGHT 0x2
+#define DDSD_WIDTH 0x4
+#define DDSD_PIXELFORMAT 0x1000
+#define DDSD_MIPMAPCOUNT 0x20000
+#define DDSD_LINEARSIZE 0x80000
+#define DDPF_FOURCC 0x4
+#define DDSCAPS_COMPLEX 0x8
+#define DDSCAPS_TEXTURE 0x1000
+#define DDSCAPS_MIPMAP 0x400000
+
+// KTX2 container
+static const uint8_t s_ktx2_identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+struct sKTX2Header
+{
+	uint32_t vk_format;
+	uint32_t type_size;
+	uint32_t pixel_width;
+	uint32_t pixel_height;
+	uint32_t pixel_depth;
+	uint32_t layer_count;
+	uint32_t face_count;
+	uint32_t level_count;
+	uint32_t supercompression_scheme;
+	uint32_t dfd_byte_offset;
+	uint32_t dfd_byte_length;
+	uint32_t kvd_byte_offset;
+	uint32_t kvd_byte_length;
+	uint64_t sgd_byte_offset;
+	uint64_t sgd_byte_length;
+};
+
+struct sKTX2Level
+{
+	uint64_t byte_offset;
+	uint64_t byte_length;
+	uint64_t uncompressed_byte_length;
+};
+
+static bool read_file(const char* filename, std::vector<uint8_t>& content)
+{
+	FILE* f = fopen(filename, "rb");
+	if (!f)
+		return false;
+
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	content.resize(size > 0 ? size : 0);
+	bool ok = size > 0 && fread(content.data(), 1, size, f) == (size_t)size;
+	fclose(f);
+	return ok;
+}
+
+// fills the level offsets of an image whose levels are stored one after the other
+static bool build_levels(sCompressedImage& image, unsigned int num_levels, size_t available)
+{
+	image.level_offsets.clear();
+	image.level_sizes.clear();
+
+	size_t offset = 0;
+	for (unsigned int i = 0; i < num_levels; i++)
+	{
+		size_t size = TextureCompression::get_level_size(image.format, image.get_level_width(i), image.get_level_height(i));
+		if (offset + size > available)
+			break;
+		image.level_offsets.push_back(offset);
+		image.level_sizes.push_back(size);
+		offset += size;
+	}
+	return image.level_offsets.size() > 0;
+}
+
+const char* TextureCompression::get_format_name(int format)
+{
+	switch (format) {
+	case COMPRESSED_BC1: return "bc1";
+	case COMPRESSED_BC3: return "bc3";
+	case COMPRESSED_BC4: return "bc4";
+	case COMPRESSED_BC5: return "bc5";
+	case COMPRESSED_BC7: return "bc7";
+	}
+	return "none";
+}
+
+int TextureCompression::get_format_from_name(const char* name)
+{
+	for (int format = COMPRESSED_BC1; format <= COMPRESSED_BC7; format++) {
+		if (strcmp(name, get_format_name(format)) == 0)
+			return format;
+	}
+	return COMPRESSED_NONE;
+}
+
+bool TextureCompression::load(const char* filename, sCompressedImage& image)
+{
+	std::string name = filename;
+	std::string ext = name.substr(name.find_last_of('.') + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+	if (ext == "dds")
+		return load_dds(filename, image);
+	if (ext == "ktx2")
+		return load_ktx2(filename, image);
+	return false;
+}
+
+bool TextureCompression::load_dds(const char* filename, sCompressedImage& image)
+{
+	std::vector<uint8_t> content;
+	if (!read_file(filename, content) || content.size() < 4 + sizeof(sDDSHeader))
+		return false;
+
+	if (memcmp(content.data(), "DDS ", 4) != 0)
+		return false;
+
+	sDDSHeader header;
+	memcpy(&header, &content[4], sizeof(header));
+	if (header.size != sizeof(sDDSHeader) || !(header.pixel_format.flags & DDPF_FOURCC))
+		return false;
+
+	size_t data_start = 4 + sizeof(sDDSHeader);
+	switch (header.pixel_format.fourcc) {
+	case MAKE_FOURCC('D', 'X', 'T', '1'): image.format = COMPRESSED_BC1; break;
+	case MAKE_FOURCC('D', 'X', 'T', '5'): image.format = COMPRESSED_BC3; break;
+	case MAKE_FOURCC('A', 'T', 'I', '1'):
+	case MAKE_FOURCC('B', 'C', '4', 'U'): image.format = COMPRESSED_BC4; break;
+	case MAKE_FOURCC('A', 'T', 'I', '2'):
+	case MAKE_FOURCC('B', 'C', '5', 'U'): image.format = COMPRESSED_BC5; break;
+	case MAKE_FOURCC('D', 'X', '1', '0'):
+	{
+		if (content.size() < data_start + sizeof(sDDSHeaderDX10))
+			return false;
+		sDDSHeaderDX10 dx10;
+		memcpy(&dx10, &content[data_start], sizeof(dx10));
+		data_start += sizeof(sDDSHeaderDX10);
+
+		// DXGI_FORMAT values (typeless, unorm and srgb of each one)
+		image.srgb = dx10.dxgi_format == 72 || dx10.dxgi_format == 78 || dx10.dxgi_format == 99;
+		if (dx10.dxgi_format >= 70 && dx10.dxgi_format <= 72) image.format = COMPRESSED_BC1;
+		else if (dx10.dxgi_format >= 76 && dx10.dxgi_format <= 78) image.format = COMPRESSED_BC3;
+		else if (dx10.dxgi_format >= 79 && dx10.dxgi_format <= 80) image.format = COMPRESSED_BC4;
+		else if (dx10.dxgi_format >= 82 && dx10.dxgi_format <= 83) image.format = COMPRESSED_BC5;
+		else if (dx10.dxgi_format >= 97 && dx10.dxgi_format <= 99) image.format = COMPRESSED_BC7;
+		else return false;
+		break;
+	}
+	default:
+		return false;
+	}
+
+	image.width = header.width;
+	image.height = header.height;
+	unsigned int num_levels = (header.flags & DDSD_MIPMAPCOUNT) && header.mipmap_count ? header.mipmap_count : 1;
+
+	image.data.assign(content.begin() + data_start, content.end());
+	return build_levels(image, num_levels, image.data.size());
+}
+
+bool TextureCompression::load_ktx2(const char* filename, sCompressedImage& image)
+{
+	std::vector<uint8_t> content;
+	if (!read_file(filename, content) || content.size() < sizeof(s_ktx2_identifier) + sizeof(sKTX2Header))
+		return false;
+
+	if (memcmp(content.data(), s_ktx2_identifier, sizeof(s_ktx2_identifier)) != 0)
+		return false;
+
+	sKTX2Header header;
+	memcpy(&header, &content[sizeof(s_ktx2_identifier)], sizeof(header));
+
+	// basis universal and zstd payloads need a transcoder, only plain 2D textures are read
+	if (header.supercompression_scheme != 0 || header.pixel_depth > 1 || header.layer_count > 1 || header.face_count != 1)
+		return false;
+
+	// VkFormat values (unorm and srgb of each one)
+	image.srgb = header.vk_format == 132 || header.vk_format == 134 || header.vk_format == 138 || header.vk_format == 146;
+	switch (header.vk_format) {
+	case 131: case 132: case 133: case 134: image.format = COMPRESSED_BC1; break;
+	case 137: case 138: image.format = COMPRESSED_BC3; break;
+	case 139: image.format = COMPRESSED_BC4; break;
+	case 141: image.format = COMPRESSED_BC5; break;
+	case 145: case 146: image.format = COMPRESSED_BC7; break;
+	default: return false;
+	}
+
+	image.width = header.pixel_width;
+	image.height = header.pixel_height;
+	unsigned int num_levels = std::max(1u, header.level_count);
+
+	size_t index_start = sizeof(s_ktx2_identifier) + sizeof(sKTX2Header);
+	if (content.size() < index_start + num_levels * sizeof(sKTX2Level))
+		return false;
+
+	// the levels are stored from the smallest to the biggest, the index gives where each one is
+	image.data.clear();
+	image.level_offsets.clear();
+	image.level_sizes.clear();
+	for (unsigned int i = 0; i < num_levels; i++)
+	{
+		sKTX2Level level;
+		memcpy(&level, &content[index_start + i * sizeof(sKTX2Level)], sizeof(level));
+		if (level.byte_offset + level.byte_length > content.size())
+			return false;
+
+		image.level_offsets.push_back(image.data.size());
+		image.level_sizes.push_back((size_t)level.byte_length);
+		image.data.insert(image.data.end(), content.begin() + (size_t)level.byte_offset, content.begin() + (size_t)(level.byte_offset + level.byte_length));
+	}
+
+	return true;
+}
+
+bool TextureCompression::save_dds(const char* filename, sCompressedImage& image)
+{
+	FILE* f = fopen(filename, "wb");
+	if (f == NULL)
+		return false;
+
+	unsigned int num_levels = image.get_num_levels();
+
+	sDDSHeader header;
+	memset(&header, 0, sizeof(header));
+	header.size = sizeof(sDDSHeader);
+	header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_LINEARSIZE | (num_levels > 1 ? DDSD_MIPMAPCOUNT : 0);
+	header.width = image.width;
+	header.height = image.height;
+	header.pitch_or_linear_size = (uint32_t)image.level_sizes[0];
+	header.mipmap_count = num_levels;
+	header.pixel_format.size = sizeof(sDDSPixelFormat);
+	header.pixel_format.flags = DDPF_FOURCC;
+	header.caps[0] = DDSCAPS_TEXTURE | (num_levels > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0);
+
+	switch (image.format) {
+	case COMPRESSED_BC1: header.pixel_format.fourcc = MAKE_FOURCC('D', 'X', 'T', '1'); break;
+	case COMPRESSED_BC3: header.pixel_format.fourcc = MAKE_FOURCC('D', 'X', 'T', '5'); break;
+	case COMPRESSED_BC4: header.pixel_format.fourcc = MAKE_FOURCC('A', 'T', 'I', '1'); break;
+	case COMPRESSED_BC5: header.pixel_format.fourcc = MAKE_FOURCC('A', 'T', 'I', '2'); break;
+	default: header.pixel_format.fourcc = MAKE_FOURCC('D', 'X', '1', '0'); break;
+	}
+
+	fwrite("DDS ", 1, 4, f);
+	fwrite(&header, sizeof(header), 1, f);
+	if (image.format == COMPRESSED_BC7) {
+		sDDSHeaderDX10 dx10 = { 98, 3, 0, 1, 0 }; // BC7_UNORM, TEXTURE2D
+		fwrite(&dx10, sizeof(dx10), 1, f);
+	}
+	fwrite(image.data.data(), 1, image.data.size(), f);
+	fclose(f);
+	return true;
+}
+
+int TextureCompression::choose_format(const char* filename, const uint8_t* rgba, int width, int height)
+{
+	std::string name = filename;
+	std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+	if (name.find("normal") != std::string::npos)
+		return COMPRESSED_BC5;
+
+	for (size_t i = 0; i < (size_t)width * height; i++) {
+		if (rgba[i * 4 + 3] != 255)
+			return COMPRESSED_BC3;
+	}
+	return COMPRESSED_BC1;
+}
+
+void TextureCompression::compress(const uint8_t* rgba, int width, int height, int format, bool mipmaps, sCompressedImage& image)
+{
+	image.format = format;
+	image.width = width;
+	image.height = height;
+	image.data.clear();
+	image.level_offsets.clear();
+	image.level_sizes.clear();
+
+	std::vector<uint8_t> level(rgba, rgba + (size_t)width * height * 4);
+	std::vector<uint8_t> next;
+	int w = width, h = height;
+
+	while (true)
+	{
+		size_t offset = image.data.size();
+		size_t size = get_level_size(format, w, h);
+		image.level_offsets.push_back(offset);
+		image.level_sizes.push_back(size);
+		image.data.resize(offset + size);
+
+		uint8_t* out = &image.data[offset];
+		uint8_t block[16 * 4];
+		for (int by = 0; by < h; by += 4)
+		{
+			for (int bx = 0; bx < w; bx += 4)
+			{
+				// the blocks on the border repeat the last row and column
+				for (int y = 0; y < 4; y++)
+					for (int x = 0; x < 4; x++)
+						memcpy(&block[(y * 4 + x) * 4], &level[((size_t)std::min(by + y, h - 1) * w + std::min(bx + x, w - 1)) * 4], 4);
+
+				switch (format) {
+				case COMPRESSED_BC1: compress_bc1_block(block, out); break;
+				case COMPRESSED_BC3: compress_bc3_block(block, out); break;
+				case COMPRESSED_BC4: compress_bc4_block(block, 0, out); break;
+				case COMPRESSED_BC5: compress_bc5_block(block, out); break;
+				}
+				out += get_block_bytes(format);
+			}
+		}
+
+		if (!mipmaps || (w == 1 && h == 1))
+			break;
+
+		// 2x2 box filter for the next level
+		int next_w = std::max(1, w / 2);
+		int next_h = std::max(1, h / 2);
+		next.resize((size_t)next_w * next_h * 4);
+		for (int y = 0; y < next_h; y++)
+		{
+			for (int x = 0; x < next_w; x++)
+			{
+				int x0 = std::min(x * 2, w - 1), x1 = std::min(x * 2 + 1, w - 1);
+				int y0 = std::min(y * 2, h - 1), y1 = std::min(y * 2 + 1, h - 1);
+				for (int c = 0; c < 4; c++)
+					next[((size_t)y * next_w + x) * 4 + c] = (uint8_t)((level[((size_t)y0 * w + x0) * 4 + c] + level[((size_t)y0 * w + x1) * 4 + c] +
+						level[((size_t)y1 * w + x0) * 4 + c] + level[((size_t)y1 * w + x1) * 4 + c] + 2) >> 2);
+			}
+		}
+		level.swap(next);
+		w = next_w;
+		h = next_h;
+	}
+}
+
+static uint16_t pack_565(const float* color)
+{
+	int r = std::clamp((int)(color[0] * 31.f / 255.f + 0.5f), 0, 31);
+	int g = std::clamp((int)(color[1] * 63.f / 255.f + 0.5f), 0, 63);
+	int b = std::clamp((int)(color[2] * 31.f / 255.f + 0.5f), 0, 31);
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void unpack_565(uint16_t value, float* color)
+{
+	int r = (value >> 11) & 31;
+	int g = (value >> 5) & 63;
+	int b = value & 31;
+	color[0] = (float)((r << 3) | (r >> 2));
+	color[1] = (float)((g << 2) | (g >> 4));
+	color[2] = (float)((b << 3) | (b >> 2));
+}
+
+// Endpoints on the principal axis of the colors of the block, moved slightly inwards so the extremes
+// are not wasted on outliers, then every pixel takes the nearest of the four palette colors
+void TextureCompression::compress_bc1_block(const uint8_t* block, uint8_t* out)
+{
+	float mean[3] = { 0.f, 0.f, 0.f };
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 3; c++)
+			mean[c] += block[i * 4 + c] / 16.f;
+
+	float cov[6] = { 0.f, 0.f, 0.f, 0.f, 0.f, 0.f }; // rr rg rb gg gb bb
+	for (int i = 0; i < 16; i++)
+	{
+		float r = block[i * 4] - mean[0];
+		float g = block[i * 4 + 1] - mean[1];
+		float b = block[i * 4 + 2] - mean[2];
+		cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+		cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+	}
+
+	// power iteration
+	float axis[3] = { 0.577f, 0.577f, 0.577f };
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+		float length = std::max(std::max(fabsf(x), fabsf(y)), fabsf(z));
+		if (length < 1e-6f)
+			break;
+		axis[0] = x / length; axis[1] = y / length; axis[2] = z / length;
+	}
+
+	float min_t = 1e30f, max_t = -1e30f;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = (block[i * 4] - mean[0]) * axis[0] + (block[i * 4 + 1] - mean[1]) * axis[1] + (block[i * 4 + 2] - mean[2]) * axis[2];
+		min_t = std::min(min_t, t);
+		max_t = std::max(max_t, t);
+	}
+
+	float axis_length2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+	float inset = (max_t - min_t) / 16.f;
+	float high[3], low[3];
+	for (int c = 0; c < 3; c++)
+	{
+		high[c] = mean[c] + axis[c] * (max_t - inset) / std::max(axis_length2, 1e-6f);
+		low[c] = mean[c] + axis[c] * (min_t + inset) / std::max(axis_length2, 1e-6f);
+	}
+
+	uint16_t c0 = pack_565(high);
+	uint16_t c1 = pack_565(low);
+	uint32_t indices = 0;
+
+	// c0 > c1 selects the four color mode
+	if (c0 < c1)
+		std::swap(c0, c1);
+
+	if (c0 != c1)
+	{
+		float palette[4][3];
+		unpack_565(c0, palette[0]);
+		unpack_565(c1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2.f * palette[0][c] + palette[1][c]) / 3.f;
+			palette[3][c] = (palette[0][c] + 2.f * palette[1][c]) / 3.f;
+		}
+
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0;
+			float best_distance = 1e30f;
+			for (int p = 0; p < 4; p++)
+			{
+				float dr = block[i * 4] - palette[p][0];
+				float dg = block[i * 4 + 1] - palette[p][1];
+				float db = block[i * 4 + 2] - palette[p][2];
+				float distance = dr * dr + dg * dg + db * db;
+				if (distance < best_distance) {
+					best_distance = distance;
+					best = p;
+				}
+			}
+			indices |= (uint32_t)best << (i * 2);
+		}
+	}
+
+	out[0] = c0 & 0xFF; out[1] = c0 >> 8;
+	out[2] = c1 & 0xFF; out[3] = c1 >> 8;
+	for (int i = 0; i < 4; i++)
+		out[4 + i] = (indices >> (i * 8)) & 0xFF;
+}
+
+// Endpoints are the minimum and the maximum of the channel (eight value mode)
+void TextureCompression::compress_bc4_block(const uint8_t* block, int channel, uint8_t* out)
+{
+	int a0 = 0, a1 = 255;
+	for (int i = 0; i < 16; i++)
+	{
+		a0 = std::max(a0, (int)block[i * 4 + channel]);
+		a1 = std::min(a1, (int)block[i * 4 + channel]);
+	}
+
+	uint64_t indices = 0;
+	if (a0 != a1)
+	{
+		int palette[8];
+		palette[0] = a0;
+		palette[1] = a1;
+		for (int i = 1; i < 7; i++)
+			palette[i + 1] = ((7 - i) * a0 + i * a1 + 3) / 7;
+
+		for (int i = 0; i < 16; i++)
+		{
+			int value = block[i * 4 + channel];
+			int best = 0;
+			for (int p = 1; p < 8; p++) {
+				if (abs(value - palette[p]) < abs(value - palette[best]))
+					best = p;
+			}
+			indices |= (uint64_t)best << (i * 3);
+		}
+	}
+
+	out[0] = (uint8_t)a0;
+	out[1] = (uint8_t)a1;
+	for (int i = 0; i < 6; i++)
+		out[2 + i] = (indices >> (i * 8)) & 0xFF;
+}
+
+void TextureCompression::compress_bc3_block(const uint8_t* block, uint8_t* out)
+{
+	compress_bc4_block(block, 3, out);
+	compress_bc1_block(block, out + 8);
+}
+
+void TextureCompression::compress_bc5_block(const uint8_t* block, uint8_t* out)
+{
+	compress_bc4_block(block, 0, out);
+	compress_bc4_block(block, 1, out + 8);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Block compressed formats (4x4 pixel blocks)
+enum eCompressedFormat {
+	COMPRESSED_NONE,
+	COMPRESSED_BC1, // RGB, 8 bytes per block
+	COMPRESSED_BC3, // RGBA, 16 bytes per block
+	COMPRESSED_BC4, // R, 8 bytes per block
+	COMPRESSED_BC5, // RG, 16 bytes per block (normal maps)
+	COMPRESSED_BC7  // RGBA, 16 bytes per block (load only)
+};
+
+// Compressed image with all its mip levels in a single buffer (level 0 first)
+struct sCompressedImage
+{
+	int format = COMPRESSED_NONE;
+	int width = 0;
+	int height = 0;
+	bool srgb = false; // color stored in sRGB, sampled through the GL sRGB format so it is linearized
+	std::vector<uint8_t> data;
+	std::vector<size_t> level_offsets;
+	std::vector<size_t> level_sizes;
+
+	unsigned int get_num_levels() { return (unsigned int)level_offsets.size(); }
+	int get_level_width(unsigned int level) { return width >> level ? width >> level : 1; }
+	int get_level_height(unsigned int level) { return height >> level ? height >> level : 1; }
+};
+
+// Reads and writes DDS/KTX2 containers and compresses RGBA8 images to BC1/BC3/BC4/BC5 on the CPU.
+// It does not depend on GL so the offline compressor (src/tools) can be built with it alone.
+// Blocks are stored in the same row order they are uploaded (first row at the bottom, like the rest of the textures),
+// the compressor flips the images when it loads them
+class TextureCompression
+{
+public:
+	static unsigned int get_block_bytes(int format) { return format == COMPRESSED_BC1 || format == COMPRESSED_BC4 ? 8 : 16; }
+	static size_t get_level_size(int format, int width, int height) { return (size_t)((width + 3) / 4) * ((height + 3) / 4) * get_block_bytes(format); }
+	static const char* get_format_name(int format);
+	static int get_format_from_name(const char* name);
+
+	// containers
+	static bool load(const char* filename, sCompressedImage& image); // by extension (.dds, .ktx2)
+	static bool load_dds(const char* filename, sCompressedImage& image);
+	static bool load_ktx2(const char* filename, sCompressedImage& image);
+	static bool save_dds(const char* filename, sCompressedImage& image);
+
+	// name of the compressed copy of a texture, loaded instead of the original when it exists (like .mbin for meshes)
+	static std::string get_sidecar_filename(const char* filename) { return std::string(filename) + ".dds"; }
+
+	// BC5 for files with "normal" in the name, BC3 for images with alpha and BC1 for the rest
+	static int choose_format(const char* filename, const uint8_t* rgba, int width, int height);
+
+	// compresses an RGBA8 image (and its box filtered mip chain if mipmaps is set)
+	static void compress(const uint8_t* rgba, int width, int height, int format, bool mipmaps, sCompressedImage& image);
+
+	// a single 4x4 block of RGBA8 pixels
+	static void compress_bc1_block(const uint8_t* block, uint8_t* out);
+	static void compress_bc4_block(const uint8_t* block, int channel, uint8_t* out);
+	static void compress_bc3_block(const uint8_t* block, uint8_t* out);
+	static void compress_bc5_block(const uint8_t* block, uint8_t* out);
+};
@@ -0,0 +1,605 @@
+#include "texture_loader.h"
+
+#include "texture.h"
+#include "../utils.h"
+#include "../profiler.h"
+#include "../math/quat.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_LOADER_SSE2
+#include <emmintrin.h>
+#endif
+
+int TextureLoader::mip_filter = TextureLoader::MIP_FILTER_BOX;
+size_t TextureLoader::upload_budget = 16 * 1024 * 1024;
+
+struct sTextureJob
+{
+	Texture* texture;
+	sTextureData data;
+	bool mipmaps;
+	bool wrap;
+	bool ok;
+	bool is_container; // the file is a .dds or .ktx2
+	bool try_compressed; // looks for the compressed copy of the image before decoding it
+	sCompressedImage compressed; // read instead of data when it has levels
+	std::function<void()> work; // other jobs (the streamer) instead of decoding data for texture
+	std::function<size_t()> done;
+};
+
+static std::vector<std::thread> s_workers;
+static std::mutex s_jobs_mutex;
+static std::condition_variable s_jobs_condition;
+static std::deque<sTextureJob*> s_pending_jobs;
+static std::deque<sTextureJob*> s_done_jobs;
+static unsigned int s_num_in_flight = 0;
+static bool s_workers_exit = false;
+
+// pixel buffer used for all the uploads, orphaned every time so the previous upload does not block
+static GLuint s_pbo = 0;
+
+// same order as Texture::load: the container, then the compressed copy, then the image decoded with stb
+static bool read_job(sTextureJob* job)
+{
+	const char* filename = job->data.filename.c_str();
+	if (job->is_container) {
+		if (TextureCompression::load(filename, job->compressed))
+			return true;
+		job->data.error = "not found or unsupported format";
+		return false;
+	}
+	if (job->try_compressed && TextureCompression::load(Texture::get_compressed_filename(filename).c_str(), job->compressed))
+		return true;
+	job->compressed = sCompressedImage();
+	return TextureLoader::decode(job->data, job->mipmaps, job->data.hdr);
+}
+
+static void queue_job(sTextureJob* job)
+{
+	{
+		std::lock_guard<std::mutex> lock(s_jobs_mutex);
+		s_pending_jobs.push_back(job);
+		s_num_in_flight++;
+	}
+	s_jobs_condition.notify_one();
+}
+
+static void worker_main()
+{
+	// stb keeps the flag per thread
+	stbi_set_flip_vertically_on_load_thread(1);
+
+	while (true)
+	{
+		sTextureJob* job = NULL;
+		{
+			std::unique_lock<std::mutex> lock(s_jobs_mutex);
+			s_jobs_condition.wait(lock, [] { return s_workers_exit || !s_pending_jobs.empty(); });
+			if (s_workers_exit)
+				break;
+			job = s_pending_jobs.front();
+			s_pending_jobs.pop_front();
+		}
+
+		if (job->work)
+			job->work();
+		else
+			job->ok = read_job(job);
+
+		std::lock_guard<std::mutex> lock(s_jobs_mutex);
+		s_done_jobs.push_back(job);
+	}
+}
+
+void TextureLoader::init(unsigned int num_threads)
+{
+	if (s_workers.size())
+		return;
+
+	// hardware_concurrency can be 0 when it is not known
+	if (num_threads == 0)
+		num_threads = (unsigned int)std::max(1, (int)std::thread::hardware_concurrency() - 1);
+
+	s_workers_exit = false;
+	for (unsigned int i = 0; i < num_threads; i++)
+		s_workers.push_back(std::thread(worker_main));
+}
+
+void TextureLoader::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(s_jobs_mutex);
+		s_workers_exit = true;
+	}
+	s_jobs_condition.notify_all();
+	for (std::thread& worker : s_workers)
+		worker.join();
+	s_workers.clear();
+
+	for (sTextureJob* job : s_pending_jobs) delete job;
+	for (sTextureJob* job : s_done_jobs) delete job;
+	s_pending_jobs.clear();
+	s_done_jobs.clear();
+	s_num_in_flight = 0;
+
+	if (s_pbo)
+		glDeleteBuffers(1, &s_pbo);
+	s_pbo = 0;
+}
+
+void TextureLoader::load_async(Texture* texture, const char* filename, bool mipmaps, bool wrap)
+{
+	init();
+
+	std::string name = filename;
+	std::string ext = name.substr(name.find_last_of('.') + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+	sTextureJob* job = new sTextureJob();
+	job->texture = texture;
+	job->data.filename = filename;
+	job->data.hdr = ext == "hdr";
+	job->mipmaps = mipmaps;
+	job->wrap = wrap;
+	job->ok = false;
+	job->is_container = ext == "dds" || ext == "ktx2";
+	job->try_compressed = Texture::use_compressed && !job->data.hdr;
+	texture->pending = true;
+
+	queue_job(job);
+}
+
+void TextureLoader::run_async(std::function<void()> work, std::function<size_t()> done)
+{
+	init();
+
+	sTextureJob* job = new sTextureJob();
+	job->texture = NULL;
+	job->work = work;
+	job->done = done;
+	job->ok = false;
+	job->is_container = false;
+	job->try_compressed = false;
+
+	queue_job(job);
+}
+
+unsigned int TextureLoader::get_num_pending()
+{
+	std::lock_guard<std::mutex> lock(s_jobs_mutex);
+	return s_num_in_flight;
+}
+
+void TextureLoader::update()
+{
+	size_t uploaded = 0;
+
+	while (uploaded < upload_budget)
+	{
+		sTextureJob* job = NULL;
+		{
+			std::lock_guard<std::mutex> lock(s_jobs_mutex);
+			if (s_done_jobs.empty())
+				break;
+			job = s_done_jobs.front();
+			s_done_jobs.pop_front();
+			s_num_in_flight--;
+		}
+
+		if (job->done) {
+			uploaded += job->done();
+			delete job;
+			continue;
+		}
+
+		Texture* texture = job->texture;
+
+		if (job->ok && job->compressed.get_num_levels()) {
+			const char* format_name = TextureCompression::get_format_name(job->compressed.format);
+			if (texture->upload_compressed(job->compressed, job->wrap)) {
+				texture->pending = false;
+				uploaded += job->compressed.data.size();
+				std::cout << " + Texture loaded: " << job->data.filename << " [" << format_name << "] Size: " << texture->width << "x" << texture->height << std::endl;
+				delete job;
+				continue;
+			}
+
+			// the GPU cannot sample the compressed copy, the original image is decoded instead
+			if (!job->is_container) {
+				job->try_compressed = false;
+				job->compressed = sCompressedImage();
+				queue_job(job);
+				continue;
+			}
+
+			job->ok = false;
+			job->data.error = std::string(format_name) + " not supported by the GPU";
+		}
+
+		texture->pending = false;
+
+		if (job->ok) {
+			upload(texture, job->data, job->wrap);
+			uploaded += job->data.pixels.size();
+			std::cout << " + Texture loaded: " << job->data.filename << " Size: " << job->data.width << "x" << job->data.height << std::endl;
+		}
+		else {
+			std::cout << " [ERROR]: Texture not loaded " << job->data.filename << " (" << job->data.error << ")" << std::endl;
+		}
+
+		delete job;
+	}
+}
+
+bool TextureLoader::load(Texture* texture, const char* filename, bool mipmaps, bool wrap, bool hdr)
+{
+	//GL expects the first row at the bottom
+	stbi_set_flip_vertically_on_load_thread(1);
+
+	std::string name = filename;
+	std::string ext = name.substr(name.find_last_of('.') + 1);
+
+	sTextureData data;
+	data.filename = filename;
+	if (!decode(data, mipmaps, hdr || ext == "hdr" || ext == "HDR"))
+		return false;
+
+	upload(texture, data, wrap);
+	return true;
+}
+
+// grey (1 channel) to RGB and grey alpha (2) to RGBA, in a new buffer allocated with malloc like the ones of stb
+template<typename T>
+static T* expand_grey(const T* pixels, size_t num_pixels, int channels)
+{
+	int new_channels = channels == 2 ? 4 : 3;
+	T* expanded = (T*)malloc(num_pixels * new_channels * sizeof(T));
+	if (!expanded)
+		return NULL;
+	for (size_t i = 0; i < num_pixels; i++)
+	{
+		T grey = pixels[i * channels];
+		T* out = expanded + i * new_channels;
+		out[0] = out[1] = out[2] = grey;
+		if (channels == 2)
+			out[3] = pixels[i * channels + 1];
+	}
+	return expanded;
+}
+
+bool TextureLoader::decode(sTextureData& data, bool mipmaps, bool hdr)
+{
+	int channels = 0;
+	void* pixels = NULL;
+
+	// only RGB and RGBA are uploaded, grey images are expanded
+	if (hdr)
+		pixels = stbi_loadf(data.filename.c_str(), &data.width, &data.height, &channels, 0);
+	else
+		pixels = stbi_load(data.filename.c_str(), &data.width, &data.height, &channels, 0);
+
+	// the reason is read in this thread, stb keeps only the last one (per thread with STBI_THREAD_LOCAL)
+	if (!pixels) {
+		const char* reason = stbi_failure_reason();
+		data.error = reason ? reason : "unknown error";
+		return false;
+	}
+
+	// expanded from the decoded pixels, decoding the file again with the channels requested would be twice the work
+	if (channels < 3) {
+		size_t num_pixels = (size_t)data.width * data.height;
+		void* expanded = hdr ? (void*)expand_grey((const float*)pixels, num_pixels, channels) : (void*)expand_grey((const uint8_t*)pixels, num_pixels, channels);
+		stbi_image_free(pixels);
+		if (!expanded) {
+			data.error = "out of memory";
+			return false;
+		}
+		pixels = expanded;
+		channels = channels == 2 ? 4 : 3;
+	}
+
+	data.channels = channels;
+	data.hdr = hdr;
+
+	size_t pixel_size = channels * (hdr ? sizeof(float) : 1);
+	size_t size = (size_t)data.width * data.height * pixel_size;
+
+	// the buffer is reserved for the whole chain (4/3 of the first level), so generating the mips does not reallocate
+	data.pixels.reserve(mipmaps ? size + size / 3 + pixel_size * 64 : size);
+	data.pixels.assign((uint8_t*)pixels, (uint8_t*)pixels + size);
+	data.level_offsets.assign(1, 0);
+	data.level_widths.assign(1, data.width);
+	data.level_heights.assign(1, data.height);
+	stbi_image_free(pixels);
+
+	// same rule as Texture::create: only power of two textures have mipmaps
+	if (mipmaps && is_power_of_two(data.width) && is_power_of_two(data.height))
+		generate_mipmaps(data);
+
+	return true;
+}
+
+void TextureLoader::generate_mipmaps(sTextureData& data)
+{
+	size_t pixel_size = data.channels * (data.hdr ? sizeof(float) : 1);
+
+	while (data.level_widths.back() > 1 || data.level_heights.back() > 1)
+	{
+		int width = data.level_widths.back();
+		int height = data.level_heights.back();
+		int next_width = std::max(1, width / 2);
+		int next_height = std::max(1, height / 2);
+
+		size_t offset = data.level_offsets.back();
+		size_t next_offset = offset + (size_t)width * height * pixel_size;
+		data.pixels.resize(next_offset + (size_t)next_width * next_height * pixel_size);
+
+		uint8_t* src = &data.pixels[offset];
+		uint8_t* dst = &data.pixels[next_offset];
+
+		if (data.hdr) {
+			if (mip_filter == MIP_FILTER_KAISER)
+				downsample_kaiser((float*)src, width, height, data.channels, (float*)dst);
+			else
+				downsample_box((float*)src, width, height, data.channels, (float*)dst);
+		}
+		else {
+			if (mip_filter == MIP_FILTER_KAISER)
+				downsample_kaiser(src, width, height, data.channels, dst);
+			else
+				downsample_box(src, width, height, data.channels, dst);
+		}
+
+		data.level_offsets.push_back(next_offset);
+		data.level_widths.push_back(next_width);
+		data.level_heights.push_back(next_height);
+	}
+}
+
+void TextureLoader::upload(Texture* texture, sTextureData& data, bool wrap)
+{
+	unsigned int num_levels = (unsigned int)data.level_offsets.size();
+
+	if (texture->texture_id == 0)
+		glGenTextures(1, &texture->texture_id);
+
+	texture->width = (float)data.width;
+	texture->height = (float)data.height;
+	texture->depth = 0;
+	texture->format = data.get_format();
+	texture->type = data.get_type();
+	texture->internal_format = data.get_internal_format();
+	texture->texture_type = GL_TEXTURE_2D;
+	texture->mipmaps = num_levels > 1;
+	texture->compressed_format = COMPRESSED_NONE;
+	texture->filename = data.filename;
+
+	// copy everything in the pixel buffer, the driver does the transfer without blocking this thread
+	if (!s_pbo)
+		glGenBuffers(1, &s_pbo);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s_pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, data.pixels.size(), NULL, GL_STREAM_DRAW);
+	Profiler::count_upload(data.pixels.size());
+
+	const uint8_t* source = NULL; // offsets inside the pixel buffer
+	void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, data.pixels.size(), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (mapped) {
+		memcpy(mapped, data.pixels.data(), data.pixels.size());
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	}
+	else {
+		// upload from client memory if the buffer cannot be mapped
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		source = data.pixels.data();
+	}
+
+	glBindTexture(GL_TEXTURE_2D, texture->texture_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (unsigned int i = 0; i < num_levels; i++)
+		glTexImage2D(GL_TEXTURE_2D, i, texture->internal_format, data.level_widths[i], data.level_heights[i], 0, texture->format, texture->type, source + data.level_offsets[i]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	texture->wrap_s = texture->wrap_t = texture->mipmaps && wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE;
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, texture->mipmaps ? Texture::default_min_filter : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, texture->wrap_s);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, texture->wrap_t);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	assert(check_gl_errors() && "Error uploading texture");
+}
+
+void TextureLoader::downsample_box(const uint8_t* src, int width, int height, int channels, uint8_t* dst)
+{
+	int next_width = std::max(1, width / 2);
+	int next_height = std::max(1, height / 2);
+	int row_size = width * channels;
+
+	for (int y = 0; y < next_height; y++)
+	{
+		const uint8_t* row0 = src + (size_t)std::min(y * 2, height - 1) * row_size;
+		const uint8_t* row1 = src + (size_t)std::min(y * 2 + 1, height - 1) * row_size;
+		uint8_t* out = dst + (size_t)y * next_width * channels;
+		int x = 0;
+
+#ifdef TEXTURE_LOADER_SSE2
+		// RGBA8: 8 source pixels of two rows give 4 pixels of the next level. The sums are done in 16 bits with the
+		// same rounding as the scalar loop, so the mips do not depend on the CPU
+		if (channels == 4 && width >= 2) {
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i two = _mm_set1_epi16(2);
+			for (; x + 4 <= next_width; x += 4)
+			{
+				__m128i a0 = _mm_loadu_si128((const __m128i*)(row0 + x * 8));
+				__m128i a1 = _mm_loadu_si128((const __m128i*)(row0 + x * 8 + 16));
+				__m128i b0 = _mm_loadu_si128((const __m128i*)(row1 + x * 8));
+				__m128i b1 = _mm_loadu_si128((const __m128i*)(row1 + x * 8 + 16));
+
+				// vertical sums, two pixels per register
+				__m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+				__m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+				__m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+				__m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+				// horizontal sums of the even and odd pixels, then (sum + 2) >> 2
+				__m128i r01 = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+				__m128i r23 = _mm_add_epi16(_mm_unpacklo_epi64(s2, s3), _mm_unpackhi_epi64(s2, s3));
+				r01 = _mm_srli_epi16(_mm_add_epi16(r01, two), 2);
+				r23 = _mm_srli_epi16(_mm_add_epi16(r23, two), 2);
+
+				_mm_storeu_si128((__m128i*)(out + x * 4), _mm_packus_epi16(r01, r23));
+			}
+		}
+#endif
+
+		for (; x < next_width; x++)
+		{
+			int x0 = std::min(x * 2, width - 1) * channels;
+			int x1 = std::min(x * 2 + 1, width - 1) * channels;
+			for (int c = 0; c < channels; c++)
+				out[x * channels + c] = (uint8_t)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+		}
+	}
+}
+
+void TextureLoader::downsample_box(const float* src, int width, int height, int channels, float* dst)
+{
+	int next_width = std::max(1, width / 2);
+	int next_height = std::max(1, height / 2);
+	int row_size = width * channels;
+
+	for (int y = 0; y < next_height; y++)
+	{
+		const float* row0 = src + (size_t)std::min(y * 2, height - 1) * row_size;
+		const float* row1 = src + (size_t)std::min(y * 2 + 1, height - 1) * row_size;
+		float* out = dst + (size_t)y * next_width * channels;
+
+		for (int x = 0; x < next_width; x++)
+		{
+			int x0 = std::min(x * 2, width - 1) * channels;
+			int x1 = std::min(x * 2 + 1, width - 1) * channels;
+			for (int c = 0; c < channels; c++)
+				out[x * channels + c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]) * 0.25f;
+		}
+	}
+}
+
+// Separable kaiser-windowed sinc for a factor 2 reduction: 6 taps centered between the two source pixels
+#define KAISER_TAPS 6
+
+static const float* get_kaiser_weights()
+{
+	// built once by the first decode worker that needs it, the initialization of a local static is thread safe
+	static const std::array<float, KAISER_TAPS> weights = []() {
+		// zeroth order modified bessel function of the first kind
+		auto bessel_i0 = [](float x) {
+			float sum = 1.f, term = 1.f;
+			for (int k = 1; k < 16; k++) {
+				term *= (x * 0.5f / k) * (x * 0.5f / k);
+				sum += term;
+			}
+			return sum;
+		};
+
+		std::array<float, KAISER_TAPS> result;
+		const float alpha = 4.f;
+		const float radius = KAISER_TAPS * 0.5f;
+		float total = 0.f;
+		for (int i = 0; i < KAISER_TAPS; i++)
+		{
+			float d = i - (KAISER_TAPS - 1) * 0.5f; // -2.5 .. 2.5
+			float t = d / radius;
+			float window = bessel_i0(alpha * sqrtf(std::max(0.f, 1.f - t * t))) / bessel_i0(alpha);
+			float x = d * 0.5f * PI;
+			float sinc = fabsf(x) < 1e-5f ? 1.f : sinf(x) / x;
+			result[i] = window * sinc;
+			total += result[i];
+		}
+		for (int i = 0; i < KAISER_TAPS; i++)
+			result[i] /= total;
+		return result;
+	}();
+
+	return weights.data();
+}
+
+// filters horizontally into a float buffer of next_width x height, then vertically into next_width x next_height
+static void downsample_kaiser_float(const float* src, int width, int height, int channels, float* dst)
+{
+	const float* weights = get_kaiser_weights();
+	int next_width = std::max(1, width / 2);
+	int next_height = std::max(1, height / 2);
+	std::vector<float> tmp((size_t)next_width * height * channels);
+
+	for (int y = 0; y < height; y++)
+	{
+		const float* row = src + (size_t)y * width * channels;
+		float* out = &tmp[(size_t)y * next_width * channels];
+		for (int x = 0; x < next_width; x++)
+		{
+			for (int c = 0; c < channels; c++)
+			{
+				float sum = 0.f;
+				for (int k = 0; k < KAISER_TAPS; k++)
+				{
+					int sx = std::clamp(x * 2 + k - (KAISER_TAPS / 2 - 1), 0, width - 1);
+					sum += row[sx * channels + c] * weights[k];
+				}
+				out[x * channels + c] = sum;
+			}
+		}
+	}
+
+	for (int y = 0; y < next_height; y++)
+	{
+		float* out = dst + (size_t)y * next_width * channels;
+		for (int i = 0; i < next_width * channels; i++)
+		{
+			float sum = 0.f;
+			for (int k = 0; k < KAISER_TAPS; k++)
+			{
+				int sy = std::clamp(y * 2 + k - (KAISER_TAPS / 2 - 1), 0, height - 1);
+				sum += tmp[(size_t)sy * next_width * channels + i] * weights[k];
+			}
+			out[i] = sum;
+		}
+	}
+}
+
+void TextureLoader::downsample_kaiser(const float* src, int width, int height, int channels, float* dst)
+{
+	downsample_kaiser_float(src, width, height, channels, dst);
+}
+
+void TextureLoader::downsample_kaiser(const uint8_t* src, int width, int height, int channels, uint8_t* dst)
+{
+	int next_width = std::max(1, width / 2);
+	int next_height = std::max(1, height / 2);
+
+	std::vector<float> source((size_t)width * height * channels);
+	for (size_t i = 0; i < source.size(); i++)
+		source[i] = src[i];
+
+	std::vector<float> result((size_t)next_width * next_height * channels);
+	downsample_kaiser_float(source.data(), width, height, channels, result.data());
+
+	// the negative lobes can go out of range
+	for (size_t i = 0; i < result.size(); i++)
+		dst[i] = (uint8_t)std::clamp(result[i] + 0.5f, 0.f, 255.f);
+}
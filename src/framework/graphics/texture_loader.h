@@ -0,0 +1,65 @@
+#pragma once
+
+#include "framework/includes.h"
+
+#include <string>
+#include <vector>
+#include <functional>
+
+class Texture;
+
+// Decoded image with all its mip levels in a single buffer (level 0 first)
+struct sTextureData
+{
+	std::string filename;
+	int width = 0;
+	int height = 0;
+	int channels = 0; // 3 or 4
+	bool hdr = false; // float pixels instead of bytes
+	std::vector<uint8_t> pixels;
+	std::vector<size_t> level_offsets; // offset in bytes of every mip level
+	std::vector<int> level_widths;
+	std::vector<int> level_heights;
+	std::string error; // reason of the failure when decode() returns false
+
+	unsigned int get_format() { return channels == 3 ? GL_RGB : GL_RGBA; }
+	unsigned int get_type() { return hdr ? GL_FLOAT : GL_UNSIGNED_BYTE; }
+	unsigned int get_internal_format() { return hdr ? (channels == 3 ? GL_RGB32F : GL_RGBA32F) : get_format(); }
+};
+
+// Texture loading pipeline: files are decoded with stb_image (JPEG, PNG, TGA, BMP, HDR) in worker threads, the mipmaps
+// are generated on the CPU in the same threads, and the main thread only copies the result into a pixel buffer object
+// and uploads it, with a budget of bytes per frame so big scenes do not stall. DDS/KTX2 files and the compressed copies
+// of the images (Texture::get_compressed_filename) are read in the threads too and uploaded as they are
+class TextureLoader
+{
+public:
+	enum { MIP_FILTER_BOX, MIP_FILTER_KAISER };
+
+	static int mip_filter; // box is fast (SSE2 for RGBA8), kaiser keeps more detail in the small levels
+	static size_t upload_budget; // bytes uploaded per frame, at least one texture is uploaded every frame
+
+	static void init(unsigned int num_threads = 0); // 0 uses the number of cores minus one
+	static void shutdown();
+
+	// queues the decoding of the file, the texture gets the pixels in a later update()
+	static void load_async(Texture* texture, const char* filename, bool mipmaps, bool wrap);
+	// runs work() in the loader threads and done() in the main thread during a later update() (it returns the bytes uploaded)
+	static void run_async(std::function<void()> work, std::function<size_t()> done);
+	// uploads the textures decoded since the last call (main thread, once per frame)
+	static void update();
+	static unsigned int get_num_pending();
+
+	// synchronous path: decodes, generates the mips and uploads in the calling thread
+	static bool load(Texture* texture, const char* filename, bool mipmaps, bool wrap, bool hdr = false);
+
+	static bool decode(sTextureData& data, bool mipmaps, bool hdr);
+	static void generate_mipmaps(sTextureData& data);
+	static void upload(Texture* texture, sTextureData& data, bool wrap);
+
+	// 2x2 downsample of one level (clamping the last row and column on odd sizes)
+	static void downsample_box(const uint8_t* src, int width, int height, int channels, uint8_t* dst);
+	static void downsample_box(const float* src, int width, int height, int channels, float* dst);
+	static void downsample_kaiser(const uint8_t* src, int width, int height, int channels, uint8_t* dst);
+	static void downsample_kaiser(const float* src, int width, int height, int channels, float* dst);
+};
@@ -0,0 +1,409 @@
+#include "texture_streamer.h"
+
+#include "mesh.h"
+#include "../camera.h"
+#include "../utils.h"
+#include "../profiler.h"
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+bool TextureStreamer::enabled = true;
+size_t TextureStreamer::vram_budget = 256 * 1024 * 1024;
+int TextureStreamer::min_resident_size = 64;
+unsigned int TextureStreamer::max_uploads_per_frame = 4;
+unsigned int TextureStreamer::eviction_frames = 120;
+float TextureStreamer::mip_bias = 0.f;
+
+std::map<Texture*, sStreamedTexture*> TextureStreamer::s_streamed;
+unsigned int TextureStreamer::frame = 1;
+Camera* TextureStreamer::camera = NULL;
+int TextureStreamer::viewport_height = 0;
+
+// pixel buffer used to keep the resident levels when a texture drops its finer ones
+static GLuint s_copy_buffer = 0;
+
+size_t sStreamedTexture::get_bytes(int from_level)
+{
+	size_t bytes = 0;
+	for (unsigned int i = std::max(from_level, 0); i < num_levels; i++)
+		bytes += get_level_bytes(i);
+	return bytes;
+}
+
+void sStreamedLevels::read()
+{
+	// the compressed copy takes less RAM and less VRAM, otherwise the image is decoded with all its mips
+	if (compressed_filename.size() && TextureCompression::load(compressed_filename.c_str(), compressed) && ((supported_formats >> compressed.format) & 1)) {
+		is_compressed = ok = true;
+		return;
+	}
+
+	compressed = sCompressedImage();
+	data.filename = filename;
+	ok = TextureLoader::decode(data, true, hdr);
+}
+
+Texture* TextureStreamer::get(const char* filename, bool wrap)
+{
+	assert(filename);
+
+	auto it = Texture::s_textures_loaded.find(filename);
+	if (it != Texture::s_textures_loaded.end())
+		return it->second;
+
+	std::string name = filename;
+	std::string ext = name.substr(name.find_last_of('.') + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	bool is_container = ext == "dds" || ext == "ktx2";
+
+	//white until the first read finishes
+	const uint8_t white[3] = { 255,255,255 };
+	Texture* texture = new Texture(1, 1, GL_RGB, GL_UNSIGNED_BYTE, false, (uint8_t*)white);
+	texture->filename = filename;
+	texture->wrap_s = texture->wrap_t = wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE;
+
+	sStreamedTexture* streamed = new sStreamedTexture();
+	streamed->texture = texture;
+	streamed->filename = filename;
+	streamed->hdr = ext == "hdr";
+	if (is_container || Texture::use_compressed)
+		streamed->compressed_filename = is_container ? name : Texture::get_compressed_filename(filename);
+
+	s_streamed[texture] = streamed;
+	texture->set_name(filename);
+	ResourceManager::add(texture);
+	read_levels(streamed);
+	return texture;
+}
+
+void TextureStreamer::read_levels(sStreamedTexture* streamed)
+{
+	sStreamedLevels* levels = new sStreamedLevels();
+	levels->filename = streamed->filename;
+	levels->compressed_filename = streamed->compressed_filename;
+	levels->hdr = streamed->hdr;
+	for (int format = COMPRESSED_BC1; format <= COMPRESSED_BC7; format++)
+		if (Texture::is_compressed_format_supported(format))
+			levels->supported_formats |= 1 << format;
+
+	// not evicted by the ResourceManager while the job uses it
+	streamed->loading = true;
+	streamed->texture->pending = true;
+	TextureLoader::run_async([levels]() { levels->read(); }, [streamed, levels]() {
+		size_t bytes = on_levels_read(streamed, levels);
+		delete levels;
+		return bytes;
+	});
+}
+
+size_t TextureStreamer::on_levels_read(sStreamedTexture* streamed, sStreamedLevels* levels)
+{
+	// the texture was deleted while reading
+	Texture* texture = streamed->texture;
+	if (!texture) {
+		delete streamed;
+		return 0;
+	}
+
+	streamed->loading = false;
+	texture->pending = false;
+	if (!levels->ok) {
+		if (!streamed->num_levels)
+			std::cout << " [ERROR]: Texture not loaded " << streamed->filename << std::endl;
+		return 0;
+	}
+
+	if (!streamed->num_levels)
+	{
+		// first read: the format and the levels of the texture
+		streamed->is_compressed = levels->is_compressed;
+		if (!levels->is_compressed)
+			streamed->compressed_filename.clear();
+		streamed->num_levels = levels->get_num_levels();
+		for (unsigned int i = 0; i < streamed->num_levels; i++) {
+			if (levels->is_compressed) {
+				streamed->level_sizes.push_back(levels->compressed.level_sizes[i]);
+				streamed->level_widths.push_back(levels->compressed.get_level_width(i));
+				streamed->level_heights.push_back(levels->compressed.get_level_height(i));
+			}
+			else {
+				sTextureData& data = levels->data;
+				streamed->level_sizes.push_back((i + 1 < streamed->num_levels ? data.level_offsets[i + 1] : data.pixels.size()) - data.level_offsets[i]);
+				streamed->level_widths.push_back(data.level_widths[i]);
+				streamed->level_heights.push_back(data.level_heights[i]);
+			}
+		}
+
+		texture->mipmaps = streamed->num_levels > 1;
+		texture->image.clear();
+		if (levels->is_compressed) {
+			texture->width = (float)levels->compressed.width;
+			texture->height = (float)levels->compressed.height;
+			texture->format = texture->internal_format = Texture::get_compressed_gl_format(levels->compressed.format, levels->compressed.srgb);
+			texture->type = 0;
+			texture->compressed_format = levels->compressed.format;
+		}
+		else {
+			texture->width = (float)levels->data.width;
+			texture->height = (float)levels->data.height;
+			texture->format = levels->data.get_format();
+			texture->type = levels->data.get_type();
+			texture->internal_format = levels->data.get_internal_format();
+		}
+
+		// coarsest level that is always kept, the finer ones are streamed
+		streamed->min_level = streamed->num_levels - 1;
+		for (unsigned int i = 0; i < streamed->num_levels; i++) {
+			if (std::max(streamed->level_widths[i], streamed->level_heights[i]) <= min_resident_size) {
+				streamed->min_level = i;
+				break;
+			}
+		}
+		streamed->resident_level = streamed->num_levels;
+		streamed->requested_level = streamed->target_level = streamed->min_level;
+		std::cout << " + Texture streamed: " << streamed->filename << " Size: " << texture->width << "x" << texture->height << " Levels: " << streamed->num_levels << std::endl;
+	}
+	else if (levels->is_compressed != streamed->is_compressed || levels->get_num_levels() != streamed->num_levels)
+		return 0; // the file changed, the resident levels stay
+
+	// the target may have changed while reading (it is never finer than the levels read)
+	int level = std::min(streamed->target_level, streamed->min_level);
+	if (level >= streamed->resident_level)
+		return 0;
+
+	size_t bytes = streamed->get_bytes(level) - streamed->get_bytes(streamed->resident_level);
+	set_resident_level(streamed, level, levels);
+	return bytes;
+}
+
+sStreamedTexture* TextureStreamer::find(Texture* texture)
+{
+	auto it = s_streamed.find(texture);
+	return it != s_streamed.end() ? it->second : NULL;
+}
+
+void TextureStreamer::remove(Texture* texture)
+{
+	auto it = s_streamed.find(texture);
+	if (it == s_streamed.end())
+		return;
+	// a job reading the file deletes it when it finishes
+	if (it->second->loading)
+		it->second->texture = NULL;
+	else
+		delete it->second;
+	s_streamed.erase(it);
+}
+
+void TextureStreamer::begin_frame(Camera* camera, int viewport_height)
+{
+	TextureStreamer::camera = camera;
+	TextureStreamer::viewport_height = viewport_height;
+}
+
+void TextureStreamer::request(Texture* texture, Mesh* mesh, const mat4& model)
+{
+	if (!texture || !mesh || !camera || s_streamed.empty())
+		return;
+
+	// bounding sphere in world space (the radius is scaled by the biggest axis of the model)
+	vec3 center = transform_point(model, mesh->box.center);
+	float scale = std::max(len(vec3(model.right.x, model.right.y, model.right.z)),
+		std::max(len(vec3(model.up.x, model.up.y, model.up.z)), len(vec3(model.forward.x, model.forward.y, model.forward.z))));
+	float radius = mesh->radius * scale;
+
+	// pixels covered by the diameter of the sphere
+	float screen_size = 0.f;
+	if (camera->type == Camera::ORTHOGRAPHIC) {
+		screen_size = 2.f * radius / std::max(fabsf(camera->top - camera->bottom), 1e-6f) * viewport_height;
+	}
+	else {
+		float distance = len(center - camera->eye);
+		float focal = viewport_height / (2.f * tanf(camera->fov * 0.5f * PI / 180.f));
+		screen_size = distance > radius ? 2.f * radius / distance * focal : (float)viewport_height;
+	}
+
+	request(texture, screen_size);
+}
+
+void TextureStreamer::request(Texture* texture, float screen_size)
+{
+	sStreamedTexture* streamed = find(texture);
+	if (!streamed || !streamed->num_levels)
+		return;
+
+	// the level whose size matches the pixels on screen
+	float texels = std::max(texture->width, texture->height);
+	int level = (int)floorf(log2f(texels / std::max(screen_size, 1.f)) + mip_bias);
+	level = std::clamp(level, 0, streamed->min_level);
+
+	streamed->requested_level = std::min(streamed->requested_level, level);
+	streamed->screen_size = std::max(streamed->screen_size, screen_size);
+	streamed->last_frame_used = frame;
+}
+
+void TextureStreamer::update()
+{
+	if (!enabled || s_streamed.empty()) {
+		frame++;
+		return;
+	}
+
+	// levels wanted by the requests of this frame
+	size_t total = 0;
+	for (auto& it : s_streamed)
+	{
+		sStreamedTexture* streamed = it.second;
+		if (!streamed->num_levels)
+			continue;
+		bool recently_used = streamed->last_frame_used && frame - streamed->last_frame_used <= eviction_frames;
+		streamed->target_level = recently_used ? streamed->requested_level : streamed->min_level;
+		total += streamed->get_bytes(streamed->target_level);
+	}
+
+	// over budget: drop one level of the least recently used texture (the smallest on screen if there is a tie) until it fits
+	while (total > vram_budget)
+	{
+		sStreamedTexture* victim = NULL;
+		for (auto& it : s_streamed)
+		{
+			sStreamedTexture* streamed = it.second;
+			if (!streamed->num_levels || streamed->target_level >= streamed->min_level)
+				continue;
+			if (!victim || streamed->last_frame_used < victim->last_frame_used ||
+				(streamed->last_frame_used == victim->last_frame_used && streamed->screen_size < victim->screen_size))
+				victim = streamed;
+		}
+		if (!victim)
+			break;
+
+		total -= victim->get_level_bytes(victim->target_level);
+		victim->target_level++;
+	}
+
+	// evictions are applied at once, finer levels are read from the file in background (the biggest on screen first)
+	// and uploaded by TextureLoader::update when they are ready
+	std::vector<sStreamedTexture*> uploads;
+	for (auto& it : s_streamed)
+	{
+		sStreamedTexture* streamed = it.second;
+		if (!streamed->num_levels)
+			continue;
+		if (streamed->target_level > streamed->resident_level)
+			set_resident_level(streamed, streamed->target_level);
+		else if (streamed->target_level < streamed->resident_level && !streamed->loading)
+			uploads.push_back(streamed);
+	}
+
+	std::sort(uploads.begin(), uploads.end(), [](sStreamedTexture* a, sStreamedTexture* b) { return a->screen_size > b->screen_size; });
+	for (unsigned int i = 0; i < uploads.size() && i < max_uploads_per_frame; i++)
+		read_levels(uploads[i]);
+
+	for (auto& it : s_streamed)
+	{
+		it.second->requested_level = it.second->min_level;
+		it.second->screen_size = 0.f;
+	}
+
+	frame++;
+}
+
+void TextureStreamer::set_resident_level(sStreamedTexture* streamed, int level, sStreamedLevels* levels)
+{
+	Texture* texture = streamed->texture;
+	bool created = streamed->resident_level < (int)streamed->num_levels; // otherwise it is the white placeholder
+
+	if (level < streamed->resident_level)
+	{
+		assert(levels);
+		// finer levels are added to the same texture object
+		if (!created) {
+			glDeleteTextures(1, &texture->texture_id);
+			glGenTextures(1, &texture->texture_id);
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (int i = std::min(streamed->resident_level, (int)streamed->num_levels) - 1; i >= level; i--)
+			upload_level(streamed, i, levels->get_level(i));
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+	else if (level > streamed->resident_level)
+	{
+		// GL cannot free single levels: the levels that stay are read back into a pixel buffer (they do not
+		// go through RAM) and the texture is created again from it
+		if (!s_copy_buffer)
+			glGenBuffers(1, &s_copy_buffer);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, s_copy_buffer);
+		glBufferData(GL_PIXEL_PACK_BUFFER, streamed->get_bytes(level), NULL, GL_STREAM_COPY);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glBindTexture(GL_TEXTURE_2D, texture->texture_id);
+		size_t offset = 0;
+		for (int i = level; i < (int)streamed->num_levels; i++) {
+			if (streamed->is_compressed)
+				glGetCompressedTexImage(GL_TEXTURE_2D, i, (void*)offset);
+			else
+				glGetTexImage(GL_TEXTURE_2D, i, texture->format, texture->type, (void*)offset);
+			offset += streamed->get_level_bytes(i);
+		}
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		glDeleteTextures(1, &texture->texture_id);
+		glGenTextures(1, &texture->texture_id);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s_copy_buffer);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		offset = 0;
+		for (int i = level; i < (int)streamed->num_levels; i++) {
+			upload_level(streamed, i, (const void*)offset);
+			offset += streamed->get_level_bytes(i);
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	streamed->resident_level = level;
+
+	glBindTexture(GL_TEXTURE_2D, texture->texture_id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, streamed->num_levels - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, texture->mipmaps ? Texture::default_min_filter : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, texture->wrap_s);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, texture->wrap_t);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	assert(check_gl_errors() && "Error streaming texture");
+}
+
+void TextureStreamer::upload_level(sStreamedTexture* streamed, int level, const void* pixels)
+{
+	Texture* texture = streamed->texture;
+	glBindTexture(GL_TEXTURE_2D, texture->texture_id);
+
+	if (streamed->is_compressed)
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, texture->internal_format, streamed->level_widths[level], streamed->level_heights[level], 0,
+			(GLsizei)streamed->level_sizes[level], pixels);
+	else
+		glTexImage2D(GL_TEXTURE_2D, level, texture->internal_format, streamed->level_widths[level], streamed->level_heights[level], 0,
+			texture->format, texture->type, pixels);
+	Profiler::count_upload(streamed->level_sizes[level]);
+}
+
+size_t TextureStreamer::get_resident_bytes()
+{
+	size_t bytes = 0;
+	for (auto& it : s_streamed)
+		bytes += it.second->get_bytes(it.second->resident_level);
+	return bytes;
+}
+
+void TextureStreamer::render_gui()
+{
+	int budget = (int)(vram_budget / (1024 * 1024));
+	ImGui::Checkbox("Streaming", &enabled);
+	if (ImGui::SliderInt("VRAM budget (MB)", &budget, 1, 2048))
+		vram_budget = (size_t)budget * 1024 * 1024;
+	ImGui::SliderFloat("Mip bias", &mip_bias, -2.f, 4.f);
+	ImGui::Text("Textures: %d Resident: %.1f MB", (int)s_streamed.size(), get_resident_bytes() / (1024.f * 1024.f));
+}
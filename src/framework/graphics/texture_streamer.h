@@ -0,0 +1,97 @@
+#pragma once
+
+#include "texture.h"
+#include "texture_loader.h"
+#include "texture_compression.h"
+#include "../math/mat4.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+class Camera;
+class Mesh;
+
+// Mip residency of a streamed texture. Only the levels from resident_level to the last one are kept, in VRAM
+// (GL_TEXTURE_BASE_LEVEL skips the others), the finer ones are read again from the file when they are requested
+struct sStreamedTexture
+{
+	Texture* texture = NULL;
+	std::string filename;
+	std::string compressed_filename; // BCn copy tried first (empty if there is none or the GPU does not support it)
+	bool is_compressed = false;
+	bool hdr = false;
+	bool loading = false; // reading the file in the TextureLoader threads
+
+	unsigned int num_levels = 0; // 0 until the first read finishes
+	std::vector<size_t> level_sizes; // bytes of every level in VRAM
+	std::vector<int> level_widths;
+	std::vector<int> level_heights;
+	int resident_level = 0; // finest level in VRAM
+	int min_level = 0; // coarsest level that is always resident
+	int requested_level = 0; // finest level requested during the frame
+	int target_level = 0; // level chosen by the last update (after the budget)
+	unsigned int last_frame_used = 0;
+	float screen_size = 0.f; // biggest size in pixels requested during the frame
+
+	size_t get_level_bytes(int level) { return level_sizes[level]; }
+	size_t get_bytes(int from_level); // VRAM used with the levels from from_level to the last one resident
+};
+
+// Whole mip chain read by a streaming job, only lives until its levels are uploaded
+struct sStreamedLevels
+{
+	std::string filename;
+	std::string compressed_filename;
+	unsigned int supported_formats = 0; // bit per eCompressedFormat, GL cannot be asked from the loader threads
+	bool hdr = false;
+
+	bool ok = false;
+	bool is_compressed = false;
+	sTextureData data; // uncompressed chain
+	sCompressedImage compressed; // or BCn chain
+
+	void read(); // in a loader thread
+	unsigned int get_num_levels() { return is_compressed ? compressed.get_num_levels() : (unsigned int)data.level_offsets.size(); }
+	const uint8_t* get_level(int level) { return is_compressed ? &compressed.data[compressed.level_offsets[level]] : &data.pixels[data.level_offsets[level]]; }
+};
+
+class TextureStreamer
+{
+public:
+	static bool enabled;
+	static size_t vram_budget; // bytes of all the streamed textures together
+	static int min_resident_size; // levels this size or smaller are always resident
+	static unsigned int max_uploads_per_frame; // number of textures that can start reading finer levels every frame
+	static unsigned int eviction_frames; // frames without requests before a texture drops to its smallest levels
+	static float mip_bias; // added to the level computed from the size on screen
+
+	static std::map<Texture*, sStreamedTexture*> s_streamed;
+	static unsigned int frame;
+	static Camera* camera;
+	static int viewport_height;
+
+	// white until the file is read in background, then only its smallest levels are resident (cached like Texture::get)
+	static Texture* get(const char* filename, bool wrap = true);
+	static sStreamedTexture* find(Texture* texture);
+	static void remove(Texture* texture); // the texture is being deleted
+
+	// camera used to compute the size on screen of the requests of this frame
+	static void begin_frame(Camera* camera, int viewport_height);
+	// asks for the level needed to draw a mesh with the texture (called by the materials before drawing)
+	static void request(Texture* texture, Mesh* mesh, const mat4& model);
+	static void request(Texture* texture, float screen_size);
+	// chooses the levels of every texture inside the budget and uploads or evicts (once per frame, after rendering)
+	static void update();
+
+	static size_t get_resident_bytes();
+	static void render_gui();
+
+protected:
+	static void read_levels(sStreamedTexture* streamed);
+	static size_t on_levels_read(sStreamedTexture* streamed, sStreamedLevels* levels); // main thread, returns the bytes uploaded
+	// levels finer than the resident ones come from levels, coarser ones are copied from the texture itself
+	static void set_resident_level(sStreamedTexture* streamed, int level, sStreamedLevels* levels = NULL);
+	// pixels can be an offset in the bound GL_PIXEL_UNPACK_BUFFER
+	static void upload_level(sStreamedTexture* streamed, int level, const void* pixels);
+};
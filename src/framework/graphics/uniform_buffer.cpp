@@ -0,0 +1,196 @@
+#include "uniform_buffer.h"
+
+#include "../camera.h"
+#include "../profiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+UniformBuffer* UniformBlocks::frame_buffer = nullptr;
+UniformRingBuffer* UniformBlocks::object_buffer = nullptr;
+UniformBuffer* UniformBlocks::frame_objects_buffer = nullptr;
+unsigned int UniformBlocks::frame_object_stride = 0;
+int UniformBlocks::frame_object = -1;
+Camera* UniformBlocks::frame_camera = nullptr;
+float UniformBlocks::frame_time = 0.f;
+
+static_assert(sizeof(sFrameBlock) == 208, "sFrameBlock does not follow the std140 layout");
+static_assert(sizeof(sMaterialBlock) == 32, "sMaterialBlock does not follow the std140 layout");
+
+UniformBuffer::UniformBuffer()
+{
+	buffer_id = 0;
+	size = 0;
+}
+
+UniformBuffer::~UniformBuffer()
+{
+	if (buffer_id)
+		glDeleteBuffers(1, &buffer_id);
+}
+
+void UniformBuffer::create(unsigned int size)
+{
+	if (!buffer_id)
+		glGenBuffers(1, &buffer_id);
+
+	this->size = size;
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer_id);
+	glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void UniformBuffer::update(const void* data, unsigned int size)
+{
+	assert(buffer_id && size <= this->size);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer_id);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	Profiler::count_upload(size);
+}
+
+void UniformBuffer::bind(unsigned int binding)
+{
+	glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer_id);
+	Profiler::counters.buffer_binds++;
+}
+
+UniformRingBuffer::UniformRingBuffer()
+{
+	buffer_id = 0;
+	size = 0;
+	offset = 0;
+	alignment = 256;
+}
+
+UniformRingBuffer::~UniformRingBuffer()
+{
+	if (buffer_id)
+		glDeleteBuffers(1, &buffer_id);
+}
+
+void UniformRingBuffer::create(unsigned int size)
+{
+	GLint align = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+	if (align > 0)
+		alignment = align;
+
+	if (!buffer_id)
+		glGenBuffers(1, &buffer_id);
+
+	this->size = size;
+	offset = 0;
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer_id);
+	glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+unsigned int UniformRingBuffer::allocate(const void* data, unsigned int size)
+{
+	assert(buffer_id && size <= this->size);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer_id);
+
+	// wrap around: orphan the storage instead of waiting for the GPU to finish with it
+	if (offset + size > this->size) {
+		glBufferData(GL_UNIFORM_BUFFER, this->size, NULL, GL_STREAM_DRAW);
+		offset = 0;
+	}
+
+	unsigned int start = offset;
+	glBufferSubData(GL_UNIFORM_BUFFER, start, size, data);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	Profiler::count_upload(size);
+
+	offset = (start + size + alignment - 1) / alignment * alignment;
+	return start;
+}
+
+void UniformRingBuffer::bind(unsigned int binding, const void* data, unsigned int size)
+{
+	unsigned int start = allocate(data, size);
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer_id, start, size);
+	Profiler::counters.buffer_binds++;
+}
+
+void UniformBlocks::init()
+{
+	if (frame_buffer)
+		return;
+
+	frame_buffer = new UniformBuffer();
+	frame_buffer->create(sizeof(sFrameBlock));
+
+	// room for a few thousand objects before the storage is orphaned
+	object_buffer = new UniformRingBuffer();
+	object_buffer->create(1 << 20);
+
+	frame_objects_buffer = new UniformBuffer();
+	frame_object_stride = (sizeof(sObjectBlock) + object_buffer->alignment - 1) / object_buffer->alignment * object_buffer->alignment;
+}
+
+void UniformBlocks::begin_frame(Camera* camera, float time)
+{
+	init();
+
+	sFrameBlock block;
+	block.viewprojection = camera->viewprojection_matrix;
+	block.view = camera->view_matrix;
+	block.projection = camera->projection_matrix;
+	block.camera_position = camera->eye;
+	block.time = time;
+
+	frame_buffer->update(&block, sizeof(sFrameBlock));
+	frame_buffer->bind(FRAME_BLOCK_BINDING);
+
+	frame_camera = camera;
+	frame_time = time;
+}
+
+void UniformBlocks::use_camera(Camera* camera)
+{
+	if (camera != frame_camera)
+		begin_frame(camera, frame_time);
+}
+
+void UniformBlocks::set_object(const mat4& model)
+{
+	init();
+
+	sObjectBlock block;
+	block.model = model;
+	object_buffer->bind(OBJECT_BLOCK_BINDING, &block, sizeof(sObjectBlock));
+}
+
+void UniformBlocks::upload_frame_objects(const mat4* models, size_t count)
+{
+	init();
+	if (!count)
+		return;
+
+	// the blocks are laid out at the offset alignment, the staging copy only grows
+	static std::vector<uint8_t> staging;
+	size_t size = count * frame_object_stride;
+	if (staging.size() < size)
+		staging.resize(size);
+	for (size_t i = 0; i < count; i++)
+		memcpy(&staging[i * frame_object_stride], &models[i], sizeof(sObjectBlock));
+
+	// the storage is orphaned every frame (create), the draws of the previous frame can still be reading it
+	unsigned int capacity = std::max(frame_objects_buffer->size, 64u * frame_object_stride);
+	while (capacity < size)
+		capacity *= 2;
+	frame_objects_buffer->create(capacity);
+	frame_objects_buffer->update(staging.data(), (unsigned int)size);
+}
+
+void UniformBlocks::bind_frame_object(int slot)
+{
+	assert(slot >= 0 && (unsigned int)(slot + 1) * frame_object_stride <= frame_objects_buffer->size);
+	glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_BLOCK_BINDING, frame_objects_buffer->buffer_id, (GLintptr)slot * frame_object_stride, sizeof(sObjectBlock));
+	Profiler::counters.buffer_binds++;
+}
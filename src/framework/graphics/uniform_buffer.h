@@ -0,0 +1,110 @@
+#pragma once
+
+#include "framework/includes.h"
+#include "../math/vec3.h"
+#include "../math/vec4.h"
+#include "../math/mat4.h"
+
+class Camera;
+
+// std140 uniform blocks shared by all the shaders. The C++ structs follow the std140 layout
+// (a vec3 followed by a float fills a whole vec4), keep them in sync with res/shaders/basic.vs
+enum {
+	FRAME_BLOCK_BINDING,
+	MATERIAL_BLOCK_BINDING,
+	OBJECT_BLOCK_BINDING,
+	MATERIAL_TABLE_BINDING,
+	NUM_BLOCK_BINDINGS
+};
+
+struct sFrameBlock
+{
+	mat4 viewprojection;
+	mat4 view;
+	mat4 projection;
+	vec3 camera_position;
+	float time;
+};
+
+struct sMaterialBlock
+{
+	vec4 color;
+	float metallic;
+	float roughness;
+	float padding[2];
+};
+
+struct sObjectBlock
+{
+	mat4 model;
+};
+
+// materials of the submeshes of a mesh, indexed by the material of every draw (see DrawBatch)
+#define MAX_TABLE_MATERIALS 256
+
+struct sMaterialTableEntry
+{
+	vec4 Ka;
+	vec4 Kd;
+	vec4 Ks;
+};
+
+// A GL uniform buffer with a fixed size, updated as a whole
+class UniformBuffer
+{
+public:
+	GLuint buffer_id;
+	unsigned int size;
+
+	UniformBuffer();
+	~UniformBuffer();
+
+	void create(unsigned int size);
+	void update(const void* data, unsigned int size);
+	void bind(unsigned int binding);
+};
+
+// Big uniform buffer sub-allocated in order, every allocation is bound with its offset.
+// When the end is reached the storage is orphaned, so the driver can keep the old one alive for the draws in flight
+class UniformRingBuffer
+{
+public:
+	GLuint buffer_id;
+	unsigned int size;
+	unsigned int offset;
+	unsigned int alignment; // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+
+	UniformRingBuffer();
+	~UniformRingBuffer();
+
+	void create(unsigned int size);
+	// copies the data in the buffer and returns its offset
+	unsigned int allocate(const void* data, unsigned int size);
+	// copies the data and binds its range to the block binding
+	void bind(unsigned int binding, const void* data, unsigned int size);
+};
+
+// Buffers used by the renderer: the frame block is written once per frame, the object blocks of the draws of the frame
+// are uploaded together in one buffer and bound by offset. The objects drawn outside the frame go to the ring buffer
+class UniformBlocks
+{
+public:
+	static UniformBuffer* frame_buffer;
+	static UniformRingBuffer* object_buffer;
+	static UniformBuffer* frame_objects_buffer;
+	static unsigned int frame_object_stride; // sObjectBlock rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+	static int frame_object; // slot of the custom item being drawn (helpers, terrain), -1 when there is none
+	static Camera* frame_camera; // camera of the frame block currently bound
+	static float frame_time;
+
+	static void init();
+	// uploads the camera matrices once, call it before rendering each frame (and when rendering from another camera)
+	static void begin_frame(Camera* camera, float time);
+	// binds the frame block of this camera if it is not the one already bound
+	static void use_camera(Camera* camera);
+	// uploads the model of one draw to the ring and binds it
+	static void set_object(const mat4& model);
+	// uploads the object blocks of all the draws of the frame with a single update, the draws bind them by slot
+	static void upload_frame_objects(const mat4* models, size_t count);
+	static void bind_frame_object(int slot);
+};
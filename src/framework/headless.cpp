@@ -0,0 +1,246 @@
+#include "headless.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+
+#include "application.h"
+#include "profiler.h"
+#include "frame_allocator.h"
+#include "resource_manager.h"
+#include "graphics/shader.h"
+#include "graphics/texture.h"
+#include "graphics/texture_loader.h"
+
+sHeadlessOptions Headless::options;
+unsigned int Headless::fbo = 0;
+unsigned int Headless::color_renderbuffer = 0;
+unsigned int Headless::depth_renderbuffer = 0;
+
+bool sHeadlessOptions::parse(int argc, char** argv)
+{
+	bool headless = false;
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		if (strcmp(arg, "-headless") == 0) headless = true;
+		else if (strcmp(arg, "-null") == 0) null_platform = true;
+		else if (strcmp(arg, "-frames") == 0 && i + 1 < argc) frames = std::max(1, atoi(argv[++i]));
+		else if (strcmp(arg, "-width") == 0 && i + 1 < argc) width = std::max(1, atoi(argv[++i]));
+		else if (strcmp(arg, "-height") == 0 && i + 1 < argc) height = std::max(1, atoi(argv[++i]));
+		else if (strcmp(arg, "-radius") == 0 && i + 1 < argc) orbit_radius = (float)atof(argv[++i]);
+		else if (strcmp(arg, "-dump") == 0 && i + 1 < argc) dump_folder = argv[++i];
+		else if (strcmp(arg, "-dump_every") == 0 && i + 1 < argc) dump_every = std::max(1, atoi(argv[++i]));
+		else if (strcmp(arg, "-o") == 0 && i + 1 < argc) output = argv[++i];
+		else
+			std::cout << "[WARN] unknown argument " << arg << std::endl;
+	}
+
+	if (headless)
+		return true;
+	if (argc > 1)
+		std::cout << "usage: " << argv[0] << " -headless [-null] [-frames n] [-width w] [-height h] [-radius r] [-dump folder] [-dump_every n] [-o results.json]" << std::endl;
+	return false;
+}
+
+void Headless::set_window_hints()
+{
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	if (options.null_platform) {
+		// surfaceless EGL, the only framebuffer is the FBO
+		glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+	}
+}
+
+bool Headless::create_framebuffer(int width, int height)
+{
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+	glGenRenderbuffers(1, &color_renderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, color_renderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_renderbuffer);
+
+	glGenRenderbuffers(1, &depth_renderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depth_renderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth_renderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cout << "[ERROR] headless framebuffer incomplete" << std::endl;
+		destroy_framebuffer();
+		return false;
+	}
+	return true;
+}
+
+void Headless::destroy_framebuffer()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (fbo)
+		glDeleteFramebuffers(1, &fbo);
+	if (color_renderbuffer)
+		glDeleteRenderbuffers(1, &color_renderbuffer);
+	if (depth_renderbuffer)
+		glDeleteRenderbuffers(1, &depth_renderbuffer);
+	fbo = color_renderbuffer = depth_renderbuffer = 0;
+}
+
+bool Headless::run(Application* app, GLFWwindow* window)
+{
+	int width = options.width;
+	int height = options.height;
+	if (!create_framebuffer(width, height))
+		return false;
+
+	glfwSwapInterval(0);
+	app->window_width = width;
+	app->window_height = height;
+	Application::camera->set_perspective(45.f, width / (float)height, 0.1f, 500.f);
+
+	// one fixed step per frame, the images do not depend on how long the frames take
+	app->fixed_steps_per_frame = 1;
+
+	if (options.dump_folder.size()) {
+		std::error_code error;
+		std::filesystem::create_directories(options.dump_folder, error);
+	}
+
+	std::vector<double> frame_times;
+	std::vector<double> gpu_times;
+	double draw_calls = 0.0;
+	double triangles = 0.0;
+	uint64_t last_gpu_frame = UINT64_MAX;
+	Image image;
+
+	double start = glfwGetTime();
+	for (int i = 0; i < options.frames && !glfwWindowShouldClose(window); i++)
+	{
+		double frame_start = glfwGetTime();
+		Profiler::begin_frame();
+		// the pipelined update of the last frame may still be running, like in the window loop
+		app->wait_update();
+		FrameAllocator::begin_frame();
+		ResourceManager::update();
+
+		Shader::update_async();
+		TextureLoader::update();
+
+		// scripted camera: a turn around the scene
+		float angle = 2.f * (float)M_PI * i / options.frames;
+		vec3 eye(cosf(angle) * options.orbit_radius, options.orbit_height, sinf(angle) * options.orbit_radius);
+		Application::camera->look_at(eye, vec3(0.f, 0.f, 0.f), vec3(0.f, 1.f, 0.f));
+
+		app->update(app->fixed_timestep);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glViewport(0, 0, width, height);
+		app->render();
+
+		// the frame time includes the GPU work
+		glFinish();
+		draw_calls += Mesh::num_meshes_rendered;
+		triangles += Mesh::num_triangles_rendered;
+		Profiler::end_frame();
+		frame_times.push_back((glfwGetTime() - frame_start) * 1000.0);
+
+		const sProfilerFrame* resolved = Profiler::get_last_resolved_frame();
+		if (resolved && resolved->index != last_gpu_frame && resolved->gpu_time >= 0.0) {
+			gpu_times.push_back(resolved->gpu_time);
+			last_gpu_frame = resolved->index;
+		}
+
+		// the read back is not part of the frame time
+		if (options.dump_folder.size() && i % options.dump_every == 0) {
+			char filename[512];
+			snprintf(filename, sizeof(filename), "%s/frame_%05d.tga", options.dump_folder.c_str(), i);
+			image.from_screen(width, height);
+			if (!image.saveTGA(filename, false))
+				std::cout << "[ERROR] cannot write " << filename << std::endl;
+		}
+		glfwPollEvents();
+	}
+	app->wait_update();
+	double total_time = glfwGetTime() - start;
+
+	destroy_framebuffer();
+
+	std::string json = to_json(frame_times, gpu_times, total_time, draw_calls / options.frames, triangles / options.frames);
+	if (options.output.empty()) {
+		std::cout << json;
+		return true;
+	}
+	std::ofstream file(options.output);
+	if (!file.is_open()) {
+		std::cerr << "Could not write " << options.output << std::endl;
+		return false;
+	}
+	file << json;
+	return true;
+}
+
+static double get_percentile(std::vector<double> values, double percentile)
+{
+	if (values.empty())
+		return 0.0;
+	std::sort(values.begin(), values.end());
+	size_t index = std::min(values.size() - 1, (size_t)(percentile * (values.size() - 1) + 0.5));
+	return values[index];
+}
+
+static std::string escape_json(const char* text)
+{
+	std::string result;
+	for (const char* c = text ? text : ""; *c; c++) {
+		if (*c == '"' || *c == '\\') result += '\\';
+		result += *c;
+	}
+	return result;
+}
+
+std::string Headless::to_json(const std::vector<double>& frame_times, const std::vector<double>& gpu_times, double total_time,
+	double draw_calls, double triangles)
+{
+	std::stringstream ss;
+	char date[32];
+	time_t now = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+	double sum = 0.0;
+	for (double time : frame_times)
+		sum += time;
+	double gpu_sum = 0.0;
+	for (double time : gpu_times)
+		gpu_sum += time;
+
+	ss << "{\n";
+	ss << "\t\"context\": {\n";
+	ss << "\t\t\"date\": \"" << date << "\",\n";
+	ss << "\t\t\"renderer\": \"" << escape_json((const char*)glGetString(GL_RENDERER)) << "\",\n";
+	ss << "\t\t\"gl_version\": \"" << escape_json((const char*)glGetString(GL_VERSION)) << "\",\n";
+	ss << "\t\t\"width\": " << options.width << ",\n";
+	ss << "\t\t\"height\": " << options.height << ",\n";
+	ss << "\t\t\"frames\": " << options.frames << "\n";
+	ss << "\t},\n";
+	ss << "\t\"total_seconds\": " << total_time << ",\n";
+	ss << "\t\"fps\": " << (total_time > 0.0 ? frame_times.size() / total_time : 0.0) << ",\n";
+	ss << "\t\"frame_ms\": { \"mean\": " << sum / std::max<size_t>(frame_times.size(), 1)
+		<< ", \"min\": " << get_percentile(frame_times, 0.0)
+		<< ", \"median\": " << get_percentile(frame_times, 0.5)
+		<< ", \"p95\": " << get_percentile(frame_times, 0.95)
+		<< ", \"p99\": " << get_percentile(frame_times, 0.99)
+		<< ", \"max\": " << get_percentile(frame_times, 1.0) << " },\n";
+	ss << "\t\"gpu_ms\": { \"mean\": " << gpu_sum / std::max<size_t>(gpu_times.size(), 1)
+		<< ", \"median\": " << get_percentile(gpu_times, 0.5)
+		<< ", \"samples\": " << gpu_times.size() << " },\n";
+	ss << "\t\"draw_calls_per_frame\": " << draw_calls << ",\n";
+	ss << "\t\"triangles_per_frame\": " << triangles << "\n";
+	ss << "}\n";
+	return ss.str();
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "includes.h"
+
+class Application;
+
+struct sHeadlessOptions
+{
+	int frames = 300;
+	int width = 1280;
+	int height = 720;
+	bool null_platform = false; // no display at all (GLFW null platform with an EGL context), otherwise a hidden window
+	float orbit_radius = 8.f; // camera path: one turn around the origin in all the frames
+	float orbit_height = 2.f;
+	std::string dump_folder; // frames saved as TGA when set
+	int dump_every = 1;
+	std::string output; // JSON with the timings, stdout when empty
+
+	bool parse(int argc, char** argv); // false when -headless is not in the arguments
+};
+
+// Runs the application without a visible window for benchmarks and regression images: the frames are drawn in an
+// offscreen FBO following a scripted camera path, without vsync and with a fixed simulation step per frame, so two runs
+// of the same build draw the same images. Frame times include the GPU (glFinish), it works with software GL (llvmpipe):
+//   EGL_PLATFORM=surfaceless LIBGL_ALWAYS_SOFTWARE=1 ComputerAnimation -headless -null -frames 600 -o results.json
+class Headless
+{
+public:
+	static sHeadlessOptions options;
+
+	static void set_window_hints(); // before creating the window
+	static bool run(Application* app, GLFWwindow* window);
+
+protected:
+	static unsigned int fbo;
+	static unsigned int color_renderbuffer;
+	static unsigned int depth_renderbuffer;
+
+	static bool create_framebuffer(int width, int height);
+	static void destroy_framebuffer();
+	static std::string to_json(const std::vector<double>& frame_times, const std::vector<double>& gpu_times, double total_time,
+		double draw_calls, double triangles);
+};
@@ -0,0 +1,221 @@
+#include "job_system.h"
+
+#include <algorithm>
+#include <cassert>
+
+bool JobSystem::enabled = true;
+
+std::vector<std::thread> JobSystem::s_workers;
+std::vector<JobSystem::sJobQueue*> JobSystem::s_queues;
+std::atomic<int> JobSystem::s_num_queued{ 0 };
+std::atomic<bool> JobSystem::s_exit{ false };
+std::mutex JobSystem::s_sleep_mutex;
+std::condition_variable JobSystem::s_sleep_condition;
+
+// queue of the current thread, the threads that are not workers share the one of the main thread
+static thread_local unsigned int t_queue_index = 0;
+
+void JobSystem::init(unsigned int num_threads)
+{
+	if (s_queues.size())
+		return;
+
+	// hardware_concurrency can be 0 when it is not known
+	if (num_threads == 0)
+		num_threads = (unsigned int)std::max(1, (int)std::thread::hardware_concurrency() - 1);
+
+	s_exit = false;
+	for (unsigned int i = 0; i <= num_threads; i++)
+		s_queues.push_back(new sJobQueue());
+	for (unsigned int i = 1; i <= num_threads; i++)
+		s_workers.push_back(std::thread(worker_main, i));
+}
+
+void JobSystem::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(s_sleep_mutex);
+		s_exit = true;
+	}
+	s_sleep_condition.notify_all();
+	for (std::thread& worker : s_workers)
+		worker.join();
+	s_workers.clear();
+
+	for (sJobQueue* queue : s_queues)
+		delete queue;
+	s_queues.clear();
+	s_num_queued = 0;
+}
+
+void JobSystem::worker_main(unsigned int index)
+{
+	t_queue_index = index;
+
+	while (true)
+	{
+		sJob job;
+		if (pop(job)) {
+			execute(job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(s_sleep_mutex);
+		s_sleep_condition.wait(lock, [] { return s_num_queued > 0 || s_exit; });
+		if (s_exit)
+			break;
+	}
+}
+
+void JobSystem::push(sJob& job)
+{
+	sJobQueue* queue = s_queues[t_queue_index];
+	{
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		queue->jobs.push_back(std::move(job));
+	}
+	s_num_queued++;
+
+	// taking the mutex makes sure a worker checking the condition does not miss the wake up
+	{
+		std::lock_guard<std::mutex> lock(s_sleep_mutex);
+	}
+	s_sleep_condition.notify_one();
+}
+
+bool JobSystem::pop(sJob& job)
+{
+	unsigned int num_queues = (unsigned int)s_queues.size();
+	for (unsigned int i = 0; i < num_queues; i++)
+	{
+		unsigned int index = (t_queue_index + i) % num_queues;
+		sJobQueue* queue = s_queues[index];
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		if (queue->front == queue->jobs.size())
+			continue;
+
+		// newest from the own queue, oldest from the others
+		if (i == 0) {
+			job = std::move(queue->jobs.back());
+			queue->jobs.pop_back();
+		}
+		else
+			job = std::move(queue->jobs[queue->front++]);
+
+		if (queue->front == queue->jobs.size()) {
+			queue->jobs.clear();
+			queue->front = 0;
+		}
+		s_num_queued--;
+		return true;
+	}
+	return false;
+}
+
+void JobSystem::execute(sJob& job)
+{
+	job.function();
+	finish(job.counter);
+}
+
+void JobSystem::finish(sJobCounter* counter)
+{
+	if (!counter)
+		return;
+
+	// the last job of the group releases the ones that depend on it. The decrement is done with the lock taken:
+	// once the value is zero the waiter can destroy the counter, so it must not be touched after the unlock
+	std::vector<std::pair<tJobFunction, sJobCounter*>> continuations;
+	{
+		std::lock_guard<std::mutex> lock(counter->mutex);
+		if (counter->value.fetch_sub(1, std::memory_order_acq_rel) != 1)
+			return;
+		continuations.swap(counter->continuations);
+	}
+	for (auto& continuation : continuations)
+	{
+		sJob job = { std::move(continuation.first), continuation.second };
+		if (enabled && s_queues.size())
+			push(job);
+		else
+			execute(job);
+	}
+}
+
+void JobSystem::run(tJobFunction job, sJobCounter* counter)
+{
+	if (counter)
+		counter->value++;
+
+	sJob new_job = { std::move(job), counter };
+	if (enabled && s_queues.size())
+		push(new_job);
+	else
+		execute(new_job);
+}
+
+void JobSystem::run_after(sJobCounter* dependency, tJobFunction job, sJobCounter* counter)
+{
+	assert(dependency);
+	if (counter)
+		counter->value++;
+
+	{
+		// checked with the lock taken, so the last job of the dependency sees the continuation
+		std::lock_guard<std::mutex> lock(dependency->mutex);
+		if (!dependency->is_done()) {
+			dependency->continuations.push_back({ std::move(job), counter });
+			return;
+		}
+	}
+
+	sJob new_job = { std::move(job), counter };
+	if (enabled && s_queues.size())
+		push(new_job);
+	else
+		execute(new_job);
+}
+
+void JobSystem::wait(sJobCounter* counter)
+{
+	while (!counter->is_done())
+	{
+		sJob job;
+		if (pop(job))
+			execute(job);
+		else
+			std::this_thread::yield();
+	}
+
+	// the last job may still hold the mutex after the value got to zero, the counter can be destroyed after this
+	std::lock_guard<std::mutex> lock(counter->mutex);
+}
+
+void JobSystem::parallel_for(size_t count, size_t batch_size, tRangeFunction function, const void* data)
+{
+	batch_size = std::max(batch_size, (size_t)1);
+	if (!enabled || !s_queues.size() || count <= batch_size) {
+		if (count)
+			function(data, 0, count);
+		return;
+	}
+
+	// the first batch runs in this thread while the others are stolen.
+	// The jobs only capture two words, so std::function keeps them inline instead of allocating every batch
+	struct sRange
+	{
+		tRangeFunction function;
+		const void* data;
+		size_t batch_size;
+		size_t count;
+	} range = { function, data, batch_size, count };
+	const sRange* shared = &range;
+
+	sJobCounter counter;
+	for (size_t begin = batch_size; begin < count; begin += batch_size)
+	{
+		run([shared, begin]() { shared->function(shared->data, begin, std::min(begin + shared->batch_size, shared->count)); }, &counter);
+	}
+	function(data, 0, batch_size);
+	wait(&counter);
+}
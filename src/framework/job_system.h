@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef std::function<void()> tJobFunction;
+
+// Counts the jobs not finished yet of a group, so they can be waited for or other jobs can depend on them.
+// It must live until the jobs of the group and the jobs depending on it have started, or until wait() returns
+struct sJobCounter
+{
+	std::atomic<int> value{ 0 };
+
+	std::mutex mutex; // guards the continuations
+	std::vector<std::pair<tJobFunction, sJobCounter*>> continuations; // jobs queued when the value gets to zero, with their counters
+
+	bool is_done() { return value.load(std::memory_order_acquire) == 0; }
+};
+
+// Job system for the per frame CPU work (entity updates, poses, CPU skinning): one worker per core besides the
+// main thread, each with its own deque. Threads take the newest job of their deque (the one with the data still in
+// the cache) and when it is empty they steal the oldest one of another thread. Waiting for a counter runs jobs
+// instead of blocking, so jobs can wait for other jobs.
+// Jobs must not issue GL calls, the context only exists in the main thread
+class JobSystem
+{
+public:
+	static bool enabled; // when disabled the jobs run in the calling thread, to compare or debug
+
+	static void init(unsigned int num_threads = 0); // 0 uses the number of cores minus one
+	static void shutdown();
+	static unsigned int get_num_workers() { return (unsigned int)s_workers.size(); }
+
+	// counter is incremented now and decremented when the job ends (it can be NULL)
+	static void run(tJobFunction job, sJobCounter* counter = nullptr);
+	// the job is queued once dependency gets to zero
+	static void run_after(sJobCounter* dependency, tJobFunction job, sJobCounter* counter = nullptr);
+	// runs other jobs until the counter gets to zero
+	static void wait(sJobCounter* counter);
+
+	// function(begin, end) for ranges of at most batch_size items of [0, count), returns when all of them are done.
+	// The callable is not copied into a std::function, so capturing by reference does not allocate
+	template<typename tFunction>
+	static void parallel_for(size_t count, size_t batch_size, const tFunction& function)
+	{
+		parallel_for(count, batch_size, [](const void* data, size_t begin, size_t end) { (*(const tFunction*)data)(begin, end); }, &function);
+	}
+
+	typedef void (*tRangeFunction)(const void* data, size_t begin, size_t end);
+	static void parallel_for(size_t count, size_t batch_size, tRangeFunction function, const void* data);
+
+protected:
+	struct sJob
+	{
+		tJobFunction function;
+		sJobCounter* counter;
+	};
+
+	struct sJobQueue
+	{
+		std::mutex mutex;
+		std::vector<sJob> jobs; // the owner pushes and pops at the back, the others steal from the front
+		size_t front = 0;
+	};
+
+	static std::vector<std::thread> s_workers;
+	static std::vector<sJobQueue*> s_queues; // 0 is the main thread (and any other thread that is not a worker)
+	static std::atomic<int> s_num_queued;
+	static std::atomic<bool> s_exit;
+	static std::mutex s_sleep_mutex;
+	static std::condition_variable s_sleep_condition;
+
+	static void worker_main(unsigned int index);
+	static void push(sJob& job);
+	static bool pop(sJob& job); // own queue first, then steals
+	static void execute(sJob& job);
+	static void finish(sJobCounter* counter);
+};
@@ -0,0 +1,187 @@
+#include "json.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+struct sJsonParser
+{
+	const char* start;
+	const char* c;
+	std::string error;
+
+	bool fail(const char* message)
+	{
+		if (error.empty()) {
+			int line = 1;
+			for (const char* p = start; p < c; p++)
+				if (*p == '\n') line++;
+			error = std::string(message) + " at line " + std::to_string(line);
+		}
+		return false;
+	}
+
+	void skip_spaces()
+	{
+		while (*c == ' ' || *c == '\t' || *c == '\n' || *c == '\r')
+			c++;
+	}
+
+	bool parse_string(std::string& out)
+	{
+		c++; // "
+		while (*c && *c != '"') {
+			if (*c != '\\') {
+				out += *c++;
+				continue;
+			}
+			c++;
+			switch (*c) {
+			case 'n': out += '\n'; break;
+			case 't': out += '\t'; break;
+			case 'r': out += '\r'; break;
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'u': {
+				// only the code points of one byte are kept, the paths and names are ASCII
+				unsigned int code = 0;
+				for (int i = 0; i < 4; i++, c++) {
+					char h = c[1];
+					if (!isxdigit((unsigned char)h))
+						return fail("bad unicode escape");
+					code = code * 16 + (h <= '9' ? h - '0' : (h | 32) - 'a' + 10);
+				}
+				out += code < 0x80 ? (char)code : '?';
+				break;
+			}
+			case 0: return fail("unfinished string");
+			default: out += *c; break; // \" \\ \/
+			}
+			c++;
+		}
+		if (*c != '"')
+			return fail("unfinished string");
+		c++;
+		return true;
+	}
+
+	bool parse_value(sJsonValue& value, int depth)
+	{
+		if (depth > 64)
+			return fail("too many nested values");
+
+		skip_spaces();
+		if (*c == '{') {
+			value.type = JSON_OBJECT;
+			c++;
+			skip_spaces();
+			if (*c == '}') { c++; return true; }
+			while (true) {
+				skip_spaces();
+				if (*c != '"')
+					return fail("expected a key");
+				value.members.emplace_back();
+				if (!parse_string(value.members.back().first))
+					return false;
+				skip_spaces();
+				if (*c != ':')
+					return fail("expected ':'");
+				c++;
+				if (!parse_value(value.members.back().second, depth + 1))
+					return false;
+				skip_spaces();
+				if (*c == ',') { c++; continue; }
+				if (*c == '}') { c++; return true; }
+				return fail("expected ',' or '}'");
+			}
+		}
+		if (*c == '[') {
+			value.type = JSON_ARRAY;
+			c++;
+			skip_spaces();
+			if (*c == ']') { c++; return true; }
+			while (true) {
+				value.items.emplace_back();
+				if (!parse_value(value.items.back(), depth + 1))
+					return false;
+				skip_spaces();
+				if (*c == ',') { c++; continue; }
+				if (*c == ']') { c++; return true; }
+				return fail("expected ',' or ']'");
+			}
+		}
+		if (*c == '"') {
+			value.type = JSON_STRING;
+			return parse_string(value.string);
+		}
+		if (strncmp(c, "true", 4) == 0) { value.type = JSON_BOOL; value.boolean = true; c += 4; return true; }
+		if (strncmp(c, "false", 5) == 0) { value.type = JSON_BOOL; value.boolean = false; c += 5; return true; }
+		if (strncmp(c, "null", 4) == 0) { value.type = JSON_NULL; c += 4; return true; }
+
+		char* end = NULL;
+		value.number = strtod(c, &end);
+		if (end == c)
+			return fail("unexpected character");
+		value.type = JSON_NUMBER;
+		c = end;
+		return true;
+	}
+};
+
+bool parse_json(const char* text, sJsonValue& root, std::string& error)
+{
+	sJsonParser parser = { text, text };
+	root = sJsonValue();
+	bool ok = parser.parse_value(root, 0);
+	if (ok) {
+		parser.skip_spaces();
+		if (*parser.c)
+			ok = parser.fail("unexpected data after the document");
+	}
+	error = parser.error;
+	return ok;
+}
+
+const sJsonValue* sJsonValue::get(const char* key) const
+{
+	if (type != JSON_OBJECT)
+		return NULL;
+	for (const auto& member : members)
+		if (member.first == key)
+			return &member.second;
+	return NULL;
+}
+
+bool sJsonValue::get_bool(const char* key, bool default_value) const
+{
+	const sJsonValue* value = get(key);
+	return value && value->type == JSON_BOOL ? value->boolean : default_value;
+}
+
+float sJsonValue::get_float(const char* key, float default_value) const
+{
+	const sJsonValue* value = get(key);
+	return value && value->type == JSON_NUMBER ? (float)value->number : default_value;
+}
+
+std::string sJsonValue::get_string(const char* key, const char* default_value) const
+{
+	const sJsonValue* value = get(key);
+	return value && value->type == JSON_STRING ? value->string : default_value;
+}
+
+vec3 sJsonValue::get_vec3(const char* key, const vec3& default_value) const
+{
+	const sJsonValue* value = get(key);
+	if (!value || value->type != JSON_ARRAY || value->items.size() < 3)
+		return default_value;
+	return vec3((float)value->items[0].number, (float)value->items[1].number, (float)value->items[2].number);
+}
+
+vec4 sJsonValue::get_vec4(const char* key, const vec4& default_value) const
+{
+	const sJsonValue* value = get(key);
+	if (!value || value->type != JSON_ARRAY || value->items.size() < 4)
+		return default_value;
+	return vec4((float)value->items[0].number, (float)value->items[1].number, (float)value->items[2].number, (float)value->items[3].number);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "math/vec3.h"
+#include "math/vec4.h"
+
+enum eJsonType { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+
+// Minimal JSON document for the authoring formats (scenes): the whole file is parsed into a tree, the values are read
+// with defaults so missing keys are not errors. Not meant for big files, the cooked formats are binary
+struct sJsonValue
+{
+	int type = JSON_NULL;
+	bool boolean = false;
+	double number = 0.0;
+	std::string string;
+	std::vector<sJsonValue> items; // array
+	std::vector<std::pair<std::string, sJsonValue>> members; // object, in the order of the file
+
+	const sJsonValue* get(const char* key) const; // NULL when it is not an object or the key is missing
+	size_t size() const { return type == JSON_ARRAY ? items.size() : members.size(); }
+	const sJsonValue& operator[](size_t index) const { return items[index]; }
+
+	bool get_bool(const char* key, bool default_value) const;
+	float get_float(const char* key, float default_value) const;
+	std::string get_string(const char* key, const char* default_value = "") const;
+	vec3 get_vec3(const char* key, const vec3& default_value) const; // [x, y, z]
+	vec4 get_vec4(const char* key, const vec4& default_value) const; // [x, y, z, w]
+};
+
+// false with the line of the first syntax error in error
+bool parse_json(const char* text, sJsonValue& root, std::string& error);
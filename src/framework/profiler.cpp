@@ -0,0 +1,350 @@
+#include "profiler.h"
+
+#include "graphics/mesh.h"
+
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <algorithm>
+
+bool Profiler::enabled = true;
+bool Profiler::paused = false;
+sProfilerCounters Profiler::counters;
+
+std::vector<sProfilerFrame> Profiler::s_frames;
+uint64_t Profiler::s_frame_index = 0;
+
+std::vector<GLuint> Profiler::s_queries[PROFILER_GPU_LATENCY];
+unsigned int Profiler::s_queries_used[PROFILER_GPU_LATENCY] = { 0 };
+std::vector<int> Profiler::s_stack;
+int Profiler::s_open_gpu_scopes = 0;
+std::set<std::string, std::less<>> Profiler::s_names;
+int Profiler::s_selected_frame = 0;
+
+// the statics are initialized by the main thread, the markers of the other threads are ignored
+static std::thread::id s_main_thread = std::this_thread::get_id();
+static std::chrono::steady_clock::time_point s_start_time = std::chrono::steady_clock::now();
+static bool s_recording = false; // inside a frame that is stored
+
+double Profiler::get_time_ms()
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - s_start_time).count();
+}
+
+const char* Profiler::intern(const char* name)
+{
+	// the nodes of the set do not move, the strings stay valid
+	auto it = s_names.find(name);
+	if (it == s_names.end())
+		it = s_names.insert(name).first;
+	return it->c_str();
+}
+
+void Profiler::begin_frame()
+{
+	s_stack.clear();
+	s_open_gpu_scopes = 0;
+	s_recording = enabled && !paused;
+	if (!s_recording)
+		return;
+
+	if (s_frames.empty())
+		s_frames.resize(PROFILER_FRAMES);
+
+	// the queries of the frame that used this pool are old enough to be read without waiting
+	unsigned int pool = s_frame_index % PROFILER_GPU_LATENCY;
+	if (s_frame_index >= PROFILER_GPU_LATENCY)
+		resolve_gpu(s_frames[(s_frame_index - PROFILER_GPU_LATENCY) % PROFILER_FRAMES], pool);
+	s_queries_used[pool] = 0;
+
+	sProfilerFrame& frame = s_frames[s_frame_index % PROFILER_FRAMES];
+	frame.index = s_frame_index;
+	frame.events.clear();
+	frame.gpu_time = -1.0;
+	frame.start = get_time_ms();
+	frame.end = frame.start;
+
+	// does not wait for the GPU, only reads its clock
+	GLint64 gpu_clock = 0;
+	glGetInteger64v(GL_TIMESTAMP, &gpu_clock);
+	frame.gpu_clock_base = gpu_clock;
+
+	counters = sProfilerCounters();
+	Mesh::num_meshes_rendered = 0;
+	Mesh::num_triangles_rendered = 0;
+}
+
+void Profiler::end_frame()
+{
+	if (!s_recording)
+		return;
+
+	sProfilerFrame& frame = s_frames[s_frame_index % PROFILER_FRAMES];
+	frame.end = get_time_ms();
+
+	counters.draw_calls = (unsigned int)Mesh::num_meshes_rendered;
+	counters.triangles = (unsigned int)Mesh::num_triangles_rendered;
+	frame.counters = counters;
+
+	s_recording = false;
+	s_frame_index++;
+}
+
+void Profiler::begin(const char* name, bool gpu)
+{
+	if (std::this_thread::get_id() != s_main_thread)
+		return;
+
+	sProfilerFrame* frame = s_recording ? &s_frames[s_frame_index % PROFILER_FRAMES] : NULL;
+	if (!frame || frame->events.size() >= PROFILER_MAX_EVENTS) {
+		s_stack.push_back(-1);
+		return;
+	}
+
+	sProfilerEvent event;
+	event.name = intern(name);
+	event.depth = (int)s_stack.size();
+	event.gpu_nested = s_open_gpu_scopes > 0;
+	event.cpu_start = get_time_ms();
+	event.cpu_end = event.cpu_start;
+
+	if (gpu)
+	{
+		unsigned int pool = s_frame_index % PROFILER_GPU_LATENCY;
+		std::vector<GLuint>& queries = s_queries[pool];
+		if (s_queries_used[pool] + 2 > queries.size()) {
+			size_t old_size = queries.size();
+			queries.resize(std::max<size_t>(64, old_size * 2));
+			glGenQueries((GLsizei)(queries.size() - old_size), &queries[old_size]);
+		}
+
+		// timestamps instead of GL_TIME_ELAPSED, which cannot be nested
+		event.gpu_query = s_queries_used[pool];
+		s_queries_used[pool] += 2;
+		s_open_gpu_scopes++;
+		glQueryCounter(queries[event.gpu_query], GL_TIMESTAMP);
+	}
+
+	s_stack.push_back((int)frame->events.size());
+	frame->events.push_back(event);
+}
+
+void Profiler::end()
+{
+	if (std::this_thread::get_id() != s_main_thread || s_stack.empty())
+		return;
+
+	int id = s_stack.back();
+	s_stack.pop_back();
+	if (id == -1 || !s_recording)
+		return;
+
+	sProfilerEvent& event = s_frames[s_frame_index % PROFILER_FRAMES].events[id];
+	event.cpu_end = get_time_ms();
+	if (event.gpu_query != -1) {
+		glQueryCounter(s_queries[s_frame_index % PROFILER_GPU_LATENCY][event.gpu_query + 1], GL_TIMESTAMP);
+		s_open_gpu_scopes--;
+	}
+}
+
+void Profiler::resolve_gpu(sProfilerFrame& frame, unsigned int pool)
+{
+	unsigned int used = s_queries_used[pool];
+	if (!used)
+		return;
+
+	// the queries finish in order, if the last one is ready all of them are
+	GLint available = 0;
+	glGetQueryObjectiv(s_queries[pool][used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return;
+
+	double gpu_time = 0.0;
+	for (sProfilerEvent& event : frame.events)
+	{
+		if (event.gpu_query == -1)
+			continue;
+
+		GLuint64 start = 0, end = 0;
+		glGetQueryObjectui64v(s_queries[pool][event.gpu_query], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(s_queries[pool][event.gpu_query + 1], GL_QUERY_RESULT, &end);
+		event.gpu_start = frame.start + (double)((int64_t)start - frame.gpu_clock_base) * 1e-6;
+		event.gpu_end = frame.start + (double)((int64_t)end - frame.gpu_clock_base) * 1e-6;
+
+		// the nested scopes are already inside their parents (known when they were recorded)
+		if (!event.gpu_nested)
+			gpu_time += event.gpu_end - event.gpu_start;
+	}
+	frame.gpu_time = gpu_time;
+}
+
+const sProfilerFrame* Profiler::get_last_resolved_frame()
+{
+	if (s_frame_index <= PROFILER_GPU_LATENCY || s_frames.empty())
+		return NULL;
+
+	// frames after this one can still have queries in flight
+	uint64_t last = s_frame_index - PROFILER_GPU_LATENCY - 1;
+	uint64_t selected = last - std::min<uint64_t>(s_selected_frame, last);
+	if (last - selected >= PROFILER_FRAMES - PROFILER_GPU_LATENCY)
+		selected = last - (PROFILER_FRAMES - PROFILER_GPU_LATENCY - 1);
+	return &s_frames[selected % PROFILER_FRAMES];
+}
+
+void Profiler::render_timeline(const sProfilerFrame& frame)
+{
+	const float row_height = ImGui::GetTextLineHeight() + 4.f;
+
+	int cpu_rows = 0, gpu_rows = 0;
+	double range_start = frame.start, range_end = frame.end;
+	for (const sProfilerEvent& event : frame.events)
+	{
+		cpu_rows = std::max(cpu_rows, event.depth + 1);
+		if (event.gpu_start >= 0.0) {
+			gpu_rows = std::max(gpu_rows, event.depth + 1);
+			range_start = std::min(range_start, event.gpu_start);
+			range_end = std::max(range_end, event.gpu_end);
+		}
+	}
+
+	ImVec2 origin = ImGui::GetCursorScreenPos();
+	float width = std::max(ImGui::GetContentRegionAvail().x, 100.f);
+	float height = row_height * (cpu_rows + gpu_rows) + 4.f;
+	ImGui::InvisibleButton("timeline", ImVec2(width, height));
+	bool hovered = ImGui::IsItemHovered();
+	ImVec2 mouse = ImGui::GetIO().MousePos;
+
+	ImDrawList* draw_list = ImGui::GetWindowDrawList();
+	draw_list->AddRectFilled(origin, ImVec2(origin.x + width, origin.y + height), IM_COL32(30, 30, 30, 255));
+
+	double scale = width / std::max(range_end - range_start, 0.001);
+	const sProfilerEvent* hovered_event = NULL;
+	bool hovered_gpu = false;
+
+	// CPU scopes on top, the GPU ones below with the same nesting
+	for (int track = 0; track < 2; track++)
+	{
+		for (const sProfilerEvent& event : frame.events)
+		{
+			double start = track == 0 ? event.cpu_start : event.gpu_start;
+			double end = track == 0 ? event.cpu_end : event.gpu_end;
+			if (track == 1 && event.gpu_start < 0.0)
+				continue;
+
+			float y = origin.y + row_height * (track == 0 ? event.depth : cpu_rows + event.depth);
+			ImVec2 a(origin.x + (float)((start - range_start) * scale), y);
+			ImVec2 b(std::max(a.x + 1.f, origin.x + (float)((end - range_start) * scale)), y + row_height - 1.f);
+
+			// the color comes from the name so a scope keeps it between frames
+			unsigned int hash = 2166136261u;
+			for (const char* c = event.name; *c; c++)
+				hash = (hash ^ (unsigned char)*c) * 16777619u;
+			ImU32 color = track == 0 ? IM_COL32(80 + hash % 120, 80 + (hash >> 8) % 120, 160, 255) : IM_COL32(160, 80 + hash % 120, 80 + (hash >> 8) % 120, 255);
+			draw_list->AddRectFilled(a, b, color);
+
+			if (b.x - a.x > ImGui::CalcTextSize(event.name).x + 4.f)
+				draw_list->AddText(ImVec2(a.x + 2.f, a.y + 2.f), IM_COL32(255, 255, 255, 255), event.name);
+
+			if (hovered && mouse.x >= a.x && mouse.x <= b.x && mouse.y >= a.y && mouse.y <= b.y) {
+				hovered_event = &event;
+				hovered_gpu = track == 1;
+			}
+		}
+	}
+
+	if (hovered_event) {
+		if (hovered_gpu)
+			ImGui::SetTooltip("%s (GPU)\n%.3f ms", hovered_event->name, hovered_event->gpu_end - hovered_event->gpu_start);
+		else
+			ImGui::SetTooltip("%s\n%.3f ms", hovered_event->name, hovered_event->cpu_end - hovered_event->cpu_start);
+	}
+}
+
+void Profiler::render_gui()
+{
+	ImGui::Checkbox("Enabled", &enabled);
+	ImGui::SameLine();
+	ImGui::Checkbox("Pause", &paused);
+	ImGui::SameLine();
+	if (ImGui::Button("Export Chrome trace"))
+		export_chrome_trace("profiler_trace.json");
+
+	const sProfilerFrame* frame = get_last_resolved_frame();
+	if (!frame) {
+		ImGui::Text("No frames yet");
+		return;
+	}
+
+	// CPU frame times of the history, oldest first
+	float times[PROFILER_FRAMES];
+	int num_times = 0;
+	for (uint64_t i = s_frame_index > PROFILER_FRAMES ? s_frame_index - PROFILER_FRAMES : 0; i < s_frame_index; i++)
+		times[num_times++] = (float)(s_frames[i % PROFILER_FRAMES].end - s_frames[i % PROFILER_FRAMES].start);
+	ImGui::PlotLines("CPU ms", times, num_times, 0, NULL, 0.f, 33.f, ImVec2(0.f, 40.f));
+
+	ImGui::SliderInt("Frames back", &s_selected_frame, 0, PROFILER_FRAMES - PROFILER_GPU_LATENCY - 1);
+
+	if (frame->gpu_time >= 0.0)
+		ImGui::Text("Frame %llu CPU %.3f ms GPU %.3f ms", (unsigned long long)frame->index, frame->end - frame->start, frame->gpu_time);
+	else
+		ImGui::Text("Frame %llu CPU %.3f ms GPU -", (unsigned long long)frame->index, frame->end - frame->start);
+	const sProfilerCounters& c = frame->counters;
+	ImGui::Text("Draws: %u Triangles: %u", c.draw_calls, c.triangles);
+	ImGui::Text("Binds: %u shaders %u textures %u buffers", c.shader_binds, c.texture_binds, c.buffer_binds);
+	ImGui::Text("Uploads: %u (%.1f KB)", c.uploads, c.upload_bytes / 1024.0);
+
+	render_timeline(*frame);
+}
+
+static void write_json_string(std::ofstream& file, const char* text)
+{
+	file << '"';
+	for (const char* c = text; *c; c++) {
+		if (*c == '"' || *c == '\\') file << '\\';
+		file << *c;
+	}
+	file << '"';
+}
+
+bool Profiler::export_chrome_trace(const char* filename)
+{
+	std::ofstream file(filename);
+	if (!file.is_open()) {
+		std::cerr << "[Profiler] Could not write " << filename << std::endl;
+		return false;
+	}
+
+	// complete events ("X") in microseconds, tid 0 is the CPU and tid 1 the GPU
+	file << "{\"traceEvents\":[\n";
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"CPU\"}},\n";
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,\"args\":{\"name\":\"GPU\"}}";
+
+	uint64_t first = s_frame_index > PROFILER_FRAMES ? s_frame_index - PROFILER_FRAMES : 0;
+	for (uint64_t i = first; i < s_frame_index; i++)
+	{
+		const sProfilerFrame& frame = s_frames[i % PROFILER_FRAMES];
+		const sProfilerCounters& c = frame.counters;
+
+		file << ",\n{\"name\":\"Frame " << frame.index << "\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":" << frame.start * 1000.0
+			<< ",\"dur\":" << (frame.end - frame.start) * 1000.0 << ",\"args\":{\"draws\":" << c.draw_calls << ",\"triangles\":" << c.triangles
+			<< ",\"shader_binds\":" << c.shader_binds << ",\"texture_binds\":" << c.texture_binds << ",\"buffer_binds\":" << c.buffer_binds
+			<< ",\"uploads\":" << c.uploads << ",\"upload_bytes\":" << c.upload_bytes << "}}";
+
+		for (const sProfilerEvent& event : frame.events)
+		{
+			file << ",\n{\"name\":";
+			write_json_string(file, event.name);
+			file << ",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":" << event.cpu_start * 1000.0 << ",\"dur\":" << (event.cpu_end - event.cpu_start) * 1000.0 << "}";
+
+			if (event.gpu_start >= 0.0) {
+				file << ",\n{\"name\":";
+				write_json_string(file, event.name);
+				file << ",\"ph\":\"X\",\"pid\":0,\"tid\":1,\"ts\":" << event.gpu_start * 1000.0 << ",\"dur\":" << (event.gpu_end - event.gpu_start) * 1000.0 << "}";
+			}
+		}
+	}
+	file << "\n]}\n";
+
+	std::cout << "[Profiler] Trace saved to " << filename << std::endl;
+	return true;
+}
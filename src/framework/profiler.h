@@ -0,0 +1,104 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <set>
+#include <cstdint>
+
+#include "includes.h"
+
+#define PROFILER_FRAMES 120 // frames kept for the panel and the trace export
+#define PROFILER_GPU_LATENCY 4 // frames in flight before their GPU queries are read, so reading them never stalls
+#define PROFILER_MAX_EVENTS 4096 // per frame, the rest of the markers are dropped
+
+// Markers of the main thread, the names are interned so they can come from strings that are destroyed later (entity names)
+#define PROFILER_CONCAT_(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ProfilerScope PROFILER_CONCAT(profiler_scope_, __LINE__)(name, false)
+// also measures the GPU time of the GL commands issued inside the scope
+#define PROFILE_GPU_SCOPE(name) ProfilerScope PROFILER_CONCAT(profiler_scope_, __LINE__)(name, true)
+
+// Per frame counters, incremented where the GL calls are made
+struct sProfilerCounters
+{
+	unsigned int draw_calls = 0;
+	unsigned int triangles = 0;
+	unsigned int shader_binds = 0;
+	unsigned int texture_binds = 0;
+	unsigned int buffer_binds = 0;
+	unsigned int uploads = 0;
+	size_t upload_bytes = 0;
+};
+
+struct sProfilerEvent
+{
+	const char* name; // interned, lives until the end of the program
+	int depth;
+	bool gpu_nested = false; // inside another GPU scope, its time is already counted by the parent
+	double cpu_start; // ms since the profiler started
+	double cpu_end;
+	int gpu_query = -1; // first of the two timestamp queries of the event in the pool of its frame, -1 for CPU only
+	double gpu_start = -1.0; // ms in the same clock as the CPU times, -1 until the queries are read
+	double gpu_end = -1.0;
+};
+
+struct sProfilerFrame
+{
+	uint64_t index = 0;
+	double start = 0.0;
+	double end = 0.0;
+	double gpu_time = -1.0; // sum of the root GPU scopes, -1 until the queries are read
+	std::vector<sProfilerEvent> events;
+	sProfilerCounters counters;
+
+	int64_t gpu_clock_base = 0; // GL timestamp at the start of the frame, to place the GPU times in the CPU clock
+};
+
+// Frame profiler: nested CPU scopes, GPU timestamp queries around the GPU scopes and the counters of every frame.
+// The queries of a frame are read PROFILER_GPU_LATENCY frames later (if they are not ready the GPU times of that
+// frame are dropped instead of waiting). The last frames are shown as a timeline and can be saved as a Chrome trace
+class Profiler
+{
+public:
+	static bool enabled;
+	static bool paused; // keeps the history as it is to inspect it
+	static sProfilerCounters counters; // of the frame being recorded
+
+	static std::vector<sProfilerFrame> s_frames; // ring of PROFILER_FRAMES
+	static uint64_t s_frame_index;
+
+	static void begin_frame();
+	static void end_frame();
+
+	static void begin(const char* name, bool gpu);
+	static void end();
+
+	static void count_upload(size_t bytes) { counters.uploads++; counters.upload_bytes += bytes; }
+
+	// last frame whose GPU times are known (NULL at the start)
+	static const sProfilerFrame* get_last_resolved_frame();
+
+	static void render_gui();
+	// chrome://tracing or https://ui.perfetto.dev, one track for the CPU and one for the GPU
+	static bool export_chrome_trace(const char* filename);
+
+protected:
+	static std::vector<GLuint> s_queries[PROFILER_GPU_LATENCY];
+	static unsigned int s_queries_used[PROFILER_GPU_LATENCY];
+	static std::vector<int> s_stack; // open events of the current frame
+	static int s_open_gpu_scopes; // of s_stack
+	static std::set<std::string, std::less<>> s_names;
+	static int s_selected_frame; // frames back from the last resolved one
+
+	static double get_time_ms();
+	static const char* intern(const char* name);
+	static void resolve_gpu(sProfilerFrame& frame, unsigned int pool);
+	static void render_timeline(const sProfilerFrame& frame);
+};
+
+class ProfilerScope
+{
+public:
+	ProfilerScope(const char* name, bool gpu) { Profiler::begin(name, gpu); }
+	~ProfilerScope() { Profiler::end(); }
+};
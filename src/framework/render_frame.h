@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+
+#include "math/mat4.h"
+
+class Entity;
+class Mesh;
+class Material;
+class Camera;
+
+// One draw of the scene as it was when the frame was captured
+struct sDrawItem
+{
+	Entity* entity = nullptr; // custom draws (helpers, terrain) call entity->render, the rest only use the copied state
+	Mesh* mesh = nullptr;
+	Material* material = nullptr;
+	mat4 model;
+	mat4 prev_model; // at the previous simulation step, the render interpolates between both
+	bool has_prev_model = false;
+	int palette_start = -1; // first skin matrix in sRenderFrame::palettes, -1 without skin
+	int palette_size = 0;
+	bool custom = false;
+	bool batchable = false; // plain entity that can be drawn in a multi draw batch with the others sharing mesh and material
+};
+
+// What the renderer needs from the scene, copied at the end of the update. In the pipelined mode the update of the
+// next frame runs in a worker while this one is rendered, so the render only reads its frame (double buffered)
+struct sRenderFrame
+{
+	Camera* camera = nullptr; // copy of the application camera (not Camera::current, the update keeps moving that one)
+	std::vector<sDrawItem> items;
+	std::vector<mat4> palettes; // skin matrices of all the skinned items
+	bool grid = true;
+
+	void clear() { items.clear(); palettes.clear(); }
+};
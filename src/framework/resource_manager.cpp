@@ -0,0 +1,134 @@
+#include "resource_manager.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "includes.h"
+
+size_t ResourceManager::cpu_budget = (size_t)1024 * 1024 * 1024;
+size_t ResourceManager::gpu_budget = (size_t)1024 * 1024 * 1024;
+unsigned int ResourceManager::min_unused_frames = 8;
+unsigned int ResourceManager::frame = 0;
+
+std::vector<Resource*> ResourceManager::s_resources;
+
+static const char* s_type_names[NUM_RESOURCE_TYPES] = { "Mesh", "Texture" };
+
+Resource::~Resource()
+{
+	assert(ref_count == 0 && "resource deleted while a handle still points to it");
+	if (managed)
+		ResourceManager::remove(this);
+}
+
+void ResourceManager::add(Resource* resource)
+{
+	if (resource->managed)
+		return;
+	resource->managed = true;
+	resource->touch();
+	s_resources.push_back(resource);
+}
+
+void ResourceManager::remove(Resource* resource)
+{
+	auto it = std::find(s_resources.begin(), s_resources.end(), resource);
+	if (it != s_resources.end())
+		s_resources.erase(it);
+	resource->managed = false;
+}
+
+bool ResourceManager::is_evictable(Resource* resource)
+{
+	return resource->ref_count <= 0 && frame - resource->last_frame_used >= min_unused_frames && resource->can_evict();
+}
+
+Resource* ResourceManager::find_lru()
+{
+	Resource* lru = nullptr;
+	for (Resource* resource : s_resources) {
+		if (is_evictable(resource) && (!lru || resource->last_frame_used < lru->last_frame_used))
+			lru = resource;
+	}
+	return lru;
+}
+
+void ResourceManager::evict(Resource* resource)
+{
+	std::cout << " - Unloading " << s_type_names[resource->get_resource_type()] << ": " << resource->get_resource_name() << std::endl;
+	// the destructor removes it from the list and from the cache of its type
+	delete resource;
+}
+
+void ResourceManager::update()
+{
+	frame++;
+
+	if (!cpu_budget && !gpu_budget)
+		return;
+
+	size_t cpu_bytes = get_cpu_bytes();
+	size_t gpu_bytes = get_gpu_bytes();
+	while ((cpu_budget && cpu_bytes > cpu_budget) || (gpu_budget && gpu_bytes > gpu_budget))
+	{
+		Resource* lru = find_lru();
+		if (!lru)
+			break; // everything over the budget is in use
+
+		cpu_bytes -= std::min(cpu_bytes, lru->get_cpu_bytes());
+		gpu_bytes -= std::min(gpu_bytes, lru->get_gpu_bytes());
+		evict(lru);
+	}
+}
+
+unsigned int ResourceManager::unload_unused()
+{
+	unsigned int count = 0;
+	while (Resource* lru = find_lru()) {
+		evict(lru);
+		count++;
+	}
+	return count;
+}
+
+size_t ResourceManager::get_cpu_bytes()
+{
+	size_t bytes = 0;
+	for (Resource* resource : s_resources)
+		bytes += resource->get_cpu_bytes();
+	return bytes;
+}
+
+size_t ResourceManager::get_gpu_bytes()
+{
+	size_t bytes = 0;
+	for (Resource* resource : s_resources)
+		bytes += resource->get_gpu_bytes();
+	return bytes;
+}
+
+void ResourceManager::render_gui()
+{
+	const float mb = 1024.f * 1024.f;
+	int cpu_mb = (int)(cpu_budget / (1024 * 1024));
+	int gpu_mb = (int)(gpu_budget / (1024 * 1024));
+	if (ImGui::SliderInt("RAM budget (MB)", &cpu_mb, 0, 4096))
+		cpu_budget = (size_t)cpu_mb * 1024 * 1024;
+	if (ImGui::SliderInt("VRAM budget (MB)", &gpu_mb, 0, 4096))
+		gpu_budget = (size_t)gpu_mb * 1024 * 1024;
+
+	ImGui::Text("Resources: %d RAM: %.2f MB VRAM: %.2f MB", (int)s_resources.size(), get_cpu_bytes() / mb, get_gpu_bytes() / mb);
+	if (ImGui::Button("Unload unused")) {
+		unsigned int count = unload_unused();
+		std::cout << "[INFO] " << count << " unused resources unloaded" << std::endl;
+	}
+
+	if (ImGui::TreeNode("List")) {
+		for (Resource* resource : s_resources) {
+			ImGui::Text("%s %s refs: %d RAM: %.1f KB VRAM: %.1f KB unused: %u frames", s_type_names[resource->get_resource_type()],
+				resource->get_resource_name(), resource->ref_count, resource->get_cpu_bytes() / 1024.f, resource->get_gpu_bytes() / 1024.f,
+				frame - resource->last_frame_used);
+		}
+		ImGui::TreePop();
+	}
+}
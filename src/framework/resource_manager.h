@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+enum eResourceType {
+	RESOURCE_MESH,
+	RESOURCE_TEXTURE,
+	NUM_RESOURCE_TYPES
+};
+
+// Base of the cached assets (meshes and textures): the handles pointing to it and the memory it uses, so the
+// ResourceManager can unload the ones that nobody holds. Deleting a managed resource removes it from its cache
+class Resource
+{
+public:
+	int ref_count = 0; // ResourceHandles holding it (main thread only)
+	unsigned int last_frame_used = 0; // drawn or bound, a resource used recently is not evicted even without references
+	bool managed = false; // registered in the ResourceManager, it can be unloaded
+
+	virtual ~Resource();
+
+	virtual eResourceType get_resource_type() = 0;
+	virtual const char* get_resource_name() = 0;
+	virtual size_t get_cpu_bytes() = 0;
+	virtual size_t get_gpu_bytes() = 0;
+	virtual bool can_evict() { return true; } // false while it is still loading
+
+	inline void touch();
+};
+
+// Reference to a resource: while there is one the resource is never unloaded. Converts to and from the raw pointer,
+// so it can replace the Mesh* or Texture* members without changing the code that uses them
+template<typename T>
+class ResourceHandle
+{
+public:
+	ResourceHandle() {}
+	ResourceHandle(T* resource) { set(resource); }
+	ResourceHandle(const ResourceHandle& other) { set(other.resource); }
+	~ResourceHandle() { set(nullptr); }
+
+	ResourceHandle& operator=(T* resource) { set(resource); return *this; }
+	ResourceHandle& operator=(const ResourceHandle& other) { set(other.resource); return *this; }
+
+	operator T*() const { return resource; }
+	T* operator->() const { return resource; }
+	T* get() const { return resource; }
+
+protected:
+	T* resource = nullptr;
+
+	void set(T* new_resource)
+	{
+		if (new_resource) new_resource->ref_count++;
+		if (resource) resource->ref_count--;
+		resource = new_resource;
+	}
+};
+
+// Tracks the meshes and textures loaded through their caches (Mesh::get, Texture::get, TextureStreamer::get) and the
+// memory they use. When the total goes over a budget the resources without references are unloaded, least recently
+// used first. Only the ones not used for some frames are candidates: the render frames in flight still point to them
+class ResourceManager
+{
+public:
+	static size_t cpu_budget; // bytes, 0 disables the eviction
+	static size_t gpu_budget;
+	static unsigned int min_unused_frames;
+	static unsigned int frame;
+
+	static std::vector<Resource*> s_resources;
+
+	static void add(Resource* resource);
+	static void remove(Resource* resource);
+
+	// once per frame with no render frame in flight (after the pipelined update was waited for)
+	static void update();
+	// unloads every resource without references (not used for min_unused_frames), returns how many
+	static unsigned int unload_unused();
+
+	static size_t get_cpu_bytes();
+	static size_t get_gpu_bytes();
+	static void render_gui();
+
+protected:
+	static bool is_evictable(Resource* resource);
+	static Resource* find_lru();
+	static void evict(Resource* resource);
+};
+
+inline void Resource::touch()
+{
+	last_frame_used = ResourceManager::frame;
+}
@@ -0,0 +1,721 @@
+#include "scene.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#include "includes.h"
+#include "json.h"
+#include "entity.h"
+#include "profiler.h"
+#include "frame_allocator.h"
+#include "resource_manager.h"
+#include "graphics/mesh.h"
+#include "graphics/material.h"
+#include "graphics/texture.h"
+#include "graphics/texture_streamer.h"
+
+// an unloaded section is freed once no render frame or profiler frame can point to its entities (names, items)
+#define SCENE_RETIRE_FRAMES (PROFILER_FRAMES + 2)
+
+std::map<std::string, Skeleton*> Scene::s_skeletons;
+
+// JSON to the cooked records: tables of unique strings and references, entities grouped by the cell of their root
+struct sSceneCooker
+{
+	struct sSection
+	{
+		sSceneBinSection info;
+		std::vector<sSceneBinEntity> entities;
+		std::vector<sSceneBinLine> lines;
+		std::vector<sSceneBinTerrain> terrains;
+	};
+
+	float cell_size = 0.f;
+	std::string strings;
+	std::map<std::string, int32_t> string_offsets;
+	std::vector<uint32_t> meshes;
+	std::map<std::string, int32_t> mesh_indices;
+	std::vector<uint32_t> skeletons;
+	std::map<std::string, int32_t> skeleton_indices;
+	std::vector<sSceneBinMaterial> materials;
+	std::map<std::string, int32_t> material_indices;
+	std::map<std::pair<int32_t, int32_t>, sSection> sections; // by cell, so the order does not depend on the file
+	std::string error;
+
+	int32_t add_string(const std::string& value)
+	{
+		if (value.empty())
+			return SCENE_BIN_NONE;
+		auto it = string_offsets.find(value);
+		if (it != string_offsets.end())
+			return it->second;
+		int32_t offset = (int32_t)strings.size();
+		strings.append(value.c_str(), value.size() + 1);
+		string_offsets[value] = offset;
+		return offset;
+	}
+
+	int32_t add_reference(std::vector<uint32_t>& table, std::map<std::string, int32_t>& indices, const std::string& value)
+	{
+		if (value.empty())
+			return SCENE_BIN_NONE;
+		auto it = indices.find(value);
+		if (it != indices.end())
+			return it->second;
+		int32_t index = (int32_t)table.size();
+		table.push_back((uint32_t)add_string(value));
+		indices[value] = index;
+		return index;
+	}
+
+	bool add_material(const sJsonValue& json)
+	{
+		std::string name = json.get_string("name");
+		if (name.empty() || material_indices.count(name))
+			return fail("material without a name or with a repeated one: " + name);
+
+		sSceneBinMaterial material;
+		memset(&material, 0, sizeof(material));
+		std::string type = json.get_string("type", "flat");
+		if (type == "flat") material.type = SCENE_MATERIAL_FLAT;
+		else if (type == "normal") material.type = SCENE_MATERIAL_NORMAL;
+		else if (type == "pbr") material.type = SCENE_MATERIAL_PBR;
+		else return fail("unknown material type: " + type);
+
+		vec4 color = json.get_vec4("color", vec4(1.f));
+		memcpy(material.color, color.v, sizeof(material.color));
+		material.metallic = json.get_float("metallic", 1.f);
+		material.roughness = json.get_float("roughness", 1.f);
+		material.textures[0] = add_string(json.get_string("texture"));
+		material.textures[1] = add_string(json.get_string("normal_texture"));
+		material.textures[2] = add_string(json.get_string("metallic_roughness_texture"));
+
+		material_indices[name] = (int32_t)materials.size();
+		materials.push_back(material);
+		return true;
+	}
+
+	// the entity and its children, depth first so the parents come before their children
+	bool add_entity(const sJsonValue& json, sSection* section, int32_t parent)
+	{
+		if (json.type != JSON_OBJECT)
+			return fail("entity is not an object");
+
+		sSceneBinEntity entity;
+		memset(&entity, 0, sizeof(entity));
+		entity.parent = parent;
+		entity.component = SCENE_BIN_NONE;
+
+		std::string type = json.get_string("type", "entity");
+		vec3 position = json.get_vec3("position", vec3(0.f));
+		if (type == "entity") entity.type = SCENE_ENTITY;
+		else if (type == "line_helper") {
+			entity.type = SCENE_LINE_HELPER;
+			position = json.get_vec3("origin", position); // the line helpers are placed by their origin
+		}
+		else if (type == "skinned") entity.type = SCENE_SKINNED_ENTITY;
+		else if (type == "terrain") entity.type = SCENE_TERRAIN;
+		else return fail("unknown entity type: " + type);
+
+		// the whole hierarchy goes to the cell of its root
+		if (!section) {
+			int32_t cell_x = cell_size > 0.f ? (int32_t)floorf(position.x / cell_size) : 0;
+			int32_t cell_z = cell_size > 0.f ? (int32_t)floorf(position.z / cell_size) : 0;
+			auto it = sections.find({ cell_x, cell_z });
+			if (it == sections.end()) {
+				it = sections.insert({ { cell_x, cell_z }, sSection() }).first;
+				sSceneBinSection& info = it->second.info;
+				memset(&info, 0, sizeof(info));
+				info.cell_x = cell_x;
+				info.cell_z = cell_z;
+				info.bounds_min[0] = info.bounds_min[1] = info.bounds_min[2] = FLT_MAX;
+				info.bounds_max[0] = info.bounds_max[1] = info.bounds_max[2] = -FLT_MAX;
+			}
+			section = &it->second;
+			for (int i = 0; i < 3; i++) {
+				section->info.bounds_min[i] = std::min(section->info.bounds_min[i], position.v[i]);
+				section->info.bounds_max[i] = std::max(section->info.bounds_max[i], position.v[i]);
+			}
+		}
+
+		entity.name = add_string(json.get_string("name"));
+		entity.mesh = add_reference(meshes, mesh_indices, json.get_string("mesh"));
+		entity.skeleton = add_reference(skeletons, skeleton_indices, json.get_string("skeleton"));
+		entity.material = SCENE_BIN_NONE;
+		std::string material = json.get_string("material");
+		if (!material.empty()) {
+			auto it = material_indices.find(material);
+			if (it == material_indices.end())
+				return fail("unknown material: " + material);
+			entity.material = it->second;
+		}
+		entity.flags = json.get_bool("visible", true) ? SCENE_ENTITY_VISIBLE : 0;
+
+		vec4 rotation = json.get_vec4("rotation", vec4(0.f, 0.f, 0.f, 1.f));
+		vec3 scale = json.get_vec3("scale", vec3(1.f));
+		memcpy(entity.position, position.v, sizeof(entity.position));
+		memcpy(entity.rotation, rotation.v, sizeof(entity.rotation));
+		memcpy(entity.scale, scale.v, sizeof(entity.scale));
+
+		if (entity.type == SCENE_LINE_HELPER) {
+			sSceneBinLine line;
+			memset(&line, 0, sizeof(line));
+			vec3 end = json.get_vec3("end", vec3(0.f, 1.f, 0.f));
+			vec4 color = json.get_vec4("color", vec4(1.f));
+			memcpy(line.origin, position.v, sizeof(line.origin));
+			memcpy(line.end, end.v, sizeof(line.end));
+			memcpy(line.color, color.v, sizeof(line.color));
+			line.unlocked = json.get_bool("unlocked", true) ? 1 : 0;
+			entity.component = (int32_t)section->lines.size();
+			section->lines.push_back(line);
+		}
+		else if (entity.type == SCENE_TERRAIN) {
+			sSceneBinTerrain terrain;
+			memset(&terrain, 0, sizeof(terrain));
+			std::string heightmap = json.get_string("heightmap");
+			if (heightmap.empty())
+				return fail("terrain without heightmap: " + json.get_string("name"));
+			terrain.heightmap = add_string(heightmap);
+			terrain.size = json.get_float("size", 256.f);
+			terrain.altitude = json.get_float("altitude", 32.f);
+			terrain.lod_distance = json.get_float("lod_distance", 0.f);
+			terrain.num_lods = (int32_t)json.get_float("lods", 6.f);
+			terrain.grid_resolution = (int32_t)json.get_float("grid_resolution", 32.f);
+			if (terrain.grid_resolution < 2 || terrain.grid_resolution % 2)
+				return fail("the grid resolution of a terrain must be even: " + json.get_string("name"));
+			vec4 color = json.get_vec4("color", vec4(0.6f, 0.55f, 0.45f, 1.f));
+			memcpy(terrain.color, color.v, sizeof(terrain.color));
+			entity.component = (int32_t)section->terrains.size();
+			section->terrains.push_back(terrain);
+		}
+
+		int32_t index = (int32_t)section->entities.size();
+		section->entities.push_back(entity);
+
+		const sJsonValue* children = json.get("children");
+		if (children && children->type == JSON_ARRAY) {
+			for (size_t i = 0; i < children->size(); i++)
+				if (!add_entity((*children)[i], section, index))
+					return false;
+		}
+		return true;
+	}
+
+	bool fail(const std::string& message)
+	{
+		if (error.empty())
+			error = message;
+		return false;
+	}
+};
+
+static uint64_t align_offset(uint64_t offset)
+{
+	return (offset + 7) & ~(uint64_t)7;
+}
+
+bool Scene::cook(const sJsonValue& root, std::vector<uint8_t>& output, std::string& error)
+{
+	if (root.type != JSON_OBJECT) {
+		error = "the scene is not a JSON object";
+		return false;
+	}
+
+	sSceneCooker cooker;
+	cooker.cell_size = root.get_float("cell_size", 0.f);
+
+	const sJsonValue* materials = root.get("materials");
+	if (materials && materials->type == JSON_ARRAY) {
+		for (size_t i = 0; i < materials->size(); i++) {
+			if (!cooker.add_material((*materials)[i])) {
+				error = cooker.error;
+				return false;
+			}
+		}
+	}
+
+	const sJsonValue* entities = root.get("entities");
+	if (entities && entities->type == JSON_ARRAY) {
+		for (size_t i = 0; i < entities->size(); i++) {
+			if (!cooker.add_entity((*entities)[i], nullptr, SCENE_BIN_NONE)) {
+				error = cooker.error;
+				return false;
+			}
+		}
+	}
+
+	sSceneBinHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = SCENE_BIN_MAGIC;
+	header.version = SCENE_BIN_VERSION;
+	header.cell_size = cooker.cell_size;
+	header.flags = root.get_bool("grid", true) ? SCENE_FLAG_GRID : 0;
+
+	const sJsonValue empty;
+	const sJsonValue* camera = root.get("camera");
+	if (!camera)
+		camera = &empty;
+	vec3 eye = camera->get_vec3("eye", vec3(0.f, 1.5f, 7.f));
+	vec3 center = camera->get_vec3("center", vec3(0.f));
+	memcpy(header.camera_eye, eye.v, sizeof(header.camera_eye));
+	memcpy(header.camera_center, center.v, sizeof(header.camera_center));
+	header.camera_fov = camera->get_float("fov", 45.f);
+
+	header.num_sections = (uint32_t)cooker.sections.size();
+	header.num_meshes = (uint32_t)cooker.meshes.size();
+	header.num_skeletons = (uint32_t)cooker.skeletons.size();
+	header.num_materials = (uint32_t)cooker.materials.size();
+	header.strings_size = (uint32_t)cooker.strings.size();
+
+	// layout: every array starts 8 bytes aligned so the records can be read in place
+	uint64_t offset = sizeof(sSceneBinHeader);
+	header.sections_offset = offset;
+	offset += header.num_sections * sizeof(sSceneBinSection);
+	header.meshes_offset = offset = align_offset(offset);
+	offset += header.num_meshes * sizeof(uint32_t);
+	header.skeletons_offset = offset = align_offset(offset);
+	offset += header.num_skeletons * sizeof(uint32_t);
+	header.materials_offset = offset = align_offset(offset);
+	offset += header.num_materials * sizeof(sSceneBinMaterial);
+	header.strings_offset = offset = align_offset(offset);
+	offset += header.strings_size;
+
+	std::vector<sSceneBinSection> section_table;
+	section_table.reserve(cooker.sections.size());
+	for (auto& it : cooker.sections) {
+		sSceneBinSection info = it.second.info;
+		info.num_entities = (uint32_t)it.second.entities.size();
+		info.num_lines = (uint32_t)it.second.lines.size();
+		info.entities_offset = offset = align_offset(offset);
+		offset += info.num_entities * sizeof(sSceneBinEntity);
+		info.lines_offset = offset = align_offset(offset);
+		offset += info.num_lines * sizeof(sSceneBinLine);
+		info.num_terrains = (uint32_t)it.second.terrains.size();
+		info.terrains_offset = offset = align_offset(offset);
+		offset += info.num_terrains * sizeof(sSceneBinTerrain);
+		section_table.push_back(info);
+	}
+
+	output.assign((size_t)offset, 0);
+	auto write = [&output](uint64_t at, const void* source, size_t bytes) {
+		if (bytes)
+			memcpy(output.data() + at, source, bytes);
+	};
+	write(0, &header, sizeof(header));
+	write(header.sections_offset, section_table.data(), section_table.size() * sizeof(sSceneBinSection));
+	write(header.meshes_offset, cooker.meshes.data(), cooker.meshes.size() * sizeof(uint32_t));
+	write(header.skeletons_offset, cooker.skeletons.data(), cooker.skeletons.size() * sizeof(uint32_t));
+	write(header.materials_offset, cooker.materials.data(), cooker.materials.size() * sizeof(sSceneBinMaterial));
+	write(header.strings_offset, cooker.strings.data(), cooker.strings.size());
+
+	size_t i = 0;
+	for (auto& it : cooker.sections) {
+		const sSceneBinSection& info = section_table[i++];
+		write(info.entities_offset, it.second.entities.data(), it.second.entities.size() * sizeof(sSceneBinEntity));
+		write(info.lines_offset, it.second.lines.data(), it.second.lines.size() * sizeof(sSceneBinLine));
+		write(info.terrains_offset, it.second.terrains.data(), it.second.terrains.size() * sizeof(sSceneBinTerrain));
+	}
+	return true;
+}
+
+bool Scene::cook(const char* json_filename, std::vector<uint8_t>& output, std::string& error)
+{
+	std::string text;
+	if (!read_file(json_filename, text)) {
+		error = "cannot read the file";
+		return false;
+	}
+
+	sJsonValue root;
+	if (!parse_json(text.c_str(), root, error))
+		return false;
+	return cook(root, output, error);
+}
+
+static bool write_scene_bin(const std::string& filename, const std::vector<uint8_t>& bytes)
+{
+	//the cooked bins are written in their own folder tree
+	std::filesystem::path folder = std::filesystem::path(filename).parent_path();
+	std::error_code error;
+	if (!folder.empty())
+		std::filesystem::create_directories(folder, error);
+
+	FILE* f = fopen(filename.c_str(), "wb");
+	if (f == NULL)
+		return false;
+	bool ok = fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+	fclose(f);
+	return ok;
+}
+
+Scene* Scene::load(const char* filename, std::vector<Entity*>& entity_list)
+{
+	assert(filename);
+	PROFILE_SCOPE("Scene::load");
+
+	long time = get_time();
+	std::cout << " + Scene loading: " << filename << " ... ";
+
+	Scene* scene = new Scene();
+	scene->filename = filename;
+	scene->entity_list = &entity_list;
+
+	std::string name = filename;
+	std::string ext = name.substr(name.find_last_of(".") + 1);
+	std::string binfilename = ext == "scnbin" ? name : get_cooked_filename(name, ".scnbin");
+
+	bool loaded = false;
+	if (is_cooked_file_valid(name, binfilename) && scene->file.open(binfilename.c_str())) {
+		loaded = scene->open(scene->file.data, scene->file.size);
+		if (loaded)
+			std::cout << "[OK BIN] ";
+		else
+			scene->file.close();
+	}
+
+	if (!loaded && ext != "scnbin") {
+		std::string error;
+		if (!cook(filename, scene->memory, error)) {
+			std::cout << "[ERROR]: " << error << std::endl;
+			delete scene;
+			return nullptr;
+		}
+		if (!write_scene_bin(binfilename, scene->memory))
+			std::cout << "[WARN] cannot write " << binfilename << " ";
+		loaded = scene->open(scene->memory.data(), scene->memory.size());
+		if (loaded)
+			std::cout << "[OK] ";
+	}
+
+	if (!loaded) {
+		std::cout << "[ERROR]: Scene not found or invalid" << std::endl;
+		delete scene;
+		return nullptr;
+	}
+
+	std::cout << "Sections: " << scene->header->num_sections << " Time: " << (get_time() - time) * 0.001 << "sec" << std::endl;
+
+	// what is around the camera is there from the first frame
+	scene->update(scene->camera_eye, true);
+	return scene;
+}
+
+bool Scene::open(const uint8_t* bytes, size_t size)
+{
+	if (!bytes || size < sizeof(sSceneBinHeader))
+		return false;
+
+	const sSceneBinHeader* bin = (const sSceneBinHeader*)bytes;
+	if (bin->magic != SCENE_BIN_MAGIC || bin->version != SCENE_BIN_VERSION)
+		return false;
+
+	auto fits = [size](uint64_t offset, uint64_t count, size_t record) {
+		return offset <= size && count <= (size - offset) / record;
+	};
+	if (!fits(bin->sections_offset, bin->num_sections, sizeof(sSceneBinSection)) ||
+		!fits(bin->meshes_offset, bin->num_meshes, sizeof(uint32_t)) ||
+		!fits(bin->skeletons_offset, bin->num_skeletons, sizeof(uint32_t)) ||
+		!fits(bin->materials_offset, bin->num_materials, sizeof(sSceneBinMaterial)) ||
+		!fits(bin->strings_offset, bin->strings_size, 1))
+		return false;
+	if (bin->strings_size && bytes[bin->strings_offset + bin->strings_size - 1] != 0)
+		return false;
+
+	const sSceneBinSection* table = (const sSceneBinSection*)(bytes + bin->sections_offset);
+	for (uint32_t i = 0; i < bin->num_sections; i++) {
+		if (!fits(table[i].entities_offset, table[i].num_entities, sizeof(sSceneBinEntity)) ||
+			!fits(table[i].lines_offset, table[i].num_lines, sizeof(sSceneBinLine)) ||
+			!fits(table[i].terrains_offset, table[i].num_terrains, sizeof(sSceneBinTerrain)))
+			return false;
+	}
+
+	data = bytes;
+	header = bin;
+	sections = table;
+	section_states.assign(header->num_sections, sSectionState());
+	materials.assign(header->num_materials, nullptr);
+
+	camera_eye = vec3(header->camera_eye[0], header->camera_eye[1], header->camera_eye[2]);
+	camera_center = vec3(header->camera_center[0], header->camera_center[1], header->camera_center[2]);
+	camera_fov = header->camera_fov;
+	grid = (header->flags & SCENE_FLAG_GRID) != 0;
+	return true;
+}
+
+Scene::~Scene()
+{
+	for (unsigned int i = 0; i < section_states.size(); i++)
+		if (section_states[i].instance)
+			unload_section(i);
+	free_retired(true);
+
+	for (Material* material : materials)
+		delete material;
+}
+
+const char* Scene::get_string(int32_t offset)
+{
+	if (offset < 0 || (uint32_t)offset >= header->strings_size)
+		return nullptr;
+	return (const char*)(data + header->strings_offset + offset);
+}
+
+Mesh* Scene::get_mesh(int32_t index, Mesh** resolved)
+{
+	if (index < 0 || (uint32_t)index >= header->num_meshes)
+		return nullptr;
+	// not cached across loads: the ResourceManager can unload a mesh once the sections using it are gone
+	if (!resolved[index]) {
+		const uint32_t* references = (const uint32_t*)(data + header->meshes_offset);
+		const char* path = get_string((int32_t)references[index]);
+		resolved[index] = path ? Mesh::get(path) : nullptr;
+	}
+	return resolved[index];
+}
+
+// streamed by size on screen when the streamer is enabled, otherwise decoded in background (white until then)
+static Texture* get_texture(const char* filename)
+{
+	return TextureStreamer::enabled ? TextureStreamer::get(filename) : Texture::get_async(filename);
+}
+
+Material* Scene::get_material(int32_t index)
+{
+	if (index < 0 || (uint32_t)index >= header->num_materials)
+		return nullptr;
+	if (materials[index])
+		return materials[index];
+
+	const sSceneBinMaterial& bin = ((const sSceneBinMaterial*)(data + header->materials_offset))[index];
+	vec4 color(bin.color[0], bin.color[1], bin.color[2], bin.color[3]);
+	const char* textures[3] = { get_string(bin.textures[0]), get_string(bin.textures[1]), get_string(bin.textures[2]) };
+
+	Material* material = nullptr;
+	switch (bin.type) {
+	case SCENE_MATERIAL_PBR: {
+		PBRMaterial* pbr = new PBRMaterial();
+		pbr->color = color;
+		pbr->metallic = bin.metallic;
+		pbr->roughness = bin.roughness;
+		if (textures[0]) pbr->albedo_tex = get_texture(textures[0]);
+		if (textures[1]) pbr->normal_tex = get_texture(textures[1]);
+		if (textures[2]) pbr->met_rou_tex = get_texture(textures[2]);
+		material = pbr;
+		break;
+	}
+	case SCENE_MATERIAL_NORMAL:
+		material = new NormalMaterial();
+		material->color = color;
+		break;
+	default:
+		material = new FlatMaterial(color);
+		break;
+	}
+	if (bin.type != SCENE_MATERIAL_PBR) {
+		if (textures[0]) material->texture = get_texture(textures[0]);
+		if (textures[1]) material->normal_texture = get_texture(textures[1]);
+	}
+
+	materials[index] = material;
+	return material;
+}
+
+// the heightmap is read when the section streams in, the terrain is deleted with its entity
+Terrain* Scene::create_terrain(const sSceneBinTerrain& bin)
+{
+	const char* heightmap = get_string(bin.heightmap);
+	Image image;
+	if (!heightmap || !image.loadPNG(heightmap, true)) {
+		std::cout << "[WARN] Scene " << filename << ": heightmap not found: " << (heightmap ? heightmap : "") << std::endl;
+		return nullptr;
+	}
+
+	Terrain* terrain = new Terrain();
+	terrain->create(&image, bin.size, bin.altitude, bin.num_lods, bin.grid_resolution);
+	if (bin.lod_distance > 0.f)
+		terrain->set_lod_distance(bin.lod_distance);
+	return terrain;
+}
+
+float Scene::get_distance(const sSceneBinSection& section, const vec3& position)
+{
+	// on the XZ plane, to the bounds of the section (0 inside)
+	float dx = std::max(std::max(section.bounds_min[0] - position.x, position.x - section.bounds_max[0]), 0.f);
+	float dz = std::max(std::max(section.bounds_min[2] - position.z, position.z - section.bounds_max[2]), 0.f);
+	return sqrtf(dx * dx + dz * dz);
+}
+
+void Scene::update(const vec3& position, bool no_limit)
+{
+	PROFILE_SCOPE("Scene::update");
+
+	free_retired(false);
+
+	unsigned int num_loads = 0;
+	for (unsigned int i = 0; i < section_states.size(); i++) {
+		// the margin to unload keeps a section at the border from loading and unloading every frame
+		float distance = stream_radius > 0.f ? get_distance(sections[i], position) : 0.f;
+		if (!section_states[i].instance) {
+			if (distance <= stream_radius && (no_limit || num_loads < max_loads_per_frame)) {
+				load_section(i);
+				num_loads++;
+			}
+		}
+		else if (distance > stream_radius * 1.25f)
+			unload_section(i);
+	}
+}
+
+void Scene::load_section(unsigned int index)
+{
+	PROFILE_SCOPE("Scene::load_section");
+
+	const sSceneBinSection& section = sections[index];
+	const sSceneBinEntity* records = (const sSceneBinEntity*)(data + section.entities_offset);
+	const sSceneBinLine* lines = (const sSceneBinLine*)(data + section.lines_offset);
+	const sSceneBinTerrain* terrains = (const sSceneBinTerrain*)(data + section.terrains_offset);
+
+	// one allocation per type: the vectors never grow after this, so the pointers to the entities stay valid
+	size_t counts[NUM_SCENE_ENTITY_TYPES] = {};
+	for (uint32_t i = 0; i < section.num_entities; i++) {
+		uint32_t type = records[i].type;
+		if (type == SCENE_LINE_HELPER && (records[i].component < 0 || (uint32_t)records[i].component >= section.num_lines))
+			type = SCENE_ENTITY;
+		if (type == SCENE_TERRAIN && (records[i].component < 0 || (uint32_t)records[i].component >= section.num_terrains))
+			type = SCENE_ENTITY;
+		counts[type < NUM_SCENE_ENTITY_TYPES ? type : SCENE_ENTITY]++;
+	}
+
+	sSceneSectionInstance* instance = new sSceneSectionInstance();
+	instance->entities.reserve(counts[SCENE_ENTITY]);
+	instance->lines.reserve(counts[SCENE_LINE_HELPER]);
+	instance->skinned.reserve(counts[SCENE_SKINNED_ENTITY]);
+	instance->terrains.reserve(counts[SCENE_TERRAIN]);
+
+	LinearArena& arena = FrameAllocator::get();
+	sArenaScope scope(arena);
+	Entity** created = arena.alloc_array<Entity*>(std::max(section.num_entities, 1u));
+	Mesh** resolved = arena.alloc_array<Mesh*>(std::max(header->num_meshes, 1u));
+	memset(resolved, 0, sizeof(Mesh*) * header->num_meshes);
+
+	for (uint32_t i = 0; i < section.num_entities; i++) {
+		const sSceneBinEntity& record = records[i];
+		const char* name = get_string(record.name);
+
+		Entity* entity = nullptr;
+		bool is_line = record.type == SCENE_LINE_HELPER && record.component >= 0 && (uint32_t)record.component < section.num_lines;
+		if (is_line) {
+			const sSceneBinLine& line = lines[record.component];
+			instance->lines.emplace_back(vec3(line.origin[0], line.origin[1], line.origin[2]), vec3(line.end[0], line.end[1], line.end[2]), name);
+			LineHelper* line_helper = &instance->lines.back();
+			line_helper->color = vec4(line.color[0], line.color[1], line.color[2], line.color[3]);
+			line_helper->unlocked = line.unlocked != 0;
+			entity = line_helper;
+		}
+		else if (record.type == SCENE_TERRAIN && record.component >= 0 && (uint32_t)record.component < section.num_terrains) {
+			const sSceneBinTerrain& bin = terrains[record.component];
+			instance->terrains.emplace_back(create_terrain(bin), name);
+			TerrainEntity* terrain = &instance->terrains.back();
+			terrain->color = vec4(bin.color[0], bin.color[1], bin.color[2], bin.color[3]);
+			entity = terrain;
+		}
+		else if (record.type == SCENE_SKINNED_ENTITY) {
+			instance->skinned.emplace_back(name);
+			SkinnedEntity* skinned = &instance->skinned.back();
+			if (record.skeleton >= 0 && (uint32_t)record.skeleton < header->num_skeletons) {
+				const uint32_t* references = (const uint32_t*)(data + header->skeletons_offset);
+				const char* skeleton = get_string((int32_t)references[record.skeleton]);
+				auto it = skeleton ? s_skeletons.find(skeleton) : s_skeletons.end();
+				if (it != s_skeletons.end())
+					skinned->skeleton = it->second;
+				else
+					std::cout << "[WARN] Scene " << filename << ": skeleton not found: " << (skeleton ? skeleton : "") << std::endl;
+			}
+			entity = skinned;
+		}
+		else {
+			instance->entities.emplace_back(name);
+			entity = &instance->entities.back();
+		}
+
+		// the line helpers draw their own lines mesh, already in world space
+		if (!is_line) {
+			entity->mesh = get_mesh(record.mesh, resolved);
+			entity->material = get_material(record.material);
+			entity->set_transform(Transform(vec3(record.position[0], record.position[1], record.position[2]),
+				quat(record.rotation[0], record.rotation[1], record.rotation[2], record.rotation[3]),
+				vec3(record.scale[0], record.scale[1], record.scale[2])));
+		}
+		entity->flag_visible = (record.flags & SCENE_ENTITY_VISIBLE) != 0;
+
+		created[i] = entity;
+		if (record.parent >= 0 && (uint32_t)record.parent < i) {
+			Entity* parent = created[record.parent];
+			entity->parent = parent;
+			parent->children.push_back(entity);
+		}
+		else {
+			instance->roots.push_back(entity);
+			entity_list->push_back(entity);
+		}
+	}
+
+	section_states[index].instance = instance;
+}
+
+void Scene::unload_section(unsigned int index)
+{
+	PROFILE_SCOPE("Scene::unload_section");
+
+	sSceneSectionInstance* instance = section_states[index].instance;
+	section_states[index].instance = nullptr;
+
+	// one pass over the entity list whatever the number of roots
+	std::vector<Entity*>& roots = instance->roots;
+	std::sort(roots.begin(), roots.end());
+	entity_list->erase(std::remove_if(entity_list->begin(), entity_list->end(), [&roots](Entity* entity) {
+		return std::binary_search(roots.begin(), roots.end(), entity);
+	}), entity_list->end());
+
+	retired.push_back({ instance, ResourceManager::frame });
+}
+
+void Scene::free_retired(bool all)
+{
+	size_t kept = 0;
+	for (size_t i = 0; i < retired.size(); i++) {
+		if (all || ResourceManager::frame - retired[i].frame >= SCENE_RETIRE_FRAMES)
+			delete retired[i].instance;
+		else
+			retired[kept++] = retired[i];
+	}
+	retired.resize(kept);
+}
+
+unsigned int Scene::get_num_sections()
+{
+	return (unsigned int)section_states.size();
+}
+
+unsigned int Scene::get_num_loaded_sections()
+{
+	unsigned int count = 0;
+	for (const sSectionState& state : section_states)
+		count += state.instance ? 1 : 0;
+	return count;
+}
+
+void Scene::render_gui()
+{
+	ImGui::Text("%s", filename.c_str());
+	ImGui::Text("Sections: %u loaded: %u retired: %d", get_num_sections(), get_num_loaded_sections(), (int)retired.size());
+	ImGui::DragFloat("Stream radius", &stream_radius, 1.f, 0.f, 10000.f);
+	int max_loads = (int)max_loads_per_frame;
+	if (ImGui::SliderInt("Loads per frame", &max_loads, 1, 16))
+		max_loads_per_frame = (unsigned int)max_loads;
+}
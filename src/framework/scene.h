@@ -0,0 +1,213 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+#include "utils.h"
+#include "math/vec3.h"
+
+class Entity;
+class LineHelper;
+class SkinnedEntity;
+class TerrainEntity;
+class Terrain;
+class Material;
+class Mesh;
+class Skeleton;
+struct sJsonValue;
+
+// Cooked scene (.scnbin). Everything is plain arrays of fixed size records, so the file is memory mapped and the
+// records are read in place: no parsing, no per entity allocations besides the entities themselves.
+//   header | section table | shared block: strings, mesh and skeleton references, materials | sections
+// A section holds the entities of one cell of a grid on the XZ plane (a hierarchy goes to the cell of its root),
+// with its entities in one array (parents before children) and the components of every type in their own arrays
+#define SCENE_BIN_MAGIC 0x314E4353 // "SCN1"
+#define SCENE_BIN_VERSION 2
+#define SCENE_BIN_NONE -1 // missing reference (name, mesh, material...)
+
+enum eSceneEntityType {
+	SCENE_ENTITY,
+	SCENE_LINE_HELPER,
+	SCENE_SKINNED_ENTITY,
+	SCENE_TERRAIN,
+	NUM_SCENE_ENTITY_TYPES
+};
+
+enum eSceneMaterialType {
+	SCENE_MATERIAL_FLAT,
+	SCENE_MATERIAL_NORMAL,
+	SCENE_MATERIAL_PBR
+};
+
+#define SCENE_ENTITY_VISIBLE 1
+
+struct sSceneBinHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	float cell_size;
+	uint32_t flags; // SCENE_FLAG_GRID
+	float camera_eye[3];
+	float camera_center[3];
+	float camera_fov;
+	uint32_t num_sections;
+	uint32_t num_meshes;
+	uint32_t num_skeletons;
+	uint32_t num_materials;
+	uint32_t strings_size;
+	uint64_t sections_offset; // from the start of the file, like all the offsets
+	uint64_t meshes_offset; // uint32_t string offsets
+	uint64_t skeletons_offset; // uint32_t string offsets
+	uint64_t materials_offset;
+	uint64_t strings_offset; // zero terminated strings
+};
+
+#define SCENE_FLAG_GRID 1
+
+struct sSceneBinSection
+{
+	int32_t cell_x;
+	int32_t cell_z;
+	float bounds_min[3]; // of the root positions, to decide when it is streamed
+	float bounds_max[3];
+	uint32_t num_entities;
+	uint32_t num_lines;
+	uint32_t num_terrains;
+	uint32_t reserved;
+	uint64_t entities_offset;
+	uint64_t lines_offset;
+	uint64_t terrains_offset;
+};
+
+struct sSceneBinEntity
+{
+	uint32_t type; // eSceneEntityType
+	int32_t parent; // index in the section, parents come first
+	int32_t name; // string offset
+	int32_t mesh; // index in the mesh references
+	int32_t material;
+	int32_t skeleton;
+	int32_t component; // index in the array of its type (lines, terrains), -1 for plain entities
+	uint32_t flags;
+	float position[3];
+	float rotation[4]; // quaternion x y z w
+	float scale[3];
+};
+
+struct sSceneBinMaterial
+{
+	uint32_t type; // eSceneMaterialType
+	float color[4];
+	float metallic;
+	float roughness;
+	int32_t textures[3]; // string offsets: texture and normal texture (PBR: albedo, normal and metallic-roughness)
+};
+
+struct sSceneBinLine
+{
+	float origin[3];
+	float end[3]; // relative to the origin
+	float color[4];
+	uint32_t unlocked;
+};
+
+struct sSceneBinTerrain
+{
+	int32_t heightmap; // string offset of the image, its first channel are the heights
+	float size; // width and depth
+	float altitude; // height of a white texel
+	float lod_distance; // range of the finest level, 0 keeps the one chosen by Terrain::create
+	int32_t num_lods;
+	int32_t grid_resolution;
+	float color[4];
+};
+
+// The entities of a section once instantiated: one array per type, built with a single allocation each
+struct sSceneSectionInstance
+{
+	std::vector<Entity> entities;
+	std::vector<LineHelper> lines;
+	std::vector<SkinnedEntity> skinned;
+	std::vector<TerrainEntity> terrains; // each one owns its terrain
+	std::vector<Entity*> roots; // the ones in the entity list of the application
+};
+
+// A scene loaded from its JSON authoring form or from the cooked binary. The sections around the stream position
+// are instantiated into the entity list and the far ones are removed (a scene with a single cell, or a stream radius
+// of 0, is loaded whole). The meshes are loaded when a section that needs them streams in (and can be unloaded by the
+// ResourceManager once no section holds them), the materials are created once and shared by the entities using them.
+//
+// JSON form:
+//   { "camera": { "eye": [0, 1.5, 7], "center": [0, 0, 0], "fov": 45 }, "grid": true, "cell_size": 32 (0 = one section),
+//     "materials": [ { "name": "red", "type": "flat" | "normal" | "pbr", "color": [1, 0, 0, 1], "texture": "a.png" } ],
+//     "entities": [ { "name": "A", "type": "entity" | "line_helper" | "skinned" | "terrain", "mesh": "res/meshes/a.obj",
+//                     "material": "red", "skeleton": "name", "position": [0, 0, 0], "rotation": [0, 0, 0, 1], "scale": [1, 1, 1],
+//                     "visible": true, "origin": [0, 0, 0], "end": [0, 1, 0], "color": [1, 1, 1, 1], "unlocked": true,
+//                     "heightmap": "a.png", "size": 256, "altitude": 32, "lods": 6, "grid_resolution": 32, "lod_distance": 0,
+//                     "children": [ ... ] } ] }
+class Scene
+{
+public:
+	static std::map<std::string, Skeleton*> s_skeletons; // skeletons the skinned entities refer to by name (not owned)
+
+	std::string filename;
+	float stream_radius = 0.f; // around the stream position, 0 loads every section
+	unsigned int max_loads_per_frame = 2; // sections instantiated per update, the rest wait for the next frames
+
+	vec3 camera_eye;
+	vec3 camera_center;
+	float camera_fov;
+	bool grid;
+
+	// the cooked file is used when it exists, otherwise the JSON is cooked (and written for the next time)
+	static Scene* load(const char* filename, std::vector<Entity*>& entity_list);
+	// JSON to the binary form, false with the reason in error
+	static bool cook(const char* json_filename, std::vector<uint8_t>& output, std::string& error);
+	static bool cook(const sJsonValue& root, std::vector<uint8_t>& output, std::string& error);
+
+	~Scene(); // removes its entities from the entity list
+
+	// streams the sections in and out around the position (main thread, with no update job running),
+	// no_limit loads every section due at once instead of max_loads_per_frame
+	void update(const vec3& position, bool no_limit = false);
+	void render_gui();
+
+	unsigned int get_num_sections();
+	unsigned int get_num_loaded_sections();
+
+protected:
+	struct sSectionState
+	{
+		sSceneSectionInstance* instance = nullptr;
+	};
+
+	struct sRetiredSection
+	{
+		sSceneSectionInstance* instance;
+		unsigned int frame; // ResourceManager::frame when it was unloaded
+	};
+
+	sMappedFile file;
+	std::vector<uint8_t> memory; // the cooked bytes when they do not come from a file
+	const uint8_t* data = nullptr;
+	const sSceneBinHeader* header = nullptr;
+	const sSceneBinSection* sections = nullptr;
+
+	std::vector<Entity*>* entity_list = nullptr;
+	std::vector<sSectionState> section_states;
+	std::vector<sRetiredSection> retired;
+	std::vector<Material*> materials; // owned
+
+	Scene() {}
+	bool open(const uint8_t* bytes, size_t size);
+	const char* get_string(int32_t offset);
+	Mesh* get_mesh(int32_t index, Mesh** resolved); // resolved: the meshes already looked up by this section load
+	Material* get_material(int32_t index);
+	Terrain* create_terrain(const sSceneBinTerrain& bin);
+	float get_distance(const sSceneBinSection& section, const vec3& position);
+	void load_section(unsigned int index);
+	void unload_section(unsigned int index);
+	void free_retired(bool all);
+};
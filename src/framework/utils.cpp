@@ -4,8 +4,13 @@
 	#include <windows.h>
 #else
 	#include <sys/time.h>
+	#include <sys/mman.h>
+	#include <fcntl.h>
+	#include <unistd.h>
 #endif
 
+#include <sys/stat.h>
+
 #include "includes.h"
 
 #include "application.h"
@@ -193,6 +198,123 @@ char const* gl_error_string(GLenum const err) noexcept
 	}
 }
 
+bool file_exists(const std::string& filename)
+{
+	struct stat stbuffer;
+	return stat(filename.c_str(), &stbuffer) == 0;
+}
+
+bool is_cooked_file_valid(const std::string& source, const std::string& cooked)
+{
+	struct stat source_info, cooked_info;
+	if (stat(cooked.c_str(), &cooked_info) != 0)
+		return false;
+	//without the source the cooked one is all there is
+	if (stat(source.c_str(), &source_info) != 0)
+		return true;
+	return source_info.st_mtime <= cooked_info.st_mtime;
+}
+
+std::string get_cooked_filename(const std::string& filename, const char* extension)
+{
+	std::string name = filename;
+	for (size_t i = 0; i < name.size(); ++i)
+		if (name[i] == '\\' || name[i] == ':')
+			name[i] = '/';
+	//the cooked tree cannot escape its folder
+	while (true)
+	{
+		if (name.compare(0, 2, "./") == 0)
+			name = name.substr(2);
+		else if (name.compare(0, 3, "../") == 0)
+			name = name.substr(3);
+		else if (name.size() && name[0] == '/')
+			name = name.substr(1);
+		else
+			break;
+	}
+	return COOKED_FOLDER + name + extension;
+}
+
+bool sMappedFile::open(const char* filename)
+{
+	close();
+#ifndef _WIN32
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat stbuffer;
+	if (fstat(fd, &stbuffer) == 0 && stbuffer.st_size > 0)
+	{
+		void* view = mmap(NULL, (size_t)stbuffer.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (view != MAP_FAILED)
+		{
+			data = (const uint8_t*)view;
+			size = (size_t)stbuffer.st_size;
+			mapped = true;
+		}
+	}
+	::close(fd); //the mapping keeps the file
+#else
+	HANDLE file_handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file_handle == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER file_length;
+	if (GetFileSizeEx(file_handle, &file_length) && file_length.QuadPart > 0 && (unsigned long long)file_length.QuadPart <= (size_t)-1)
+	{
+		HANDLE mapping = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping)
+		{
+			void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			if (view)
+			{
+				data = (const uint8_t*)view;
+				size = (size_t)file_length.QuadPart;
+				mapped = true;
+			}
+			CloseHandle(mapping); //the view keeps the mapping
+		}
+	}
+	CloseHandle(file_handle);
+#endif
+	if (mapped)
+		return true;
+	//empty files cannot be mapped, and a failed mapping falls back to reading
+	FILE* file = fopen(filename, "rb");
+	if (!file)
+		return false;
+	fseek(file, 0, SEEK_END);
+	long file_size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	buffer.resize(file_size > 0 ? (size_t)file_size : 0);
+	size_t read = buffer.size() ? fread(buffer.data(), 1, buffer.size(), file) : 0;
+	fclose(file);
+	if (read != buffer.size())
+	{
+		buffer.clear();
+		return false;
+	}
+	data = buffer.data();
+	size = buffer.size();
+	return true;
+}
+
+void sMappedFile::close()
+{
+	if (mapped)
+	{
+#ifndef _WIN32
+		munmap((void*)data, size);
+#else
+		UnmapViewOfFile(data);
+#endif
+	}
+	mapped = false;
+	buffer.clear();
+	data = NULL;
+	size = 0;
+}
+
 bool check_gl_errors()
 {
 	#ifdef _DEBUG
@@ -315,8 +437,11 @@ std::vector<std::string> tokenize(const std::string& source, const char* delimit
 
 Mesh* grid = NULL;
 
-void draw_grid()
+void draw_grid(Camera* camera)
 {
+	if (!camera)
+		camera = Camera::current;
+
 	if (!grid)
 	{
 		grid = new Mesh();
@@ -331,13 +456,13 @@ void draw_grid()
 	Shader* grid_shader = Shader::get_default_shader("grid");
 	grid_shader->enable();
 	mat4 m = mat4();
-	m.c3r0 = floor(Camera::current->eye.x / 100.0) * 100.0f;
+	m.c3r0 = floor(camera->eye.x / 100.0) * 100.0f;
 	m.c3r1 = 0.0f;
-	m.c3r2 = floor(Camera::current->eye.z / 100.0f) * 100.0f; // translate(vec3(floor(Camera::current->eye.x / 100.0) * 100.0f, 0.0f, floor(Camera::current->eye.z / 100.0f) * 100.0f));
-	grid_shader->set_uniform("u_color", vec4(0.7f));
-	grid_shader->set_uniform("u_model", m);
-	grid_shader->set_uniform("u_camera_position", Camera::current->eye);
-	grid_shader->set_uniform("u_viewprojection", Camera::current->viewprojection_matrix);
+	m.c3r2 = floor(camera->eye.z / 100.0f) * 100.0f; // translate(vec3(floor(camera->eye.x / 100.0) * 100.0f, 0.0f, floor(camera->eye.z / 100.0f) * 100.0f));
+	grid_shader->set_uniform(Shader::UNIFORM_COLOR, vec4(0.7f));
+	grid_shader->set_uniform(Shader::UNIFORM_MODEL, m);
+	grid_shader->set_uniform(Shader::UNIFORM_CAMERA_POSITION, camera->eye);
+	grid_shader->set_uniform(Shader::UNIFORM_VIEWPROJECTION, camera->viewprojection_matrix);
 	grid->render(GL_LINES); //background grid
 	glDisable(GL_BLEND);
 	glDepthMask(true);
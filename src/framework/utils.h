@@ -7,18 +7,46 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <cstdint>
 
 #include "math/math.h"
 
 #include "includes.h"
 
+class Camera;
+
 //General functions **************
 long get_time();
 float* snapshot();
 bool read_file(const std::string& filename, std::string& content);
+bool file_exists(const std::string& filename);
+
+//cooked assets (written by the AssetCooker tool) live in their own folder tree mirroring the source paths
+#define COOKED_FOLDER "cooked/"
+std::string get_cooked_filename(const std::string& filename, const char* extension); //data/a.obj -> cooked/data/a.obj.mbin
+bool is_cooked_file_valid(const std::string& source, const std::string& cooked); //exists and is not older than the source
+
+//read only view of a whole file: memory mapped where the platform allows it, otherwise read to memory
+struct sMappedFile
+{
+	const uint8_t* data = NULL;
+	size_t size = 0;
+
+	sMappedFile() {}
+	sMappedFile(const sMappedFile&) = delete;
+	sMappedFile& operator=(const sMappedFile&) = delete;
+	~sMappedFile() { close(); }
+
+	bool open(const char* filename);
+	void close();
+
+protected:
+	std::vector<uint8_t> buffer; //when it is not mapped
+	bool mapped = false;
+};
 
 //generic purposes fuctions
-void draw_grid();
+void draw_grid(Camera* camera = nullptr); //nullptr uses Camera::current
 vec3 transform_quat(const vec3& a, const quat& q);
 
 //check opengl errors
@@ -10,6 +10,12 @@
 #include "ImGuizmo.h"
 
 #include "framework/application.h"
+#include "framework/graphics/texture_loader.h"
+#include "framework/profiler.h"
+#include "framework/job_system.h"
+#include "framework/frame_allocator.h"
+#include "framework/resource_manager.h"
+#include "framework/headless.h"
 
 // Globals
 Application* app;
@@ -42,8 +48,11 @@ void render_gui(GLFWwindow* window, Application* app)
 
 		ImGui::End();
 	}
+}
 
-	// Rendering
+// the GUI is built before the update (it edits the scene) and drawn after the scene
+void draw_gui(GLFWwindow* window)
+{
 	ImGui::Render();
 	int display_w, display_h;
 	glfwGetFramebufferSize(window, &display_w, &display_h);
@@ -135,22 +144,32 @@ void main_loop(GLFWwindow* window)
 	/* Loop until the user closes the window */
 	while (!glfwWindowShouldClose(window))
 	{
+		Profiler::begin_frame();
+
+		// in the pipelined mode the update of the last frame may still be running, the events and the GUI change the scene
+		app->wait_update();
+		// nothing of the last frame is running now, its transient allocations are released
+		FrameAllocator::begin_frame();
+		// unused meshes and textures over the budget are unloaded
+		ResourceManager::update();
+
 		glfwGetFramebufferSize(window, &width, &height);
 		glViewport(0, 0, width, height);
 
 		// Poll for and process events
 		glfwPollEvents();
+
+		{
+			PROFILE_GPU_SCOPE("Async uploads");
+			// Swap in the shaders compiled in background
+			Shader::update_async();
+			// Upload the textures decoded in background
+			TextureLoader::update();
+		}
 		glfwGetCursorPos(window, &xpos, &ypos);
 		app->mouse_position.x = static_cast<float>(xpos);
 		app->mouse_position.y = static_cast<float>(ypos);
 
-		double curr_time = glfwGetTime();
-		double delta_time = curr_time - prev_frame_time;
-		prev_frame_time = curr_time;
-		app->update(delta_time);
-
-		if (app->close) break;
-
 		// Start the Dear ImGui frame
 		ImGui_ImplOpenGL3_NewFrame();
 		ImGui_ImplGlfw_NewFrame();
@@ -161,26 +180,60 @@ void main_loop(GLFWwindow* window)
 
 		//ImGui::ShowDemoWindow();
 
+		{
+			PROFILE_SCOPE("GUI");
+			render_gui(window, app);
+		}
+
+		double curr_time = glfwGetTime();
+		double delta_time = curr_time - prev_frame_time;
+		prev_frame_time = curr_time;
+		app->update(delta_time);
+
+		if (app->close) {
+			ImGui::EndFrame();
+			Profiler::end_frame();
+			break;
+		}
+
 		app->render();
 
-		render_gui(window, app);
-		
-		/* Swap front and back buffers */
-		glfwSwapBuffers(window);
+		{
+			PROFILE_GPU_SCOPE("GUI draw");
+			draw_gui(window);
+		}
+
+		{
+			PROFILE_SCOPE("Swap");
+			/* Swap front and back buffers */
+			glfwSwapBuffers(window);
+		}
 
 		ImGui::EndFrame();
+
+		Profiler::end_frame();
 	}
 }
 
-int main(void) 
+int main(int argc, char** argv) 
 {
+	// -headless: offscreen benchmark / image dump, without GUI
+	bool headless = Headless::options.parse(argc, argv);
+
 	/* Glfw (Window API) */
+#ifdef GLFW_PLATFORM_NULL
+	// no display server at all, the context is created with EGL
+	if (headless && Headless::options.null_platform)
+		glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#endif
 	if (!glfwInit())
 		return -1;
 
 	/* Create a windowed mode window and its OpenGL context */
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	if (headless)
+		Headless::set_window_hints();
 
 	GLFWwindow* window = glfwCreateWindow(1600, 900, "Computer Animation", nullptr, nullptr); // 1600, 900 or 1280, 720
 	if (!window)
@@ -191,7 +244,7 @@ int main(void)
 
 	/* Make the window's context current */
 	glfwMakeContextCurrent(window);
-	glfwSwapInterval(1); // Enable vsync
+	glfwSwapInterval(headless ? 0 : 1); // Enable vsync
 
 	/* Glew (OpenGL API) */
 	if (glewInit() != GLEW_OK)
@@ -205,6 +258,26 @@ int main(void)
 	printf("\n[INFO] OpenGL version supported %s\n\n", version);
 	fflush(stdout);
 
+	if (headless) {
+		Shader::init_async(window);
+		JobSystem::init();
+
+		app = new Application();
+		app->init(window);
+		bool ok = Headless::run(app, window);
+
+		app->shut_down();
+		delete app;
+
+		Shader::shutdown_async();
+		TextureLoader::shutdown();
+		JobSystem::shutdown();
+
+		glfwDestroyWindow(window);
+		glfwTerminate();
+		return ok ? 0 : -1;
+	}
+
 	// Bind event callbacks
 	glfwSetKeyCallback(window, on_key_event);
 	glfwSetMouseButtonCallback(window, on_mouse_event);
@@ -225,6 +298,12 @@ int main(void)
 	ImGui_ImplGlfw_InitForOpenGL(window, true);
 	ImGui_ImplOpenGL3_Init(glsl_version);
 
+	// Compile the shaders in a shared context so the start and the reloads do not stall
+	Shader::init_async(window);
+
+	// Workers for the per frame CPU work (the main thread keeps the GL context)
+	JobSystem::init();
+
 	app = new Application();
 	app->init(window);
 
@@ -232,8 +311,13 @@ int main(void)
 	main_loop(window);
 
 	// Free memory
+	app->shut_down();
 	delete app;
 
+	Shader::shutdown_async();
+	TextureLoader::shutdown();
+	JobSystem::shutdown();
+
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
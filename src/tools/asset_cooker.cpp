@@ -0,0 +1,364 @@
+// Offline asset cooker: converts the source assets into the runtime formats inside the cooked folder (COOKED_FOLDER),
+// mirroring their paths, so loading them at runtime is only reading the file:
+//  - meshes (.obj, .mesh with its skeleton): welded, reordered for the vertex cache, quantized and written as .mbin
+//    with their materials (the .mtl is not parsed at runtime)
+//  - textures (.png, .jpg, .tga, .bmp): block compressed with all their mips as .dds
+//  - scenes (.json): entities, materials and references in the binary sections of .scnbin (see scene.h)
+// Mesh::get, Texture::get and Scene::load use the cooked file when it exists, and fall back to the source otherwise.
+// The hash of every source (with its .mtl) and the cooking options is stored in the manifest, only the
+// assets whose hash changed are cooked again
+//
+// usage: AssetCooker [-j threads] [-force] [-noquantize] [-nooptimize] [-nomips] files or folders...
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <filesystem>
+
+#include "stb_image.h"
+
+#include "framework/utils.h"
+#include "framework/graphics/mesh.h"
+#include "framework/graphics/mesh_cooking.h"
+#include "framework/graphics/texture_compression.h"
+#include "framework/scene.h"
+
+// part of the hash, so changing the cooking code cooks everything again
+#define ASSET_COOKER_VERSION 3
+#define ASSET_COOKER_MANIFEST COOKED_FOLDER "manifest.txt"
+
+enum eAssetType { ASSET_UNKNOWN, ASSET_MESH, ASSET_TEXTURE, ASSET_SCENE, ASSET_UNSUPPORTED };
+
+struct sCookerOptions
+{
+	bool force = false;
+	bool quantize = true;
+	bool optimize = true;
+	bool mipmaps = true;
+	int num_threads = 0;
+
+	std::string to_string() const { return std::to_string(ASSET_COOKER_VERSION) + (quantize ? "q" : "") + (optimize ? "o" : "") + (mipmaps ? "m" : ""); }
+};
+
+struct sCookJob
+{
+	std::string source;
+	std::string output;
+	int type = ASSET_UNKNOWN;
+	uint64_t hash = 0;
+};
+
+static sCookerOptions options;
+static std::mutex output_mutex; // std::cout and the manifest
+static std::map<std::string, uint64_t> manifest; // output -> hash of the sources that produced it
+
+static int get_asset_type(const std::string& filename)
+{
+	std::string ext = filename.substr(filename.find_last_of('.') + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	if (ext == "obj" || ext == "mesh")
+		return ASSET_MESH;
+	if (ext == "png" || ext == "jpg" || ext == "jpeg" || ext == "tga" || ext == "bmp")
+		return ASSET_TEXTURE;
+	if (ext == "json")
+		return ASSET_SCENE;
+	if (ext == "gltf" || ext == "glb")
+		return ASSET_UNSUPPORTED;
+	return ASSET_UNKNOWN;
+}
+
+// FNV-1a 64
+static uint64_t hash_bytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// the materials of an obj are in other file, it has to be part of the hash too
+static std::string get_mtl_filename(const std::string& filename, const std::string& content)
+{
+	std::istringstream stream(content);
+	std::string line;
+	while (std::getline(stream, line))
+	{
+		if (line.compare(0, 7, "mtllib ") != 0)
+			continue;
+		std::string mtl = line.substr(7);
+		while (mtl.size() && (mtl.back() == '\r' || mtl.back() == ' '))
+			mtl.pop_back();
+		return filename.substr(0, filename.find_last_of('/')) + '/' + mtl;
+	}
+	std::string mtl = filename;
+	replace(mtl, ".obj", ".mtl");
+	return mtl;
+}
+
+static bool compute_hash(sCookJob& job)
+{
+	std::string content;
+	if (!read_file(job.source, content))
+		return false;
+
+	std::string settings = options.to_string();
+	job.hash = hash_bytes(settings.data(), settings.size());
+	job.hash = hash_bytes(content.data(), content.size(), job.hash);
+
+	if (job.type == ASSET_MESH && job.source.find(".obj") != std::string::npos)
+	{
+		std::string mtl_filename = get_mtl_filename(job.source, content);
+		std::string mtl;
+		if (file_exists(mtl_filename) && read_file(mtl_filename, mtl))
+			job.hash = hash_bytes(mtl.data(), mtl.size(), job.hash);
+	}
+	return true;
+}
+
+static bool cook_mesh(const sCookJob& job, std::string& info)
+{
+	Mesh mesh;
+	if (!mesh.load_source(job.source.c_str()))
+		return false;
+
+	size_t num_source_vertices = mesh.get_num_vertices();
+	bool welded = MeshCooking::weld(&mesh);
+
+	if (options.optimize)
+	{
+		float acmr = MeshCooking::get_acmr(mesh.indices);
+		MeshCooking::optimize_vertex_cache(&mesh);
+		info += "ACMR " + std::to_string(acmr).substr(0, 4) + " -> " + std::to_string(MeshCooking::get_acmr(mesh.indices)).substr(0, 4) + " ";
+	}
+
+	// the same streams the runtime uses, then packed
+	mesh.interleave_buffers();
+	if (options.quantize && MeshCooking::quantize(&mesh))
+		info += "quantized ";
+
+	info += "vertices " + std::to_string(num_source_vertices) + (welded ? " -> " + std::to_string(mesh.get_num_vertices()) : "");
+	if (mesh.bones_info.size())
+		info += " bones " + std::to_string(mesh.bones_info.size());
+
+	// write_bin appends the extension
+	std::string output = job.output.substr(0, job.output.size() - 5);
+	return mesh.write_bin(output.c_str());
+}
+
+static bool cook_texture(const sCookJob& job, std::string& info)
+{
+	// same orientation as the textures loaded at runtime (first row at the bottom)
+	stbi_set_flip_vertically_on_load_thread(1);
+
+	int width, height, channels;
+	uint8_t* rgba = stbi_load(job.source.c_str(), &width, &height, &channels, 4);
+	if (!rgba)
+	{
+		info = stbi_failure_reason();
+		return false;
+	}
+
+	int format = TextureCompression::choose_format(job.source.c_str(), rgba, width, height);
+	// same rule as Texture::create: only power of two textures have mipmaps
+	bool power_of_two = (width & (width - 1)) == 0 && (height & (height - 1)) == 0;
+
+	sCompressedImage image;
+	TextureCompression::compress(rgba, width, height, format, options.mipmaps && power_of_two, image);
+	stbi_image_free(rgba);
+
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(job.output).parent_path(), error);
+	if (!TextureCompression::save_dds(job.output.c_str(), image))
+		return false;
+
+	info = std::string(TextureCompression::get_format_name(format)) + " " + std::to_string(width) + "x" + std::to_string(height) +
+		" levels " + std::to_string(image.get_num_levels()) + " " + std::to_string((size_t)width * height * 4 / 1024) + "KB -> " + std::to_string(image.data.size() / 1024) + "KB";
+	return true;
+}
+
+static bool cook_scene(const sCookJob& job, std::string& info)
+{
+	std::vector<uint8_t> bytes;
+	if (!Scene::cook(job.source.c_str(), bytes, info))
+		return false;
+
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(job.output).parent_path(), error);
+	std::ofstream file(job.output, std::ios::binary);
+	if (!file.write((const char*)bytes.data(), bytes.size()))
+		return false;
+
+	const sSceneBinHeader* header = (const sSceneBinHeader*)bytes.data();
+	info = "sections " + std::to_string(header->num_sections) + " meshes " + std::to_string(header->num_meshes) +
+		" materials " + std::to_string(header->num_materials) + " " + std::to_string(bytes.size() / 1024) + "KB";
+	return true;
+}
+
+static void add_jobs(const std::string& path, std::vector<sCookJob>& jobs)
+{
+	std::error_code error;
+	if (std::filesystem::is_directory(path, error))
+	{
+		for (const auto& entry : std::filesystem::recursive_directory_iterator(path, error))
+			if (entry.is_regular_file())
+				add_jobs(entry.path().generic_string(), jobs);
+		return;
+	}
+
+	sCookJob job;
+	job.source = path;
+	job.type = get_asset_type(path);
+	if (job.type == ASSET_UNKNOWN)
+		return;
+	if (job.type == ASSET_UNSUPPORTED)
+	{
+		std::cout << "[WARN] " << path << " skipped: there is no glTF loader yet" << std::endl;
+		return;
+	}
+	const char* extension = job.type == ASSET_MESH ? ".mbin" : job.type == ASSET_SCENE ? ".scnbin" : ".dds";
+	job.output = get_cooked_filename(path, extension);
+	jobs.push_back(job);
+}
+
+static void load_manifest()
+{
+	std::ifstream file(ASSET_COOKER_MANIFEST);
+	std::string line;
+	while (std::getline(file, line))
+	{
+		std::istringstream stream(line);
+		std::string hash, output;
+		if (stream >> hash >> output)
+			manifest[output] = std::stoull(hash, nullptr, 16);
+	}
+}
+
+static bool save_manifest(const std::map<std::string, std::string>& sources)
+{
+	std::ofstream file(ASSET_COOKER_MANIFEST);
+	if (!file.is_open())
+		return false;
+	for (auto& it : manifest)
+	{
+		auto source = sources.find(it.first);
+		char hash[17];
+		snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)it.second);
+		file << hash << " " << it.first << " " << (source != sources.end() ? source->second : "") << "\n";
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<sCookJob> jobs;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		if (arg[0] != '-') {
+			add_jobs(arg, jobs);
+			continue;
+		}
+		if (strcmp(arg, "-force") == 0) options.force = true;
+		else if (strcmp(arg, "-noquantize") == 0) options.quantize = false;
+		else if (strcmp(arg, "-nooptimize") == 0) options.optimize = false;
+		else if (strcmp(arg, "-nomips") == 0) options.mipmaps = false;
+		else if (strcmp(arg, "-j") == 0 && i + 1 < argc) options.num_threads = std::max(1, atoi(argv[++i]));
+		else {
+			std::cout << "usage: " << argv[0] << " [-j threads] [-force] [-noquantize] [-nooptimize] [-nomips] files or folders..." << std::endl;
+			return 1;
+		}
+	}
+
+	if (jobs.empty()) {
+		std::cout << "nothing to cook" << std::endl;
+		return 0;
+	}
+
+	// only the cooker writes the cooked tree, the runtime reads it
+	Mesh::use_binary = false;
+	Mesh::auto_upload_to_vram = false;
+
+	std::error_code error;
+	std::filesystem::create_directories(COOKED_FOLDER, error);
+	load_manifest();
+
+	std::map<std::string, std::string> sources; // output -> source, for the manifest
+	for (const sCookJob& job : jobs)
+		sources[job.output] = job.source;
+
+	std::atomic<size_t> next_job(0);
+	std::atomic<int> num_cooked(0), num_skipped(0), num_failed(0);
+	auto start = std::chrono::steady_clock::now();
+
+	auto worker = [&]() {
+		size_t index;
+		while ((index = next_job++) < jobs.size())
+		{
+			sCookJob& job = jobs[index];
+			if (!compute_hash(job)) {
+				std::lock_guard<std::mutex> lock(output_mutex);
+				std::cout << "[ERROR] cannot read " << job.source << std::endl;
+				num_failed++;
+				continue;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(output_mutex);
+				auto it = manifest.find(job.output);
+				if (!options.force && it != manifest.end() && it->second == job.hash && file_exists(job.output)) {
+					num_skipped++;
+					continue;
+				}
+			}
+
+			std::string info;
+			bool cooked = false;
+			if (job.type == ASSET_MESH)
+				cooked = cook_mesh(job, info);
+			else if (job.type == ASSET_SCENE)
+				cooked = cook_scene(job, info);
+			else
+				cooked = cook_texture(job, info);
+
+			std::lock_guard<std::mutex> lock(output_mutex);
+			if (!cooked) {
+				std::cout << "[ERROR] cannot cook " << job.source << " " << info << std::endl;
+				num_failed++;
+				continue;
+			}
+			manifest[job.output] = job.hash;
+			num_cooked++;
+			std::cout << " + " << job.output << " " << info << std::endl;
+		}
+	};
+
+	int num_threads = options.num_threads ? options.num_threads : std::max(1, (int)std::thread::hardware_concurrency());
+	num_threads = std::min(num_threads, (int)jobs.size());
+	std::vector<std::thread> threads;
+	for (int i = 1; i < num_threads; ++i)
+		threads.emplace_back(worker);
+	worker();
+	for (std::thread& thread : threads)
+		thread.join();
+
+	if (!save_manifest(sources))
+		std::cout << "[ERROR] cannot write " << ASSET_COOKER_MANIFEST << std::endl;
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "cooked " << num_cooked << ", up to date " << num_skipped << ", failed " << num_failed << " in " << seconds << "s (" << num_threads << " threads)" << std::endl;
+	return num_failed ? 1 : 0;
+}
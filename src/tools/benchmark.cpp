@@ -0,0 +1,371 @@
+// Headless benchmark of the CPU animation kernels (math, poses and skinning), no window or GL context.
+// Every benchmark runs batches until the minimum time is reached, a few times, and the fastest run is kept.
+// The results are written as JSON so they can be compared between versions
+//
+// usage: Benchmark [-o results.json] [-filter name] [-min_time seconds] [-repetitions n] [-quick]
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <ctime>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+
+#include "framework/math/mat4.h"
+#include "framework/math/quat.h"
+#include "framework/math/transform.h"
+#include "framework/animations/pose.h"
+#include "framework/animations/skeleton.h"
+#include "framework/animations/skinning.h"
+#include "framework/frame_allocator.h"
+
+struct sBenchmarkResult
+{
+	std::string name;
+	std::string params;
+	size_t items_per_op; // joints, vertices... processed by one operation
+	size_t iterations;
+	double ns_per_op; // fastest repetition
+	double median_ns_per_op;
+};
+
+struct sBenchmarkOptions
+{
+	std::string filter;
+	double min_time = 0.2; // seconds per repetition
+	int repetitions = 5;
+	bool quick = false; // smallest sizes only
+};
+
+static sBenchmarkOptions options;
+static std::vector<sBenchmarkResult> results;
+static volatile float sink; // keeps the results of the kernels alive
+
+// deterministic random numbers, so every version runs the same data
+static uint32_t random_state = 12345;
+static float random_float(float min, float max)
+{
+	random_state = random_state * 1664525u + 1013904223u;
+	return min + (max - min) * ((random_state >> 8) / 16777216.f);
+}
+
+static quat random_rotation()
+{
+	return normalized(quat(random_float(-1.f, 1.f), random_float(-1.f, 1.f), random_float(-1.f, 1.f), random_float(-1.f, 1.f)));
+}
+
+static Transform random_transform()
+{
+	return Transform(vec3(random_float(-1.f, 1.f), random_float(-1.f, 1.f), random_float(-1.f, 1.f)), random_rotation(), vec3(1.f));
+}
+
+static mat4 random_matrix()
+{
+	return transform_to_mat4(random_transform());
+}
+
+// runs the operation (that processes items_per_op items) until the minimum time and keeps the fastest repetition
+static void run(const std::string& name, const std::string& params, size_t items_per_op, const std::function<void()>& op)
+{
+	std::string full_name = params.empty() ? name : name + "/" + params;
+	if (!options.filter.empty() && full_name.find(options.filter) == std::string::npos)
+		return;
+
+	typedef std::chrono::steady_clock clock;
+
+	// batch size that takes about a millisecond
+	op();
+	size_t batch = 1;
+	while (true)
+	{
+		clock::time_point start = clock::now();
+		for (size_t i = 0; i < batch; i++)
+			op();
+		double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+		if (elapsed > 0.001 || batch >= ((size_t)1 << 30))
+			break;
+		batch *= 2;
+	}
+
+	std::vector<double> ns_per_op;
+	size_t total_iterations = 0;
+	for (int r = 0; r < options.repetitions; r++)
+	{
+		size_t iterations = 0;
+		double elapsed = 0.0;
+		clock::time_point start = clock::now();
+		while (elapsed < options.min_time)
+		{
+			for (size_t i = 0; i < batch; i++)
+				op();
+			iterations += batch;
+			elapsed = std::chrono::duration<double>(clock::now() - start).count();
+		}
+		ns_per_op.push_back(elapsed * 1e9 / iterations);
+		total_iterations += iterations;
+	}
+	std::sort(ns_per_op.begin(), ns_per_op.end());
+
+	sBenchmarkResult result = { name, params, items_per_op, total_iterations, ns_per_op.front(), ns_per_op[ns_per_op.size() / 2] };
+	results.push_back(result);
+
+	std::cerr << full_name << ": " << result.ns_per_op << " ns/op (" << (items_per_op * 1e9 / result.ns_per_op) << " items/s)" << std::endl;
+}
+
+// Synthetic rig: every joint hangs from a random previous one, like the branches of a real skeleton
+static Pose create_rig(unsigned int num_joints)
+{
+	Pose pose(num_joints);
+	for (unsigned int i = 0; i < num_joints; i++)
+	{
+		int parent = i == 0 ? -1 : (int)random_float(0.f, (float)i - 0.001f);
+		pose.set_parent(i, parent);
+		pose.set_local_transform(i, random_transform());
+	}
+	return pose;
+}
+
+static void benchmark_math()
+{
+	const size_t count = 1024;
+	std::vector<mat4> a(count), b(count), out(count);
+	std::vector<quat> qa(count), qb(count), qout(count);
+	std::vector<Transform> ta(count), tb(count), tout(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		a[i] = random_matrix();
+		b[i] = random_matrix();
+		qa[i] = random_rotation();
+		qb[i] = random_rotation();
+		ta[i] = random_transform();
+		tb[i] = random_transform();
+	}
+
+	run("mat4_multiply", "", count, [&]() {
+		for (size_t i = 0; i < count; i++)
+			out[i] = a[i] * b[i];
+		sink = out[count - 1].tx;
+	});
+
+	run("mat4_inverse", "", count, [&]() {
+		for (size_t i = 0; i < count; i++)
+			out[i] = inverse(a[i]);
+		sink = out[count - 1].tx;
+	});
+
+	run("quat_slerp", "", count, [&]() {
+		for (size_t i = 0; i < count; i++)
+			qout[i] = slerp(qa[i], qb[i], (i & 15) / 15.f);
+		sink = qout[count - 1].w;
+	});
+
+	run("quat_nlerp", "", count, [&]() {
+		for (size_t i = 0; i < count; i++)
+			qout[i] = nlerp(qa[i], qb[i], (i & 15) / 15.f);
+		sink = qout[count - 1].w;
+	});
+
+	run("transform_combine", "", count, [&]() {
+		for (size_t i = 0; i < count; i++)
+			tout[i] = combine(ta[i], tb[i]);
+		sink = tout[count - 1].position.x;
+	});
+}
+
+// exposes the inverse bind pose update, which is only called when the skeleton is set
+class BenchmarkSkeleton : public Skeleton
+{
+public:
+	using Skeleton::update_inv_bind_pose;
+};
+
+static void benchmark_poses(const std::vector<unsigned int>& rig_sizes)
+{
+	for (unsigned int num_joints : rig_sizes)
+	{
+		std::string params = "joints:" + std::to_string(num_joints);
+		Pose pose = create_rig(num_joints);
+
+		// every joint moved, the whole hierarchy is evaluated
+		run("pose_global_matrices", params, num_joints, [&]() {
+			pose.mark_all_dirty();
+			std::vector<mat4> matrices = pose.get_global_matrices();
+			sink = matrices.back().tx;
+		});
+
+		// nothing moved, only the cached matrices are returned
+		run("pose_global_matrices_cached", params, num_joints, [&]() {
+			std::vector<mat4> matrices = pose.get_global_matrices();
+			sink = matrices.back().tx;
+		});
+
+		// same copied to a linear arena instead of a new vector
+		LinearArena arena;
+		run("pose_global_matrices_arena", params, num_joints, [&]() {
+			sArenaScope scope(arena);
+			mat4* matrices = pose.get_global_matrices(arena);
+			sink = matrices[num_joints - 1].tx;
+		});
+
+		BenchmarkSkeleton skeleton;
+		skeleton.set(pose, pose, std::vector<std::string>(num_joints, "joint"));
+		run("skeleton_update_inv_bind_pose", params, num_joints, [&]() {
+			skeleton.get_bind_pose().mark_all_dirty();
+			skeleton.update_inv_bind_pose();
+			sink = skeleton.get_inv_bind_pose().back().tx;
+		});
+	}
+}
+
+static void benchmark_skinning(const std::vector<unsigned int>& rig_sizes, const std::vector<size_t>& mesh_sizes)
+{
+	for (unsigned int num_joints : rig_sizes)
+	{
+		Pose bind = create_rig(num_joints);
+		std::vector<mat4> inv_bind_pose(num_joints);
+		for (unsigned int i = 0; i < num_joints; i++)
+			inv_bind_pose[i] = inverse(bind.get_global_matrix(i));
+
+		// an animated pose: the bind pose with every joint rotated a bit
+		Pose pose = bind;
+		for (unsigned int i = 0; i < num_joints; i++)
+		{
+			Transform local = pose.get_local_transform(i);
+			local.rotation = normalized(local.rotation * angle_axis(random_float(-0.5f, 0.5f), vec3(0.f, 1.f, 0.f)));
+			pose.set_local_transform(i, local);
+		}
+		const std::vector<mat4>& skin_matrices = pose.get_skin_matrices(inv_bind_pose, 1); // the only inverse bind pose used with this pose
+
+		for (size_t num_vertices : mesh_sizes)
+		{
+			std::string params = "joints:" + std::to_string(num_joints) + "/vertices:" + std::to_string(num_vertices);
+
+			std::vector<vec3> positions(num_vertices), normals(num_vertices), out_positions(num_vertices), out_normals(num_vertices);
+			std::vector<ivec4> joints(num_vertices);
+			std::vector<vec4> weights(num_vertices);
+			for (size_t i = 0; i < num_vertices; i++)
+			{
+				positions[i] = vec3(random_float(-1.f, 1.f), random_float(0.f, 2.f), random_float(-1.f, 1.f));
+				normals[i] = normalized(vec3(random_float(-1.f, 1.f), random_float(-1.f, 1.f), random_float(-1.f, 1.f)));
+				float w[4], total = 0.f;
+				for (int k = 0; k < 4; k++) {
+					joints[i].v[k] = (int)random_float(0.f, num_joints - 0.001f);
+					w[k] = random_float(0.f, 1.f);
+					total += w[k];
+				}
+				weights[i] = vec4(w[0] / total, w[1] / total, w[2] / total, w[3] / total);
+			}
+
+			run("cpu_skinning", params, num_vertices, [&]() {
+				skin_vertices(positions.data(), 0, normals.data(), 0, joints.data(), weights.data(), num_vertices,
+					skin_matrices.data(), out_positions.data(), out_normals.data());
+				sink = out_positions.back().x;
+			});
+		}
+	}
+}
+
+static std::string escape_json(const std::string& text)
+{
+	std::string result;
+	for (char c : text) {
+		if (c == '"' || c == '\\') result += '\\';
+		result += c;
+	}
+	return result;
+}
+
+static std::string to_json()
+{
+	std::stringstream ss;
+	char date[32];
+	time_t now = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+	ss << "{\n";
+	ss << "\t\"context\": {\n";
+	ss << "\t\t\"date\": \"" << date << "\",\n";
+#ifdef BENCHMARK_VERSION
+	ss << "\t\t\"version\": \"" << escape_json(BENCHMARK_VERSION) << "\",\n";
+#endif
+#if defined(__clang__)
+	ss << "\t\t\"compiler\": \"clang " << __clang_major__ << "." << __clang_minor__ << "\",\n";
+#elif defined(__GNUC__)
+	ss << "\t\t\"compiler\": \"gcc " << __GNUC__ << "." << __GNUC_MINOR__ << "\",\n";
+#elif defined(_MSC_VER)
+	ss << "\t\t\"compiler\": \"msvc " << _MSC_VER << "\",\n";
+#endif
+#ifdef NDEBUG
+	ss << "\t\t\"build_type\": \"release\",\n";
+#else
+	ss << "\t\t\"build_type\": \"debug\",\n";
+#endif
+	ss << "\t\t\"min_time\": " << options.min_time << ",\n";
+	ss << "\t\t\"repetitions\": " << options.repetitions << "\n";
+	ss << "\t},\n";
+
+	ss << "\t\"benchmarks\": [\n";
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const sBenchmarkResult& r = results[i];
+		ss << "\t\t{ \"name\": \"" << escape_json(r.name) << "\", \"params\": \"" << escape_json(r.params) << "\""
+			<< ", \"iterations\": " << r.iterations
+			<< ", \"ns_per_op\": " << r.ns_per_op
+			<< ", \"median_ns_per_op\": " << r.median_ns_per_op
+			<< ", \"items_per_op\": " << r.items_per_op
+			<< ", \"items_per_second\": " << (r.items_per_op * 1e9 / r.ns_per_op) << " }"
+			<< (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	ss << "\t]\n";
+	ss << "}\n";
+	return ss.str();
+}
+
+int main(int argc, char** argv)
+{
+	std::string output_filename;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		if (strcmp(arg, "-o") == 0 && i + 1 < argc) output_filename = argv[++i];
+		else if (strcmp(arg, "-filter") == 0 && i + 1 < argc) options.filter = argv[++i];
+		else if (strcmp(arg, "-min_time") == 0 && i + 1 < argc) options.min_time = atof(argv[++i]);
+		else if (strcmp(arg, "-repetitions") == 0 && i + 1 < argc) options.repetitions = std::max(1, atoi(argv[++i]));
+		else if (strcmp(arg, "-quick") == 0) options.quick = true;
+		else {
+			std::cout << "usage: " << argv[0] << " [-o results.json] [-filter name] [-min_time seconds] [-repetitions n] [-quick]" << std::endl;
+			return 1;
+		}
+	}
+
+	std::vector<unsigned int> rig_sizes = { 10, 50, 100, 250, 500 };
+	std::vector<size_t> mesh_sizes = { 1000, 10000, 100000, 1000000 };
+	if (options.quick) {
+		rig_sizes = { 10, 100 };
+		mesh_sizes = { 1000, 10000 };
+	}
+
+	benchmark_math();
+	benchmark_poses(rig_sizes);
+	benchmark_skinning(rig_sizes, mesh_sizes);
+
+	std::string json = to_json();
+	if (output_filename.empty()) {
+		std::cout << json;
+	}
+	else {
+		std::ofstream file(output_filename);
+		if (!file.is_open()) {
+			std::cerr << "Could not write " << output_filename << std::endl;
+			return 1;
+		}
+		file << json;
+	}
+	return 0;
+}
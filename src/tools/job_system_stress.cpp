@@ -0,0 +1,79 @@
+// Stress test of the job system: lots of small parallel_for calls (counters on the stack that are destroyed as soon
+// as the wait returns), nested waits and continuations. Checks that every item runs exactly once, a race on the
+// counters shows up as a crash, a hang or a wrong sum (run it with the sanitizers to see it sooner)
+//
+// usage: JobSystemStress [-iterations n] [-threads n]
+
+#include <iostream>
+#include <atomic>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#include "framework/job_system.h"
+
+static bool check(bool condition, const char* message, int iteration)
+{
+	if (!condition)
+		std::cerr << "[ERROR] " << message << " (iteration " << iteration << ")" << std::endl;
+	return condition;
+}
+
+int main(int argc, char** argv)
+{
+	int iterations = 20000;
+	unsigned int num_threads = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		if (strcmp(arg, "-iterations") == 0 && i + 1 < argc) iterations = std::max(1, atoi(argv[++i]));
+		else if (strcmp(arg, "-threads") == 0 && i + 1 < argc) num_threads = (unsigned int)std::max(0, atoi(argv[++i]));
+		else {
+			std::cout << "usage: " << argv[0] << " [-iterations n] [-threads n]" << std::endl;
+			return 1;
+		}
+	}
+
+	JobSystem::init(num_threads);
+	std::cout << "workers: " << JobSystem::get_num_workers() << " iterations: " << iterations << std::endl;
+
+	bool ok = true;
+	std::vector<int> hits(64);
+	for (int iteration = 0; iteration < iterations && ok; iteration++)
+	{
+		// small ranges, so the counter is destroyed right after the last batch finishes
+		size_t count = 2 + iteration % 62;
+		std::fill(hits.begin(), hits.end(), 0);
+		JobSystem::parallel_for(count, 1, [&hits](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+				hits[i]++;
+		});
+		for (size_t i = 0; i < count; i++)
+			ok &= check(hits[i] == 1, "parallel_for item not run exactly once", iteration);
+
+		// nested: the batches wait for their own parallel_for
+		std::atomic<int> nested{ 0 };
+		JobSystem::parallel_for(4, 1, [&nested](size_t, size_t) {
+			JobSystem::parallel_for(4, 1, [&nested](size_t, size_t) { nested++; });
+		});
+		ok &= check(nested == 16, "nested parallel_for lost items", iteration);
+
+		// continuation queued on a counter that lives on the stack
+		std::atomic<int> order{ 0 };
+		int first = -1, second = -1;
+		{
+			sJobCounter jobs;
+			sJobCounter continuation;
+			JobSystem::run([&]() { first = order++; }, &jobs);
+			JobSystem::run_after(&jobs, [&]() { second = order++; }, &continuation);
+			JobSystem::wait(&continuation);
+		}
+		ok &= check(first == 0 && second == 1, "continuation ran before its dependency", iteration);
+	}
+
+	JobSystem::shutdown();
+	std::cout << (ok ? "[OK]" : "[FAILED]") << std::endl;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+// Offline texture compressor: writes the BCn compressed copy (file.png.dds) of every texture given,
+// which Texture::load uses instead of the original when Texture::use_compressed is set
+//
+// usage: TextureCompressor [-bc1|-bc3|-bc4|-bc5] [-nomips] [-force] file1 file2 ...
+// without a format option BC3 is used for images with alpha and BC1 for the rest,
+// files with "normal" in the name are compressed to BC5
+
+#include <iostream>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "framework/graphics/texture_compression.h"
+
+static bool is_newer(const char* a, const char* b)
+{
+	struct stat sa, sb;
+	if (stat(a, &sa) != 0 || stat(b, &sb) != 0)
+		return true;
+	return sa.st_mtime > sb.st_mtime;
+}
+
+int main(int argc, char** argv)
+{
+	int forced_format = COMPRESSED_NONE;
+	bool mipmaps = true;
+	bool force = false;
+	int num_failed = 0;
+
+	if (argc < 2) {
+		std::cout << "usage: " << argv[0] << " [-bc1|-bc3|-bc4|-bc5] [-nomips] [-force] files..." << std::endl;
+		return 1;
+	}
+
+	// same orientation as the textures loaded at runtime (first row at the bottom)
+	stbi_set_flip_vertically_on_load(1);
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		if (arg[0] == '-') {
+			if (strcmp(arg, "-nomips") == 0) mipmaps = false;
+			else if (strcmp(arg, "-force") == 0) force = true;
+			else if ((forced_format = TextureCompression::get_format_from_name(arg + 1)) == COMPRESSED_NONE || forced_format == COMPRESSED_BC7) {
+				std::cout << "[ERROR] unknown option " << arg << std::endl;
+				return 1;
+			}
+			continue;
+		}
+
+		std::string output = TextureCompression::get_sidecar_filename(arg);
+		if (!force && !is_newer(arg, output.c_str())) {
+			std::cout << " + " << arg << " up to date" << std::endl;
+			continue;
+		}
+
+		int width, height, channels;
+		uint8_t* rgba = stbi_load(arg, &width, &height, &channels, 4);
+		if (!rgba) {
+			std::cout << "[ERROR] cannot load " << arg << " (" << stbi_failure_reason() << ")" << std::endl;
+			num_failed++;
+			continue;
+		}
+
+		int format = forced_format != COMPRESSED_NONE ? forced_format : TextureCompression::choose_format(arg, rgba, width, height);
+
+		// same rule as Texture::create: only power of two textures have mipmaps
+		bool power_of_two = (width & (width - 1)) == 0 && (height & (height - 1)) == 0;
+
+		sCompressedImage image;
+		TextureCompression::compress(rgba, width, height, format, mipmaps && power_of_two, image);
+		stbi_image_free(rgba);
+
+		if (!TextureCompression::save_dds(output.c_str(), image)) {
+			std::cout << "[ERROR] cannot write " << output << std::endl;
+			num_failed++;
+			continue;
+		}
+
+		std::cout << " + " << output << " " << TextureCompression::get_format_name(format) << " " << width << "x" << height
+			<< " levels: " << image.get_num_levels() << " " << (size_t)width * height * 4 / 1024 << "KB -> " << image.data.size() / 1024 << "KB" << std::endl;
+	}
+
+	return num_failed ? 1 : 0;
+}